@@ -0,0 +1,57 @@
+#!/bin/sh
+# Short connections with and without the accept fast path.
+#
+# Runs bench_tcp_connect against a fresh server for each mode and reads the
+# event loop wakeups and the early reads from the admin endpoint, e.g.:
+#
+#   bench/accept.sh [connections] [size]
+#
+# With TCP_DEFER_ACCEPT the connection is only accepted once its first
+# request arrived, with TCP Fast Open the request comes with the SYN: both
+# are echoed right after accept, without waiting for another poll. Fast Open
+# needs net.ipv4.tcp_fastopen=3 (client and server) on the host.
+
+BUILD_DIR=${BUILD_DIR:-build}
+PORT=${PORT:-5995}
+ADMIN_PORT=${ADMIN_PORT:-9195}
+CONNECTIONS=${1:-10000}
+SIZE=${2:-64}
+
+# Value of a counter of the server
+metric() {
+  curl -s "http://127.0.0.1:${ADMIN_PORT}/metrics" |
+    awk -v name="$1" '$1 == name { print $2 }'
+}
+
+for mode in plain defer fastopen; do
+  fastopen=0
+  case "$mode" in
+  plain)
+    echo "== accept, then poll"
+    set --
+    ;;
+  defer)
+    echo "== TCP_DEFER_ACCEPT"
+    set -- --defer-accept 1
+    ;;
+  fastopen)
+    echo "== TCP Fast Open"
+    set -- --fastopen 256
+    fastopen=1
+    ;;
+  esac
+  "${BUILD_DIR}/echo" --port "$PORT" --admin-port "$ADMIN_PORT" "$@" \
+    >/dev/null &
+  server=$!
+  sleep 0.5
+  "${BUILD_DIR}/bench_tcp_connect" 127.0.0.1 "$PORT" "$CONNECTIONS" "$SIZE" \
+    "$fastopen"
+  accepted=$(metric echo_connections_accepted_total)
+  wakeups=$(metric echo_loop_wakeups_total)
+  early=$(metric echo_early_reads_total)
+  awk -v accepted="$accepted" -v wakeups="$wakeups" -v early="${early:-0}" \
+    'BEGIN { printf "wakeups per connection %.2f, early reads %d%%\n",
+             wakeups / accepted, 100 * early / accepted }'
+  kill "$server"
+  wait "$server" 2>/dev/null || true
+done
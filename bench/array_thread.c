@@ -0,0 +1,304 @@
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// The same source is built once per concurrency mode of array.h (see the
+// `bench` target of the Makefile): with `_DA_THREAD_SAFE` every thread works on
+// one shared array behind the `pthread_mutex_t` of `_DA_MUTEX`, without it
+// every thread works on a private array (the only correct way to use the
+// unlocked mode concurrently), which gives the ideal scaling reference.
+#include "../includes/array.h"
+
+#ifdef _DA_THREAD_SAFE
+#define BENCH_MODE "mutex (shared array)"
+#else
+#define BENCH_MODE "none (private arrays)"
+#endif
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define OPS_PER_THREAD 200000
+#define PREFILL 1024
+// Time one operation out of (SAMPLE_MASK + 1) to keep the clock overhead out of
+// the throughput figures.
+#define SAMPLE_MASK 63
+
+typedef struct {
+  da_struct(int)
+} s_da_int;
+
+typedef struct {
+  const char *name;
+  // Percentage of the operations of each kind (the four sum to 100)
+  int append;
+  int remove;
+  int iterate;
+  int insert;
+} s_mix;
+
+static const s_mix mixes[] = {
+    {"append", 100, 0, 0, 0},
+    {"mixed", 40, 40, 10, 10},
+    {"iterate", 5, 5, 90, 0},
+    {"insert", 0, 50, 0, 50},
+};
+
+typedef struct {
+  s_da_int *da;
+  const s_mix *mix;
+  pthread_barrier_t *barrier;
+  uint64_t seed;
+  // Results
+  uint64_t ops;
+  uint64_t samples;
+  uint64_t wait_ns;
+  uint64_t hold_ns;
+  uint64_t max_wait_ns;
+  int64_t cache_misses; // -1 if perf_event_open is not available
+  uint64_t start_ns;     // first operation
+  uint64_t end_ns;       // after the last operation
+  long sink;
+} s_worker;
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t xorshift(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+/**
+ * @brief Open a per-thread cache-miss counter
+ *
+ * @return int the counter file descriptor, -1 if unavailable
+ */
+static int open_cache_counter() {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Run one operation under the array lock, timing the wait and the hold of the
+// lock on sampled operations.
+#define bench_locked(w, op)                                                    \
+  do {                                                                         \
+    if (((w)->ops & SAMPLE_MASK) == 0) {                                       \
+      uint64_t t0 = now_ns();                                                  \
+      _da_lock((w)->da);                                                       \
+      uint64_t t1 = now_ns();                                                  \
+      op;                                                                      \
+      uint64_t t2 = now_ns();                                                  \
+      _da_unlock((w)->da);                                                     \
+      (w)->wait_ns += t1 - t0;                                                 \
+      (w)->hold_ns += t2 - t1;                                                 \
+      if (t1 - t0 > (w)->max_wait_ns)                                          \
+        (w)->max_wait_ns = t1 - t0;                                            \
+      (w)->samples++;                                                          \
+    } else {                                                                   \
+      _da_lock((w)->da);                                                       \
+      op;                                                                      \
+      _da_unlock((w)->da);                                                     \
+    }                                                                          \
+    (w)->ops++;                                                                \
+  } while (0)
+
+void *bench_worker(s_worker *w) {
+  s_da_int *da = w->da;
+  const s_mix *mix = w->mix;
+  uint64_t seed = w->seed;
+  long sink = 0;
+  int perf_fd = open_cache_counter();
+
+  pthread_barrier_wait(w->barrier);
+  w->start_ns = now_ns();
+
+  if (perf_fd != -1) {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  for (size_t i = 0; i < OPS_PER_THREAD; i++) {
+    uint64_t r = xorshift(&seed);
+    int dice = r % 100;
+    int value = (int)(r >> 32);
+
+    if (dice < mix->append) {
+      bench_locked(w, da_append_unsafe(da, value));
+    } else if (dice < mix->append + mix->remove) {
+      // Ordered removal when the mix inserts (keeps the memmove cost
+      // symmetric), swap removal otherwise
+      if (mix->insert) {
+        bench_locked(w, if (da->count > 0) {
+          size_t index = (size_t)(r >> 40) % da->count;
+          da_remove_unsafe(da, index);
+        });
+      } else {
+        bench_locked(w, if (da->count > 0) {
+          size_t index = (size_t)(r >> 40) % da->count;
+          da_fast_remove_unsafe(da, index);
+        });
+      }
+    } else if (dice < mix->append + mix->remove + mix->iterate) {
+      bench_locked(w, da_for_unsafe(da, index) { sink += da->items[index]; });
+    } else {
+      bench_locked(w, {
+        size_t index = (size_t)(r >> 40) % (da->count + 1);
+        da_insert_unsafe(da, index, value);
+      });
+    }
+  }
+  w->end_ns = now_ns();
+
+  if (perf_fd != -1) {
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(perf_fd, &w->cache_misses, sizeof(w->cache_misses)) !=
+        sizeof(w->cache_misses)) {
+      w->cache_misses = -1;
+    }
+    close(perf_fd);
+  } else {
+    w->cache_misses = -1;
+  }
+
+  w->sink = sink;
+  return NULL;
+}
+
+/**
+ * @brief Prefill an array so remove and iterate have something to work on
+ *
+ */
+void prefill(s_da_int *da) {
+  for (int i = 0; i < PREFILL; i++) {
+    da_append(da, i);
+  }
+}
+
+/**
+ * @brief Run one mix with a given number of threads and print a result row
+ *
+ */
+void bench_run(const s_mix *mix, size_t n_threads) {
+  pthread_t threads[n_threads];
+  s_worker workers[n_threads];
+  s_da_int arrays[n_threads];
+  pthread_barrier_t barrier;
+  uint64_t start = UINT64_MAX, end = 0, elapsed;
+  uint64_t ops = 0, samples = 0, wait_ns = 0, hold_ns = 0, max_wait_ns = 0;
+  int64_t cache_misses = 0;
+
+#ifdef _DA_THREAD_SAFE
+  size_t n_arrays = 1;
+#else
+  size_t n_arrays = n_threads;
+#endif
+
+  for (size_t i = 0; i < n_arrays; i++) {
+    da_init(&arrays[i]);
+    if (mix->remove || mix->iterate) {
+      prefill(&arrays[i]);
+    }
+  }
+
+  pthread_barrier_init(&barrier, NULL, n_threads + 1);
+  for (size_t i = 0; i < n_threads; i++) {
+    memset(&workers[i], 0, sizeof(workers[i]));
+    workers[i].da = &arrays[i % n_arrays];
+    workers[i].mix = mix;
+    workers[i].barrier = &barrier;
+    workers[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+    pthread_create(&threads[i], NULL, (void *(*)(void *))bench_worker,
+                   &workers[i]);
+  }
+
+  // The workers time themselves: they may start before this thread leaves
+  // the barrier
+  pthread_barrier_wait(&barrier);
+  for (size_t i = 0; i < n_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+
+  for (size_t i = 0; i < n_threads; i++) {
+    if (workers[i].start_ns < start)
+      start = workers[i].start_ns;
+    if (workers[i].end_ns > end)
+      end = workers[i].end_ns;
+    ops += workers[i].ops;
+    samples += workers[i].samples;
+    wait_ns += workers[i].wait_ns;
+    hold_ns += workers[i].hold_ns;
+    if (workers[i].max_wait_ns > max_wait_ns)
+      max_wait_ns = workers[i].max_wait_ns;
+    if (cache_misses != -1)
+      cache_misses = workers[i].cache_misses == -1
+                         ? -1
+                         : cache_misses + workers[i].cache_misses;
+  }
+  elapsed = end - start;
+
+  printf("%-8s %7zu %10.2f %10.1f %12.1f %10.1f", mix->name, n_threads,
+         (double)ops * 1e3 / (double)elapsed, (double)wait_ns / samples,
+         (double)max_wait_ns / 1e3, (double)hold_ns / samples);
+  if (cache_misses == -1) {
+    printf(" %12s\n", "n/a");
+  } else {
+    printf(" %12.3f\n", (double)cache_misses / ops);
+  }
+
+  for (size_t i = 0; i < n_arrays; i++) {
+    da_free(&arrays[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (argc > 1) {
+    max_threads = strtol(argv[1], NULL, 10);
+  }
+  if (max_threads < 1) {
+    eprintf("Usage: %s [max threads]\n", argv[0]);
+    return 1;
+  }
+
+  printf("Concurrency mode: %s, %d ops per thread\n", BENCH_MODE,
+         OPS_PER_THREAD);
+  printf("%-8s %7s %10s %10s %12s %10s %12s\n", "mix", "threads", "Mops/s",
+         "wait(ns)", "maxwait(us)", "hold(ns)", "misses/op");
+
+  for (size_t m = 0; m < sizeof(mixes) / sizeof(*mixes); m++) {
+    for (long n = 1; n <= max_threads; n <<= 1) {
+      bench_run(&mixes[m], n);
+    }
+    // Always include the requested maximum, even if not a power of two
+    if ((max_threads & (max_threads - 1)) != 0) {
+      bench_run(&mixes[m], max_threads);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Latency and CPU of the busy poll mode against the blocking event loop.
+#
+# Runs bench_tcp_latency against a fresh server for each spin budget, keep the
+# client off the event loop CPU (the last one by default), e.g.:
+#
+#   taskset -c 0 bench/busy_poll.sh [messages] [size]
+#
+# SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN, without it only
+# the event loop spins (non-blocking poll).
+
+BUILD_DIR=${BUILD_DIR:-build}
+PORT=${PORT:-5999}
+MESSAGES=${1:-100000}
+SIZE=${2:-64}
+
+for spin in 0 50 1000; do
+  if [ "$spin" -eq 0 ]; then
+    echo "== blocking poll"
+  else
+    echo "== busy poll ${spin}us"
+  fi
+  "${BUILD_DIR}/echo" --port "$PORT" --busy-poll "$spin" >/dev/null &
+  server=$!
+  sleep 0.5
+  "${BUILD_DIR}/bench_tcp_latency" 127.0.0.1 "$PORT" "$MESSAGES" "$SIZE" \
+    "$server"
+  kill "$server"
+  wait "$server" 2>/dev/null || true
+done
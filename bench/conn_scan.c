@@ -0,0 +1,162 @@
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Cost of an event loop iteration with many connections and few of them
+// active: the user space work of the reactor around poll (scan of the poll
+// array, then the events) per iteration, and the cache misses of the process
+// in user space when perf_event_open is available.
+//
+// The idle connections all share one idle socket (poll takes the same
+// descriptor many times), the active ones are socket pairs spread over the
+// poll array, each echoing one message per iteration. The poll array cannot
+// hold more entries than RLIMIT_NOFILE: the connections are capped to it.
+//
+//   ./build/bench_conn_scan [connections] [active] [iterations]
+#include "../includes/reactor.h"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define CONNECTIONS 100000
+#define ACTIVE 16
+#define ITERATIONS 20000
+#define MESSAGE_SIZE 64
+// Descriptors left for the process besides the poll array
+#define FD_MARGIN 64
+
+static ssize_t echo_data(s_reactor *reactor, s_conn *conn, char *data,
+                         size_t size) {
+  reactor_send(reactor, conn, data, size);
+  return size;
+}
+
+/**
+ * @brief Open a counter of the user space cache misses of the process
+ *
+ * @return int the counter file descriptor, -1 if unavailable
+ */
+static int open_cache_counter() {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int main(int argc, char **argv) {
+  size_t connections = argc > 1 ? strtoull(argv[1], NULL, 10) : CONNECTIONS;
+  size_t active = argc > 2 ? strtoull(argv[2], NULL, 10) : ACTIVE;
+  size_t iterations = argc > 3 ? strtoull(argv[3], NULL, 10) : ITERATIONS;
+  s_reactor_config config = {0};
+  s_reactor_handler handler = {.on_data = echo_data};
+  s_reactor reactor;
+  struct rlimit limit;
+  int *peers;
+  int idle[2];
+  char message[MESSAGE_SIZE] = {0};
+  char buffer[MESSAGE_SIZE];
+  int64_t misses = -1;
+  int perf_fd;
+  uint64_t processing;
+  uint64_t start;
+
+  if (active == 0 || active > connections || iterations == 0) {
+    eprintf("Usage: %s [connections] [active] [iterations]\n", argv[0]);
+    return 1;
+  }
+  getrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur != RLIM_INFINITY &&
+      connections + active + FD_MARGIN > limit.rlim_cur) {
+    connections = limit.rlim_cur - active - FD_MARGIN;
+    eprintf("Connections capped to %zu by RLIMIT_NOFILE\n", connections);
+  }
+
+  reactor_init(&reactor, &config, &handler, NULL);
+  peers = calloc(active, sizeof(int));
+  socketpair(AF_UNIX, SOCK_STREAM, 0, idle);
+  for (size_t i = 0, added = 0; i < connections; i++) {
+    int sv[2];
+
+    // Active connections evenly spread over the poll array
+    if (added < active && i == added * connections / active +
+                                   connections / active / 2) {
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        eprintf("Error socketpair failed\n");
+        return 1;
+      }
+      reactor_add_client(&reactor, sv[0], NULL);
+      peers[added++] = sv[1];
+    } else {
+      reactor_add_client(&reactor, idle[0], NULL);
+    }
+  }
+
+  perf_fd = open_cache_counter();
+  if (perf_fd != -1) {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  processing = counter_get(&reactor.stats.processing_ns);
+  start = now_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < active; j++) {
+      if (write(peers[j], message, sizeof(message)) != sizeof(message)) {
+        eprintf("Error write failed\n");
+        return 1;
+      }
+    }
+    reactor_run_once(&reactor, 1000);
+    for (size_t j = 0; j < active; j++) {
+      if (read(peers[j], buffer, sizeof(buffer)) != sizeof(buffer)) {
+        eprintf("Error read failed\n");
+        return 1;
+      }
+    }
+  }
+  start = now_ns() - start;
+  processing = counter_get(&reactor.stats.processing_ns) - processing;
+  if (perf_fd != -1) {
+    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(perf_fd, &misses, sizeof(misses)) != sizeof(misses)) {
+      misses = -1;
+    }
+    close(perf_fd);
+  }
+
+  printf("%zu connections, %zu active, %zu iterations\n", connections, active,
+         iterations);
+  printf("iteration %.0f ns, reactor outside poll %.0f ns", (double)start /
+         iterations, (double)processing / iterations);
+  if (misses >= 0) {
+    printf(", cache misses %.1f", (double)misses / iterations);
+  }
+  printf("\n");
+
+  // The idle descriptor is closed once, the reactor closes the others
+  for (size_t i = 0; i < reactor.conns.count; i++) {
+    if (reactor.fds.items[reactor.listeners + i].fd == idle[0]) {
+      reactor.fds.items[reactor.listeners + i].fd = -1;
+    }
+  }
+  reactor_free(&reactor);
+  for (size_t j = 0; j < active; j++) {
+    close(peers[j]);
+  }
+  close(idle[0]);
+  close(idle[1]);
+  free(peers);
+  return 0;
+}
@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Cost of the coroutine handlers against the callback path of the reactor:
+// context switch time, memory per coroutine and echo round trips over
+// socket pairs served by one reactor. The same source is built once per
+// context switch (see the `bench` target of the Makefile): hand-written on
+// x86-64, swapcontext with `_CO_UCONTEXT`.
+//
+//   ./build/bench_coroutine [switches] [coroutines] [round trips]
+#include "../includes/coroutine.h"
+
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+#define BENCH_MODE "hand-written (x86-64)"
+#else
+#define BENCH_MODE "swapcontext"
+#endif
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define SWITCHES 10000000
+#define COROUTINES 10000
+#define ROUND_TRIPS 20000
+// Clients served by the reactor during the echo round trips
+#define CLIENTS 64
+#define MESSAGE_SIZE 64
+// Stack a coroutine touches before suspending in the memory benchmark
+#define TOUCHED_STACK 2048
+
+void ping(s_co *co, void *arg) {
+  while (true) {
+    co_suspend(co);
+  }
+}
+
+void touch(s_co *co, void *arg) {
+  volatile char frame[TOUCHED_STACK];
+
+  memset((char *)frame, 1, sizeof(frame));
+  co_suspend(co);
+}
+
+ssize_t echo_data(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  reactor_send(reactor, conn, data, size);
+  return size;
+}
+
+void echo_session(s_co *co, void *arg) {
+  char buffer[MESSAGE_SIZE];
+  ssize_t size;
+
+  while ((size = co_read(co, buffer, sizeof(buffer))) > 0) {
+    co_write(co, buffer, size);
+  }
+}
+
+// Resident memory of the process in bytes
+size_t resident_bytes() {
+  unsigned long size = 0, resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+
+  if (file == NULL) {
+    return 0;
+  }
+  if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(file);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+void bench_switch(size_t switches) {
+  s_co_pool pool;
+  s_co *co;
+  uint64_t start;
+  uint64_t elapsed;
+
+  co_pool_init(&pool, 0);
+  co = co_create(&pool, ping, NULL);
+  start = now_ns();
+  for (size_t i = 0; i < switches; i++) {
+    co_resume(co);
+  }
+  elapsed = now_ns() - start;
+  // A resume and a suspend per iteration
+  printf("switch      %8.1f ns  (resume + suspend %.1f ns)\n",
+         (double)elapsed / switches / 2, (double)elapsed / switches);
+  co_release(co);
+  co_pool_free(&pool);
+}
+
+void bench_memory(size_t count) {
+  s_co_pool pool;
+  s_co **cos = malloc(count * sizeof(s_co *));
+  size_t before = resident_bytes();
+  size_t after;
+  uint64_t start = now_ns();
+  uint64_t created;
+
+  co_pool_init(&pool, 0);
+  for (size_t i = 0; i < count; i++) {
+    cos[i] = co_create(&pool, touch, NULL);
+    co_resume(cos[i]);
+  }
+  created = now_ns() - start;
+  after = resident_bytes();
+  printf("memory      %8.1f KiB resident, %zu KiB mapped per coroutine "
+         "(%d bytes of stack used)\n",
+         (double)(after - before) / count / 1024,
+         (pool.page_size + pool.stack_size) / 1024, TOUCHED_STACK);
+  printf("create      %8.1f ns per new stack\n", (double)created / count);
+
+  // Pooled stacks are already mapped and faulted in
+  for (size_t i = 0; i < count; i++) {
+    co_release(cos[i]);
+  }
+  start = now_ns();
+  for (size_t i = 0; i < count; i++) {
+    cos[i] = co_create(&pool, touch, NULL);
+    co_resume(cos[i]);
+  }
+  printf("reuse       %8.1f ns per pooled stack\n",
+         (double)(now_ns() - start) / count);
+  printf("callback    %8.1f KiB per connection (s_conn, no stack)\n",
+         (double)sizeof(s_conn) / 1024);
+
+  for (size_t i = 0; i < count; i++) {
+    co_release(cos[i]);
+  }
+  co_pool_free(&pool);
+  free(cos);
+}
+
+/**
+ * @brief Echo round trips of CLIENTS socket pairs through a reactor
+ *
+ * @param handler callback handler, NULL for the coroutine handler
+ * @return double nanoseconds per message
+ */
+double bench_echo(const s_reactor_handler *handler, size_t round_trips) {
+  s_reactor_config config = {0};
+  s_co_server server = {.fn = echo_session};
+  s_reactor reactor;
+  char message[MESSAGE_SIZE] = {0};
+  int peers[CLIENTS];
+  uint64_t start;
+
+  co_pool_init(&server.pool, 0);
+  reactor_init(&reactor, &config, handler ? handler : &co_handler, &server);
+  for (size_t i = 0; i < CLIENTS; i++) {
+    int sv[2];
+    s_conn *conn;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      eprintf("Error socketpair failed\n");
+      exit(1);
+    }
+    conn = reactor_add_client(&reactor, sv[0], NULL);
+    if (handler == NULL) {
+      co_spawn(&reactor, conn);
+    }
+    peers[i] = sv[1];
+  }
+
+  start = now_ns();
+  for (size_t n = 0; n < round_trips; n++) {
+    for (size_t i = 0; i < CLIENTS; i++) {
+      if (write(peers[i], message, sizeof(message)) != sizeof(message)) {
+        eprintf("Error write failed\n");
+        exit(1);
+      }
+    }
+    reactor_run_once(&reactor, 1000);
+    for (size_t i = 0; i < CLIENTS; i++) {
+      if (read(peers[i], message, sizeof(message)) != sizeof(message)) {
+        eprintf("Error read failed\n");
+        exit(1);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < CLIENTS; i++) {
+    close(peers[i]);
+  }
+  reactor_free(&reactor);
+  co_pool_free(&server.pool);
+  return (double)(now_ns() - start) / round_trips / CLIENTS;
+}
+
+int main(int argc, char **argv) {
+  size_t switches = argc > 1 ? strtoull(argv[1], NULL, 10) : SWITCHES;
+  size_t coroutines = argc > 2 ? strtoull(argv[2], NULL, 10) : COROUTINES;
+  size_t round_trips = argc > 3 ? strtoull(argv[3], NULL, 10) : ROUND_TRIPS;
+  s_reactor_handler callback = {.on_data = echo_data};
+  double callback_ns;
+  double coroutine_ns;
+
+  if (switches == 0 || coroutines == 0 || round_trips == 0) {
+    eprintf("Usage: %s [switches] [coroutines] [round trips]\n", argv[0]);
+    return 1;
+  }
+
+  printf("Context switch: %s\n", BENCH_MODE);
+  bench_switch(switches);
+  bench_memory(coroutines);
+
+  callback_ns = bench_echo(&callback, round_trips);
+  coroutine_ns = bench_echo(NULL, round_trips);
+  printf("echo        %8.1f ns per message (callback), %.1f ns (coroutine, "
+         "%+.1f%%), %d clients\n",
+         callback_ns, coroutine_ns,
+         100 * (coroutine_ns - callback_ns) / callback_ns, CLIENTS);
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes and writes sent to the terminal per frame by the client renderer:
+// only the changed cells against a full redraw of every frame, for a
+// keystroke in the input line and for an echo scrolling the history. The
+// frames mimic the client layout and are written to /dev/null.
+//
+//   ./build/bench_screen [rows] [columns] [frames]
+#include "../includes/screen.h"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define ROWS 24
+#define COLUMNS 80
+#define FRAMES 100000
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Client frame: borders, history from `first`, input line with its cursor
+void draw(s_screen *screen, size_t first, const char *input, size_t size) {
+  int rows = screen->rows;
+  int columns = screen->columns;
+  char line[64];
+
+  screen_put(screen, 0, 0, "┌", 3, 0);
+  screen_fill(screen, 0, 1, columns - 2, "─", 0);
+  screen_put(screen, 0, columns - 1, "┐", 3, 0);
+  screen_put(screen, 0, 2, " 127.0.0.1:5000 | 0 in flight ", 30, 0);
+  for (int row = 1; row < rows - 3; row++) {
+    int len = snprintf(line, sizeof(line), "< message %zu  (0.042 ms)",
+                       first + row);
+    int drawn;
+
+    screen_put(screen, row, 0, "│", 3, 0);
+    drawn = screen_put(screen, row, 1, line, len, 0);
+    screen_fill(screen, row, 1 + drawn, columns - 2 - drawn, " ", 0);
+    screen_put(screen, row, columns - 1, "│", 3, 0);
+  }
+  screen_put(screen, rows - 3, 0, "├", 3, 0);
+  screen_fill(screen, rows - 3, 1, columns - 2, "─", 0);
+  screen_put(screen, rows - 3, columns - 1, "┤", 3, 0);
+  screen_put(screen, rows - 2, 0, "│ > ", 6, 0);
+  screen_put(screen, rows - 2, 4, input, size, 0);
+  screen_fill(screen, rows - 2, 4 + size, columns - 5 - size, " ", 0);
+  screen_put(screen, rows - 2, 4 + size, " ", 1, SCREEN_INVERSE);
+  screen_put(screen, rows - 2, columns - 1, "│", 3, 0);
+  screen_put(screen, rows - 1, 0, "└", 3, 0);
+  screen_fill(screen, rows - 1, 1, columns - 2, "─", 0);
+  screen_put(screen, rows - 1, columns - 1, "┘", 3, 0);
+}
+
+/**
+ * @brief Render frames and print the output per frame
+ *
+ * @param scroll true to scroll the history each frame, false to type a key
+ * @param full true to redraw every cell of every frame
+ */
+void bench(int fd, int rows, int columns, size_t frames, bool scroll,
+           bool full) {
+  const char *text = "the quick brown fox jumps over the lazy dog ";
+  size_t typed = columns - 6;
+  s_screen screen;
+  uint64_t start;
+
+  screen_init(&screen, rows, columns);
+  draw(&screen, 0, "", 0);
+  screen_flush(&screen, fd);
+  screen.frames = screen.writes = screen.bytes = 0;
+
+  start = now_ns();
+  for (size_t i = 0; i < frames; i++) {
+    char input[256];
+    size_t size = scroll ? 0 : i % typed;
+
+    for (size_t j = 0; j < size; j++) {
+      input[j] = text[j % strlen(text)];
+    }
+    if (full) {
+      screen_invalidate(&screen);
+    }
+    draw(&screen, scroll ? i : 0, input, size);
+    screen_flush(&screen, fd);
+  }
+  printf("%-9s %-5s %8.1f bytes %5.2f writes %8.1f ns per frame\n",
+         scroll ? "echo" : "keystroke", full ? "full" : "diff",
+         (double)screen.bytes / frames, (double)screen.writes / frames,
+         (double)(now_ns() - start) / frames);
+  screen_free(&screen);
+}
+
+int main(int argc, char **argv) {
+  int rows = argc > 1 ? atoi(argv[1]) : ROWS;
+  int columns = argc > 2 ? atoi(argv[2]) : COLUMNS;
+  size_t frames = argc > 3 ? strtoull(argv[3], NULL, 10) : FRAMES;
+  int fd = open("/dev/null", O_WRONLY);
+
+  if (rows < 5 || columns < 10 || columns > 200 || frames == 0 || fd == -1) {
+    eprintf("Usage: %s [rows] [columns (10 to 200)] [frames]\n", argv[0]);
+    return 1;
+  }
+
+  printf("Terminal %dx%d, %zu frames\n", columns, rows, frames);
+  bench(fd, rows, columns, frames, false, false);
+  bench(fd, rows, columns, frames, false, true);
+  bench(fd, rows, columns, frames, true, false);
+  bench(fd, rows, columns, frames, true, true);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE // memfd_create
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Round trip latency of the local transports of the echo server: the same
+// request/response exchange over the Unix socket, then over a shared memory
+// channel passed on that socket (see includes/shm_ring.h).
+//
+//   ./build/echo --unix /tmp/echo.sock &
+//   ./build/bench_shm_echo /tmp/echo.sock [messages] [size]
+#include "../includes/shm_ring.h"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define MESSAGES 100000
+#define MESSAGE_SIZE 64
+#define WARMUP 1000
+// Longest time the client spins on its ring before sleeping (as the server)
+#define SPIN_NS 50000
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void report(const char *name, uint64_t *rtt, size_t count, uint64_t sleeps) {
+  uint64_t sum = 0;
+
+  qsort(rtt, count, sizeof(*rtt), compare_u64);
+  for (size_t i = 0; i < count; i++) {
+    sum += rtt[i];
+  }
+  printf("%-12s avg %8.0f ns  p50 %8llu ns  p99 %8llu ns  p99.9 %8llu ns  "
+         "sleeps %llu\n",
+         name, (double)sum / count, (unsigned long long)rtt[count / 2],
+         (unsigned long long)rtt[count * 99 / 100],
+         (unsigned long long)rtt[count * 999 / 1000],
+         (unsigned long long)sleeps);
+}
+
+int connect_unix(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    eprintf("Error unix socket path too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    eprintf("Error connect failed: %s\n", strerror(errno));
+    if (fd != -1) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Ping-pong over the Unix socket
+ *
+ */
+int bench_socket(const char *path, uint64_t *rtt, size_t count, size_t size) {
+  char *buffer = calloc(1, size);
+  int fd = connect_unix(path);
+
+  if (fd == -1) {
+    free(buffer);
+    return -1;
+  }
+  for (size_t i = 0; i < WARMUP + count; i++) {
+    uint64_t start = now_ns();
+    size_t received = 0;
+
+    if (write(fd, buffer, size) != (ssize_t)size) {
+      eprintf("Error write failed: %s\n", strerror(errno));
+      break;
+    }
+    while (received < size) {
+      ssize_t n = read(fd, buffer + received, size - received);
+      if (n <= 0) {
+        eprintf("Error read failed: %s\n", n ? strerror(errno) : "closed");
+        close(fd);
+        free(buffer);
+        return -1;
+      }
+      received += n;
+    }
+    if (i >= WARMUP) {
+      rtt[i - WARMUP] = now_ns() - start;
+    }
+  }
+  close(fd);
+  free(buffer);
+  return 0;
+}
+
+/**
+ * @brief Wait until `size` bytes of echo are available (spin then sleep)
+ *
+ * @return uint64_t 1 if the client had to sleep, 0 otherwise
+ */
+uint64_t wait_echo(s_shm_channel *channel, s_shm_spin *spin, size_t size) {
+  s_shm_header *header = channel->header;
+  uint64_t start = now_ns();
+  uint64_t sleeps = 0;
+  uint64_t value;
+
+  while (shm_ring_readable(&header->to_client) < size) {
+    if (now_ns() - start < spin->spin_ns) {
+      shm_cpu_relax();
+      continue;
+    }
+    shm_sleep_prepare(&header->client_sleeping);
+    if (shm_ring_readable(&header->to_client) < size) {
+      (void)!read(channel->client_efd, &value, sizeof(value));
+      sleeps++;
+    }
+    shm_sleep_done(&header->client_sleeping);
+    shm_spin_update(spin, now_ns() - start);
+  }
+  return sleeps ? 1 : 0;
+}
+
+/**
+ * @brief Ping-pong over a shared memory channel
+ *
+ */
+int bench_shm(const char *path, uint64_t *rtt, size_t count, size_t size,
+              uint64_t *sleeps) {
+  s_shm_channel channel;
+  s_shm_header *header;
+  s_shm_spin spin;
+  char *buffer = calloc(1, size);
+  char ack = 0;
+  int fd = connect_unix(path);
+
+  if (fd == -1) {
+    free(buffer);
+    return -1;
+  }
+  if (shm_channel_create(&channel, SHM_RING_SIZE) != 0 ||
+      shm_channel_send(fd, &channel) != 0 || read(fd, &ack, 1) != 1 ||
+      ack != 'K') {
+    eprintf("Error shared memory setup failed: %s\n", strerror(errno));
+    close(fd);
+    free(buffer);
+    return -1;
+  }
+  header = channel.header;
+  shm_spin_init(&spin, SPIN_NS);
+
+  *sleeps = 0;
+  for (size_t i = 0; i < WARMUP + count; i++) {
+    uint64_t start = now_ns();
+    uint64_t slept;
+
+    // Messages are smaller than the ring: always written at once
+    shm_ring_write(&header->to_server, channel.to_server, channel.ring_size,
+                   buffer, size);
+    shm_notify(&header->server_sleeping, channel.server_efd);
+    slept = wait_echo(&channel, &spin, size);
+    shm_ring_read(&header->to_client, channel.to_client, channel.ring_size,
+                  buffer, size);
+    if (i >= WARMUP) {
+      rtt[i - WARMUP] = now_ns() - start;
+      *sleeps += slept;
+    }
+  }
+
+  close(fd);
+  shm_channel_close(&channel);
+  free(buffer);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 2 ? strtoull(argv[2], NULL, 10) : MESSAGES;
+  size_t size = argc > 3 ? strtoull(argv[3], NULL, 10) : MESSAGE_SIZE;
+  uint64_t *rtt;
+  uint64_t sleeps = 0;
+
+  if (argc < 2 || count == 0 || size == 0 || size > SHM_RING_SIZE) {
+    eprintf("Usage: %s SOCKET_PATH [messages] [size]\n", argv[0]);
+    return 1;
+  }
+  rtt = calloc(count, sizeof(uint64_t));
+
+  printf("%zu round trips of %zu bytes\n", count, size);
+  if (bench_socket(argv[1], rtt, count, size) != 0) {
+    free(rtt);
+    return 1;
+  }
+  report("unix socket", rtt, count, 0);
+  if (bench_shm(argv[1], rtt, count, size, &sleeps) != 0) {
+    free(rtt);
+    return 1;
+  }
+  report("shm ring", rtt, count, sleeps);
+
+  free(rtt);
+  return 0;
+}
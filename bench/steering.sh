@@ -0,0 +1,38 @@
+#!/bin/sh
+# Cross-CPU connections of the worker modes: handed by the acceptor, a
+# SO_REUSEPORT listener per worker with the kernel hash, and with the CPU
+# steering program.
+#
+# One bench_tcp_latency client is pinned to each CPU (on loopback a packet is
+# received on the CPU of its sender) and the statistics endpoint is scraped
+# with curl once they are done, e.g.:
+#
+#   bench/steering.sh [messages] [size]
+
+BUILD_DIR=${BUILD_DIR:-build}
+PORT=${PORT:-5998}
+ADMIN_PORT=${ADMIN_PORT:-5997}
+MESSAGES=${1:-20000}
+SIZE=${2:-64}
+CPUS=$(nproc)
+
+for mode in off hash cpu; do
+  echo "== ${CPUS} workers, reuseport ${mode}"
+  "${BUILD_DIR}/echo" --port "$PORT" --admin-port "$ADMIN_PORT" \
+    --workers "$CPUS" --reuseport "$mode" >/dev/null &
+  server=$!
+  sleep 0.5
+  cpu=0
+  clients=""
+  while [ "$cpu" -lt "$CPUS" ]; do
+    taskset -c "$cpu" "${BUILD_DIR}/bench_tcp_latency" 127.0.0.1 "$PORT" \
+      "$MESSAGES" "$SIZE" | sed -n "s/^rtt/cpu ${cpu}: rtt/p" &
+    clients="$clients $!"
+    cpu=$((cpu + 1))
+  done
+  wait $clients
+  curl -s "http://127.0.0.1:${ADMIN_PORT}/metrics" |
+    grep -E "^echo_(connections_accepted_total|cross_cpu|steered)"
+  kill "$server"
+  wait "$server" 2>/dev/null || true
+done
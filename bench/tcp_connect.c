@@ -0,0 +1,138 @@
+#define _GNU_SOURCE // MSG_FASTOPEN
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Short lived connections: connect, send one request, read its echo, close.
+// The time of a whole exchange, with a normal handshake or with TCP Fast Open
+// (the request travels in the SYN), to compare the connection fast paths of
+// the server (see bench/accept.sh).
+//
+//   ./build/bench_tcp_connect HOST PORT [connections] [size] [fastopen]
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define CONNECTIONS 10000
+#define MESSAGE_SIZE 64
+#define WARMUP 100
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Connect, send the request, read its echo and close
+ *
+ * With Fast Open, sendto connects and sends the request in the SYN once the
+ * client has a cookie from the server (the first connection gets it).
+ *
+ * @return int 0 if success, -1 on error
+ */
+int exchange(struct sockaddr_in *addr, char *buffer, size_t size,
+             bool fastopen) {
+  size_t received = 0;
+  int sockopt = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (fd == -1) {
+    eprintf("Error socket failed: %s\n", strerror(errno));
+    return -1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &sockopt, sizeof(sockopt));
+  if (fastopen) {
+    if (sendto(fd, buffer, size, MSG_FASTOPEN, (struct sockaddr *)addr,
+               sizeof(*addr)) != (ssize_t)size) {
+      eprintf("Error sendto failed: %s\n", strerror(errno));
+      close(fd);
+      return -1;
+    }
+  } else if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 ||
+             write(fd, buffer, size) != (ssize_t)size) {
+    eprintf("Error connect failed: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  while (received < size) {
+    ssize_t n = read(fd, buffer + received, size - received);
+    if (n <= 0) {
+      eprintf("Error read failed: %s\n", n ? strerror(errno) : "closed");
+      close(fd);
+      return -1;
+    }
+    received += n;
+  }
+  close(fd);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 3 ? strtoull(argv[3], NULL, 10) : CONNECTIONS;
+  size_t size = argc > 4 ? strtoull(argv[4], NULL, 10) : MESSAGE_SIZE;
+  bool fastopen = argc > 5 && atoi(argv[5]) != 0;
+  struct sockaddr_in addr = {0};
+  uint64_t *times;
+  uint64_t sum = 0;
+  uint64_t start, elapsed;
+  char *buffer;
+
+  if (argc < 3 || count == 0 || size == 0) {
+    eprintf("Usage: %s HOST PORT [connections] [size] [fastopen]\n",
+            argv[0]);
+    return 1;
+  }
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(argv[2]));
+  if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1) {
+    eprintf("Error invalid address %s\n", argv[1]);
+    return 1;
+  }
+
+  times = calloc(count, sizeof(uint64_t));
+  buffer = calloc(1, size);
+
+  start = now_ns();
+  for (size_t i = 0; i < WARMUP + count; i++) {
+    uint64_t begin_ns = now_ns();
+
+    if (exchange(&addr, buffer, size, fastopen) != 0) {
+      return 1;
+    }
+    if (i >= WARMUP) {
+      times[i - WARMUP] = now_ns() - begin_ns;
+    } else if (i + 1 == WARMUP) {
+      start = now_ns();
+    }
+  }
+  elapsed = now_ns() - start;
+
+  qsort(times, count, sizeof(uint64_t), compare_u64);
+  for (size_t i = 0; i < count; i++) {
+    sum += times[i];
+  }
+  printf("%zu connections with a %zu bytes exchange%s, %.0f per second\n"
+         "time avg %.0f ns  p50 %llu ns  p99 %llu ns  max %llu ns\n",
+         count, size, fastopen ? " (Fast Open)" : "", count * 1e9 / elapsed,
+         (double)sum / count, (unsigned long long)times[count / 2],
+         (unsigned long long)times[count * 99 / 100],
+         (unsigned long long)times[count - 1]);
+
+  free(buffer);
+  free(times);
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Round trip latency of the TCP echo, with the CPU time used meanwhile by the
+// client and (given its pid) by the server: the trade-off of the busy poll
+// mode against the blocking event loop (see bench/busy_poll.sh).
+//
+//   ./build/bench_tcp_latency HOST PORT [messages] [size] [server pid]
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+#define MESSAGES 100000
+#define MESSAGE_SIZE 64
+#define WARMUP 1000
+// Pause between messages, as a request/response client would (microseconds)
+#define THINK_US 20
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Get the CPU time of a process in nanoseconds (user + system)
+ *
+ * @return uint64_t CPU time, 0 if unknown
+ */
+uint64_t process_cpu_ns(long pid) {
+  char path[64];
+  unsigned long utime = 0, stime = 0;
+  FILE *file;
+  int matched;
+
+  snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+  file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+  // Fields 14 and 15, after the command name (which ends with ')')
+  matched = fscanf(file, "%*d (%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                         "%*u %lu %lu",
+                   &utime, &stime);
+  fclose(file);
+  if (matched != 2) {
+    return 0;
+  }
+  return (uint64_t)(utime + stime) * (1000000000ull / sysconf(_SC_CLK_TCK));
+}
+
+uint64_t self_cpu_ns() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+             1000000000ull +
+         (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 3 ? strtoull(argv[3], NULL, 10) : MESSAGES;
+  size_t size = argc > 4 ? strtoull(argv[4], NULL, 10) : MESSAGE_SIZE;
+  long server_pid = argc > 5 ? atol(argv[5]) : 0;
+  struct sockaddr_in addr = {0};
+  uint64_t *rtt;
+  uint64_t sum = 0;
+  uint64_t start, elapsed, server_cpu, client_cpu;
+  struct timespec think = {.tv_sec = 0, .tv_nsec = THINK_US * 1000};
+  char *buffer;
+  int sockopt = 1;
+  int fd;
+
+  if (argc < 3 || count == 0 || size == 0) {
+    eprintf("Usage: %s HOST PORT [messages] [size] [server pid]\n", argv[0]);
+    return 1;
+  }
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(argv[2]));
+  if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1) {
+    eprintf("Error invalid address %s\n", argv[1]);
+    return 1;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    eprintf("Error connect failed: %s\n", strerror(errno));
+    return 1;
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &sockopt, sizeof(sockopt));
+
+  rtt = calloc(count, sizeof(uint64_t));
+  buffer = calloc(1, size);
+
+  server_cpu = server_pid ? process_cpu_ns(server_pid) : 0;
+  client_cpu = self_cpu_ns();
+  start = now_ns();
+  for (size_t i = 0; i < WARMUP + count; i++) {
+    uint64_t sent_ns = now_ns();
+    size_t received = 0;
+
+    if (write(fd, buffer, size) != (ssize_t)size) {
+      eprintf("Error write failed: %s\n", strerror(errno));
+      return 1;
+    }
+    while (received < size) {
+      ssize_t n = read(fd, buffer + received, size - received);
+      if (n <= 0) {
+        eprintf("Error read failed: %s\n", n ? strerror(errno) : "closed");
+        return 1;
+      }
+      received += n;
+    }
+    if (i >= WARMUP) {
+      rtt[i - WARMUP] = now_ns() - sent_ns;
+    }
+    // Let the server go back to waiting, as between real requests
+    nanosleep(&think, NULL);
+  }
+  elapsed = now_ns() - start;
+  client_cpu = self_cpu_ns() - client_cpu;
+  if (server_pid) {
+    server_cpu = process_cpu_ns(server_pid) - server_cpu;
+  }
+
+  qsort(rtt, count, sizeof(uint64_t), compare_u64);
+  for (size_t i = 0; i < count; i++) {
+    sum += rtt[i];
+  }
+  printf("%zu round trips of %zu bytes\n"
+         "rtt avg %.0f ns  p50 %llu ns  p99 %llu ns  p99.9 %llu ns  "
+         "max %llu ns\n",
+         count, size, (double)sum / count,
+         (unsigned long long)rtt[count / 2],
+         (unsigned long long)rtt[count * 99 / 100],
+         (unsigned long long)rtt[count * 999 / 1000],
+         (unsigned long long)rtt[count - 1]);
+  printf("cpu client %.0f%%", 100.0 * client_cpu / elapsed);
+  if (server_pid) {
+    printf("  server %.0f%%", 100.0 * server_cpu / elapsed);
+  }
+  printf("\n");
+
+  close(fd);
+  free(buffer);
+  free(rtt);
+  return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Server CPU time per GB echoed with copying writes and with MSG_ZEROCOPY.
+#
+# Streams a generated payload through a fresh server for each mode with the
+# headless client and reads the CPU time of the server from /proc, e.g.:
+#
+#   bench/zerocopy.sh [bytes] [threshold]
+#
+# --zerocopy also lets the raw echo reads grow to 256 KiB: the "large
+# reads" mode sets a threshold no write reaches, to tell the gain of the
+# larger writes from the gain of not copying. On loopback the kernel copies
+# every zerocopy send anyway (echo_zerocopy_copied_total): run the client on
+# another host (HOST) to measure the copies saved.
+
+BUILD_DIR=${BUILD_DIR:-build}
+HOST=${HOST:-127.0.0.1}
+PORT=${PORT:-5996}
+BYTES=${1:-2000000000}
+THRESHOLD=${2:-65536}
+TICKS=$(getconf CLK_TCK)
+
+# utime + stime of a process, in clock ticks
+cpu_ticks() {
+  awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+for zerocopy in 0 1073741824 "$THRESHOLD"; do
+  if [ "$zerocopy" -eq 0 ]; then
+    echo "== copy"
+  elif [ "$zerocopy" -eq 1073741824 ]; then
+    echo "== copy, large reads"
+  else
+    echo "== zerocopy from ${zerocopy} bytes"
+  fi
+  "${BUILD_DIR}/echo" --port "$PORT" --zerocopy "$zerocopy" >/dev/null &
+  server=$!
+  sleep 0.5
+  before=$(cpu_ticks "$server")
+  "${BUILD_DIR}/client" --bytes "$BYTES" "$HOST" "$PORT"
+  after=$(cpu_ticks "$server")
+  awk -v ticks=$((after - before)) -v hz="$TICKS" -v bytes="$BYTES" \
+    'BEGIN { printf "server cpu %.3f s, %.3f s per GB\n", ticks / hz,
+             ticks / hz / (bytes / 1e9) }'
+  kill "$server"
+  wait "$server" 2>/dev/null || true
+done
@@ -0,0 +1,173 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#if !defined(__x86_64__) || defined(_CO_UCONTEXT)
+#include <ucontext.h>
+#endif
+
+#include "reactor.h"
+
+// Stackful coroutines on top of the reactor (see src/coroutine.c).
+//
+// A coroutine runs a function on its own stack and can suspend anywhere in
+// it, so a stateful protocol is written as straight-line code:
+//
+//   void session(s_co *co, void *arg) {
+//     char line[64];
+//     while (co_read(co, line, sizeof(line)) > 0) {
+//       ...
+//       co_write(co, reply, size);
+//     }
+//   }
+//
+// With `co_handler` as the reactor handler, every accepted client runs the
+// coroutine of a `s_co_server`: co_read suspends until on_data hands it
+// bytes, co_write suspends until the reactor drained the output the socket
+// did not take (on_writable). Everything still runs on the reactor thread.
+//
+// Stacks are mapped with a guard page below them (an overflow faults instead
+// of corrupting memory) and kept in a pool when a coroutine ends, so a new
+// connection reuses a stack whose pages are already faulted in. Only the
+// pages a coroutine touches use memory.
+//
+// On x86-64 the context switch is hand-written: it saves the callee-saved
+// registers and swaps the stack pointers, about as cheap as a function call.
+// Elsewhere, or when built with -D _CO_UCONTEXT, it uses swapcontext, which
+// also saves the signal mask (a system call per switch).
+
+// Default stack size of a coroutine (guard page excluded)
+#define CO_STACK_SIZE (64 * 1024)
+
+typedef enum {
+  CO_READY,      // created, not started
+  CO_RUNNING,    // running (or resumed something else)
+  CO_SUSPENDED,  // suspended with co_suspend
+  CO_WAIT_READ,  // suspended in co_read
+  CO_WAIT_WRITE, // suspended in co_write
+  CO_DONE,       // returned from its function
+} e_co_state;
+
+typedef struct s_co s_co;
+typedef void (*co_fn)(s_co *co, void *arg);
+
+typedef struct {
+  da_struct(s_co *)
+} s_da_co;
+
+// Pool of coroutine stacks
+typedef struct {
+  size_t stack_size; // usable stack of a coroutine
+  size_t page_size;
+  size_t mapped; // stacks currently mapped (in use or free)
+  s_da_co free;  // stacks of the coroutines that ended
+} s_co_pool;
+
+struct s_co {
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+  void *sp;        // saved stack pointer of the coroutine
+  void *caller_sp; // saved stack pointer of the resumer
+#else
+  ucontext_t ctx;
+  ucontext_t caller;
+#endif
+  s_co_pool *pool;
+  char *mapping; // guard page then stack, this structure at its top
+  co_fn fn;
+  void *arg;
+  e_co_state state;
+
+  // Reactor connection (co_handler)
+  s_reactor *reactor;
+  s_conn *conn;
+  char *view;  // bytes handed by on_data
+  size_t size; // size of the view
+  size_t used; // bytes of the view consumed by co_read
+  bool closed; // connection closed, co_read returns 0 and co_write -1
+};
+
+// Coroutine run for each client, the context of a reactor using co_handler
+typedef struct {
+  s_co_pool pool;
+  co_fn fn;  // called with the client coroutine and `arg`
+  void *arg; // see `co->conn` for the connection
+} s_co_server;
+
+// Reactor handler running a coroutine per client (reactor arg: s_co_server)
+extern const s_reactor_handler co_handler;
+
+/**
+ * @brief Initialize a stack pool
+ *
+ * @param pool the pool
+ * @param stack_size usable stack of a coroutine (0 for CO_STACK_SIZE), rounded
+ * up to pages
+ */
+void co_pool_init(s_co_pool *pool, size_t stack_size);
+
+/**
+ * @brief Unmap the free stacks of a pool
+ *
+ * Stacks of the coroutines still alive stay mapped (`reactor_free` does not
+ * call on_close).
+ */
+void co_pool_free(s_co_pool *pool);
+
+/**
+ * @brief Create a coroutine, started by the first co_resume
+ *
+ * @param pool stack pool
+ * @param fn function run by the coroutine
+ * @param arg argument of the function
+ * @return s_co* the coroutine (lives at the top of its stack)
+ */
+s_co *co_create(s_co_pool *pool, co_fn fn, void *arg);
+
+/**
+ * @brief Return the stack of a coroutine to its pool
+ *
+ * A suspended coroutine is dropped without unwinding its function.
+ */
+void co_release(s_co *co);
+
+/**
+ * @brief Run a coroutine until it suspends or returns
+ *
+ * @return bool true if suspended, false if it returned
+ */
+bool co_resume(s_co *co);
+
+/**
+ * @brief Suspend the running coroutine, back to its last co_resume
+ *
+ */
+void co_suspend(s_co *co);
+
+/**
+ * @brief Start the coroutine of a client added with `reactor_add_client`
+ *
+ * Accepted clients are started by co_handler. A coroutine that returns
+ * before suspending gets its connection closed on its next event.
+ *
+ * @param reactor reactor whose arg is a s_co_server
+ * @param conn the client
+ * @return s_co* the client coroutine (also `conn->data`)
+ */
+s_co *co_spawn(s_reactor *reactor, s_conn *conn);
+
+/**
+ * @brief Read bytes from the client, suspending until some arrive
+ *
+ * @return ssize_t bytes copied, 0 once the connection is closed
+ */
+ssize_t co_read(s_co *co, char *buffer, size_t size);
+
+/**
+ * @brief Write bytes to the client
+ *
+ * Returns right away if the socket takes everything, otherwise suspends
+ * until the rest is written: the buffer may be reused on return.
+ *
+ * @return ssize_t size, -1 if the connection is closed
+ */
+ssize_t co_write(s_co *co, const char *data, size_t size);
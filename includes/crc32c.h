@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// CRC32C (Castagnoli polynomial, reflected), as used by iSCSI and ext4.
+//
+// `crc32c_update` extends a running checksum, starting from 0:
+//
+//   uint32_t crc = 0;
+//   crc = crc32c_update(crc, chunk, size); // for each chunk
+//
+// On x86-64 CPUs with SSE4.2 it uses the crc32 instruction (8 bytes per
+// instruction), elsewhere a slicing-by-8 table built on first use.
+
+static uint32_t _crc32c_table[8][256];
+static bool _crc32c_table_ready = false;
+
+static inline void _crc32c_init_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    }
+    _crc32c_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int slice = 1; slice < 8; slice++) {
+      uint32_t previous = _crc32c_table[slice - 1][i];
+
+      _crc32c_table[slice][i] =
+          (previous >> 8) ^ _crc32c_table[0][previous & 0xff];
+    }
+  }
+  _crc32c_table_ready = true;
+}
+
+static inline uint32_t _crc32c_table_update(uint32_t crc, const char *data,
+                                            size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+
+  if (!_crc32c_table_ready) {
+    _crc32c_init_table();
+  }
+  while (size >= 8) {
+    uint32_t low;
+    uint32_t high;
+
+    memcpy(&low, bytes, 4);
+    memcpy(&high, bytes + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    low = __builtin_bswap32(low);
+    high = __builtin_bswap32(high);
+#endif
+    low ^= crc;
+    crc = _crc32c_table[7][low & 0xff] ^ _crc32c_table[6][(low >> 8) & 0xff] ^
+          _crc32c_table[5][(low >> 16) & 0xff] ^ _crc32c_table[4][low >> 24] ^
+          _crc32c_table[3][high & 0xff] ^
+          _crc32c_table[2][(high >> 8) & 0xff] ^
+          _crc32c_table[1][(high >> 16) & 0xff] ^ _crc32c_table[0][high >> 24];
+    bytes += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ _crc32c_table[0][(crc ^ *bytes++) & 0xff];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static inline uint32_t
+_crc32c_sse42_update(uint32_t crc, const char *data, size_t size) {
+  uint64_t crc64 = crc;
+
+  while (size >= 8) {
+    uint64_t word;
+
+    memcpy(&word, data, 8);
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (size-- > 0) {
+    crc = __builtin_ia32_crc32qi(crc, (unsigned char)*data++);
+  }
+  return crc;
+}
+#endif
+
+/**
+ * @brief Extend a CRC32C with more bytes
+ *
+ * @param crc checksum of the previous bytes (0 for none)
+ * @param data the bytes
+ * @param size number of bytes
+ * @return uint32_t checksum of the previous bytes and `data`
+ */
+static inline uint32_t crc32c_update(uint32_t crc, const void *data,
+                                     size_t size) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    return ~_crc32c_sse42_update(crc, data, size);
+  }
+#endif
+  return ~_crc32c_table_update(crc, data, size);
+}
@@ -0,0 +1,118 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// Message framing.
+//
+// Splits a byte stream into frames, a frame including its header or
+// delimiter:
+// - FRAMING_LENGTH: a 4 bytes big endian payload length, then the payload
+// - FRAMING_LINE: the bytes up to and including a '\n'
+// - FRAMING_NONE: no framing, everything available is one frame
+//
+// Replies are queued as iovecs pointing to their data (no copy) and written
+// with one writev per connection; `frame_iov_consume` skips what a short
+// writev already wrote.
+
+#define FRAME_HEADER_SIZE 4
+
+// Largest number of iovecs per writev (IOV_MAX on Linux)
+#define FRAME_IOV_MAX 1024
+
+typedef enum { FRAMING_NONE, FRAMING_LENGTH, FRAMING_LINE } e_framing;
+
+typedef enum { FRAME_COMPLETE, FRAME_INCOMPLETE, FRAME_TOO_LARGE } e_frame;
+
+/**
+ * @brief Get the framing from its name (none, length or line)
+ *
+ * @return int the framing, -1 if unknown
+ */
+static inline int frame_parse_name(const char *name) {
+  if (strcmp(name, "none") == 0) {
+    return FRAMING_NONE;
+  } else if (strcmp(name, "length") == 0) {
+    return FRAMING_LENGTH;
+  } else if (strcmp(name, "line") == 0) {
+    return FRAMING_LINE;
+  }
+  return -1;
+}
+
+/**
+ * @brief Find the first frame of a buffer
+ *
+ * @param framing the codec
+ * @param data buffered bytes
+ * @param size number of buffered bytes
+ * @param max largest frame accepted (header or delimiter included)
+ * @param length set to the size of the frame when complete
+ * @return e_frame FRAME_COMPLETE, FRAME_INCOMPLETE (wait for more bytes) or
+ * FRAME_TOO_LARGE (the stream cannot be parsed any further)
+ */
+static inline e_frame frame_next(e_framing framing, const char *data,
+                                 size_t size, size_t max, size_t *length) {
+  switch (framing) {
+  case FRAMING_LENGTH: {
+    const unsigned char *header = (const unsigned char *)data;
+    uint64_t payload;
+
+    if (size < FRAME_HEADER_SIZE) {
+      return FRAME_INCOMPLETE;
+    }
+    payload = (uint64_t)header[0] << 24 | (uint64_t)header[1] << 16 |
+              (uint64_t)header[2] << 8 | (uint64_t)header[3];
+    if (FRAME_HEADER_SIZE + payload > max) {
+      return FRAME_TOO_LARGE;
+    }
+    if (size < FRAME_HEADER_SIZE + payload) {
+      return FRAME_INCOMPLETE;
+    }
+    *length = FRAME_HEADER_SIZE + payload;
+    return FRAME_COMPLETE;
+  }
+  case FRAMING_LINE: {
+    const char *end = memchr(data, '\n', size < max ? size : max);
+
+    if (end == NULL) {
+      return size >= max ? FRAME_TOO_LARGE : FRAME_INCOMPLETE;
+    }
+    *length = end - data + 1;
+    return FRAME_COMPLETE;
+  }
+  case FRAMING_NONE:
+    break;
+  }
+
+  if (size == 0) {
+    return FRAME_INCOMPLETE;
+  }
+  *length = size;
+  return FRAME_COMPLETE;
+}
+
+/**
+ * @brief Skip the bytes written by a short writev
+ *
+ * The partially written iovec is advanced in place.
+ *
+ * @param iov the iovecs
+ * @param count number of iovecs
+ * @param written bytes written
+ * @return size_t index of the first iovec with bytes left (count if none)
+ */
+static inline size_t frame_iov_consume(struct iovec *iov, size_t count,
+                                       size_t written) {
+  size_t i = 0;
+
+  while (i < count && written >= iov[i].iov_len) {
+    written -= iov[i].iov_len;
+    i++;
+  }
+  if (i < count) {
+    iov[i].iov_base = (char *)iov[i].iov_base + written;
+    iov[i].iov_len -= written;
+  }
+  return i;
+}
@@ -0,0 +1,178 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "array.h"
+
+// Gap buffer.
+//
+// Text stored in one allocation with a gap at the cursor:
+//
+//   [ before the cursor | gap | after the cursor ]
+//
+// Inserting or deleting at the cursor only moves the edges of the gap, so
+// editing the middle of a long line costs the same as editing its end.
+// Moving the cursor moves the bytes between the old and new position across
+// the gap. When the gap is full the buffer doubles and the text after the
+// cursor moves to the end of the new allocation.
+//
+// The text is two contiguous spans (`gap_before`, `gap_after`), enough to
+// render it without copying. Memory goes through the allocator hooks of
+// array.h (_DA_REALLOC, _DA_MEMCPY, _DA_MEMMOVE).
+
+typedef struct {
+  char *items;
+  size_t capacity;
+  size_t gap_start; // cursor, end of the text before it
+  size_t gap_end;   // start of the text after the cursor
+} s_gap_buffer;
+
+static inline void gap_init(s_gap_buffer *gb) {
+  gb->items = NULL;
+  gb->capacity = 0;
+  gb->gap_start = 0;
+  gb->gap_end = 0;
+}
+
+static inline void gap_free(s_gap_buffer *gb) {
+  free(gb->items);
+  gap_init(gb);
+}
+
+// Bytes of text
+static inline size_t gap_length(const s_gap_buffer *gb) {
+  return gb->capacity - (gb->gap_end - gb->gap_start);
+}
+
+// Cursor position, from 0 to gap_length
+static inline size_t gap_cursor(const s_gap_buffer *gb) {
+  return gb->gap_start;
+}
+
+// Text before the cursor
+static inline const char *gap_before(const s_gap_buffer *gb, size_t *size) {
+  *size = gb->gap_start;
+  return gb->items;
+}
+
+// Text after the cursor
+static inline const char *gap_after(const s_gap_buffer *gb, size_t *size) {
+  *size = gb->capacity - gb->gap_end;
+  return gb->items + gb->gap_end;
+}
+
+// Byte at a text position (below gap_length)
+static inline char gap_at(const s_gap_buffer *gb, size_t index) {
+  return index < gb->gap_start
+             ? gb->items[index]
+             : gb->items[gb->gap_end + index - gb->gap_start];
+}
+
+/**
+ * @brief Make room for at least `size` bytes in the gap
+ *
+ */
+static inline void gap_reserve(s_gap_buffer *gb, size_t size) {
+  size_t after = gb->capacity - gb->gap_end;
+  size_t capacity = gb->capacity;
+
+  if (gb->gap_end - gb->gap_start >= size) {
+    return;
+  }
+  if (capacity == 0) {
+    capacity = _DA_INIT_CAPACITY;
+  }
+  while (capacity - gap_length(gb) < size) {
+    capacity <<= 1;
+  }
+  gb->items = _DA_REALLOC(gb->items, capacity);
+  assert(gb->items != NULL && "Maybe you should buy more RAM");
+  _DA_MEMMOVE(gb->items + capacity - after, gb->items + gb->gap_end, after);
+  gb->gap_end = capacity - after;
+  gb->capacity = capacity;
+}
+
+/**
+ * @brief Move the cursor
+ *
+ * @param gb the buffer
+ * @param position new cursor position, clamped to gap_length
+ */
+static inline void gap_move(s_gap_buffer *gb, size_t position) {
+  size_t length = gap_length(gb);
+
+  if (position > length) {
+    position = length;
+  }
+  if (position < gb->gap_start) {
+    size_t count = gb->gap_start - position;
+
+    gb->gap_start -= count;
+    gb->gap_end -= count;
+    _DA_MEMMOVE(gb->items + gb->gap_end, gb->items + gb->gap_start, count);
+  } else if (position > gb->gap_start) {
+    size_t count = position - gb->gap_start;
+
+    _DA_MEMMOVE(gb->items + gb->gap_start, gb->items + gb->gap_end, count);
+    gb->gap_start += count;
+    gb->gap_end += count;
+  }
+}
+
+/**
+ * @brief Insert bytes at the cursor, the cursor moves after them
+ *
+ */
+static inline void gap_insert_many(s_gap_buffer *gb, const char *data,
+                                   size_t size) {
+  gap_reserve(gb, size);
+  _DA_MEMCPY(gb->items + gb->gap_start, data, size);
+  gb->gap_start += size;
+}
+
+static inline void gap_insert(s_gap_buffer *gb, char c) {
+  gap_insert_many(gb, &c, 1);
+}
+
+/**
+ * @brief Delete bytes before the cursor (backspace)
+ *
+ * @return size_t bytes deleted
+ */
+static inline size_t gap_delete_before(s_gap_buffer *gb, size_t count) {
+  if (count > gb->gap_start) {
+    count = gb->gap_start;
+  }
+  gb->gap_start -= count;
+  return count;
+}
+
+/**
+ * @brief Delete bytes after the cursor (delete)
+ *
+ * @return size_t bytes deleted
+ */
+static inline size_t gap_delete_after(s_gap_buffer *gb, size_t count) {
+  if (count > gb->capacity - gb->gap_end) {
+    count = gb->capacity - gb->gap_end;
+  }
+  gb->gap_end += count;
+  return count;
+}
+
+// Delete the text, keeping the allocation
+static inline void gap_clear(s_gap_buffer *gb) {
+  gb->gap_start = 0;
+  gb->gap_end = gb->capacity;
+}
+
+/**
+ * @brief Get the whole text as one span
+ *
+ * Moves the cursor to the end, the text is then the span before it.
+ *
+ * @return const char* the text (not terminated)
+ */
+static inline const char *gap_text(s_gap_buffer *gb, size_t *size) {
+  gap_move(gb, gap_length(gb));
+  return gap_before(gb, size);
+}
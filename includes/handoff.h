@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Hot upgrade hand off.
+//
+// The running server passes its sockets to the server replacing it over a
+// Unix socket: one record per socket, carrying the descriptor with
+// SCM_RIGHTS, followed by the bytes a connection still holds (unconsumed
+// input, then pending output). A HANDOFF_END record ends the list and the
+// new server answers with one byte once it serves everything
+// (`handoff_ack`). The descriptors are duplicated, not moved: until the ack,
+// the old server can take over again.
+
+// Environment variable giving the hand off socket to the new server
+#define HANDOFF_ENV "ECHO_HANDOFF_FD"
+// Largest input plus output accepted with a connection
+#define HANDOFF_MAX_BYTES (1024 * 1024 * 1024)
+
+typedef enum {
+  HANDOFF_LISTENER, // TCP listening socket
+  HANDOFF_UNIX,     // Unix listening socket
+  HANDOFF_ADMIN,    // statistics listening socket
+  HANDOFF_CLIENT,   // connection
+  HANDOFF_END,      // no descriptor, ends the list
+} e_handoff_kind;
+
+typedef struct {
+  uint32_t kind;
+  uint32_t local;               // client accepted on a Unix socket
+  struct sockaddr_storage addr; // source address of a TCP client
+  uint64_t created_ms; // connection time (CLOCK_MONOTONIC, system wide)
+  uint64_t in_size;    // unconsumed input following the record
+  uint64_t out_size;   // pending output following the input
+} s_handoff_record;
+
+/**
+ * @brief Write a whole buffer to a blocking socket
+ *
+ * @return int 0 if success, -1 on error
+ */
+static inline int _handoff_write(int sock, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t writed = send(sock, data, size, MSG_NOSIGNAL);
+    if (writed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (writed <= 0) {
+      return -1;
+    }
+    data += writed;
+    size -= writed;
+  }
+  return 0;
+}
+
+/**
+ * @brief Read a whole buffer from a blocking socket
+ *
+ * @return int 0 if success, -1 on error or end of stream
+ */
+static inline int _handoff_read(int sock, char *data, size_t size) {
+  while (size > 0) {
+    ssize_t readed = recv(sock, data, size, 0);
+    if (readed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (readed <= 0) {
+      return -1;
+    }
+    data += readed;
+    size -= readed;
+  }
+  return 0;
+}
+
+/**
+ * @brief Send a record with its descriptor and bytes (old server side)
+ *
+ * @param sock hand off socket (blocking)
+ * @param record the record, `in_size` and `out_size` bytes follow
+ * @param fd descriptor passed with the record (-1 for none)
+ * @param in unconsumed input of a connection
+ * @param out pending output of a connection
+ * @return int 0 if success, -1 on error
+ */
+static inline int handoff_send(int sock, const s_handoff_record *record,
+                               int fd, const char *in, const char *out) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = (void *)record, .iov_len = sizeof(*record)};
+  struct msghdr msg = {0};
+  ssize_t sent;
+
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd != -1) {
+    struct cmsghdr *cmsg;
+
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  do {
+    sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  // The descriptor goes with the first byte, the rest may follow
+  if (sent <= 0 ||
+      _handoff_write(sock, (const char *)record + sent,
+                     sizeof(*record) - sent) != 0) {
+    return -1;
+  }
+  if (_handoff_write(sock, in, record->in_size) != 0 ||
+      _handoff_write(sock, out, record->out_size) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Receive a record with its descriptor and bytes (new server side)
+ *
+ * @param sock hand off socket (blocking)
+ * @param record the record
+ * @param fd set to the descriptor passed with the record (-1 for none)
+ * @param data set to the input then output bytes (malloc'd, NULL if none)
+ * @return int 0 if success, -1 on error
+ */
+static inline int handoff_recv(int sock, s_handoff_record *record, int *fd,
+                               char **data) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = record, .iov_len = sizeof(*record)};
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+  size_t size;
+  ssize_t readed;
+
+  *fd = -1;
+  *data = NULL;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  do {
+    readed = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (readed == -1 && errno == EINTR);
+  if (readed <= 0) {
+    return -1;
+  }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS) {
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  if (_handoff_read(sock, (char *)record + readed,
+                    sizeof(*record) - readed) != 0) {
+    goto error;
+  }
+
+  if (record->in_size > HANDOFF_MAX_BYTES ||
+      record->out_size > HANDOFF_MAX_BYTES - record->in_size) {
+    goto error;
+  }
+  size = record->in_size + record->out_size;
+  if (size > 0) {
+    *data = malloc(size);
+    if (*data == NULL || _handoff_read(sock, *data, size) != 0) {
+      free(*data);
+      *data = NULL;
+      goto error;
+    }
+  }
+  return 0;
+
+error:
+  if (*fd != -1) {
+    close(*fd);
+    *fd = -1;
+  }
+  return -1;
+}
+
+/**
+ * @brief Tell the old server the hand off is complete (new server side)
+ *
+ * @return int 0 if success, -1 on error
+ */
+static inline int handoff_ack(int sock) {
+  return _handoff_write(sock, "K", 1);
+}
+
+/**
+ * @brief Wait for the new server to take over (old server side)
+ *
+ * @param sock hand off socket
+ * @param timeout longest wait in milliseconds
+ * @return bool true if the new server acknowledged
+ */
+static inline bool handoff_wait_ack(int sock, int timeout) {
+  struct pollfd pfd = {.fd = sock, .events = POLLIN};
+  char ack = 0;
+
+  if (poll(&pfd, 1, timeout) != 1) {
+    return false;
+  }
+  return recv(sock, &ack, 1, 0) == 1 && ack == 'K';
+}
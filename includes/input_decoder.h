@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "array.h"
+
+// Terminal input decoder.
+//
+// Turns the bytes read from a raw mode terminal into keys, one byte at a
+// time, so a read may hold any number of keys (fast typing, key repeat,
+// paste) and a key may be split across reads. Escape sequences are parsed
+// as CSI (`ESC [ params final`) and SS3 (`ESC O final`) sequences; unknown
+// ones are consumed whole and reported as INPUT_TYPE_UNKNOWN.
+//
+// A lone ESC cannot be told apart from the start of a sequence until the
+// next byte: while `input_decode_pending` is true, the caller waits at most
+// INPUT_ESC_TIMEOUT for more input, then calls `input_decode_timeout`.
+//
+// With bracketed paste enabled on the terminal (INPUT_PASTE_ON), a paste
+// arrives between `ESC [200~` and `ESC [201~` and is returned as a single
+// INPUT_TYPE_PASTE holding the whole text, however many reads it took.
+
+// Terminal sequences enabling and disabling bracketed paste
+#define INPUT_PASTE_ON "\033[?2004h"
+#define INPUT_PASTE_OFF "\033[?2004l"
+
+// Longest wait for the rest of a sequence after an ESC (milliseconds)
+#define INPUT_ESC_TIMEOUT 50
+
+// Parameter bytes kept for a CSI sequence (longer ones are unknown keys)
+#define INPUT_PARAMS_SIZE 16
+
+typedef enum {
+  INPUT_TYPE_KEY,
+  INPUT_TYPE_ESC,       // 1b, not followed by a sequence
+  INPUT_TYPE_ARROW,     // 1b 5b 41..44 | 1b 4f 41..44
+  INPUT_TYPE_ENTER,     // a | d
+  INPUT_TYPE_BACKSPACE, // 7f | 8
+  INPUT_TYPE_DELETE,    // 1b 5b 33 7e
+  INPUT_TYPE_CTRL_C,    // 3
+  INPUT_TYPE_BEGIN,     // 1b 5b 48 | 1b 5b 31 7e | 1
+  INPUT_TYPE_END,       // 1b 5b 46 | 1b 5b 34 7e | 5
+  INPUT_TYPE_CLEAR,     // c
+  INPUT_TYPE_PASTE,     // 1b 5b 32 30 30 7e ... 1b 5b 32 30 31 7e
+  INPUT_TYPE_PAGE_UP,   // 1b 5b 35 7e
+  INPUT_TYPE_PAGE_DOWN, // 1b 5b 36 7e
+  INPUT_TYPE_UNKNOWN
+} e_input_type;
+
+typedef enum { ARROW_UP, ARROW_DOWN, ARROW_RIGHT, ARROW_LEFT } e_arrow_key;
+
+typedef struct {
+  e_input_type type;
+  union {
+    char key;          // INPUT_TYPE_KEY
+    e_arrow_key arrow; // INPUT_TYPE_ARROW
+  };
+  const char *text; // INPUT_TYPE_PASTE, valid until the next decode
+  size_t size;
+} s_input;
+
+typedef enum {
+  DECODE_GROUND,
+  DECODE_ESC,   // after an ESC
+  DECODE_CSI,   // after ESC [
+  DECODE_SS3,   // after ESC O
+  DECODE_PASTE, // between the paste brackets
+} e_decode_state;
+
+typedef struct {
+  da_struct(char)
+} s_input_text;
+
+typedef struct {
+  e_decode_state state;
+  char params[INPUT_PARAMS_SIZE]; // CSI parameter bytes
+  size_t params_size;
+  bool overflow;      // CSI parameters did not fit
+  s_input_text paste; // text of the paste being received
+  size_t paste_end;   // bytes of the closing bracket matched
+} s_input_decoder;
+
+static inline void input_decoder_init(s_input_decoder *decoder) {
+  memset(decoder, 0, sizeof(*decoder));
+}
+
+static inline void input_decoder_free(s_input_decoder *decoder) {
+  da_free(&decoder->paste);
+}
+
+// A sequence is started: wait INPUT_ESC_TIMEOUT at most for the rest
+static inline bool input_decode_pending(const s_input_decoder *decoder) {
+  return decoder->state == DECODE_ESC || decoder->state == DECODE_CSI ||
+         decoder->state == DECODE_SS3;
+}
+
+static inline bool _input_arrow(char final, s_input *input) {
+  if (final < 'A' || final > 'D') {
+    return false;
+  }
+  input->type = INPUT_TYPE_ARROW;
+  input->arrow = final == 'A'   ? ARROW_UP
+                 : final == 'B' ? ARROW_DOWN
+                 : final == 'C' ? ARROW_RIGHT
+                                : ARROW_LEFT;
+  return true;
+}
+
+// Key of a complete CSI sequence
+static inline void _input_csi(s_input_decoder *decoder, char final,
+                              s_input *input) {
+  const char *params = decoder->params;
+  size_t size = decoder->params_size;
+
+  input->type = INPUT_TYPE_UNKNOWN;
+  if (decoder->overflow || _input_arrow(final, input)) {
+    return;
+  }
+  if (final == 'H') {
+    input->type = INPUT_TYPE_BEGIN;
+  } else if (final == 'F') {
+    input->type = INPUT_TYPE_END;
+  } else if (final == '~' && size == 1) {
+    if (params[0] == '3') {
+      input->type = INPUT_TYPE_DELETE;
+    } else if (params[0] == '1' || params[0] == '7') {
+      input->type = INPUT_TYPE_BEGIN;
+    } else if (params[0] == '4' || params[0] == '8') {
+      input->type = INPUT_TYPE_END;
+    } else if (params[0] == '5') {
+      input->type = INPUT_TYPE_PAGE_UP;
+    } else if (params[0] == '6') {
+      input->type = INPUT_TYPE_PAGE_DOWN;
+    }
+  }
+}
+
+// Key of a byte outside a sequence
+static inline void _input_ground(char byte, s_input *input) {
+  switch (byte) {
+  case '\n':
+  case '\r':
+    input->type = INPUT_TYPE_ENTER;
+    break;
+  case '\x7f':
+  case '\x08':
+    input->type = INPUT_TYPE_BACKSPACE;
+    break;
+  case '\x03':
+    input->type = INPUT_TYPE_CTRL_C;
+    break;
+  case '\x01':
+    input->type = INPUT_TYPE_BEGIN;
+    break;
+  case '\x05':
+    input->type = INPUT_TYPE_END;
+    break;
+  case '\x0c':
+    input->type = INPUT_TYPE_CLEAR;
+    break;
+  default:
+    if ((unsigned char)byte < 0x20) {
+      input->type = INPUT_TYPE_UNKNOWN;
+    } else {
+      input->type = INPUT_TYPE_KEY;
+      input->key = byte;
+    }
+  }
+}
+
+// Add a byte to the paste, true once the closing bracket is complete
+static inline bool _input_paste(s_input_decoder *decoder, char byte) {
+  static const char end[] = "\033[201~";
+
+  if (byte == end[decoder->paste_end]) {
+    decoder->paste_end++;
+    return decoder->paste_end == sizeof(end) - 1;
+  }
+  // Not the closing bracket after all: the matched bytes are text
+  da_append_many(&decoder->paste, end, decoder->paste_end);
+  decoder->paste_end = 0;
+  if (byte == end[0]) {
+    decoder->paste_end = 1;
+  } else {
+    da_append(&decoder->paste, byte);
+  }
+  return false;
+}
+
+/**
+ * @brief Decode one byte
+ *
+ * @param decoder the decoder
+ * @param byte next byte read from the terminal
+ * @param input set to the key when one is complete
+ * @return bool true if a key is complete
+ */
+static inline bool input_decode(s_input_decoder *decoder, char byte,
+                                s_input *input) {
+  memset(input, 0, sizeof(*input));
+
+  switch (decoder->state) {
+  case DECODE_GROUND:
+    if (byte == '\x1b') {
+      decoder->state = DECODE_ESC;
+      return false;
+    }
+    _input_ground(byte, input);
+    return true;
+
+  case DECODE_ESC:
+    if (byte == '[') {
+      decoder->state = DECODE_CSI;
+      decoder->params_size = 0;
+      decoder->overflow = false;
+      return false;
+    }
+    if (byte == 'O') {
+      decoder->state = DECODE_SS3;
+      return false;
+    }
+    if (byte == '\x1b') {
+      // The first ESC was alone, the second may start a sequence
+      input->type = INPUT_TYPE_ESC;
+      return true;
+    }
+    // Alt and a key: do not take it for ESC
+    decoder->state = DECODE_GROUND;
+    input->type = INPUT_TYPE_UNKNOWN;
+    return true;
+
+  case DECODE_CSI:
+    if (byte >= 0x30 && byte <= 0x3f) {
+      if (decoder->params_size < INPUT_PARAMS_SIZE) {
+        decoder->params[decoder->params_size++] = byte;
+      } else {
+        decoder->overflow = true;
+      }
+      return false;
+    }
+    if (byte >= 0x20 && byte <= 0x2f) {
+      return false; // intermediate bytes, not used by any key here
+    }
+    decoder->state = DECODE_GROUND;
+    if (byte == '~' && !decoder->overflow && decoder->params_size == 3 &&
+        memcmp(decoder->params, "200", 3) == 0) {
+      decoder->state = DECODE_PASTE;
+      da_clear(&decoder->paste);
+      decoder->paste_end = 0;
+      return false;
+    }
+    if (byte < 0x40 || byte > 0x7e) {
+      // Broken sequence
+      input->type = INPUT_TYPE_UNKNOWN;
+      return true;
+    }
+    _input_csi(decoder, byte, input);
+    return true;
+
+  case DECODE_SS3:
+    decoder->state = DECODE_GROUND;
+    if (!_input_arrow(byte, input)) {
+      input->type = byte == 'H'   ? INPUT_TYPE_BEGIN
+                    : byte == 'F' ? INPUT_TYPE_END
+                                  : INPUT_TYPE_UNKNOWN;
+    }
+    return true;
+
+  case DECODE_PASTE:
+    if (!_input_paste(decoder, byte)) {
+      return false;
+    }
+    decoder->state = DECODE_GROUND;
+    input->type = INPUT_TYPE_PASTE;
+    input->text = decoder->paste.items;
+    input->size = decoder->paste.count;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief End the pending sequence after INPUT_ESC_TIMEOUT without input
+ *
+ * @param decoder the decoder
+ * @param input set to ESC for a lone ESC, to an unknown key otherwise
+ * @return bool true if a key is complete
+ */
+static inline bool input_decode_timeout(s_input_decoder *decoder,
+                                        s_input *input) {
+  if (!input_decode_pending(decoder)) {
+    return false;
+  }
+  memset(input, 0, sizeof(*input));
+  input->type =
+      decoder->state == DECODE_ESC ? INPUT_TYPE_ESC : INPUT_TYPE_UNKNOWN;
+  decoder->state = DECODE_GROUND;
+  return true;
+}
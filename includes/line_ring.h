@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounded line store.
+//
+// Lines are appended to a ring of bytes and indexed by a ring of (position,
+// size) entries. Both rings are allocated once: when either is full, the
+// oldest lines are dropped, so memory stays bounded however many lines go
+// through. Every line keeps the number it was appended with, a line is read
+// back by number in O(1) (NULL once dropped), so a view only touches the
+// lines it shows.
+//
+// A line is stored contiguously: one that would wrap around the end of the
+// byte ring starts again at its beginning, the bytes skipped are lost. A line
+// larger than the byte ring is truncated.
+//
+// The rings are reserved with malloc: the pages are only used once written.
+
+typedef struct {
+  uint64_t position; // position of the first byte in the byte stream
+  size_t size;
+} s_line_entry;
+
+typedef struct {
+  char *bytes;
+  size_t capacity;     // bytes of the byte ring
+  s_line_entry *index; // entry of line n at n % lines
+  size_t lines;        // entries of the index ring
+  uint64_t first;      // number of the oldest line kept
+  uint64_t end;        // number of the next line
+  uint64_t tail;       // position after the newest line
+} s_line_ring;
+
+/**
+ * @brief Initialize a line store
+ *
+ * @param ring the store
+ * @param capacity bytes kept at most
+ * @param lines lines kept at most
+ */
+static inline void line_ring_init(s_line_ring *ring, size_t capacity,
+                                  size_t lines) {
+  memset(ring, 0, sizeof(*ring));
+  ring->capacity = capacity > 0 ? capacity : 1;
+  ring->lines = lines > 0 ? lines : 1;
+  ring->bytes = malloc(ring->capacity);
+  ring->index = malloc(ring->lines * sizeof(s_line_entry));
+  assert(ring->bytes != NULL && ring->index != NULL &&
+         "Maybe you should buy more RAM");
+}
+
+static inline void line_ring_free(s_line_ring *ring) {
+  free(ring->bytes);
+  free(ring->index);
+  memset(ring, 0, sizeof(*ring));
+}
+
+// Lines currently kept
+static inline size_t line_ring_count(const s_line_ring *ring) {
+  return ring->end - ring->first;
+}
+
+/**
+ * @brief Append a line, dropping the oldest ones to make room
+ *
+ * @param ring the store
+ * @param text the line (without delimiter)
+ * @param size bytes of the line
+ */
+static inline void line_ring_push(s_line_ring *ring, const char *text,
+                                  size_t size) {
+  uint64_t position = ring->tail;
+  size_t offset;
+
+  if (size > ring->capacity) {
+    size = ring->capacity;
+  }
+  offset = position % ring->capacity;
+  if (offset + size > ring->capacity) {
+    position += ring->capacity - offset;
+    offset = 0;
+  }
+
+  // Drop the lines the new one overwrites, and the oldest if the index is
+  // full
+  while (ring->first < ring->end &&
+         (ring->end - ring->first == ring->lines ||
+          ring->index[ring->first % ring->lines].position + ring->capacity <
+              position + size)) {
+    ring->first++;
+  }
+
+  memcpy(ring->bytes + offset, text, size);
+  ring->index[ring->end % ring->lines] =
+      (s_line_entry){.position = position, .size = size};
+  ring->end++;
+  ring->tail = position + size;
+}
+
+/**
+ * @brief Get a line by number
+ *
+ * @param ring the store
+ * @param number number of the line (from `first` to `end` - 1)
+ * @param size set to the bytes of the line
+ * @return const char* the line (not terminated), NULL if not kept
+ */
+static inline const char *line_ring_get(const s_line_ring *ring,
+                                        uint64_t number, size_t *size) {
+  const s_line_entry *entry;
+
+  if (number < ring->first || number >= ring->end) {
+    *size = 0;
+    return NULL;
+  }
+  entry = ring->index + number % ring->lines;
+  *size = entry->size;
+  return ring->bytes + entry->position % ring->capacity;
+}
@@ -0,0 +1,581 @@
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "array.h"
+#include "stats.h"
+#include "timer_wheel.h"
+
+// Connection reactor: the poll event loop of the echo server as a library
+// (build/libreactor.a, see src/reactor.c).
+//
+// The reactor owns the listening sockets and the connections. It accepts
+// within the admission limits, reads into a per connection buffer, writes the
+// queued output, evicts on timeouts and calls a handler on each event:
+// - on_accept: a connection was accepted (return REACTOR_CLOSE to refuse it)
+// - on_data: bytes were read; the handler gets a view of the unconsumed bytes
+//   of the read buffer and returns how many it consumed (or REACTOR_CLOSE /
+//   REACTOR_DETACH). The rest, a partial message, is passed again with the
+//   next bytes.
+// - on_writable: the pending output of a stalled connection was written
+//   (return REACTOR_CLOSE or REACTOR_DETACH to end the connection)
+// - on_close: the connection is closed (or detached) and about to be freed
+//
+// Output is queued with `reactor_send` without copying: the bytes must stay
+// valid until the end of the loop iteration, when each connection with queued
+// output is written with one writev. Consumed bytes of the read buffer stay
+// in place until then, so a view of the request can be sent back as is. What
+// the socket does not take is copied into the pending output and the
+// connection is only polled for POLLOUT until it drains (backpressure).
+//
+// Idle connections hold no read buffer: a connection takes one from a per
+// reactor pool before reading and gives it back once its input is consumed
+// and flushed, so memory follows the bytes in flight rather than the number
+// of connections. The pool keeps the buffers by size class (`read_size`
+// doubled up to REACTOR_POOL_CLASSES - 1 times) and REACTOR_POOL_BYTES at
+// most. Each connection adapts its read size to its recent reads: a read
+// filling the buffer doubles it (up to `max_read_size`), REACTOR_SHRINK_READS
+// reads in a row using less than a quarter of it halve it (down to
+// `read_size`).
+//
+// With `config.zerocopy`, queued output of that many bytes or more lying in
+// the read buffer is sent with MSG_ZEROCOPY: the kernel sends the pages of
+// the read buffer instead of copying them. The buffer then belongs to the
+// kernel until the completion notification shows up on the socket error
+// queue; meanwhile the connection reads into a buffer of the pool, which
+// completed buffers go back to. A connection closed with sends in
+// flight keeps its socket open until they complete (at most
+// REACTOR_ZEROCOPY_LINGER, then it is reset).
+//
+// Everything runs on the thread calling `reactor_run`, a reactor is not
+// thread-safe (its statistics can be read from any thread, see stats.h).
+// The only exception is `reactor_post`: an acceptor reactor given worker
+// reactors (`reactor_set_workers`) hands each accepted connection to one of
+// them through a lock-free queue, each worker running on its own thread.
+
+// Default bytes read per readable event
+#define REACTOR_READ_SIZE 1024
+// Size classes of the pooled read buffers (read_size << class)
+#define REACTOR_POOL_CLASSES 16
+// Bytes of idle read buffers kept for reuse
+#define REACTOR_POOL_BYTES (4 * 1024 * 1024)
+// Consecutive small reads (under a quarter of the read size) halving it
+#define REACTOR_SHRINK_READS 4
+// Length of the kernel accept queue (holds the connections while paused)
+#define REACTOR_BACKLOG SOMAXCONN
+// Maximum number of connections accepted per wakeup
+#define REACTOR_ACCEPT_BATCH 64
+// Busy poll: packets the kernel may process per busy poll of a socket
+#define REACTOR_BUSY_POLL_BUDGET 64
+// Resolution of the connection timers in milliseconds
+#define REACTOR_TIMER_TICK 100
+// Largest number of descriptors a local client may pass with its data
+#define REACTOR_MAX_PASSED_FDS 3
+// Connections an acceptor may hand to a worker ahead of it (power of two)
+#define REACTOR_INBOX_SIZE 1024
+// Traffic window of the least-loaded balancing in milliseconds
+#define REACTOR_LOAD_WINDOW 1000
+// Longest wait for the zerocopy sends of a closed connection in milliseconds
+#define REACTOR_ZEROCOPY_LINGER 5000
+
+// Handler results ending the connection (on_accept, on_data, on_writable)
+enum {
+  REACTOR_CLOSE = -1,  // close the connection
+  REACTOR_DETACH = -2, // remove it from the reactor, the handler owns the fd
+};
+
+typedef enum {
+  REACTOR_CLOSED,            // closed by the peer, an error or the handler
+  REACTOR_EVICT_IDLE,        // idle timeout
+  REACTOR_EVICT_WRITE_STALL, // output not drained in time
+  REACTOR_EVICT_LIFETIME,    // maximum lifetime
+  REACTOR_DETACHED,          // removed without closing (REACTOR_DETACH)
+  REACTOR_DRAINED,           // closed by a graceful drain (reactor_drain)
+} e_reactor_close;
+
+// How an acceptor picks the worker of a new connection
+typedef enum {
+  REACTOR_BALANCE_ROUND_ROBIN,
+  REACTOR_BALANCE_LEAST_CONN,   // fewest open connections
+  REACTOR_BALANCE_LEAST_LOADED, // fewest bytes over the last load window
+} e_reactor_balance;
+
+typedef struct {
+  da_struct(struct pollfd)
+} s_da_fd;
+
+typedef struct {
+  da_struct(char)
+} s_da_char;
+
+typedef struct {
+  da_struct(struct iovec)
+} s_da_iovec;
+
+typedef struct {
+  da_struct(char *)
+} s_da_buffer;
+
+// Read buffer lent to the kernel by MSG_ZEROCOPY sends
+typedef struct {
+  char *items;
+  size_t capacity;
+  uint32_t first;   // sequence number of its first send
+  uint32_t last;    // sequence number of its last send
+  uint32_t pending; // sends not completed yet
+} s_zc_buffer;
+
+typedef struct {
+  da_struct(s_zc_buffer)
+} s_da_zc;
+
+// Closed connection waiting for its zerocopy sends to complete
+typedef struct {
+  int fd;
+  bool owned;           // not a duplicate of a detached socket
+  uint64_t deadline_ms; // reset (or given up) after it
+  s_da_zc buffers;
+} s_zc_linger;
+
+typedef struct {
+  da_struct(s_zc_linger)
+} s_da_linger;
+
+// State of a connection. An event reads or writes the first two cache lines
+// (the read, write and flush paths), the rest is only used by handlers with
+// per connection data, zerocopy sends, local clients passing descriptors and
+// timers. What is only needed to connect, log or evict lives in the side
+// table of the reactor (s_conn_info, see `reactor_conn_info`).
+typedef struct {
+  // Hot: 128 bytes, aligned on a cache line
+  _Alignas(64) s_da_char in; // read buffer (none while idle), unconsumed last
+  s_da_iovec queued;         // output queued this iteration (not copied)
+  size_t in_consumed;        // bytes of `in` consumed this iteration
+  size_t index;              // index of the connection in the poll array
+  size_t read_size;          // bytes asked by the next read (adaptive)
+  uint64_t last_active_ms;   // last read or write
+  uint64_t stall_ms;         // time output started pending (0 if none)
+  size_t out_offset;         // bytes of `out` already written
+  s_da_char out;             // pending output (short writes)
+  int npassed; // passed descriptors, closed after on_data unless reset to 0
+  uint8_t small_reads; // reads in a row under a quarter of read_size
+  bool local;          // accepted on a Unix socket
+  bool dirty;          // in the reactor dirty list
+  bool zerocopy;       // SO_ZEROCOPY enabled on the socket
+  // Warm
+  void *data;              // handler data
+  uint64_t reply_start_ns; // wakeup time of the pending output (latency)
+  uint32_t zc_next;        // sequence number of the next zerocopy send
+  s_da_zc zc_inflight;     // read buffers lent to the kernel
+  s_tw_timer timer;        // idle, write-stall and lifetime timer
+  int passed_fds[REACTOR_MAX_PASSED_FDS]; // received with the last read
+} s_conn;
+
+// Cold data of a connection, kept by the reactor next to the poll array
+typedef struct {
+  struct sockaddr_storage addr; // source address (AF_UNSPEC for local ones)
+  uint64_t created_ms;          // connection time
+} s_conn_info;
+
+typedef struct {
+  da_struct(s_conn_info)
+} s_da_conn_info;
+
+typedef struct {
+  da_struct(s_conn *)
+} s_da_conn;
+
+typedef struct {
+  struct in6_addr ip; // IPv4 addresses mapped (::ffff:a.b.c.d)
+  uint32_t count;     // 0 for an empty slot
+} s_ip_slot;
+
+// Open addressing table of the number of connections per source address
+typedef struct {
+  size_t capacity; // power of two
+  size_t count;
+  s_ip_slot *slots;
+} s_ip_table;
+
+typedef struct {
+  bool paused;       // listening sockets read interest removed
+  bool out_of_fds;   // accept failed with EMFILE/ENFILE
+  uint64_t fds_ms;   // time of that failure, retried a tick later
+  uint64_t closed;   // acceptor: worker closes seen when out of fds
+  size_t buffered;   // pending output bytes of all the clients
+  s_ip_table per_ip; // connections per source address
+} s_admission;
+
+// Connection handed to a worker
+typedef struct {
+  _Atomic size_t seq; // position it holds a connection for, plus one
+  int fd;
+  bool local;
+  struct sockaddr_storage addr;
+} s_inbox_slot;
+
+// Bounded multi-producer single-consumer queue of the connections handed to a
+// worker (Vyukov's ring: producers claim a position with a CAS on `tail`,
+// then publish the slot through its sequence)
+typedef struct {
+  _Alignas(64) _Atomic size_t tail; // next position claimed by a producer
+  _Alignas(64) _Atomic size_t head; // next position read by the worker
+  _Alignas(64) _Atomic bool armed;  // worker may block: producers signal efd
+  s_inbox_slot *slots;              // NULL without an inbox
+  int efd;                          // eventfd polled by the worker
+  size_t index;                     // poll array index of efd
+} s_inbox;
+
+// Balancing state of a worker, only used by its acceptor
+typedef struct {
+  uint64_t bytes;    // bytes of the worker at the start of the window
+  uint64_t recent;   // bytes of the worker during the previous window
+  uint64_t assigned; // connections handed during the current window
+} s_worker_load;
+
+// Admission limits and timeouts (0 disables a limit or a timeout)
+typedef struct {
+  size_t max_connections; // for all the workers of an acceptor
+  size_t max_per_ip;      // TCP clients only, per worker with workers
+  size_t max_buffered;    // in bytes, for all the workers of an acceptor
+  uint64_t idle_timeout;  // in milliseconds
+  uint64_t write_timeout; // in milliseconds
+  uint64_t max_lifetime;  // in milliseconds
+  uint64_t busy_poll_us;  // spin before blocking in poll
+  size_t read_size;       // bytes read per readable event (smallest)
+  size_t max_read_size;   // largest adaptive read size (0: read_size)
+  size_t zerocopy;        // MSG_ZEROCOPY for writes of this many bytes (TCP)
+  bool read_on_accept;    // read without waiting for poll after accept
+} s_reactor_config;
+
+// Event loop statistics, only written by the reactor thread (see stats.h)
+typedef struct {
+  s_counter accepted;
+  s_counter closed;
+  s_counter bytes_in;
+  s_counter bytes_out;
+  s_counter reads;
+  s_counter writevs; // writes of queued output
+  s_counter wakeups;
+  s_counter poll_wait_ns;
+  s_counter processing_ns;
+  s_counter evicted_idle;
+  s_counter evicted_write_stall;
+  s_counter evicted_lifetime;
+  s_counter rejected;        // accepted then closed (per address limit)
+  s_counter deferred;        // times accepting was paused by a limit
+  s_counter buffered;        // gauge, pending output bytes
+  s_counter paused;          // gauge, 1 while accepting is paused
+  s_counter spin_polls;      // non-blocking polls while busy polling
+  s_counter spin_hits;       // events found while busy polling
+  s_counter blocking_waits;  // blocking polls
+  s_counter cross_cpu;       // admitted off the CPU that received them
+  s_counter steered;         // handed to the reactor of their CPU
+  s_counter drained;         // closed by a graceful drain
+  s_counter zerocopy_sends;  // sendmsg with MSG_ZEROCOPY
+  s_counter zerocopy_bytes;  // bytes sent with MSG_ZEROCOPY
+  s_counter zerocopy_copied; // zerocopy sends the kernel copied anyway
+  s_counter early_reads;     // data read right after accept
+  s_counter buffer_allocs;   // read buffers allocated (pool empty)
+  s_counter pooled_bytes;    // gauge, bytes of the idle read buffers
+  s_histogram reads_per_wakeup;
+  s_histogram loop_ns;    // processing time of a loop iteration
+  s_histogram latency_ns; // wakeup to output fully written
+} s_reactor_stats;
+
+typedef struct s_reactor s_reactor;
+
+typedef struct {
+  int (*on_accept)(s_reactor *reactor, s_conn *conn);
+  ssize_t (*on_data)(s_reactor *reactor, s_conn *conn, char *data,
+                     size_t size);
+  int (*on_writable)(s_reactor *reactor, s_conn *conn);
+  void (*on_close)(s_reactor *reactor, s_conn *conn, e_reactor_close reason);
+} s_reactor_handler;
+
+typedef void (*reactor_watch_fn)(s_reactor *reactor, int fd, void *arg);
+
+// Descriptor polled with the listeners for the owner of the reactor
+typedef struct {
+  int fd;
+  size_t index;        // poll array index of fd
+  reactor_watch_fn fn; // called when fd is readable (NULL without a watch)
+  void *arg;
+} s_reactor_watch;
+
+struct s_reactor {
+  s_reactor_config config;
+  s_reactor_handler handler;
+  void *arg;           // handler context
+  s_da_fd fds;         // listening sockets first, then the clients
+  s_da_conn conns;     // conns.items[i - listeners] is the client of fds[i]
+  s_da_conn_info info; // info.items[i - listeners]: its cold data
+  size_t listeners;    // listening sockets (and inbox) at the start of fds
+  s_da_conn dirty;     // connections with output to write or input consumed
+  s_tw_wheel timers;
+  s_admission admission;
+  s_reactor_stats stats;
+  uint64_t wake_ns;    // time the current loop iteration woke up
+  uint64_t idle_ns;    // time the previous loop iteration ended
+  bool busy_poll;      // SO_BUSY_POLL accepted, set on every TCP client
+  _Atomic bool stop;   // reactor_run returns after the current iteration
+  s_inbox inbox;       // connections handed by an acceptor
+  s_reactor **workers; // acceptor: reactors serving the accepted connections
+  size_t nworkers;
+  e_reactor_balance balance;
+  s_worker_load *load; // acceptor: balancing state of each worker
+  size_t next_worker;  // acceptor: round robin position
+  uint64_t window_ms;  // acceptor: start of the load window
+  int cpu;             // CPU running the reactor (-1 if not pinned)
+  s_reactor **peers;   // reactors of the SO_REUSEPORT group (CPU steering)
+  size_t npeers;
+  s_reactor_watch watch;     // descriptor of the owner (see reactor_watch)
+  _Atomic uint64_t drain_ms; // drain deadline (0 unless draining)
+  bool draining;             // listeners no longer polled
+  s_da_linger zc_linger;     // closed connections with zerocopy sends
+  // Idle read buffers by size class (capacity config.read_size << class)
+  s_da_buffer pool[REACTOR_POOL_CLASSES];
+  size_t pooled; // bytes of the idle read buffers
+};
+
+/**
+ * @brief Check if an entry before `reactor->listeners` in the poll array is a
+ * listening socket (not the inbox eventfd or the watched descriptor)
+ *
+ */
+static inline bool reactor_is_listener(const s_reactor *reactor, size_t i) {
+  return (reactor->inbox.slots == NULL || i != reactor->inbox.index) &&
+         (reactor->watch.fn == NULL || i != reactor->watch.index);
+}
+
+/**
+ * @brief Get the cold data of a connection (source address, connection time)
+ *
+ */
+static inline s_conn_info *reactor_conn_info(const s_reactor *reactor,
+                                             const s_conn *conn) {
+  return &reactor->info.items[conn->index - reactor->listeners];
+}
+
+/**
+ * @brief Get the monotonic time in milliseconds
+ *
+ */
+static inline uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Get the monotonic time in nanoseconds
+ *
+ */
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Initialize a reactor
+ *
+ * @param reactor the reactor
+ * @param config limits and timeouts (a read_size of 0 uses REACTOR_READ_SIZE)
+ * @param handler callbacks (on_data is required, the others may be NULL)
+ * @param arg handler context, available as `reactor->arg`
+ */
+void reactor_init(s_reactor *reactor, const s_reactor_config *config,
+                  const s_reactor_handler *handler, void *arg);
+
+/**
+ * @brief Close every socket of the reactor and free the connections
+ *
+ * on_close is not called.
+ */
+void reactor_free(s_reactor *reactor);
+
+/**
+ * @brief Add a listening socket (made non-blocking)
+ *
+ * Listening sockets must be added before any client.
+ */
+void reactor_add_listener(s_reactor *reactor, int fd);
+
+/**
+ * @brief Add an already connected socket (made non-blocking)
+ *
+ * The connection is served as an accepted one, on_accept is not called.
+ *
+ * @param reactor the reactor
+ * @param fd connected socket
+ * @param addr source address, NULL for a local client
+ * @return s_conn* the connection
+ */
+s_conn *reactor_add_client(s_reactor *reactor, int fd,
+                           const struct sockaddr_storage *addr);
+
+/**
+ * @brief Queue output without copying it
+ *
+ * The bytes must stay valid until the end of the loop iteration. Views of the
+ * read buffer of the connection do, a view of another connection's buffer
+ * does not (it may be reallocated by its next read).
+ */
+void reactor_send(s_reactor *reactor, s_conn *conn, char *data, size_t size);
+
+/**
+ * @brief Write output now, copying what the socket does not take
+ *
+ * The rest becomes pending output, written when the client drains its socket
+ * (on_writable is then called). Unlike `reactor_send`, the bytes may be
+ * reused as soon as it returns, but it costs a write per call: it must not be
+ * mixed with `reactor_send` on a connection in the same iteration.
+ *
+ * @return int 0 if everything was written, 1 if output is pending, -1 if the
+ * write failed (the connection should be closed)
+ */
+int reactor_write(s_reactor *reactor, s_conn *conn, const char *data,
+                  size_t size);
+
+/**
+ * @brief Consume bytes of the read buffer outside of on_data
+ *
+ * Bytes left unconsumed by on_data are only passed again with the next read;
+ * a handler resuming work in on_writable takes them from `conn->in` (after
+ * the `conn->in_consumed` first bytes) and consumes them with this.
+ */
+void reactor_consume(s_reactor *reactor, s_conn *conn, size_t size);
+
+/**
+ * @brief Poll a descriptor of the owner of the reactor (a signalfd)
+ *
+ * Must be called before adding clients. The callback runs on the reactor
+ * thread when the descriptor is readable and must consume what it reads;
+ * `reactor_free` closes the descriptor. Only one descriptor can be watched.
+ *
+ * @param reactor the reactor
+ * @param fd descriptor, made non-blocking
+ * @param fn callback
+ * @param arg argument of the callback
+ */
+void reactor_watch(s_reactor *reactor, int fd, reactor_watch_fn fn, void *arg);
+
+/**
+ * @brief Hand the connections accepted by a reactor to worker reactors
+ *
+ * Must be called before `reactor_run`. The acceptor keeps the listening
+ * sockets and enforces `max_connections` and `max_buffered` on the sum of its
+ * workers; the workers check `max_per_ip` and run the handler. Each worker
+ * then runs `reactor_run` on its own thread.
+ *
+ * @param acceptor reactor with the listening sockets
+ * @param workers worker reactors, initialized and without clients (the array
+ * is copied)
+ * @param count number of workers
+ * @param balance how a worker is picked for a new connection
+ */
+void reactor_set_workers(s_reactor *acceptor, s_reactor **workers,
+                         size_t count, e_reactor_balance balance);
+
+/**
+ * @brief Hand a connected socket to a reactor, from any thread
+ *
+ * The reactor needs an inbox (see `reactor_set_workers`). The connection is
+ * admitted as an accepted one on its next loop iteration.
+ *
+ * @param reactor the worker reactor
+ * @param fd connected socket
+ * @param addr source address, NULL for a local client
+ * @return int 0 if queued, -1 if the inbox is full
+ */
+int reactor_post(s_reactor *reactor, int fd,
+                 const struct sockaddr_storage *addr);
+
+/**
+ * @brief Steer the connections of a SO_REUSEPORT group to the reactor pinned
+ * on the CPU that received them
+ *
+ * Each reactor of the group has its `cpu` set and one TCP listener of the
+ * group, listening in the order of `group` (the socket index of the group).
+ * A classic BPF program attached to the group picks the listener of the
+ * receiving CPU; a connection accepted on another CPU anyway (an unpinned
+ * reactor or CPU) is handed to the right reactor at accept time, after
+ * checking its SO_INCOMING_CPU. Must be called before `reactor_run`.
+ *
+ * @param group reactors sharing the port (the array is copied)
+ * @param count number of reactors
+ * @param fd any listening socket of the group
+ * @return int 0 if success, -1 if the program was refused (only the accept
+ * time check steers)
+ */
+int reactor_steer_cpu(s_reactor **group, size_t count, int fd);
+
+/**
+ * @brief Add the statistics of a reactor to a private copy (e.g. to export
+ * the sum of the workers)
+ *
+ */
+void reactor_stats_merge(s_reactor_stats *dst, s_reactor_stats *src);
+
+/**
+ * @brief Run one loop iteration
+ *
+ * @param reactor the reactor
+ * @param timeout longest wait in milliseconds (-1 to wait for the next timer)
+ * @return int 0 if success, -1 if poll failed
+ */
+int reactor_run_once(s_reactor *reactor, int timeout);
+
+/**
+ * @brief Run the loop until `reactor_stop` is called
+ *
+ * @return int 0 if stopped, -1 if poll failed
+ */
+int reactor_run(s_reactor *reactor);
+
+/**
+ * @brief Drain the reactor gracefully, then make `reactor_run` return
+ *
+ * Safe from another thread (see reactor_stop). The listeners are no longer
+ * polled: new connections wait in the accept queue. A connection is closed
+ * as soon as it is idle, with no unconsumed input and no pending output, so
+ * the replies in flight are written first; past the deadline the others are
+ * closed too (REACTOR_DRAINED). `reactor_run` returns once no connection is
+ * left, for an acceptor once its workers have none left (drain them too).
+ * A later call may only bring the deadline closer (0 closes everything at
+ * once).
+ *
+ * @param reactor the reactor
+ * @param timeout longest drain in milliseconds
+ */
+void reactor_drain(s_reactor *reactor, uint64_t timeout);
+
+/**
+ * @brief Make `reactor_run` return after the current iteration
+ *
+ * Safe from another thread or a signal handler: a reactor with an inbox is
+ * woken through its eventfd, otherwise the signal interrupts its poll (the
+ * reactor thread must not block the signal).
+ */
+void reactor_stop(s_reactor *reactor);
+
+/**
+ * @brief Enable SO_BUSY_POLL on the TCP listeners and the clients accepted
+ * from now on (see config.busy_poll_us)
+ *
+ * @return int 0 if success, -1 if SO_BUSY_POLL was refused
+ */
+int reactor_busy_poll(s_reactor *reactor);
+
+/**
+ * @brief Format the peer of a connection for the logs
+ *
+ * @return const char* static buffer, valid until the next call
+ */
+const char *reactor_peer_name(const s_reactor *reactor, const s_conn *conn);
@@ -0,0 +1,318 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "array.h"
+
+// Off-screen terminal frame.
+//
+// The client draws a whole frame into a grid of cells (`screen_put`,
+// `screen_fill`), then `screen_flush` compares it with the frame the terminal
+// shows and emits only the cells that changed, in a single write. Cursor
+// moves are coalesced: the cursor already sits after the last cell written,
+// a short gap on the same row is filled by writing its cells again and a
+// longer one is skipped with a cursor forward, a new row costs one cursor
+// position sequence. Attributes are only switched when they change.
+//
+// A cell holds one character (a UTF-8 sequence of up to 4 bytes): wide
+// characters are not supported. Control characters and invalid or truncated
+// sequences are drawn as '?' (one byte each), so bytes received from the
+// network cannot inject escape sequences.
+
+// Attributes of a cell
+#define SCREEN_INVERSE 1
+#define SCREEN_UNDERLINE 2
+
+// Longest gap on a row filled by writing its cells again instead of moving
+// the cursor ("\033[NC" is 4 bytes and more)
+#define SCREEN_SKIP_CELLS 3
+
+typedef struct {
+  char bytes[4]; // UTF-8 sequence, not terminated
+  uint8_t size;  // bytes used, 0 for a cell never drawn
+  uint8_t attr;  // SCREEN_* attributes
+} s_cell;
+
+typedef struct {
+  da_struct(char)
+} s_screen_output;
+
+typedef struct {
+  int rows;
+  int columns;
+  s_cell *cells;          // frame being drawn
+  s_cell *shown;          // frame on the terminal
+  s_screen_output output; // sequences of the last rendered frame
+  // Terminal state while rendering, -1 when unknown
+  int row;
+  int column;
+  uint8_t attr;
+  // Totals, for benchmarks
+  size_t frames;
+  size_t writes;
+  size_t bytes;
+} s_screen;
+
+/**
+ * @brief Initialize a screen, the first flush redraws the whole terminal
+ *
+ * @param screen the screen
+ * @param rows terminal rows
+ * @param columns terminal columns
+ */
+static inline void screen_init(s_screen *screen, int rows, int columns) {
+  size_t count;
+
+  memset(screen, 0, sizeof(*screen));
+  screen->rows = rows > 0 ? rows : 0;
+  screen->columns = columns > 0 ? columns : 0;
+  count = (size_t)screen->rows * screen->columns;
+  screen->cells = calloc(count + 1, sizeof(s_cell));
+  screen->shown = calloc(count + 1, sizeof(s_cell));
+  assert(screen->cells != NULL && screen->shown != NULL &&
+         "Maybe you should buy more RAM");
+  for (size_t i = 0; i < count; i++) {
+    screen->cells[i] = (s_cell){.bytes = " ", .size = 1};
+  }
+}
+
+static inline void screen_free(s_screen *screen) {
+  free(screen->cells);
+  free(screen->shown);
+  da_free(&screen->output);
+  screen->cells = NULL;
+  screen->shown = NULL;
+}
+
+/**
+ * @brief Forget what the terminal shows: the next flush clears it and
+ * redraws every cell
+ *
+ */
+static inline void screen_invalidate(s_screen *screen) {
+  memset(screen->shown, 0,
+         (size_t)screen->rows * screen->columns * sizeof(s_cell));
+}
+
+/**
+ * @brief Get the length of the UTF-8 sequence starting a text
+ *
+ * @return size_t bytes of the sequence, 0 if it is invalid or truncated
+ */
+static inline size_t _screen_utf8_size(const char *text, size_t size) {
+  unsigned char lead = text[0];
+  size_t len = lead < 0x80                 ? 1
+               : lead >= 0xc2 && lead < 0xe0 ? 2
+               : lead >= 0xe0 && lead < 0xf0 ? 3
+               : lead >= 0xf0 && lead < 0xf5 ? 4
+                                             : 0;
+
+  if (len > size) {
+    return 0;
+  }
+  for (size_t i = 1; i < len; i++) {
+    if (((unsigned char)text[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+  }
+  return len;
+}
+
+/**
+ * @brief Draw text from a position, clipped at the end of the row
+ *
+ * @param screen the screen
+ * @param row row (from 0)
+ * @param column column (from 0)
+ * @param text UTF-8 text
+ * @param size bytes of text
+ * @param attr SCREEN_* attributes
+ * @return int cells drawn
+ */
+static inline int screen_put(s_screen *screen, int row, int column,
+                             const char *text, size_t size, uint8_t attr) {
+  s_cell *cell;
+  int drawn = 0;
+
+  if (row < 0 || row >= screen->rows || column < 0) {
+    return 0;
+  }
+  cell = screen->cells + (size_t)row * screen->columns;
+  while (size > 0 && column < screen->columns) {
+    unsigned char lead = text[0];
+    size_t len = _screen_utf8_size(text, size);
+
+    if (len == 0 || lead < 0x20 || lead == 0x7f) {
+      len = 1;
+      cell[column] = (s_cell){.bytes = "?", .size = 1, .attr = attr};
+    } else {
+      cell[column].size = len;
+      cell[column].attr = attr;
+      memcpy(cell[column].bytes, text, len);
+    }
+    text += len;
+    size -= len;
+    column++;
+    drawn++;
+  }
+  return drawn;
+}
+
+/**
+ * @brief Repeat a character from a position, clipped at the end of the row
+ *
+ * @param screen the screen
+ * @param row row (from 0)
+ * @param column column (from 0)
+ * @param count cells to fill
+ * @param character one UTF-8 character (NUL terminated)
+ * @param attr SCREEN_* attributes
+ */
+static inline void screen_fill(s_screen *screen, int row, int column,
+                               int count, const char *character,
+                               uint8_t attr) {
+  s_cell *cells;
+
+  if (count <= 0 ||
+      screen_put(screen, row, column, character, strlen(character), attr) ==
+          0) {
+    return;
+  }
+  cells = screen->cells + (size_t)row * screen->columns;
+  if (column + count > screen->columns) {
+    count = screen->columns - column;
+  }
+  for (int i = 1; i < count; i++) {
+    cells[column + i] = cells[column];
+  }
+}
+
+static inline void _screen_emit(s_screen *screen, const char *data,
+                                size_t size) {
+  da_append_many(&screen->output, data, size);
+}
+
+static inline void _screen_emit_cell(s_screen *screen, const s_cell *cell) {
+  if (cell->attr != screen->attr) {
+    char sgr[16];
+    int len = snprintf(sgr, sizeof(sgr), "\033[0%s%sm",
+                       cell->attr & SCREEN_INVERSE ? ";7" : "",
+                       cell->attr & SCREEN_UNDERLINE ? ";4" : "");
+
+    _screen_emit(screen, sgr, len);
+    screen->attr = cell->attr;
+  }
+  _screen_emit(screen, cell->bytes, cell->size);
+  screen->column++;
+  // The cursor stays on the last column until the next character: its
+  // position depends on the terminal
+  if (screen->column == screen->columns) {
+    screen->row = -1;
+  }
+}
+
+/**
+ * @brief Move the terminal cursor to a cell about to be written
+ *
+ */
+static inline void _screen_move(s_screen *screen, int row, int column) {
+  const s_cell *cells = screen->cells + (size_t)row * screen->columns;
+  char move[32];
+  int len;
+
+  if (screen->row == row && screen->column == column) {
+    return;
+  }
+  if (screen->row == row && screen->column < column) {
+    if (column - screen->column <= SCREEN_SKIP_CELLS) {
+      // Cheaper to write the unchanged cells again
+      while (screen->column < column) {
+        _screen_emit_cell(screen, cells + screen->column);
+      }
+      return;
+    }
+    len = snprintf(move, sizeof(move), "\033[%dC", column - screen->column);
+  } else {
+    len = snprintf(move, sizeof(move), "\033[%d;%dH", row + 1, column + 1);
+  }
+  _screen_emit(screen, move, len);
+  screen->row = row;
+  screen->column = column;
+}
+
+/**
+ * @brief Build the sequences turning the shown frame into the drawn one
+ *
+ * The drawn frame becomes the shown frame, the sequences are left in
+ * `screen->output`.
+ *
+ * @return size_t bytes of the sequences
+ */
+static inline size_t screen_render(s_screen *screen) {
+  size_t count = (size_t)screen->rows * screen->columns;
+
+  da_clear(&screen->output);
+  screen->row = -1;
+  screen->column = -1;
+  screen->attr = 0;
+  // Cells never drawn are not on the terminal: start from a blank one
+  if (count > 0 && screen->shown[0].size == 0) {
+    _screen_emit(screen, "\033[0m\033[2J", 8);
+    for (size_t i = 0; i < count; i++) {
+      screen->shown[i] = (s_cell){.bytes = " ", .size = 1};
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    s_cell *cell = screen->cells + i;
+    s_cell *shown = screen->shown + i;
+
+    if (cell->size == shown->size && cell->attr == shown->attr &&
+        memcmp(cell->bytes, shown->bytes, cell->size) == 0) {
+      continue;
+    }
+    _screen_move(screen, i / screen->columns, i % screen->columns);
+    _screen_emit_cell(screen, cell);
+    *shown = *cell;
+  }
+
+  if (screen->attr != 0) {
+    _screen_emit(screen, "\033[0m", 4);
+    screen->attr = 0;
+  }
+  return screen->output.count;
+}
+
+/**
+ * @brief Render the frame and write it with a single write
+ *
+ * @param screen the screen
+ * @param fd terminal (blocking)
+ * @return int 0 if success, -1 on error
+ */
+static inline int screen_flush(s_screen *screen, int fd) {
+  size_t size = screen_render(screen);
+  const char *data = screen->output.items;
+
+  screen->frames++;
+  while (size > 0) {
+    ssize_t writed = write(fd, data, size);
+
+    if (writed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (writed <= 0) {
+      return -1;
+    }
+    screen->writes++;
+    screen->bytes += writed;
+    data += writed;
+    size -= writed;
+  }
+  return 0;
+}
@@ -0,0 +1,387 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared-memory transport.
+//
+// A channel is a memfd holding a header and two single-producer
+// single-consumer byte rings: `to_server` (written by the client) and
+// `to_client` (written by the server). The client creates the channel and
+// sends the memfd and two eventfds to the server over a Unix socket with
+// SCM_RIGHTS (`shm_channel_send`), the server maps it (`shm_channel_attach`).
+//
+// The fast path needs no syscall: both sides spin on the rings. A side that
+// runs out of work for a while sets its `sleeping` flag and blocks on its
+// eventfd; after producing data or freeing space a side only writes the peer
+// eventfd if the peer flag is set (`shm_notify`). How long to spin adapts to
+// how fast the peer answers (`s_shm_spin`).
+//
+// Requires _GNU_SOURCE (memfd_create, file seals).
+
+#define SHM_MAGIC 0x314d48534f484345ull // "ECHOSHM1" (little endian)
+#define SHM_HEADER_SIZE 4096
+#define SHM_CACHE_LINE 64
+
+// Default size of each ring (power of two)
+#ifndef SHM_RING_SIZE
+#define SHM_RING_SIZE (256 * 1024)
+#endif
+
+// Largest ring accepted from a client
+#define SHM_MAX_RING_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+  _Alignas(SHM_CACHE_LINE) _Atomic uint64_t head; // bytes produced
+  _Alignas(SHM_CACHE_LINE) _Atomic uint64_t tail; // bytes consumed
+} s_shm_ring;
+
+typedef struct {
+  uint64_t magic;
+  uint64_t ring_size;
+  _Alignas(SHM_CACHE_LINE) _Atomic uint32_t server_sleeping;
+  _Alignas(SHM_CACHE_LINE) _Atomic uint32_t client_sleeping;
+  s_shm_ring to_server;
+  s_shm_ring to_client;
+} s_shm_header;
+
+typedef struct {
+  s_shm_header *header;
+  char *to_server; // data of the to_server ring
+  char *to_client; // data of the to_client ring
+  size_t ring_size; // validated copy (the header is writable by the peer)
+  size_t map_size;
+  int memfd;
+  int server_efd; // written to wake the server
+  int client_efd; // written to wake the client
+} s_shm_channel;
+
+// Adaptive spin budget: follows the time the peer takes to answer while it is
+// under `max_ns`, halves when the peer is slower (spinning would only burn CPU)
+typedef struct {
+  uint64_t spin_ns;
+  uint64_t max_ns;
+} s_shm_spin;
+
+_Static_assert(sizeof(s_shm_header) <= SHM_HEADER_SIZE,
+               "Shared memory header too large");
+
+/**
+ * @brief Get the number of bytes ready to be read from a ring (consumer)
+ *
+ */
+static inline size_t shm_ring_readable(s_shm_ring *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+/**
+ * @brief Get the number of bytes that can be written to a ring (producer)
+ *
+ */
+static inline size_t shm_ring_writable(s_shm_ring *ring, size_t size) {
+  uint64_t used = atomic_load_explicit(&ring->head, memory_order_relaxed) -
+                  atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  // A corrupted tail (written by the peer) must not overflow the ring
+  return used > size ? 0 : size - used;
+}
+
+/**
+ * @brief Write up to `len` bytes to a ring (producer)
+ *
+ * @return size_t number of bytes written
+ */
+static inline size_t shm_ring_write(s_shm_ring *ring, char *data, size_t size,
+                                    const void *buf, size_t len) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t offset = head & (size - 1);
+  size_t first;
+
+  if (len > shm_ring_writable(ring, size)) {
+    len = shm_ring_writable(ring, size);
+  }
+  first = len < size - offset ? len : size - offset;
+  memcpy(data + offset, buf, first);
+  memcpy(data, (const char *)buf + first, len - first);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  return len;
+}
+
+/**
+ * @brief Read up to `len` bytes from a ring (consumer)
+ *
+ * @return size_t number of bytes read
+ */
+static inline size_t shm_ring_read(s_shm_ring *ring, char *data, size_t size,
+                                   void *buf, size_t len) {
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t offset = tail & (size - 1);
+  size_t first;
+
+  if (len > shm_ring_readable(ring)) {
+    len = shm_ring_readable(ring);
+  }
+  if (len > size) {
+    len = size;
+  }
+  first = len < size - offset ? len : size - offset;
+  memcpy(buf, data + offset, first);
+  memcpy((char *)buf + first, data, len - first);
+  atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+  return len;
+}
+
+/**
+ * @brief Move bytes from one ring to another without an intermediate copy
+ * (consumer of `src`, producer of `dst`)
+ *
+ * @return size_t number of bytes moved
+ */
+static inline size_t shm_ring_transfer(s_shm_ring *src, char *src_data,
+                                       s_shm_ring *dst, char *dst_data,
+                                       size_t size) {
+  size_t moved = 0;
+
+  // At most two contiguous spans on the source side
+  for (int span = 0; span < 2; span++) {
+    uint64_t tail = atomic_load_explicit(&src->tail, memory_order_relaxed);
+    size_t offset = tail & (size - 1);
+    size_t len = shm_ring_readable(src);
+
+    if (len > size - offset) {
+      len = size - offset;
+    }
+    len = shm_ring_write(dst, dst_data, size, src_data + offset, len);
+    if (len == 0) {
+      break;
+    }
+    atomic_store_explicit(&src->tail, tail + len, memory_order_release);
+    moved += len;
+  }
+  return moved;
+}
+
+/**
+ * @brief Wake the peer if it is sleeping (after producing or consuming)
+ *
+ * @param sleeping the peer sleeping flag
+ * @param efd the peer eventfd
+ * @return bool true if the peer was woken up (a syscall was made)
+ */
+static inline bool shm_notify(_Atomic uint32_t *sleeping, int efd) {
+  uint64_t one = 1;
+
+  // Pairs with the fence of `shm_sleep_prepare`: either the peer sees our
+  // ring update, or we see its flag
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(sleeping, memory_order_relaxed)) {
+    return write(efd, &one, sizeof(one)) == sizeof(one);
+  }
+  return false;
+}
+
+/**
+ * @brief Announce that we are about to sleep
+ *
+ * The caller must check its rings again afterwards and only block on its
+ * eventfd if there is still nothing to do.
+ *
+ */
+static inline void shm_sleep_prepare(_Atomic uint32_t *sleeping) {
+  atomic_store_explicit(sleeping, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Clear the sleeping flag after waking up
+ *
+ */
+static inline void shm_sleep_done(_Atomic uint32_t *sleeping) {
+  atomic_store_explicit(sleeping, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Hint the CPU that we are spinning
+ *
+ */
+static inline void shm_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @brief Initialize a spin budget
+ *
+ * Spinning is disabled on a single CPU: the peer cannot run meanwhile.
+ *
+ * @param spin the spin budget
+ * @param max_ns longest spin in nanoseconds
+ */
+static inline void shm_spin_init(s_shm_spin *spin, uint64_t max_ns) {
+  spin->max_ns = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? max_ns : 0;
+  spin->spin_ns = spin->max_ns;
+}
+
+/**
+ * @brief Update a spin budget after a sleep
+ *
+ * @param spin the spin budget
+ * @param waited_ns time from the start of the spin to the wakeup
+ */
+static inline void shm_spin_update(s_shm_spin *spin, uint64_t waited_ns) {
+  if (waited_ns <= spin->max_ns) {
+    // Spinning a bit longer would have avoided the sleep
+    spin->spin_ns = 2 * waited_ns < spin->max_ns ? 2 * waited_ns : spin->max_ns;
+  } else {
+    spin->spin_ns /= 2;
+  }
+}
+
+// Map a channel memfd and set the ring pointers
+static inline int _shm_channel_map(s_shm_channel *channel, size_t size) {
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   channel->memfd, 0);
+  if (mem == MAP_FAILED) {
+    return -1;
+  }
+  channel->header = mem;
+  channel->map_size = size;
+  channel->to_server = (char *)mem + SHM_HEADER_SIZE;
+  channel->to_client = channel->to_server + (size - SHM_HEADER_SIZE) / 2;
+  return 0;
+}
+
+/**
+ * @brief Close a channel (unmap and close its file descriptors)
+ *
+ */
+static inline void shm_channel_close(s_shm_channel *channel) {
+  if (channel->header != NULL) {
+    munmap(channel->header, channel->map_size);
+  }
+  if (channel->memfd != -1)
+    close(channel->memfd);
+  if (channel->server_efd != -1)
+    close(channel->server_efd);
+  if (channel->client_efd != -1)
+    close(channel->client_efd);
+  channel->header = NULL;
+  channel->memfd = channel->server_efd = channel->client_efd = -1;
+}
+
+/**
+ * @brief Create a channel (client side)
+ *
+ * @param channel the channel
+ * @param ring_size size of each ring (power of two)
+ * @return int 0 if success, -1 on error (errno is set)
+ */
+static inline int shm_channel_create(s_shm_channel *channel,
+                                     size_t ring_size) {
+  size_t size = SHM_HEADER_SIZE + 2 * ring_size;
+
+  *channel = (s_shm_channel){0};
+  channel->memfd = channel->server_efd = channel->client_efd = -1;
+  if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  channel->memfd = memfd_create("echo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  channel->server_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  channel->client_efd = eventfd(0, EFD_CLOEXEC);
+  if (channel->memfd == -1 || channel->server_efd == -1 ||
+      channel->client_efd == -1 || ftruncate(channel->memfd, size) != 0 ||
+      _shm_channel_map(channel, size) != 0) {
+    int saved = errno;
+    shm_channel_close(channel);
+    errno = saved;
+    return -1;
+  }
+
+  channel->header->magic = SHM_MAGIC;
+  channel->header->ring_size = ring_size;
+  channel->ring_size = ring_size;
+  return 0;
+}
+
+/**
+ * @brief Send a channel to the server (client side)
+ *
+ * Sends one byte carrying the memfd and the two eventfds.
+ *
+ * @return int 0 if success, -1 on error
+ */
+static inline int shm_channel_send(int sock, s_shm_channel *channel) {
+  int fds[3] = {channel->memfd, channel->server_efd, channel->client_efd};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = "S", .iov_len = 1};
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Attach a channel received from a client (server side)
+ *
+ * The memfd is sealed against resizing so the client cannot make the server
+ * fault by shrinking it, and its layout is validated. Takes ownership of the
+ * file descriptors, even on error.
+ *
+ * @param channel the channel
+ * @param fds memfd, server eventfd, client eventfd
+ * @return int 0 if success, -1 on error
+ */
+static inline int shm_channel_attach(s_shm_channel *channel, int fds[3]) {
+  struct stat st;
+  uint64_t ring_size;
+
+  *channel = (s_shm_channel){0};
+  channel->memfd = fds[0];
+  channel->server_efd = fds[1];
+  channel->client_efd = fds[2];
+
+  if (fcntl(channel->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0 ||
+      fstat(channel->memfd, &st) != 0 || st.st_size <= SHM_HEADER_SIZE ||
+      _shm_channel_map(channel, st.st_size) != 0) {
+    shm_channel_close(channel);
+    return -1;
+  }
+
+  ring_size = channel->header->ring_size;
+  if (channel->header->magic != SHM_MAGIC || ring_size == 0 ||
+      (ring_size & (ring_size - 1)) != 0 || ring_size > SHM_MAX_RING_SIZE ||
+      (uint64_t)st.st_size != SHM_HEADER_SIZE + 2 * ring_size) {
+    shm_channel_close(channel);
+    return -1;
+  }
+  channel->ring_size = ring_size;
+  return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Lock-free statistics.
+//
+// Every counter has a single writer (the thread owning the data it counts), so
+// updates are a relaxed load and store: no locked instruction on the data
+// path. Any other thread may read them at any time without tearing, which is
+// what the exporters below do. Values read by an exporter may be slightly out
+// of sync with each other, never torn.
+
+// Number of finite buckets of a histogram (bucket `i` counts values <= 2^i)
+#ifndef STATS_BUCKETS
+#define STATS_BUCKETS 32
+#endif
+
+typedef struct {
+  _Atomic uint64_t value;
+} s_counter;
+
+typedef struct {
+  _Atomic uint64_t buckets[STATS_BUCKETS + 1]; // last one is +Inf
+  _Atomic uint64_t sum;
+} s_histogram;
+
+// Add to a value with a single writer
+static inline void _stats_add(_Atomic uint64_t *value, uint64_t n) {
+  atomic_store_explicit(
+      value, atomic_load_explicit(value, memory_order_relaxed) + n,
+      memory_order_relaxed);
+}
+
+/**
+ * @brief Add to a counter (single writer)
+ *
+ */
+static inline void counter_add(s_counter *counter, uint64_t n) {
+  _stats_add(&counter->value, n);
+}
+
+/**
+ * @brief Set a counter, used as gauge (single writer)
+ *
+ */
+static inline void counter_set(s_counter *counter, uint64_t value) {
+  atomic_store_explicit(&counter->value, value, memory_order_relaxed);
+}
+
+/**
+ * @brief Read a counter (any thread)
+ *
+ */
+static inline uint64_t counter_get(s_counter *counter) {
+  return atomic_load_explicit(&counter->value, memory_order_relaxed);
+}
+
+/**
+ * @brief Record a value in a log2 histogram (single writer)
+ *
+ */
+static inline void histogram_record(s_histogram *histogram, uint64_t value) {
+  // Smallest i such as value <= 2^i (Prometheus buckets are inclusive)
+  unsigned bucket = value > 1 ? 64 - __builtin_clzll(value - 1) : 0;
+
+  if (bucket > STATS_BUCKETS) {
+    bucket = STATS_BUCKETS;
+  }
+  _stats_add(&histogram->buckets[bucket], 1);
+  _stats_add(&histogram->sum, value);
+}
+
+/**
+ * @brief Add the values of a histogram to a private one (e.g. to export the
+ * sum of per-thread histograms)
+ *
+ */
+static inline void histogram_merge(s_histogram *dst, s_histogram *src) {
+  for (unsigned i = 0; i <= STATS_BUCKETS; i++) {
+    _stats_add(&dst->buckets[i], atomic_load_explicit(&src->buckets[i],
+                                                      memory_order_relaxed));
+  }
+  _stats_add(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed));
+}
+
+/**
+ * @brief Print a metric in the Prometheus text format
+ *
+ * @param file output file
+ * @param name metric name
+ * @param type metric type (counter or gauge)
+ * @param help metric description
+ * @param value metric value
+ */
+static inline void metric_print(FILE *file, const char *name, const char *type,
+                                const char *help, double value) {
+  fprintf(file, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name,
+          type, name, value);
+}
+
+/**
+ * @brief Print a histogram in the Prometheus text format
+ *
+ * @param file output file
+ * @param name metric name
+ * @param help metric description
+ * @param histogram the histogram
+ * @param scale multiplier from the recorded unit to the exported one
+ * @param buckets number of finite buckets to export (larger values are only
+ * counted in +Inf)
+ */
+static inline void histogram_print(FILE *file, const char *name,
+                                   const char *help, s_histogram *histogram,
+                                   double scale, unsigned buckets) {
+  uint64_t cumulative = 0;
+
+  if (buckets > STATS_BUCKETS) {
+    buckets = STATS_BUCKETS;
+  }
+
+  fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (unsigned i = 0; i <= STATS_BUCKETS; i++) {
+    cumulative +=
+        atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    if (i < buckets) {
+      fprintf(file, "%s_bucket{le=\"%.10g\"} %llu\n", name,
+              (double)(1ull << i) * scale, (unsigned long long)cumulative);
+    }
+  }
+  fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+          (unsigned long long)cumulative);
+  fprintf(file, "%s_sum %.10g\n", name,
+          (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) *
+              scale);
+  // The count is the +Inf bucket so the exported buckets stay consistent
+  fprintf(file, "%s_count %llu\n", name, (unsigned long long)cumulative);
+}
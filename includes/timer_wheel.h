@@ -0,0 +1,308 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel.
+//
+// Time is counted in ticks of `tick_ms` milliseconds. Each level has
+// TW_SLOTS slots, a slot of level `l` covers TW_SLOTS^l ticks. A timer is
+// stored in the lowest level that can represent its distance to the current
+// tick, and is cascaded to the lower levels as the wheel turns. Add and delete
+// are O(1), advancing is O(1) per tick and O(levels) to find the next expiry.
+//
+// Timers are intrusive: embed a `s_tw_timer` in the owning object and use
+// `tw_entry` to get back to it from the expire callback.
+
+// Number of bits per level (64 slots)
+#ifndef TW_SLOT_BITS
+#define TW_SLOT_BITS 6
+#endif
+
+// Number of levels (64^4 ticks, ~46 hours with 10ms ticks)
+#ifndef TW_LEVELS
+#define TW_LEVELS 4
+#endif
+
+#define TW_SLOTS (1u << TW_SLOT_BITS)
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+#define TW_MAX_TICKS ((1ull << (TW_SLOT_BITS * TW_LEVELS)) - 1)
+
+// Get the object embedding a timer
+#define tw_entry(timer, type, member)                                          \
+  ((type *)((char *)(timer) - offsetof(type, member)))
+
+typedef struct s_tw_timer {
+  struct s_tw_timer *next;
+  struct s_tw_timer **pprev; // NULL when the timer is not pending
+  uint64_t expires;          // expiry tick
+  uint16_t bucket;           // level * TW_SLOTS + slot
+} s_tw_timer;
+
+typedef struct {
+  uint64_t base_ms; // time of tick 0
+  uint64_t now;     // last processed tick
+  unsigned tick_ms;
+  size_t count;
+  uint64_t occupied[TW_LEVELS]; // non-empty slots bitmap per level
+  s_tw_timer *slots[TW_LEVELS][TW_SLOTS];
+} s_tw_wheel;
+
+typedef void (*tw_expire_fn)(s_tw_timer *timer, void *arg);
+
+#if TW_SLOTS != 64
+#error "TW_SLOT_BITS must be 6 (slot bitmaps are 64 bits wide)"
+#endif
+
+/**
+ * @brief Initialize the wheel
+ *
+ * @param wheel the wheel
+ * @param now_ms current time in milliseconds
+ * @param tick_ms resolution of the wheel in milliseconds
+ */
+static inline void tw_init(s_tw_wheel *wheel, uint64_t now_ms,
+                           unsigned tick_ms) {
+  *wheel = (s_tw_wheel){0};
+  wheel->base_ms = now_ms;
+  wheel->tick_ms = tick_ms ? tick_ms : 1;
+}
+
+/**
+ * @brief Check if a timer is armed
+ *
+ */
+static inline bool tw_pending(const s_tw_timer *timer) {
+  return timer->pprev != NULL;
+}
+
+// Link a timer in the bucket matching its expiry tick (expires >= now)
+static inline void _tw_link(s_tw_wheel *wheel, s_tw_timer *timer) {
+  uint64_t delta = timer->expires - wheel->now;
+  unsigned level = 0;
+  unsigned slot;
+  s_tw_timer **head;
+
+  while (level < TW_LEVELS - 1 &&
+         delta >= (1ull << (TW_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  slot = (timer->expires >> (TW_SLOT_BITS * level)) & TW_SLOT_MASK;
+
+  head = &wheel->slots[level][slot];
+  timer->next = *head;
+  if (*head != NULL) {
+    (*head)->pprev = &timer->next;
+  }
+  *head = timer;
+  timer->pprev = head;
+  timer->bucket = level * TW_SLOTS + slot;
+  wheel->occupied[level] |= 1ull << slot;
+}
+
+// Unlink a pending timer
+static inline void _tw_unlink(s_tw_wheel *wheel, s_tw_timer *timer) {
+  unsigned level = timer->bucket / TW_SLOTS;
+  unsigned slot = timer->bucket % TW_SLOTS;
+
+  *timer->pprev = timer->next;
+  if (timer->next != NULL) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+  if (wheel->slots[level][slot] == NULL) {
+    wheel->occupied[level] &= ~(1ull << slot);
+  }
+}
+
+/**
+ * @brief Arm a timer (the timer must not be pending)
+ *
+ * Expiries in the past fire on the next advance, expiries beyond the range of
+ * the wheel are clamped to its range.
+ *
+ * @param wheel the wheel
+ * @param timer the timer
+ * @param expires_ms absolute expiry time in milliseconds
+ */
+static inline void tw_add(s_tw_wheel *wheel, s_tw_timer *timer,
+                          uint64_t expires_ms) {
+  uint64_t expires = 0;
+
+  if (expires_ms > wheel->base_ms) {
+    // Round up so a timer never fires before its expiry time
+    expires = (expires_ms - wheel->base_ms + wheel->tick_ms - 1) /
+              wheel->tick_ms;
+  }
+  if (expires <= wheel->now) {
+    expires = wheel->now + 1;
+  } else if (expires - wheel->now > TW_MAX_TICKS) {
+    expires = wheel->now + TW_MAX_TICKS;
+  }
+
+  timer->expires = expires;
+  _tw_link(wheel, timer);
+  wheel->count++;
+}
+
+/**
+ * @brief Disarm a timer (no-op if the timer is not pending)
+ *
+ */
+static inline void tw_del(s_tw_wheel *wheel, s_tw_timer *timer) {
+  if (!tw_pending(timer)) {
+    return;
+  }
+  _tw_unlink(wheel, timer);
+  wheel->count--;
+}
+
+/**
+ * @brief Re-arm a timer, pending or not
+ *
+ */
+static inline void tw_mod(s_tw_wheel *wheel, s_tw_timer *timer,
+                          uint64_t expires_ms) {
+  tw_del(wheel, timer);
+  tw_add(wheel, timer, expires_ms);
+}
+
+/**
+ * @brief Get the expiry time of a pending timer in milliseconds
+ *
+ */
+static inline uint64_t tw_expires_ms(const s_tw_wheel *wheel,
+                                     const s_tw_timer *timer) {
+  return wheel->base_ms + timer->expires * wheel->tick_ms;
+}
+
+// Move the timers of a higher level slot to the lower levels
+static inline void _tw_cascade(s_tw_wheel *wheel, unsigned level,
+                               unsigned slot) {
+  s_tw_timer *timer = wheel->slots[level][slot];
+
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~(1ull << slot);
+  while (timer != NULL) {
+    s_tw_timer *next = timer->next;
+    _tw_link(wheel, timer);
+    timer = next;
+  }
+}
+
+/**
+ * @brief Get the number of ticks until the wheel next needs to be advanced
+ *
+ * For level 0 this is the exact expiry of the next timer, for the higher
+ * levels it is the next cascade of a non-empty slot (a lower bound).
+ *
+ * @return int64_t number of ticks, -1 if no timer is pending
+ */
+static inline int64_t tw_next_ticks(const s_tw_wheel *wheel) {
+  int64_t best = -1;
+
+  if (wheel->count == 0) {
+    return -1;
+  }
+
+  for (unsigned level = 0; level < TW_LEVELS; level++) {
+    uint64_t bits = wheel->occupied[level];
+    unsigned shift = TW_SLOT_BITS * level;
+    unsigned current = (wheel->now >> shift) & TW_SLOT_MASK;
+    unsigned rotate = (current + 1) & TW_SLOT_MASK;
+    uint64_t distance; // in slots of this level, 1..TW_SLOTS
+    uint64_t ticks;
+
+    if (bits == 0) {
+      continue;
+    }
+    // Rotate so bit 0 is the slot following the current one
+    bits = rotate ? (bits >> rotate) | (bits << (TW_SLOTS - rotate)) : bits;
+    distance = (uint64_t)__builtin_ctzll(bits) + 1;
+
+    // First tick of the slot `distance` slots ahead on this level
+    ticks = (((wheel->now >> shift) + distance) << shift) - wheel->now;
+    if (best == -1 || ticks < (uint64_t)best) {
+      best = (int64_t)ticks;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * @brief Advance the wheel up to the given time, calling `expire` for each
+ * expired timer
+ *
+ * The timer is disarmed before the callback runs, the callback may re-arm it
+ * or delete any other timer.
+ *
+ * @return size_t number of expired timers
+ */
+static inline size_t tw_advance(s_tw_wheel *wheel, uint64_t now_ms,
+                                tw_expire_fn expire, void *arg) {
+  uint64_t target;
+  size_t expired = 0;
+
+  if (now_ms <= wheel->base_ms) {
+    return 0;
+  }
+  target = (now_ms - wheel->base_ms) / wheel->tick_ms;
+
+  while (wheel->now < target) {
+    int64_t next = tw_next_ticks(wheel);
+    unsigned slot;
+
+    // Skip the ticks with nothing to fire or cascade
+    if (next == -1 || wheel->now + (uint64_t)next > target) {
+      wheel->now = target;
+      break;
+    }
+
+    wheel->now += (uint64_t)next;
+    slot = wheel->now & TW_SLOT_MASK;
+
+    // Cascade the higher levels when the lower ones wrap around
+    for (unsigned level = 1; level < TW_LEVELS; level++) {
+      uint64_t shift = TW_SLOT_BITS * level;
+      if ((wheel->now & ((1ull << shift) - 1)) != 0) {
+        break;
+      }
+      _tw_cascade(wheel, level, (wheel->now >> shift) & TW_SLOT_MASK);
+    }
+
+    while (wheel->slots[0][slot] != NULL) {
+      s_tw_timer *timer = wheel->slots[0][slot];
+      _tw_unlink(wheel, timer);
+      wheel->count--;
+      expired++;
+      expire(timer, arg);
+    }
+  }
+
+  return expired;
+}
+
+/**
+ * @brief Get the timeout to wait for before the next advance (poll timeout)
+ *
+ * @param wheel the wheel
+ * @param now_ms current time in milliseconds
+ * @return int timeout in milliseconds, -1 if no timer is pending
+ */
+static inline int tw_next_timeout(const s_tw_wheel *wheel, uint64_t now_ms) {
+  int64_t ticks = tw_next_ticks(wheel);
+  uint64_t deadline_ms;
+
+  if (ticks == -1) {
+    return -1;
+  }
+  deadline_ms = wheel->base_ms + (wheel->now + ticks) * wheel->tick_ms;
+  if (deadline_ms <= now_ms) {
+    return 0;
+  }
+  if (deadline_ms - now_ms > INT32_MAX) {
+    return INT32_MAX;
+  }
+  return (int)(deadline_ms - now_ms);
+}
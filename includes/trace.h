@@ -0,0 +1,94 @@
+// Static user-level tracepoints (USDT).
+//
+// Each probe is a single `nop` in the code plus an ELF note (.note.stapsdt)
+// describing its location and arguments, which bpftrace, perf and SystemTap
+// use to attach to the running binary:
+//
+//   bpftrace -e 'usdt:./build/echo:echo:read { @[arg0] = sum(arg1); }'
+//   perf buildid-cache --add ./build/echo && perf list sdt_echo:*
+//
+// `sys/sdt.h` (systemtap-sdt-dev) is used when available, otherwise an
+// equivalent note is emitted on x86_64. Defining `_NO_TRACE` (or building for
+// another architecture without `sys/sdt.h`) compiles the probes to nothing.
+// Arguments are always evaluated when probes are enabled, keep them cheap.
+
+#if !defined(_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define _TRACE_SDT
+#elif defined(__x86_64__) && defined(__GNUC__)
+#define _TRACE_ASM
+#endif
+#endif
+
+#if defined(_TRACE_SDT)
+
+#define TRACE_PROBE0(provider, name) STAP_PROBE(provider, name)
+#define TRACE_PROBE1(provider, name, a) STAP_PROBE1(provider, name, a)
+#define TRACE_PROBE2(provider, name, a, b) STAP_PROBE2(provider, name, a, b)
+#define TRACE_PROBE3(provider, name, a, b, c)                                  \
+  STAP_PROBE3(provider, name, a, b, c)
+
+#elif defined(_TRACE_ASM)
+
+// Arguments are passed as signed 64 bits values (-8@operand)
+#define _TRACE_ARGS0 ""
+#define _TRACE_ARGS1 "-8@%0"
+#define _TRACE_ARGS2 "-8@%0 -8@%1"
+#define _TRACE_ARGS3 "-8@%0 -8@%1 -8@%2"
+
+// Same layout as the notes of sys/sdt.h (note type 3, semaphore-less)
+#define _TRACE_NOTE(provider, name, args)                                      \
+  "990: nop\n"                                                                 \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                \
+  ".balign 4\n"                                                                \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                           \
+  "991: .asciz \"stapsdt\"\n"                                                  \
+  "992: .balign 4\n"                                                           \
+  "993: .8byte 990b\n"                                                         \
+  ".8byte _.stapsdt.base\n"                                                    \
+  ".8byte 0\n"                                                                 \
+  ".asciz \"" #provider "\"\n"                                                 \
+  ".asciz \"" #name "\"\n"                                                     \
+  ".asciz \"" args "\"\n"                                                      \
+  "994: .balign 4\n"                                                           \
+  ".popsection\n"                                                              \
+  ".ifndef _.stapsdt.base\n"                                                   \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"      \
+  ".weak _.stapsdt.base\n"                                                     \
+  ".hidden _.stapsdt.base\n"                                                   \
+  "_.stapsdt.base: .space 1\n"                                                 \
+  ".size _.stapsdt.base, 1\n"                                                  \
+  ".popsection\n"                                                              \
+  ".endif\n"
+
+#define TRACE_PROBE0(provider, name)                                           \
+  __asm__ __volatile__(_TRACE_NOTE(provider, name, _TRACE_ARGS0)::)
+#define TRACE_PROBE1(provider, name, a)                                        \
+  __asm__ __volatile__(_TRACE_NOTE(provider, name, _TRACE_ARGS1)::"nor"(       \
+      (long)(a)))
+#define TRACE_PROBE2(provider, name, a, b)                                     \
+  __asm__ __volatile__(_TRACE_NOTE(provider, name, _TRACE_ARGS2)::"nor"(       \
+                           (long)(a)),                                         \
+                       "nor"((long)(b)))
+#define TRACE_PROBE3(provider, name, a, b, c)                                  \
+  __asm__ __volatile__(_TRACE_NOTE(provider, name, _TRACE_ARGS3)::"nor"(       \
+                           (long)(a)),                                         \
+                       "nor"((long)(b)), "nor"((long)(c)))
+
+#else
+
+#define TRACE_PROBE0(provider, name)                                           \
+  do {                                                                         \
+  } while (0)
+#define TRACE_PROBE1(provider, name, a)                                        \
+  do {                                                                         \
+  } while (0)
+#define TRACE_PROBE2(provider, name, a, b)                                     \
+  do {                                                                         \
+  } while (0)
+#define TRACE_PROBE3(provider, name, a, b, c)                                  \
+  do {                                                                         \
+  } while (0)
+
+#endif
@@ -1,15 +1,33 @@
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../includes/array.h"
+#include "../includes/crc32c.h"
+#include "../includes/gap_buffer.h"
+#include "../includes/input_decoder.h"
+#include "../includes/line_ring.h"
+#include "../includes/screen.h"
 
 #define _DEBUG
 
@@ -20,67 +38,102 @@
 #endif
 
 #ifdef _UNDERLINE
-#define CURSOR_SET_MODE "\033[4m"    // Invert background and foreground
-#define CURSOR_RESET_MODE "\033[24m" // Reset all attributes
+#define CURSOR_ATTR SCREEN_UNDERLINE // Underline the cursor cell
 #else
-#define CURSOR_SET_MODE "\033[7m"    // Invert background and foreground
-#define CURSOR_RESET_MODE "\033[27m" // Reset all attributes
+#define CURSOR_ATTR SCREEN_INVERSE // Invert background and foreground
 #endif
 #define RESET_ANSI "\033[0m"
 
 #define FETCH_CURSOR_POSITION "\033[6n"
 
-#define set_multichar_buffer(buffer, index, car)                               \
-  do {                                                                         \
-    for (size_t __multichar_idx = 0; __multichar_idx < (sizeof((car)) - 1);    \
-         __multichar_idx++)                                                    \
-      (buffer)[(sizeof((car)) - 1) * (index) + __multichar_idx] =              \
-          (car)[__multichar_idx];                                              \
-  } while (0)
-
-typedef struct s_user_input {
-  da_struct(char) size_t cursor_position;
-} t_user_input;
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "5000"
+#define RECV_BUFFER_SIZE 4096
+// Terminal bytes read at once: a whole burst of keys or a paste chunk
+#define INPUT_BUFFER_SIZE 4096
+// Scrollback bounds (the pages are only used once written)
+#define HISTORY_BYTES (64 * 1024 * 1024)
+#define HISTORY_LINES (4 * 1024 * 1024)
+// Bounds of the lines sent, recalled with up and down
+#define INPUTS_BYTES (1024 * 1024)
+#define INPUTS_LINES (16 * 1024)
+
+// Headless mode: bytes sent and not echoed yet at most, size of the send and
+// receive buffers, longest wait without any progress (milliseconds)
+#define HEADLESS_WINDOW (1024 * 1024)
+#define HEADLESS_BUFFER (256 * 1024)
+#define HEADLESS_STALL_TIMEOUT 10000
+
+typedef struct s_buffer {
+  da_struct(char)
+} t_buffer;
+
+typedef struct s_timestamps {
+  da_struct(uint64_t) size_t head; // oldest entry still in use
+} t_timestamps;
+
+typedef struct s_connection {
+  const char *host;
+  const char *port;
+  int fd;             // -1 once disconnected
+  t_buffer out;       // bytes not sent yet (from out_offset)
+  size_t out_offset;  // bytes of out already sent
+  t_buffer in;        // received bytes of an incomplete line
+  t_timestamps sent;  // send time of the lines waiting for their echo
+  uint64_t rtt_last;  // round trips in nanoseconds
+  uint64_t rtt_min;
+  uint64_t rtt_max;
+  uint64_t rtt_sum;
+  uint64_t rtt_count;
+} t_connection;
 
 typedef struct s_app {
   int width;
   int heigth;
   struct termios original_settings;
-  t_user_input user_input;
+  s_input_decoder decoder; // keys split across reads
+  uint64_t input_ns;        // time of the last terminal read
+  s_gap_buffer user_input; // line being edited, gap at the cursor
+  s_line_ring inputs;      // lines sent
+  uint64_t recall;         // input recalled, `inputs.end` for a new line
+  t_buffer draft;          // new line, kept while recalling
+  s_line_ring history;     // scrollback
+  size_t scroll;           // scrollback lines below the view
+  t_buffer line;           // line formatted by add_history
+  t_connection connection;
+  s_screen screen; // frame drawn by the display functions
 } t_app;
 
-typedef enum __attribute__((__packed__)) e_input_type {
-  INPUT_TYPE_KEY,
-  INPUT_TYPE_ESC,       // 1b
-  INPUT_TYPE_ARROW,     //
-                        // UP 1b 5b 41
-                        // DOWN 1b 5b 42
-                        // RIGHT 1b 5b 43
-                        // LEFT 1b 5b 44
-  INPUT_TYPE_ENTER,     // a
-  INPUT_TYPE_BACKSPACE, // 7f
-  INPUT_TYPE_DELETE,    // 1b 5b 33 7e
-  INPUT_TYPE_CTRL_C,    // 3
-  INPUT_TYPE_BEGIN,     // 1b 5b 48 | 1
-  INPUT_TYPE_END,       // 1b 5b 46 | 5
-  INPUT_TYPE_CLEAR,     // 0c
-  INPUT_TYPE_UNKNOWN
-} t_input_type;
-
-typedef enum __attribute__((__packed__)) e_arrow_key {
-  ARROW_UP,
-  ARROW_DOWN,
-  ARROW_RIGHT,
-  ARROW_LEFT
-} t_arrow_key;
-
-typedef struct s_input {
-  t_input_type type;
-  union {
-    char key;
-    t_arrow_key arrow;
-  };
-} t_input;
+typedef struct s_options {
+  const char *host;
+  const char *port;
+  const char *file; // headless: stream this file
+  uint64_t bytes;   // headless: stream this many generated bytes
+  bool headless;
+  bool sendfile; // send the file with sendfile(2)
+  size_t window;
+  size_t buffer;
+} t_options;
+
+typedef struct s_stream {
+  int fd;              // socket
+  int file;            // input file, -1 for a generated payload
+  bool sendfile;
+  uint64_t total;      // bytes to stream
+  uint64_t loaded;     // payload bytes loaded into out
+  uint64_t sent;
+  uint64_t received;
+  size_t window;
+  size_t buffer;       // size of out and in
+  char *out;           // chunk of payload being sent
+  size_t out_size;
+  size_t out_offset;   // bytes of out already sent
+  char *in;
+  uint32_t crc_sent;
+  uint32_t crc_received;
+  uint64_t start_ns;
+  uint64_t first_ns;   // first byte echoed, 0 before
+} t_stream;
 
 typedef struct s_cursor_position {
   int row;
@@ -92,8 +145,6 @@ struct termios *original_settings = NULL;
 inline void set_cursor(bool mode) { puts(mode ? "\033[?25h" : "\033[?25l"); }
 
 inline void clear() { puts("\033[2J"); }
-inline void clear_line() { puts("\033[2K"); }
-inline void set_cursor_position(int x, int y) { printf("\033[%d;%dH", x, y); }
 
 t_cursor_position get_cursor() {
   t_cursor_position cursor = {0};
@@ -116,16 +167,68 @@ t_cursor_position get_cursor() {
 }
 
 /**
- * @brief Return a buffer that set the cursor position
+ * @brief Current monotonic time
  *
- * @param x column cursor position (start at 1)
- * @param y width cursor position (start at 1)
- * @return char* the buffer (static)
+ * @return uint64_t time in nanoseconds
  */
-char *str_cursor_position(int x, int y) {
-  static char buffer[30];
-  snprintf(buffer, sizeof(buffer), "\033[%d;%dH", x, y);
-  return buffer;
+uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Connect to the echo server
+ *
+ * The connection is made before the terminal is switched to raw mode, then
+ * the socket is set non blocking for the event loop.
+ *
+ * @param connection The connection, with its host and port set
+ * @return int 0 if success, -1 on error
+ */
+int connect_server(t_connection *connection) {
+  struct addrinfo hints = {0};
+  struct addrinfo *result;
+  struct addrinfo *addr;
+  int status;
+  int fd = -1;
+  int flag = 1;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  status = getaddrinfo(connection->host, connection->port, &hints, &result);
+  if (status != 0) {
+    fprintf(stderr, "Error getaddrinfo failed: %s\n", gai_strerror(status));
+    return -1;
+  }
+  for (addr = result; addr != NULL; addr = addr->ai_next) {
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1) {
+      continue;
+    }
+    if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd == -1) {
+    fprintf(stderr, "Error connect to %s:%s failed: %s\n", connection->host,
+            connection->port, strerror(errno));
+    return -1;
+  }
+
+  // Every line is sent as soon as it is typed: do not wait to fill a segment
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+    fprintf(stderr, "Error fcntl failed: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  connection->fd = fd;
+  return 0;
 }
 
 /**
@@ -145,6 +248,8 @@ void set_terminal_mode(struct termios *original_settings) {
   tcsetattr(STDIN_FILENO, TCSANOW, &new_settings);
   // Hide cursor
   set_cursor(false);
+  // Pastes come between brackets instead of as typed keys
+  printf(INPUT_PASTE_ON);
   // Clear terminal
   clear();
 }
@@ -161,6 +266,7 @@ void restore_terminal_mode(struct termios *original_settings) {
   tcsetattr(STDIN_FILENO, TCSANOW, original_settings);
   // Show cursor
   set_cursor(true);
+  printf(INPUT_PASTE_OFF);
   puts(RESET_ANSI); // Reset all attributes
   // Clear terminal
   // clear();
@@ -213,43 +319,34 @@ void register_signal() {
 }
 
 /**
- * @brief Display the application layout to the terminal
+ * @brief Draw the application layout
  *
  * @param app The application object
  */
 void display_app(t_app *app) {
-  char *line_buffer;
+  s_screen *screen = &app->screen;
   int width = app->width;
   int heigth = app->heigth;
 
-  // Draw the top border
-  line_buffer = malloc(3 * width + 1);
-
-  for (size_t i = 1; i < width - 1; i++) {
-    set_multichar_buffer(line_buffer, i, "─");
-  }
-  set_multichar_buffer(line_buffer, 0, "┌");
-  set_multichar_buffer(line_buffer, width - 1, "┐");
-  line_buffer[3 * width] = '\0';
-
-  printf("%s%s", str_cursor_position(1, 1), line_buffer);
+  screen_put(screen, 0, 0, "┌", 3, 0);
+  screen_fill(screen, 0, 1, width - 2, "─", 0);
+  screen_put(screen, 0, width - 1, "┐", 3, 0);
 
-  for (size_t i = 1; i < heigth - 3; i++) {
-    printf("%s│", str_cursor_position(i + 1, width));
-    printf("%s│", str_cursor_position(i + 1, 1));
+  for (int i = 1; i < heigth - 3; i++) {
+    screen_put(screen, i, 0, "│", 3, 0);
+    screen_put(screen, i, width - 1, "│", 3, 0);
   }
 
-  set_multichar_buffer(line_buffer, 0, "├");
-  set_multichar_buffer(line_buffer, width - 1, "┤");
-  printf("%s%s", str_cursor_position(heigth - 2, 1), line_buffer);
+  screen_put(screen, heigth - 3, 0, "├", 3, 0);
+  screen_fill(screen, heigth - 3, 1, width - 2, "─", 0);
+  screen_put(screen, heigth - 3, width - 1, "┤", 3, 0);
 
-  printf("%s│", str_cursor_position(heigth - 1, 1));
-  printf("%s│", str_cursor_position(heigth - 1, width));
+  screen_put(screen, heigth - 2, 0, "│", 3, 0);
+  screen_put(screen, heigth - 2, width - 1, "│", 3, 0);
 
-  set_multichar_buffer(line_buffer, 0, "└");
-  set_multichar_buffer(line_buffer, width - 1, "┘");
-  printf("%s%s", str_cursor_position(heigth, 1), line_buffer);
-  free(line_buffer);
+  screen_put(screen, heigth - 1, 0, "└", 3, 0);
+  screen_fill(screen, heigth - 1, 1, width - 2, "─", 0);
+  screen_put(screen, heigth - 1, width - 1, "┘", 3, 0);
 }
 
 /**
@@ -263,11 +360,15 @@ void init_app(t_app *app) {
   ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
   app->width = w.ws_col;
   app->heigth = w.ws_row;
-  da_init_with_capacity(&app->user_input, sizeof(char) * app->width);
-  app->user_input.cursor_position = 0;
+  input_decoder_init(&app->decoder);
+  gap_init(&app->user_input);
+  gap_reserve(&app->user_input, app->width);
+  line_ring_init(&app->history, HISTORY_BYTES, HISTORY_LINES);
+  line_ring_init(&app->inputs, INPUTS_BYTES, INPUTS_LINES);
+  screen_init(&app->screen, app->heigth, app->width);
   set_terminal_mode(&app->original_settings);
   original_settings = &app->original_settings;
-  display_app(app);
+  fflush(stdout);
 }
 
 /**
@@ -276,52 +377,369 @@ void init_app(t_app *app) {
  * @param app The application object
  */
 void deinit_app(t_app *app) {
-  da_free(&app->user_input);
+  t_connection *connection = &app->connection;
+
+  if (connection->fd != -1) {
+    close(connection->fd);
+    connection->fd = -1;
+  }
+  da_free(&connection->out);
+  da_free(&connection->in);
+  da_free(&connection->sent);
+  line_ring_free(&app->history);
+  line_ring_free(&app->inputs);
+  da_free(&app->line);
+  da_free(&app->draft);
+  gap_free(&app->user_input);
+  input_decoder_free(&app->decoder);
+  screen_free(&app->screen);
   restore_terminal_mode(&app->original_settings);
 
   original_settings = NULL;
 }
 
 /**
- * @brief Display the input message to the terminal
+ * @brief Draw the input line, scrolled to keep the cursor visible
  *
  * @param app The application object
- * @param input The input message to display
- * @param input_len The length of the input message
  */
 void display_input(t_app *app) {
-  int width = app->width;
-  int heigth = app->heigth;
-  int input_len =
-      app->user_input.count > width - 3 ? width - 3 : app->user_input.count;
-  int cursor_position = app->user_input.cursor_position;
+  s_screen *screen = &app->screen;
+  int row = app->heigth - 2;
+  // Between "│ > " and the right border
+  int visible = app->width - 5;
+  size_t before_size;
+  size_t after_size;
+  const char *before = gap_before(&app->user_input, &before_size);
+  const char *after = gap_after(&app->user_input, &after_size);
+  int column = 4;
+
+  if (visible <= 0) {
+    return;
+  }
 
-  // Draw the message
-  set_cursor_position(heigth - 1, 2);
-  clear_line();
+  // The cursor is the gap: the end of the text before it is visible, the
+  // cursor cell is the start of the text after it
+  if (before_size >= visible) {
+    before += before_size - visible + 1;
+    before_size = visible - 1;
+  }
+  screen_put(screen, row, 1, " > ", 3, 0);
+  column += screen_put(screen, row, column, before, before_size, 0);
+  if (after_size > 0) {
+    screen_put(screen, row, column, after, 1, CURSOR_ATTR);
+  } else {
+    screen_put(screen, row, column, " ", 1, CURSOR_ATTR);
+  }
+  column++;
+  if (after_size > 1) {
+    column += screen_put(screen, row, column, after + 1,
+                         after_size - 1 < visible ? after_size - 1 : visible,
+                         0);
+  }
+  screen_fill(screen, row, column, app->width - 1 - column, " ", 0);
+}
 
-  printf("%s│ > ", str_cursor_position(heigth - 1, 1));
-  if (cursor_position >= input_len) {
-    printf("%.*s" CURSOR_SET_MODE "%c" CURSOR_RESET_MODE, input_len,
-           app->user_input.items, ' ');
+/**
+ * @brief Draw the connection state in the top border
+ *
+ * @param app The application object
+ */
+void display_status(t_app *app) {
+  t_connection *connection = &app->connection;
+  char status[256];
+  int len;
+
+  if (connection->fd == -1) {
+    len = snprintf(status, sizeof(status), " %s:%s disconnected ",
+                   connection->host, connection->port);
+  } else if (connection->rtt_count == 0) {
+    len = snprintf(status, sizeof(status), " %s:%s | %zu in flight ",
+                   connection->host, connection->port,
+                   connection->sent.count - connection->sent.head);
+  } else {
+    len = snprintf(
+        status, sizeof(status),
+        " %s:%s | rtt %.3f ms (min %.3f avg %.3f max %.3f) | %zu in flight ",
+        connection->host, connection->port, connection->rtt_last / 1e6,
+        connection->rtt_min / 1e6,
+        (double)connection->rtt_sum / connection->rtt_count / 1e6,
+        connection->rtt_max / 1e6,
+        connection->sent.count - connection->sent.head);
+  }
+  if (len >= sizeof(status)) {
+    len = sizeof(status) - 1;
+  }
+  if (len > app->width - 4) {
+    len = app->width - 4;
+  }
+  screen_put(&app->screen, 0, 2, status, len, 0);
+}
+
+// Scrollback rows inside the box
+static inline int history_rows(t_app *app) { return app->heigth - 4; }
+
+/**
+ * @brief Draw the visible window of the scrollback above the input
+ *
+ * Only the lines on screen are read, whatever the size of the scrollback.
+ *
+ * @param app The application object
+ */
+void display_history(t_app *app) {
+  s_line_ring *history = &app->history;
+  int rows = history_rows(app);
+  int width = app->width - 2;
+  size_t count = line_ring_count(history);
+  uint64_t bottom;
+  uint64_t top;
+
+  if (rows <= 0 || width <= 0) {
+    return;
+  }
+  if (app->scroll + rows > count) {
+    app->scroll = count > rows ? count - rows : 0;
+  }
+  bottom = history->end - app->scroll;
+  top = bottom - history->first > rows ? bottom - rows : history->first;
+
+  for (int row = 0; row < rows; row++) {
+    size_t size = 0;
+    const char *line =
+        top + row < bottom ? line_ring_get(history, top + row, &size) : NULL;
+    int drawn = screen_put(&app->screen, row + 1, 1, line, size, 0);
+
+    screen_fill(&app->screen, row + 1, 1 + drawn, width - drawn, " ", 0);
+  }
+}
+
+/**
+ * @brief Scroll the scrollback by a page
+ *
+ * @param app The application object
+ * @param up true to show older lines
+ */
+void scroll_history(t_app *app, bool up) {
+  size_t page = history_rows(app) > 1 ? history_rows(app) - 1 : 1;
 
-    printf("%s│", str_cursor_position(heigth - 1, width));
+  if (up) {
+    app->scroll += page; // clamped by display_history
   } else {
-    printf("%.*s" CURSOR_SET_MODE "%c" CURSOR_RESET_MODE "%.*s",
-           cursor_position, app->user_input.items,
-           app->user_input.items[cursor_position],
-           input_len - cursor_position - 1,
-           app->user_input.items + cursor_position + 1);
+    app->scroll = app->scroll > page ? app->scroll - page : 0;
+  }
+}
 
-    printf("%s│", str_cursor_position(heigth - 1, width));
+/**
+ * @brief Add a line to the scrollback
+ *
+ * A scrolled view stays on the lines it shows.
+ *
+ * @param app The application object
+ * @param format printf format of the line
+ */
+void add_history(t_app *app, const char *format, ...) {
+  va_list args;
+  int len;
+
+  va_start(args, format);
+  len = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  da_resize(&app->line, (size_t)len + 1);
+  va_start(args, format);
+  vsnprintf(app->line.items, len + 1, format, args);
+  va_end(args);
+  line_ring_push(&app->history, app->line.items, len);
+  if (app->scroll > 0) {
+    app->scroll++;
   }
+}
 
-  // Flush the output
-  fflush(stdout);
+/**
+ * @brief Close the connection to the server
+ *
+ * @param app The application object
+ * @param reason Reason shown in the scrollback
+ */
+void disconnect(t_app *app, const char *reason) {
+  t_connection *connection = &app->connection;
+
+  close(connection->fd);
+  connection->fd = -1;
+  da_clear(&connection->out);
+  connection->out_offset = 0;
+  da_clear(&connection->in);
+  da_clear(&connection->sent);
+  connection->sent.head = 0;
+  add_history(app, "Disconnected: %s", reason);
+}
+
+/**
+ * @brief Send the buffered output until the socket is full
+ *
+ * What the socket does not take is kept and sent once poll reports it
+ * writable again.
+ *
+ * @param app The application object
+ */
+void flush_output(t_app *app) {
+  t_connection *connection = &app->connection;
+  ssize_t sent;
+
+  while (connection->out_offset < connection->out.count) {
+    sent = send(connection->fd, connection->out.items + connection->out_offset,
+                connection->out.count - connection->out_offset, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        disconnect(app, strerror(errno));
+      }
+      return;
+    }
+    connection->out_offset += sent;
+  }
+  da_clear(&connection->out);
+  connection->out_offset = 0;
+}
+
+/**
+ * @brief Add a complete received line to the scrollback with its round trip
+ *
+ * The server answers in order: the line is the echo of the oldest line sent
+ * and not answered yet.
+ *
+ * @param app The application object
+ */
+void add_echo(t_app *app) {
+  t_connection *connection = &app->connection;
+  t_timestamps *sent = &connection->sent;
+  uint64_t rtt;
+
+  if (sent->head == sent->count) {
+    add_history(app, "< %.*s", (int)connection->in.count,
+                connection->in.items);
+    return;
+  }
+  rtt = now_ns() - sent->items[sent->head++];
+  if (sent->head == sent->count) {
+    da_clear(sent);
+    sent->head = 0;
+  }
+
+  connection->rtt_last = rtt;
+  if (connection->rtt_count == 0 || rtt < connection->rtt_min) {
+    connection->rtt_min = rtt;
+  }
+  if (rtt > connection->rtt_max) {
+    connection->rtt_max = rtt;
+  }
+  connection->rtt_sum += rtt;
+  connection->rtt_count++;
+  add_history(app, "< %.*s  (%.3f ms)", (int)connection->in.count,
+              connection->in.items, rtt / 1e6);
+}
+
+/**
+ * @brief Read the echoes available on the socket
+ *
+ * @param app The application object
+ */
+void receive_echoes(t_app *app) {
+  t_connection *connection = &app->connection;
+  char buffer[RECV_BUFFER_SIZE];
+  ssize_t readed;
+
+  while (connection->fd != -1) {
+    char *start = buffer;
+    char *newline;
+
+    readed = recv(connection->fd, buffer, sizeof(buffer), 0);
+    if (readed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (readed == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (readed <= 0) {
+      disconnect(app, readed == 0 ? "closed by the server" : strerror(errno));
+      return;
+    }
+
+    while ((newline = memchr(start, '\n', buffer + readed - start)) != NULL) {
+      da_append_many(&connection->in, start, newline - start);
+      add_echo(app);
+      da_clear(&connection->in);
+      start = newline + 1;
+    }
+    da_append_many(&connection->in, start, buffer + readed - start);
+  }
+}
+
+/**
+ * @brief Queue the input line for the server and clear it
+ *
+ * @param app The application object
+ */
+void send_input(t_app *app) {
+  t_connection *connection = &app->connection;
+  const char *text;
+  size_t size;
+
+  if (connection->fd == -1) {
+    add_history(app, "Not connected");
+    return;
+  }
+  text = gap_text(&app->user_input, &size);
+  da_append_many(&connection->out, text, size);
+  da_append(&connection->out, '\n');
+  da_append(&connection->sent, now_ns());
+  if (size > 0) {
+    line_ring_push(&app->inputs, text, size);
+  }
+  app->recall = app->inputs.end;
+  gap_clear(&app->user_input);
+  flush_output(app);
+}
+
+/**
+ * @brief Replace the input line with an earlier or later line sent
+ *
+ * The new line being typed is kept and comes back after the last line sent.
+ *
+ * @param app The application object
+ * @param older true for the line sent before the one shown
+ */
+void recall_input(t_app *app, bool older) {
+  s_line_ring *inputs = &app->inputs;
+  uint64_t recall = app->recall;
+  const char *text;
+  size_t size;
+
+  if (older ? recall <= inputs->first : recall >= inputs->end) {
+    return;
+  }
+  recall += older ? -1 : 1;
+  if (app->recall == inputs->end) {
+    text = gap_text(&app->user_input, &size);
+    da_clear(&app->draft);
+    da_append_many(&app->draft, text, size);
+  }
+
+  if (recall == inputs->end) {
+    text = app->draft.items;
+    size = app->draft.count;
+  } else {
+    text = line_ring_get(inputs, recall, &size);
+  }
+  gap_clear(&app->user_input);
+  gap_insert_many(&app->user_input, text, size);
+  app->recall = recall;
 }
 
 #ifdef _DEBUG
-void print_key(t_input *key) {
+void print_key(s_input *key) {
   char *arrow = NULL;
 
   switch (key->type) {
@@ -360,165 +778,130 @@ void print_key(t_input *key) {
   case INPUT_TYPE_BACKSPACE:
     eprintf("Backspace\n");
     break;
+  case INPUT_TYPE_PASTE:
+    eprintf("Paste: %zu bytes\n", key->size);
+    break;
+  case INPUT_TYPE_PAGE_UP:
+    eprintf("Page up\n");
+    break;
+  case INPUT_TYPE_PAGE_DOWN:
+    eprintf("Page down\n");
+    break;
   }
 }
 
 void print_app(t_app *app) {
   eprintf("Width: %d\n", app->width);
   eprintf("Heigth: %d\n", app->heigth);
-  eprintf("User input: %.*s\n", (int)app->user_input.count,
-          app->user_input.items);
-  eprintf("User input count: %zu\n", app->user_input.count);
-  eprintf("Cursor position: %zu\n", app->user_input.cursor_position);
+  eprintf("User input count: %zu\n", gap_length(&app->user_input));
+  eprintf("Cursor position: %zu\n", gap_cursor(&app->user_input));
+  eprintf("Pending output: %zu\n",
+          app->connection.out.count - app->connection.out_offset);
+  eprintf("Lines in flight: %zu\n",
+          app->connection.sent.count - app->connection.sent.head);
 }
 
 #endif
 
-t_input get_input() {
-#define PARSE_BUFFER(buffer, expected)                                         \
-  memcmp(buffer, expected, sizeof(expected) - 1) == 0
-
-#define INPUT_BUFFER_SIZE 10
-  size_t readed = 0;
-  t_input input = {0};
-  char buffer[INPUT_BUFFER_SIZE];
-
-  readed = read(STDIN_FILENO, &buffer, INPUT_BUFFER_SIZE);
-
-  if (readed == 4) {
-    if (PARSE_BUFFER(buffer, "\x1b\x5b\x33\x7e")) // DELETE
-      input.type = INPUT_TYPE_DELETE;
-    else
-      input.type = INPUT_TYPE_UNKNOWN;
-  } else if (readed == 3) {
-    if (PARSE_BUFFER(buffer, "\x1b\x5b\x48")) // BEGIN
-      input.type = INPUT_TYPE_BEGIN;
-    else if (PARSE_BUFFER(buffer, "\x1b\x5b\x46")) // END
-      input.type = INPUT_TYPE_END;
-    else if (PARSE_BUFFER(buffer, "\x1b\x5b")) { // ARROW
-      input.type = INPUT_TYPE_ARROW;
-      if (buffer[2] == '\x41')
-        input.key = ARROW_UP;
-      else if (buffer[2] == '\x42')
-        input.key = ARROW_DOWN;
-      else if (buffer[2] == '\x43')
-        input.key = ARROW_RIGHT;
-      else if (buffer[2] == '\x44')
-        input.key = ARROW_LEFT;
-      else
-        input.type = INPUT_TYPE_UNKNOWN;
-    } else
-      input.type = INPUT_TYPE_UNKNOWN;
-  } else if (readed == 1) {
-    if (buffer[0] == '\x1b') // ESC
-      input.type = INPUT_TYPE_ESC;
-    else if (buffer[0] == '\x0a') // ENTER
-      input.type = INPUT_TYPE_ENTER;
-    else if (buffer[0] == '\x7f') // BACKSPACE
-      input.type = INPUT_TYPE_BACKSPACE;
-    else if (buffer[0] == '\x03') // CTRL+C
-      input.type = INPUT_TYPE_CTRL_C;
-    else if (buffer[0] == '\x01') // CTRL+A
-      input.type = INPUT_TYPE_BEGIN;
-    else if (buffer[0] == '\x05') // CTRL+E
-      input.type = INPUT_TYPE_END;
-    else if (buffer[0] == '\x0c') // CTRL+L
-      input.type = INPUT_TYPE_CLEAR;
-    else {
-      input.type = INPUT_TYPE_KEY;
-      input.key = buffer[0];
-    }
-
-  } else {
-    input.type = INPUT_TYPE_UNKNOWN;
-  }
-
-  return input;
-}
-
-void handle_arrow(t_app *app, t_arrow_key arrow) {
+void handle_arrow(t_app *app, e_arrow_key arrow) {
   switch (arrow) {
   case ARROW_UP:
+    recall_input(app, true);
     break;
   case ARROW_DOWN:
+    recall_input(app, false);
     break;
   case ARROW_RIGHT:
-    if (app->user_input.cursor_position < app->user_input.count) {
-      app->user_input.cursor_position++;
-    }
+    gap_move(&app->user_input, gap_cursor(&app->user_input) + 1);
     break;
   case ARROW_LEFT:
-    if (app->user_input.cursor_position > 0) {
-      app->user_input.cursor_position--;
+    if (gap_cursor(&app->user_input) > 0) {
+      gap_move(&app->user_input, gap_cursor(&app->user_input) - 1);
     }
     break;
   }
 }
 
-void handle_backspace(t_app *app) {
-  if (app->user_input.cursor_position > 0) {
-    if (app->user_input.cursor_position == app->user_input.count) {
-      eprintf("Remove at end\n");
-      app->user_input.count--; // Remove the last character (fast remove)
-    } else {
-      eprintf("Remove at %zu\n", app->user_input.cursor_position - 1);
-      da_remove(&app->user_input, app->user_input.cursor_position - 1);
-    }
-    app->user_input.cursor_position--;
-  }
-}
+void handle_backspace(t_app *app) { gap_delete_before(&app->user_input, 1); }
 
-void handle_delete(t_app *app) {
-  if (app->user_input.cursor_position < app->user_input.count) {
-    da_remove(&app->user_input, app->user_input.cursor_position);
-  }
-}
+void handle_delete(t_app *app) { gap_delete_after(&app->user_input, 1); }
 
-void handle_key(t_app *app, char key) {
-  if (app->user_input.count >= app->user_input.cursor_position) {
-    da_insert(&app->user_input, app->user_input.cursor_position, key);
-  } else {
-    da_append(&app->user_input, key);
-  }
-  app->user_input.cursor_position++;
-}
+void handle_key(t_app *app, char key) { gap_insert(&app->user_input, key); }
 
-bool handle_input(t_app *app) {
-  t_input c;
+/**
+ * @brief Insert a paste at the cursor, sending each line it ends
+ *
+ * @param app The application object
+ * @param text The pasted text
+ * @param size The size of the text
+ */
+void handle_paste(t_app *app, const char *text, size_t size) {
+  const char *end = text + size;
 
-  // Read the input
-  c = get_input();
+  while (text < end) {
+    const char *line = text;
 
-  switch (c.type) {
+    while (text < end && *text != '\n' && *text != '\r') {
+      text++;
+    }
+    gap_insert_many(&app->user_input, line, text - line);
+    if (text == end) {
+      break;
+    }
+    send_input(app);
+    // "\r\n" ends a single line
+    if (*text++ == '\r' && text < end && *text == '\n') {
+      text++;
+    }
+  }
+}
+
+/**
+ * @brief Handle a decoded key
+ *
+ * @param app The application object
+ * @param c The key
+ * @return bool false to quit
+ */
+bool handle_key_input(t_app *app, s_input *c) {
+  switch (c->type) {
   case INPUT_TYPE_CTRL_C:
     kill(getpid(), SIGINT);
     break;
   case INPUT_TYPE_ESC:
     return false;
   case INPUT_TYPE_ARROW:
-    handle_arrow(app, c.arrow);
+    handle_arrow(app, c->arrow);
     break;
   case INPUT_TYPE_ENTER:
-    // Do something with the input
+    send_input(app);
     break;
   case INPUT_TYPE_BACKSPACE:
     handle_backspace(app);
     break;
   case INPUT_TYPE_KEY:
-    handle_key(app, c.key);
+    handle_key(app, c->key);
+    break;
+  case INPUT_TYPE_PASTE:
+    handle_paste(app, c->text, c->size);
+    break;
+  case INPUT_TYPE_PAGE_UP:
+    scroll_history(app, true);
+    break;
+  case INPUT_TYPE_PAGE_DOWN:
+    scroll_history(app, false);
     break;
   case INPUT_TYPE_DELETE:
     handle_delete(app);
     break;
   case INPUT_TYPE_BEGIN:
-    app->user_input.cursor_position = 0;
+    gap_move(&app->user_input, 0);
     break;
   case INPUT_TYPE_END:
-    app->user_input.cursor_position = app->user_input.count;
+    gap_move(&app->user_input, gap_length(&app->user_input));
     break;
   case INPUT_TYPE_CLEAR:
-    da_clear(&app->user_input);
-    app->user_input.cursor_position = 0;
+    gap_clear(&app->user_input);
     break;
   case INPUT_TYPE_UNKNOWN:
     break;
@@ -527,18 +910,485 @@ bool handle_input(t_app *app) {
   return true;
 }
 
-int main() {
+/**
+ * @brief Read the terminal and handle every key it sent
+ *
+ * The whole read is handled before the next frame is drawn: a burst of keys
+ * or a paste costs a single redraw.
+ *
+ * @param app The application object
+ * @return bool false to quit
+ */
+bool handle_input(t_app *app) {
+  char buffer[INPUT_BUFFER_SIZE];
+  ssize_t readed;
+  s_input c;
+
+  readed = read(STDIN_FILENO, buffer, sizeof(buffer));
+  app->input_ns = now_ns();
+  if (readed == -1) {
+    return errno == EINTR || errno == EAGAIN;
+  }
+  if (readed == 0) {
+    return false;
+  }
+  for (ssize_t i = 0; i < readed; i++) {
+    if (input_decode(&app->decoder, buffer[i], &c) &&
+        !handle_key_input(app, &c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Wait for the terminal or the server and handle what is ready
+ *
+ * @param app The application object
+ * @return bool false to quit
+ */
+bool poll_events(t_app *app) {
+  t_connection *connection = &app->connection;
+  // Once disconnected the descriptor is -1 and poll ignores it
+  struct pollfd fds[2] = {
+      {.fd = STDIN_FILENO, .events = POLLIN},
+      {.fd = connection->fd, .events = POLLIN},
+  };
+  int timeout = -1;
+  int ready;
+  s_input c;
+
+  // Wait for the rest of a sequence until INPUT_ESC_TIMEOUT after its start
+  if (input_decode_pending(&app->decoder)) {
+    uint64_t elapsed = (now_ns() - app->input_ns) / 1000000;
+
+    timeout = elapsed < INPUT_ESC_TIMEOUT ? INPUT_ESC_TIMEOUT - elapsed : 0;
+  }
+
+  if (connection->out_offset < connection->out.count) {
+    fds[1].events |= POLLOUT;
+  }
+  ready = poll(fds, 2, timeout);
+  if (ready == -1) {
+    return errno == EINTR;
+  }
+  // No rest of sequence after an ESC: it was the ESC key
+  if (ready == 0) {
+    return !input_decode_timeout(&app->decoder, &c) ||
+           handle_key_input(app, &c);
+  }
+
+  if (fds[1].revents & POLLOUT) {
+    flush_output(app);
+  }
+  if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+    receive_echoes(app);
+  }
+  if (fds[0].revents & POLLIN) {
+    return handle_input(app);
+  }
+  return !(fds[0].revents & (POLLHUP | POLLERR));
+}
+
+/**
+ * @brief Mix a 64 bits value (splitmix64 finalizer)
+ *
+ */
+static inline uint64_t mix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief Generate the payload bytes at an offset
+ *
+ * Every 8 bytes are derived from their position only, so any part of the
+ * payload can be generated on its own.
+ *
+ * @param data set to the bytes
+ * @param offset offset of the first byte in the payload
+ * @param size number of bytes
+ */
+void payload_fill(char *data, uint64_t offset, size_t size) {
+  size_t i = 0;
+
+  while (i < size) {
+    uint64_t word = mix64((offset + i) / 8);
+    size_t skip = (offset + i) % 8;
+    size_t count = 8 - skip < size - i ? 8 - skip : size - i;
+
+    memcpy(data + i, (char *)&word + skip, count);
+    i += count;
+  }
+}
+
+/**
+ * @brief Checksum a whole file, without moving its offset
+ *
+ * @param stream the stream, with its file and buffer set
+ * @return int 0 if success, -1 on error
+ */
+int checksum_file(t_stream *stream) {
+  uint64_t offset = 0;
+
+  while (offset < stream->total) {
+    ssize_t readed = pread(stream->file, stream->out, stream->buffer, offset);
+
+    if (readed == -1 && errno == EINTR) {
+      continue;
+    }
+    if (readed <= 0) {
+      fprintf(stderr, "Error read failed: %s\n",
+              readed == 0 ? "file truncated" : strerror(errno));
+      return -1;
+    }
+    stream->crc_sent = crc32c_update(stream->crc_sent, stream->out, readed);
+    offset += readed;
+  }
+  return 0;
+}
+
+/**
+ * @brief Load the next chunk of payload to send
+ *
+ * @return int 0 if success, -1 on error
+ */
+int load_payload(t_stream *stream) {
+  uint64_t left = stream->total - stream->loaded;
+  size_t size = left < stream->buffer ? left : stream->buffer;
+
+  if (stream->file == -1) {
+    payload_fill(stream->out, stream->loaded, size);
+  } else {
+    ssize_t readed;
+
+    do {
+      readed = read(stream->file, stream->out, size);
+    } while (readed == -1 && errno == EINTR);
+    if (readed <= 0) {
+      fprintf(stderr, "Error read failed: %s\n",
+              readed == 0 ? "file truncated" : strerror(errno));
+      return -1;
+    }
+    size = readed;
+  }
+  stream->crc_sent = crc32c_update(stream->crc_sent, stream->out, size);
+  stream->loaded += size;
+  stream->out_size = size;
+  stream->out_offset = 0;
+  return 0;
+}
+
+/**
+ * @brief Send until the window is full or the socket would block
+ *
+ * @return int 0 if success, -1 on error
+ */
+int stream_send(t_stream *stream) {
+  while (stream->sent < stream->total &&
+         stream->sent - stream->received < stream->window) {
+    size_t room = stream->window - (stream->sent - stream->received);
+    ssize_t sent;
+
+    if (stream->sendfile) {
+      uint64_t left = stream->total - stream->sent;
+
+      // From the file offset, which sendfile advances
+      sent = sendfile(stream->fd, stream->file, NULL,
+                      left < room ? left : room);
+    } else {
+      size_t size;
+
+      if (stream->out_offset == stream->out_size &&
+          load_payload(stream) != 0) {
+        return -1;
+      }
+      size = stream->out_size - stream->out_offset;
+      sent = send(stream->fd, stream->out + stream->out_offset,
+                  size < room ? size : room, MSG_NOSIGNAL);
+    }
+    if (sent == -1 && errno == EINTR) {
+      continue;
+    }
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (sent <= 0) {
+      fprintf(stderr, "Error send failed: %s\n",
+              sent == 0 ? "file truncated" : strerror(errno));
+      return -1;
+    }
+    stream->sent += sent;
+    stream->out_offset += stream->sendfile ? 0 : sent;
+  }
+  return 0;
+}
+
+/**
+ * @brief Receive the echoes until the socket would block
+ *
+ * @return int 0 if success, -1 on error
+ */
+int stream_receive(t_stream *stream) {
+  for (;;) {
+    ssize_t received = recv(stream->fd, stream->in, stream->buffer, 0);
+
+    if (received == -1 && errno == EINTR) {
+      continue;
+    }
+    if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (received <= 0) {
+      fprintf(stderr, "Error connection lost after %" PRIu64 " bytes: %s\n",
+              stream->received,
+              received == 0 ? "closed by the server" : strerror(errno));
+      return -1;
+    }
+    if (stream->first_ns == 0) {
+      stream->first_ns = now_ns();
+    }
+    if (stream->received + received > stream->sent) {
+      fprintf(stderr, "Error received %" PRIu64 " bytes, only %" PRIu64
+                      " sent\n",
+              stream->received + received, stream->sent);
+      return -1;
+    }
+    stream->crc_received =
+        crc32c_update(stream->crc_received, stream->in, received);
+    stream->received += received;
+  }
+}
+
+/**
+ * @brief Stream the payload through the server until everything is echoed
+ *
+ * Sends while less than a window is in flight, receives whatever is ready.
+ *
+ * @return int 0 if success, -1 on error
+ */
+int stream_run(t_stream *stream) {
+  stream->start_ns = now_ns();
+  while (stream->received < stream->total) {
+    struct pollfd fds = {.fd = stream->fd, .events = POLLIN};
+    int ready;
+
+    if (stream->sent < stream->total &&
+        stream->sent - stream->received < stream->window) {
+      fds.events |= POLLOUT;
+    }
+    ready = poll(&fds, 1, HEADLESS_STALL_TIMEOUT);
+    if (ready == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ready == -1) {
+      fprintf(stderr, "Error poll failed: %s\n", strerror(errno));
+      return -1;
+    }
+    if (ready == 0) {
+      fprintf(stderr,
+              "Error no progress for %d ms: %" PRIu64 " bytes sent, %" PRIu64
+              " echoed\n",
+              HEADLESS_STALL_TIMEOUT, stream->sent, stream->received);
+      return -1;
+    }
+    if (fds.revents & (POLLIN | POLLHUP | POLLERR) &&
+        stream_receive(stream) != 0) {
+      return -1;
+    }
+    if (fds.revents & POLLOUT && stream_send(stream) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Stream a file or a generated payload through the server and check
+ * the echo
+ *
+ * @return int exit code: 0 if the echo matches, 1 otherwise
+ */
+int run_headless(t_options *options) {
+  t_connection connection = {
+      .host = options->host, .port = options->port, .fd = -1};
+  t_stream stream = {.file = -1,
+                     .sendfile = options->sendfile,
+                     .total = options->bytes,
+                     .window = options->window,
+                     .buffer = options->buffer};
+  double elapsed;
+  int status = 1;
+
+  if (options->file != NULL) {
+    struct stat st;
+
+    stream.file = open(options->file, O_RDONLY);
+    if (stream.file == -1 || fstat(stream.file, &st) == -1) {
+      fprintf(stderr, "Error open %s failed: %s\n", options->file,
+              strerror(errno));
+      if (stream.file != -1) {
+        close(stream.file);
+      }
+      return 1;
+    }
+    stream.total = st.st_size;
+  }
+  stream.out = malloc(stream.buffer);
+  stream.in = malloc(stream.buffer);
+  assert(stream.out != NULL && stream.in != NULL &&
+         "Maybe you should buy more RAM");
+  // sendfile does not go through the send buffer: checksum the file first
+  if (stream.sendfile && checksum_file(&stream) != 0) {
+    goto cleanup;
+  }
+
+  // A broken connection is reported by stream_send (sendfile cannot take
+  // MSG_NOSIGNAL)
+  signal(SIGPIPE, SIG_IGN);
+  if (connect_server(&connection) != 0) {
+    goto cleanup;
+  }
+  stream.fd = connection.fd;
+  if (stream_run(&stream) != 0) {
+    goto cleanup;
+  }
+
+  elapsed = (now_ns() - stream.start_ns) / 1e9;
+  printf("%" PRIu64 " bytes echoed in %.3f s: %.1f MB/s (window %zu, buffer "
+         "%zu%s)\n",
+         stream.total, elapsed,
+         elapsed > 0 ? stream.total / elapsed / 1e6 : 0.0, stream.window,
+         stream.buffer, stream.sendfile ? ", sendfile" : "");
+  if (stream.first_ns != 0) {
+    printf("First byte echoed after %.3f ms\n",
+           (stream.first_ns - stream.start_ns) / 1e6);
+  }
+  printf("CRC32C sent %08" PRIx32 ", echoed %08" PRIx32 ": %s\n",
+         stream.crc_sent, stream.crc_received,
+         stream.crc_sent == stream.crc_received ? "OK" : "MISMATCH");
+  status = stream.crc_sent == stream.crc_received ? 0 : 1;
+
+cleanup:
+  if (connection.fd != -1) {
+    close(connection.fd);
+  }
+  if (stream.file != -1) {
+    close(stream.file);
+  }
+  free(stream.out);
+  free(stream.in);
+  return status;
+}
+
+/**
+ * @brief Print the command line usage
+ *
+ */
+void usage(const char *name) {
+  printf("Usage: %s [options] [host] [port]\n"
+         "Interactive client of the echo server (default %s %s).\n"
+         "With --file or --bytes, streams the payload and checks the echo.\n"
+         "  -f, --file PATH       stream the file PATH\n"
+         "  -n, --bytes N         stream N generated bytes\n"
+         "  -s, --sendfile        send the file with sendfile(2)\n"
+         "  -w, --window BYTES    bytes sent and not echoed yet at most "
+         "(default %d)\n"
+         "  -b, --buffer BYTES    size of the send and receive buffers "
+         "(default %d)\n"
+         "  -h, --help            display this help\n",
+         name, DEFAULT_HOST, DEFAULT_PORT, HEADLESS_WINDOW, HEADLESS_BUFFER);
+}
+
+/**
+ * @brief Parse the command line into the options
+ *
+ * @return int 0 if success, 1 if the program should exit
+ */
+int parse_args(t_options *options, int argc, char **argv) {
+  static const struct option long_options[] = {
+      {"file", required_argument, NULL, 'f'},
+      {"bytes", required_argument, NULL, 'n'},
+      {"sendfile", no_argument, NULL, 's'},
+      {"window", required_argument, NULL, 'w'},
+      {"buffer", required_argument, NULL, 'b'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  static const char *short_options = "f:n:sw:b:h";
+  int opt;
+
+  memset(options, 0, sizeof(*options));
+  options->window = HEADLESS_WINDOW;
+  options->buffer = HEADLESS_BUFFER;
+
+  while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'f':
+      options->file = optarg;
+      options->headless = true;
+      break;
+    case 'n':
+      options->bytes = strtoull(optarg, NULL, 10);
+      options->headless = true;
+      break;
+    case 's':
+      options->sendfile = true;
+      break;
+    case 'w':
+      options->window = strtoull(optarg, NULL, 10);
+      break;
+    case 'b':
+      options->buffer = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind > 2 || options->window == 0 || options->buffer == 0 ||
+      (options->file != NULL && options->bytes != 0) ||
+      (options->sendfile && options->file == NULL)) {
+    usage(argv[0]);
+    return 1;
+  }
+  options->host = optind < argc ? argv[optind] : DEFAULT_HOST;
+  options->port = optind + 1 < argc ? argv[optind + 1] : DEFAULT_PORT;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  t_options options;
   t_app app = {0};
 
+  if (parse_args(&options, argc, argv)) {
+    return 1;
+  }
+  if (options.headless) {
+    return run_headless(&options);
+  }
+  app.connection.host = options.host;
+  app.connection.port = options.port;
+  if (connect_server(&app.connection) != 0) {
+    return 1;
+  }
+
   init_app(&app);
   register_signal();
 
-  int i = 0;
   do {
     print_app(&app);
     eprintf("===========================\n");
+    display_app(&app);
+    display_status(&app);
+    display_history(&app);
     display_input(&app);
-  } while (handle_input(&app));
+    screen_flush(&app.screen, STDOUT_FILENO);
+  } while (poll_events(&app));
 
   deinit_app(&app);
 
@@ -0,0 +1,296 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define _DA_INIT_CAPACITY 16
+#include "../includes/coroutine.h"
+
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+
+// co_switch(save, load): push the callee-saved registers, store the stack
+// pointer in *save, switch to the stack `load` and pop its registers. The
+// caller-saved registers are already spilled by the compiler around the call.
+// The floating point control words are not switched: coroutines must not
+// change them.
+//
+// co_start: first return of a new coroutine, calls r13(r12) on its own stack.
+__asm__(".text\n"
+        ".globl co_switch\n"
+        ".hidden co_switch\n"
+        ".type co_switch, @function\n"
+        "co_switch:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n"
+        ".size co_switch, .-co_switch\n"
+        ".globl co_start\n"
+        ".hidden co_start\n"
+        ".type co_start, @function\n"
+        "co_start:\n"
+        "  movq %r12, %rdi\n"
+        "  callq *%r13\n"
+        "  ud2\n"
+        ".size co_start, .-co_start\n");
+
+void co_switch(void **save, void *load);
+void co_start(void);
+
+#endif
+
+/**
+ * @brief Entry point of a coroutine, never returns
+ *
+ */
+static void co_entry(s_co *co) {
+  co->fn(co, co->arg);
+  co->state = CO_DONE;
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+  co_switch(&co->sp, co->caller_sp);
+#else
+  swapcontext(&co->ctx, &co->caller);
+#endif
+}
+
+#if !defined(__x86_64__) || defined(_CO_UCONTEXT)
+// makecontext only passes int arguments
+static void co_entry_split(unsigned int high, unsigned int low) {
+  co_entry((s_co *)(((uintptr_t)high << 16 << 16) | low));
+}
+#endif
+
+void co_pool_init(s_co_pool *pool, size_t stack_size) {
+  memset(pool, 0, sizeof(*pool));
+  pool->page_size = sysconf(_SC_PAGESIZE);
+  if (stack_size == 0) {
+    stack_size = CO_STACK_SIZE;
+  }
+  pool->stack_size =
+      (stack_size + pool->page_size - 1) & ~(pool->page_size - 1);
+}
+
+void co_pool_free(s_co_pool *pool) {
+  da_for_unsafe(&pool->free, i) {
+    munmap(pool->free.items[i]->mapping, pool->page_size + pool->stack_size);
+    pool->mapped--;
+  }
+  da_free(&pool->free);
+}
+
+s_co *co_create(s_co_pool *pool, co_fn fn, void *arg) {
+  size_t size = pool->page_size + pool->stack_size;
+  char *mapping;
+  s_co *co;
+
+  if (pool->free.count > 0) {
+    mapping = pool->free.items[--pool->free.count]->mapping;
+  } else {
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    assert(mapping != MAP_FAILED && "Maybe you should buy more RAM");
+    // Guard page: a stack overflow faults
+    mprotect(mapping, pool->page_size, PROT_NONE);
+    pool->mapped++;
+  }
+
+  co = (s_co *)((uintptr_t)(mapping + size - sizeof(s_co)) & ~(uintptr_t)15);
+  memset(co, 0, sizeof(*co));
+  co->pool = pool;
+  co->mapping = mapping;
+  co->fn = fn;
+  co->arg = arg;
+  co->state = CO_READY;
+
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+  // Frame popped by co_switch: r15, r14, r13, r12, rbx, rbp, return address
+  // (co_start), which then runs on a 16 bytes aligned stack
+  uintptr_t *frame = (uintptr_t *)co - 7;
+  memset(frame, 0, 7 * sizeof(uintptr_t));
+  frame[2] = (uintptr_t)co_entry;
+  frame[3] = (uintptr_t)co;
+  frame[6] = (uintptr_t)co_start;
+  co->sp = frame;
+#else
+  getcontext(&co->ctx);
+  co->ctx.uc_stack.ss_sp = mapping + pool->page_size;
+  co->ctx.uc_stack.ss_size = (char *)co - (mapping + pool->page_size);
+  co->ctx.uc_link = NULL;
+  makecontext(&co->ctx, (void (*)(void))co_entry_split, 2,
+              (unsigned int)((uintptr_t)co >> 16 >> 16),
+              (unsigned int)(uintptr_t)co);
+#endif
+  return co;
+}
+
+void co_release(s_co *co) {
+  assert(co->state != CO_RUNNING && "Cannot release a running coroutine");
+  da_append(&co->pool->free, co);
+}
+
+bool co_resume(s_co *co) {
+  assert(co->state != CO_RUNNING && co->state != CO_DONE &&
+         "Coroutine is not suspended");
+  co->state = CO_RUNNING;
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+  co_switch(&co->caller_sp, co->sp);
+#else
+  swapcontext(&co->caller, &co->ctx);
+#endif
+  return co->state != CO_DONE;
+}
+
+void co_suspend(s_co *co) {
+  if (co->state == CO_RUNNING) {
+    co->state = CO_SUSPENDED;
+  }
+#if defined(__x86_64__) && !defined(_CO_UCONTEXT)
+  co_switch(&co->sp, co->caller_sp);
+#else
+  swapcontext(&co->ctx, &co->caller);
+#endif
+}
+
+/**
+ * @brief Resume a client coroutine with a view of its unconsumed bytes
+ *
+ * @return size_t bytes of the view consumed by co_read
+ */
+static size_t co_run(s_co *co, char *data, size_t size) {
+  size_t used;
+
+  co->view = data;
+  co->size = size;
+  co->used = 0;
+  co_resume(co);
+  used = co->used;
+  co->view = NULL;
+  co->size = 0;
+  co->used = 0;
+  return used;
+}
+
+// The client is done with: its coroutine returned or its connection failed
+static inline bool co_ended(s_co *co) {
+  return co->state == CO_DONE || co->closed;
+}
+
+s_co *co_spawn(s_reactor *reactor, s_conn *conn) {
+  s_co_server *server = reactor->arg;
+  s_co *co = co_create(&server->pool, server->fn, server->arg);
+
+  co->reactor = reactor;
+  co->conn = conn;
+  conn->data = co;
+  co_run(co, NULL, 0);
+  return co;
+}
+
+ssize_t co_read(s_co *co, char *buffer, size_t size) {
+  size_t available;
+
+  while (co->used == co->size) {
+    if (co->closed) {
+      return 0;
+    }
+    co->state = CO_WAIT_READ;
+    co_suspend(co);
+  }
+  available = co->size - co->used;
+  if (size < available) {
+    available = size;
+  }
+  memcpy(buffer, co->view + co->used, available);
+  co->used += available;
+  return available;
+}
+
+ssize_t co_write(s_co *co, const char *data, size_t size) {
+  int status;
+
+  if (co->closed) {
+    return -1;
+  }
+  status = reactor_write(co->reactor, co->conn, data, size);
+  if (status == -1) {
+    co->closed = true;
+    return -1;
+  }
+  if (status == 1) {
+    co->state = CO_WAIT_WRITE;
+    co_suspend(co);
+    if (co->closed) {
+      return -1;
+    }
+  }
+  return size;
+}
+
+static int co_on_accept(s_reactor *reactor, s_conn *conn) {
+  s_co *co = co_spawn(reactor, conn);
+
+  // A refused connection is not passed to on_close
+  if (co_ended(co)) {
+    co_release(co);
+    conn->data = NULL;
+    return REACTOR_CLOSE;
+  }
+  return 0;
+}
+
+static ssize_t co_on_data(s_reactor *reactor, s_conn *conn, char *data,
+                          size_t size) {
+  s_co *co = conn->data;
+  size_t used = 0;
+
+  if (co->state == CO_WAIT_READ) {
+    used = co_run(co, data, size);
+  }
+  return co_ended(co) ? REACTOR_CLOSE : (ssize_t)used;
+}
+
+static int co_on_writable(s_reactor *reactor, s_conn *conn) {
+  s_co *co = conn->data;
+
+  if (co->state == CO_WAIT_WRITE) {
+    // Bytes left by the last on_data are only passed again with the next
+    // read: hand them over now
+    reactor_consume(reactor, conn,
+                    co_run(co, conn->in.items + conn->in_consumed,
+                           conn->in.count - conn->in_consumed));
+  }
+  return co_ended(co) ? REACTOR_CLOSE : 0;
+}
+
+static void co_on_close(s_reactor *reactor, s_conn *conn,
+                        e_reactor_close reason) {
+  s_co *co = conn->data;
+
+  // Let a coroutine waiting on the connection unwind: co_read returns 0
+  co->closed = true;
+  if (co->state == CO_WAIT_READ || co->state == CO_WAIT_WRITE) {
+    co_run(co, NULL, 0);
+  }
+  co_release(co);
+  conn->data = NULL;
+}
+
+const s_reactor_handler co_handler = {
+    .on_accept = co_on_accept,
+    .on_data = co_on_data,
+    .on_writable = co_on_writable,
+    .on_close = co_on_close,
+};
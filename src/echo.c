@@ -1,39 +1,217 @@
+#define _GNU_SOURCE // recvmmsg, sendmmsg, pthread_setaffinity_np, memfd
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/poll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define _DA_INIT_CAPACITY 16
-#include "../includes/array.h"
+#include "../includes/framing.h"
+#include "../includes/handoff.h"
+#include "../includes/reactor.h"
+#include "../includes/shm_ring.h"
+#include "../includes/trace.h"
 
 #define BUFF_SIZE 1024
 #define SERVER_PORT 5000
 
+// Largest read size a bulk sender grows to (see REACTOR_SHRINK_READS)
+#define MAX_READ_SIZE (64 * 1024)
+
+// Framing: read size and largest frame accepted (header included)
+#define FRAME_BUFF_SIZE 16384
+#define MAX_FRAME (1024 * 1024)
+
+// Zerocopy: largest read size, so the echo of a large payload reaches the
+// --zerocopy threshold
+#define ZEROCOPY_BUFF_SIZE (256 * 1024)
+
+// Admission limits (0 disables the limit)
+#define MAX_CONNECTIONS 10000
+#define MAX_CONNECTIONS_PER_IP 0
+#define MAX_BUFFERED (64 * 1024 * 1024)
+
+// UDP echo: datagrams per recvmmsg/sendmmsg and receive buffer per datagram
+// (large enough for a GRO coalesced batch of segments)
+#define UDP_BATCH 64
+#define UDP_MAX_BATCH 1024
+#define UDP_BUFF_SIZE 65536
+
+// Shared memory transport: longest time the thread keeps spinning after the
+// last byte moved before it sleeps on the eventfds (microseconds)
+#define SHM_SPIN_US 50
+
+// Timeouts in milliseconds (0 disables the timeout)
+#define IDLE_TIMEOUT 300000
+#define WRITE_TIMEOUT 30000
+#define MAX_LIFETIME 0
+// Hot upgrade: longest wait for the new server to take over
+#define HANDOFF_TIMEOUT 5000
+// Graceful drain (SIGTERM): longest wait for the clients to become idle
+#define DRAIN_TIMEOUT 30000
+
 #define eprintf(...) fprintf(stderr, __VA_ARGS__)
 
 typedef struct {
-  da_struct(struct pollfd)
-} s_da_fd;
+  int port;
+  bool ipv6;                // dual stack TCP listener (IPv4 clients mapped)
+  s_reactor_config reactor; // admission limits, timeouts and busy poll
+  int admin_port;           // statistics on 127.0.0.1 (0 disables)
+  const char *admin_path;   // statistics on a Unix socket (NULL disables)
+  bool udp;                 // serve UDP echo on the same port
+  size_t udp_threads;       // SO_REUSEPORT shards
+  size_t udp_batch;         // datagrams per recvmmsg/sendmmsg
+  bool udp_gro;             // UDP GRO receive, GSO replies
+  const char *unix_path; // local listener and shared memory (NULL disables)
+  uint64_t shm_spin_us;  // spin time before sleeping
+  int loop_cpu;          // CPU the event loop is pinned to (-1 for none)
+  e_framing framing;     // message codec (FRAMING_NONE echoes raw chunks)
+  size_t max_frame;      // in bytes, header included
+  size_t workers;        // worker event loops (0: the event loop serves)
+  e_reactor_balance balance; // how the acceptor picks a worker
+  int reuseport; // workers listen themselves (REUSEPORT_OFF: acceptor)
+  uint64_t drain_timeout; // in milliseconds (SIGTERM)
+  int defer_accept; // TCP_DEFER_ACCEPT in seconds (0 disables)
+  int fastopen;     // TCP Fast Open queue length (0 disables)
+} s_config;
+
+// Echo handler statistics, only written by the event loop (see stats.h)
+typedef struct {
+  s_counter frames;             // framing: frames answered
+  s_histogram frames_per_write; // framing: replies gathered per writev
+} s_stats;
+
+// UDP shard statistics, only written by the shard thread
+typedef struct {
+  s_counter datagrams_in;
+  s_counter datagrams_out;
+  s_counter bytes_in;
+  s_counter bytes_out;
+  s_counter batches;      // recvmmsg calls returning datagrams
+  s_counter coalesced;    // GRO buffers holding more than one segment
+  s_counter send_errors;  // datagrams dropped by sendmmsg
+  s_histogram batch_fill; // datagrams per recvmmsg
+} s_udp_stats;
+
+typedef struct {
+  int fd;
+  int cpu; // CPU the shard is pinned to
+  size_t batch;
+  bool gro;
+  s_udp_stats stats;
+} s_udp_shard;
+
+// Shared memory statistics, only written by the shared memory thread
+typedef struct {
+  s_counter attached;
+  s_counter detached;
+  s_counter bytes;
+  s_counter wakeups; // eventfd writes to wake a client
+  s_counter sleeps;  // times the thread blocked in poll
+} s_shm_stats;
 
 typedef struct {
-  da_struct(struct sockaddr_in)
-} s_da_addr;
+  s_shm_channel channel;
+  int fd; // Unix socket of the client (closed by the client to detach)
+} s_shm_client;
 
 typedef struct {
-  s_da_addr *addrs;
-  s_da_fd *fds;
-} s_context;
+  da_struct(s_shm_client *)
+} s_da_shm;
 
-// Global application context (useful for signal handler)
-s_context *ctx = {0};
+typedef struct {
+  pthread_mutex_t lock;      // protects pending
+  s_da_shm pending;          // attached by the event loop, not yet served
+  _Atomic bool has_pending;  // checked without the lock while spinning
+  int wake_fd;               // eventfd, signaled when clients are pending
+  s_shm_spin spin;           // only used by the thread
+  s_shm_stats stats;
+} s_shm_server;
+
+// Socket received from the replaced server (hot upgrade, see handoff.h)
+typedef struct {
+  s_handoff_record record;
+  int fd;     // -1 once taken
+  char *data; // unconsumed input then pending output of a client
+} s_handed;
+
+typedef struct {
+  da_struct(s_handed)
+} s_da_handed;
+
+typedef struct s_context s_context;
+
+// Event loop and its echo statistics, the context of the echo handler
+typedef struct {
+  s_context *ctx;
+  s_reactor reactor;
+  s_stats stats;
+  int cpu;          // CPU a worker is pinned to
+  pthread_t thread; // worker thread
+} s_loop;
+
+struct s_context {
+  s_config config;
+  s_loop loop;       // listeners and TCP/Unix clients (acceptor with workers)
+  s_loop *workers;   // worker event loops (config.workers)
+  int admin_fd;      // statistics endpoint (-1 if disabled)
+  s_udp_shard *udp;  // UDP echo shards (config.udp_threads)
+  s_shm_server *shm; // shared memory thread (NULL if disabled)
+  s_da_handed handed; // sockets of the replaced server (hot upgrade)
+  int handoff_fd;     // hand off socket until acknowledged (-1 if none)
+  bool upgrading;     // SIGUSR2 stopped the event loop for `hot_upgrade`
+  bool draining;      // SIGINT or SIGTERM started a graceful drain
+};
+
+// Long options without a short equivalent
+enum {
+  OPT_UDP_THREADS = 256,
+  OPT_UDP_BATCH,
+  OPT_UDP_GRO,
+  OPT_UNIX,
+  OPT_SHM_SPIN,
+  OPT_BUSY_POLL,
+  OPT_LOOP_CPU,
+  OPT_FRAMING,
+  OPT_MAX_FRAME,
+  OPT_WORKERS,
+  OPT_BALANCE,
+  OPT_REUSEPORT,
+  OPT_DRAIN_TIMEOUT,
+  OPT_MAX_READ,
+  OPT_ZEROCOPY,
+  OPT_DEFER_ACCEPT,
+  OPT_FASTOPEN,
+};
+
+// Names of the balancing policies (--balance), indexed by e_reactor_balance
+static const char *balance_names[] = {"rr", "least-conn", "least-loaded"};
+
+// How the workers get their TCP connections (--reuseport)
+enum {
+  REUSEPORT_OFF,  // handed by the acceptor
+  REUSEPORT_HASH, // a SO_REUSEPORT listener each, kernel hash
+  REUSEPORT_CPU,  // a SO_REUSEPORT listener each, steered by receiving CPU
+};
+static const char *reuseport_names[] = {"off", "hash", "cpu"};
 
 /**
  * @brief Cleanup the server (close all file descriptors)
@@ -44,226 +222,1963 @@ void cleanup(s_context *ctx) {
     return;
   }
   // Cleanup
-  da_foreach_unsafe(ctx->fds, item) { close(item->fd); }
-  da_free(ctx->fds);
-  da_free(ctx->addrs);
+  reactor_free(&ctx->loop.reactor);
+  // The workers may still be running: their sockets close with the process
+  // The UDP shards may still be running: only close their sockets
+  for (size_t i = 0; ctx->udp != NULL && i < ctx->config.udp_threads; i++) {
+    close(ctx->udp[i].fd);
+  }
+  // Until the hand off is acknowledged, the paths are the replaced server's
+  if (ctx->config.unix_path != NULL && ctx->handoff_fd == -1) {
+    unlink(ctx->config.unix_path);
+  }
+  if (ctx->admin_fd != -1) {
+    close(ctx->admin_fd);
+    if (ctx->config.admin_path != NULL && ctx->handoff_fd == -1) {
+      unlink(ctx->config.admin_path);
+    }
+  }
   free(ctx);
 }
 
 /**
- * @brief Register a client file descriptor
+ * @brief Receive the signals on a signalfd instead of handlers
  *
- * @param fds file descriptor dynamic array
- * @param fd file descriptor
+ * The signals are blocked before any thread starts (threads inherit the
+ * mask), so nothing runs in signal context: the event loop reads them from
+ * the signalfd (see on_signal). SIGSEGV keeps its default action.
+ *
+ * @return int the signalfd, -1 on error
  */
-void register_client(s_da_fd *fds, int fd) {
-  struct pollfd s_fd;
-  s_fd.fd = fd;
-  s_fd.events = POLLIN;
-  // Server is always the first item.
-  da_append(fds, s_fd);
+int init_signals() {
+  sigset_t set;
+  int fd;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd == -1) {
+    eprintf("Error signalfd failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // Writing to a reset connection must fail with EPIPE, not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  return fd;
 }
 
 /**
- * @brief Register a server file descriptor
+ * @brief Take a listening socket received from the replaced server
  *
- * @param fds file descriptor dynamic array
- * @param fd file descriptor
+ * @param ctx server context
+ * @param kind HANDOFF_LISTENER, HANDOFF_UNIX or HANDOFF_ADMIN
+ * @return int the socket, -1 if none is left (bind a new one)
  */
-void register_server(s_da_fd *fds, int fd) {
-  // Server is always the first item.
-  da_clear(fds);
-  register_client(fds, fd);
+int take_socket(s_context *ctx, e_handoff_kind kind) {
+  da_for_unsafe(&ctx->handed, i) {
+    s_handed *handed = &ctx->handed.items[i];
+
+    if (handed->record.kind == kind && handed->fd != -1) {
+      int fd = handed->fd;
+
+      handed->fd = -1;
+      return fd;
+    }
+  }
+  return -1;
 }
 
+
 /**
- * @brief Handle signal to close server file descriptor
+ * @brief Hand a local client over to the shared memory thread
+ *
+ * The client passed the memfd and eventfds of a channel (see shm_ring.h)
+ * with a single request byte. Once attached, the connection leaves the
+ * event loop: its socket is only kept to notice the client going away.
  *
+ * @param ctx server context
+ * @param reactor event loop of the connection
+ * @param conn client connection (holding the passed descriptors)
+ * @param size unconsumed bytes of the connection
+ * @return int REACTOR_DETACH if handed over, REACTOR_CLOSE otherwise
  */
-void handle_signal(int sig) {
-  struct sigaction act;
-  switch (sig) {
-  case SIGSEGV:
-  case SIGINT:
-  case SIGTERM:
-    cleanup(ctx);
-    break;
+int attach_shm(s_context *ctx, s_reactor *reactor, s_conn *conn,
+               size_t size) {
+  s_shm_server *shm = ctx->shm;
+  s_shm_client *client;
+  uint64_t one = 1;
+
+  // Only a connection that has not sent anything else may switch
+  if (conn->npassed != 3 || size != 1 || conn->queued.count != 0) {
+    eprintf("Error shared memory request with %d descriptors\n",
+            conn->npassed);
+    return REACTOR_CLOSE;
+  }
+
+  client = calloc(1, sizeof(s_shm_client));
+  assert(client != NULL && "Maybe you should buy more RAM");
+  conn->npassed = 0; // Owned by the channel, even on error
+  if (shm_channel_attach(&client->channel, conn->passed_fds) != 0) {
+    eprintf("Error shared memory attach failed: %s\n", strerror(errno));
+    free(client);
+    return REACTOR_CLOSE;
+  }
+  client->fd = reactor->fds.items[conn->index].fd;
+
+  // Acknowledge on the socket: the rings are served from now on
+  if (write(client->fd, "K", 1) != 1) {
+    shm_channel_close(&client->channel);
+    free(client);
+    return REACTOR_CLOSE;
   }
+  printf("Shared memory channel attached (2 x %zu bytes)\n",
+         client->channel.ring_size);
 
-  // Restore old signal
-  act.sa_handler = SIG_DFL;
-  sigemptyset(&act.sa_mask);
-  act.sa_flags = 0;
-  sigaction(sig, &act, NULL);
+  pthread_mutex_lock(&shm->lock);
+  da_append(&shm->pending, client);
+  atomic_store_explicit(&shm->has_pending, true, memory_order_release);
+  pthread_mutex_unlock(&shm->lock);
+  if (write(shm->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+    eprintf("Error write failed: %s\n", strerror(errno));
+  }
+  return REACTOR_DETACH;
+}
 
-  // Resend the signal
-  kill(getpid(), sig);
+/**
+ * @brief Echo handler: accept callback
+ *
+ */
+int echo_accept(s_reactor *reactor, s_conn *conn) {
+  // Display addr of connected
+  printf("Connection from %s\n", reactor_peer_name(reactor, conn));
+  return 0;
 }
 
 /**
- * @brief Register signals
+ * @brief Echo handler: send the data back to the client
+ *
+ * Each chunk read is sent back as is, unless a framing is configured: then
+ * only complete frames are answered and a partial frame stays in the read
+ * buffer until the rest arrives. The replies are views of the read buffer,
+ * written by the reactor at the end of the loop iteration, a pipelined batch
+ * of frames costing one writev. A local client may instead ask for the shared
+ * memory transport, the connection is then handed over to the shared memory
+ * thread.
  *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param data unconsumed bytes of the read buffer
+ * @param size number of unconsumed bytes
+ * @return ssize_t bytes consumed, REACTOR_CLOSE or REACTOR_DETACH
  */
-void register_signal() {
-  struct sigaction act;
+ssize_t echo_data(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  s_loop *loop = reactor->arg;
+  s_context *ctx = loop->ctx;
+  s_config *config = &ctx->config;
+  size_t consumed = 0;
+  size_t frames = 0;
+
+  if (conn->npassed != 0) {
+    return attach_shm(ctx, reactor, conn, size);
+  }
+  if (config->framing == FRAMING_NONE) {
+    reactor_send(reactor, conn, data, size);
+    return size;
+  }
+
+  while (true) {
+    size_t length = 0;
+    e_frame status = frame_next(config->framing, data + consumed,
+                                size - consumed, config->max_frame, &length);
 
-  sigemptyset(&act.sa_mask);
+    if (status == FRAME_INCOMPLETE) {
+      break;
+    }
+    if (status == FRAME_TOO_LARGE) {
+      printf("Connection from %s sent a frame over %zu bytes\n",
+             reactor_peer_name(reactor, conn), config->max_frame);
+      return REACTOR_CLOSE;
+    }
+    // The reply is the frame itself
+    reactor_send(reactor, conn, data + consumed, length);
+    consumed += length;
+    frames++;
+  }
 
-  act.sa_handler = handle_signal;
-  act.sa_flags = SA_SIGINFO;
+  if (frames > 0) {
+    counter_add(&loop->stats.frames, frames);
+    histogram_record(&loop->stats.frames_per_write, frames);
+  }
+  return consumed;
+}
 
-  sigaction(SIGINT, &act, NULL);
-  sigaction(SIGTERM, &act, NULL);
-  sigaction(SIGSEGV, &act, NULL);
+/**
+ * @brief Echo handler: log the end of a connection
+ *
+ */
+void echo_close(s_reactor *reactor, s_conn *conn, e_reactor_close reason) {
+  s_reactor_stats *stats = &reactor->stats;
+  const char *name = NULL;
 
-  return;
+  switch (reason) {
+  case REACTOR_DETACHED:
+    printf("Connection from %s moved to shared memory\n",
+           reactor_peer_name(reactor, conn));
+    return;
+  case REACTOR_EVICT_IDLE:
+    name = "idle timeout";
+    break;
+  case REACTOR_EVICT_WRITE_STALL:
+    name = "write stall timeout";
+    break;
+  case REACTOR_EVICT_LIFETIME:
+    name = "max lifetime";
+    break;
+  case REACTOR_DRAINED:
+    printf("Connection from %s drained\n", reactor_peer_name(reactor, conn));
+    return;
+  case REACTOR_CLOSED:
+    break;
+  }
+  if (name != NULL) {
+    printf("Connection from %s evicted (%s), evictions: idle=%llu "
+           "write_stall=%llu lifetime=%llu\n",
+           reactor_peer_name(reactor, conn), name,
+           (unsigned long long)counter_get(&stats->evicted_idle),
+           (unsigned long long)counter_get(&stats->evicted_write_stall),
+           (unsigned long long)counter_get(&stats->evicted_lifetime));
+  }
+  printf("Connection from %s closed\n", reactor_peer_name(reactor, conn));
 }
 
+const s_reactor_handler echo_handler = {
+    .on_accept = echo_accept,
+    .on_data = echo_data,
+    .on_close = echo_close,
+};
+
 /**
- * @brief Simply echo the data back to the client
+ * @brief Warn if the kernel does not accept Fast Open on servers
  *
- * @param fd file descriptor
- * @return int 0 if success, 1 if connection closed
+ * Servers need bit 2 of net.ipv4.tcp_fastopen, the default (1) only enables
+ * clients: the listener then completes a normal handshake.
  */
-int echo_server(int fd) {
-  int readed = 0;
-  int writed = 0;
-  char buffer[BUFF_SIZE];
-  readed = read(fd, buffer, BUFF_SIZE);
-  if (readed == 0) {
-    return 1; // Connection closed
-  } else if (readed == -1) {
-    eprintf("Error read failed: %s\n", strerror(errno));
-    return 1;
-  } else {
-    writed = write(fd, buffer, readed);
-    if (writed == -1) {
-      eprintf("Error write failed: %s\n", strerror(errno));
-      return 1;
-    }
+void check_fastopen() {
+  FILE *file = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+  int mode = 0;
+
+  if (file == NULL) {
+    return;
   }
-  return 0;
+  if (fscanf(file, "%d", &mode) == 1 && !(mode & 2)) {
+    eprintf("Warning net.ipv4.tcp_fastopen is %d, server Fast Open needs "
+            "bit 2 (e.g. sysctl -w net.ipv4.tcp_fastopen=3)\n",
+            mode);
+  }
+  fclose(file);
 }
 
 /**
  * @brief Initialize the server
  *
+ * @param ctx server context
+ * @param reuseport join the SO_REUSEPORT group of the port (one listener per
+ * worker)
  * @return int file descriptor of the server
  */
-int init_server(s_context *ctx) {
-  struct sockaddr_in addr;
+int init_server(s_context *ctx, bool reuseport) {
+  struct sockaddr_storage addr = {0};
+  socklen_t addr_size;
+  int family = ctx->config.ipv6 ? AF_INET6 : AF_INET;
   int sockopt = 1;
+  int v6only = 0;
   int fd = 0;
 
+  // Already bound and listening in the replaced server
+  fd = take_socket(ctx, HANDOFF_LISTENER);
+  if (fd != -1) {
+    if (!reuseport) {
+      printf("Server handed over on port %d\n", ctx->config.port);
+    }
+    return fd;
+  }
+
   // Create socket
-  fd = socket(AF_INET, SOCK_STREAM, 0);
+  fd = socket(family, SOCK_STREAM, 0);
   if (fd == -1) {
     eprintf("Error socket failed: %s\n", strerror(errno));
     return -1;
   }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sockopt, sizeof(sockopt))) {
+  // An IPv6 listener also accepts IPv4 clients (::ffff:a.b.c.d)
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sockopt, sizeof(sockopt)) ||
+      (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &sockopt,
+                               sizeof(sockopt))) ||
+      (family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                                        &v6only, sizeof(v6only)))) {
     eprintf("Error setsockopt failed: %s\n", strerror(errno));
-    cleanup(ctx);
+    close(fd);
     return -1;
   }
 
   // Setup the server
-  memset(&addr, '0', sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  addr.sin_port = htons(SERVER_PORT);
+  if (family == AF_INET6) {
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+
+    in6->sin6_family = AF_INET6;
+    in6->sin6_addr = in6addr_any;
+    in6->sin6_port = htons(ctx->config.port);
+    addr_size = sizeof(*in6);
+  } else {
+    struct sockaddr_in *in = (struct sockaddr_in *)&addr;
 
-  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_ANY);
+    in->sin_port = htons(ctx->config.port);
+    addr_size = sizeof(*in);
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, addr_size) != 0) {
     eprintf("Error bind failed: %s\n", strerror(errno));
-    cleanup(ctx);
+    close(fd);
     return -1;
   };
 
-  listen(fd, 10);
-  printf("Server started on port %d\n", (int)SERVER_PORT);
+  // The first request usually comes with the connection: the reactor reads
+  // it right after accept (read_on_accept)
+  if ((ctx->config.defer_accept &&
+       setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &ctx->config.defer_accept,
+                  sizeof(ctx->config.defer_accept))) ||
+      (ctx->config.fastopen &&
+       setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &ctx->config.fastopen,
+                  sizeof(ctx->config.fastopen)))) {
+    eprintf("Error setsockopt failed: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  listen(fd, REACTOR_BACKLOG);
+  if (!reuseport) {
+    printf("Server started on port %d\n", ctx->config.port);
+    if (ctx->config.fastopen) {
+      check_fastopen();
+    }
+  }
 
   return fd;
 }
 
 /**
- * @brief run the server
+ * @brief Get the GRO segment size of a received datagram
+ *
+ * @return uint16_t segment size, 0 if the datagram was not coalesced
+ */
+uint16_t udp_gro_size(struct msghdr *msg) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int size;
+      memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+      return size;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief UDP shard thread: echo datagrams back in batches
+ *
+ * Each recvmmsg waits for one datagram then takes every datagram already
+ * queued (up to the batch size), and all of them are echoed with as few
+ * sendmmsg calls as possible. With GRO, a buffer may hold several segments of
+ * the same flow, echoed in one send with a UDP_SEGMENT (GSO) control message.
  *
- * @return int
+ * @param arg the shard
  */
-int run_server(s_context *ctx) {
+void *udp_shard_thread(void *arg) {
+  s_udp_shard *shard = arg;
+  s_udp_stats *stats = &shard->stats;
+  size_t batch = shard->batch;
+  size_t ctrl_size = CMSG_SPACE(sizeof(int));
+  struct mmsghdr *msgs = calloc(batch, sizeof(struct mmsghdr));
+  struct iovec *iovs = calloc(batch, sizeof(struct iovec));
+  struct sockaddr_in *addrs = calloc(batch, sizeof(struct sockaddr_in));
+  char *ctrls = calloc(batch, ctrl_size);
+  char *buffers = malloc(batch * UDP_BUFF_SIZE);
+
+  assert(msgs != NULL && iovs != NULL && addrs != NULL && ctrls != NULL &&
+         buffers != NULL && "Maybe you should buy more RAM");
+
+  if (shard->cpu != -1) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  for (size_t i = 0; i < batch; i++) {
+    iovs[i].iov_base = buffers + i * UDP_BUFF_SIZE;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+  }
+
   while (true) {
-    s_da_fd *fds = ctx->fds;
-    s_da_addr *addrs = ctx->addrs;
-    char *ip = NULL;
-    int connfd = 0;
-    int poll_status = 0;
-    struct sockaddr_in client_addr;
-    socklen_t client_size = sizeof(client_addr);
-
-    poll_status = poll(fds->items, fds->count, -1); // Wait indefinitely
-
-    if (poll_status == -1) {
-      eprintf("Error poll failed: %s\n", strerror(errno));
-      return -1;
+    int received;
+    size_t sent = 0;
+    uint64_t bytes = 0;
+
+    for (size_t i = 0; i < batch; i++) {
+      iovs[i].iov_len = UDP_BUFF_SIZE;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      msgs[i].msg_hdr.msg_control = shard->gro ? ctrls + i * ctrl_size : NULL;
+      msgs[i].msg_hdr.msg_controllen = shard->gro ? ctrl_size : 0;
+      msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    received = recvmmsg(shard->fd, msgs, batch, MSG_WAITFORONE, NULL);
+    if (received == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      eprintf("Error recvmmsg failed: %s\n", strerror(errno));
+      break;
     }
 
-    // Echo server
-    for (size_t i = 1; i < fds->count; i++) {
-      if (fds->items[i].revents & POLLIN) {
-        if (echo_server(fds->items[i].fd)) {
-          ip = inet_ntoa(addrs->items[i - 1].sin_addr);
-          printf("Connection from %s, port %d closed\n", ip,
-                 ntohs(addrs->items[i - 1].sin_port));
+    // Reply to each datagram with its own content
+    for (int i = 0; i < received; i++) {
+      struct msghdr *hdr = &msgs[i].msg_hdr;
+      uint16_t gso_size = shard->gro ? udp_gro_size(hdr) : 0;
+
+      iovs[i].iov_len = msgs[i].msg_len;
+      bytes += msgs[i].msg_len;
+      if (gso_size && msgs[i].msg_len > gso_size) {
+        struct cmsghdr *cmsg;
+
+        // Send the coalesced segments back with the same segmentation
+        hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        cmsg = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+        counter_add(&stats->coalesced, 1);
+      } else {
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+      }
+    }
 
-          close(fds->items[i].fd);
+    counter_add(&stats->batches, 1);
+    counter_add(&stats->datagrams_in, received);
+    counter_add(&stats->bytes_in, bytes);
+    histogram_record(&stats->batch_fill, received);
+    TRACE_PROBE3(echo, udp_batch, shard->fd, received, bytes);
 
-          // Remove doesn't preserve order but we remove at same
-          // time so it should be fine.
-          da_fast_remove(fds, i--);
-          da_fast_remove(addrs, i);
+    while (sent < (size_t)received) {
+      int count = sendmmsg(shard->fd, msgs + sent, received - sent, 0);
+      if (count == -1) {
+        if (errno == EINTR) {
+          continue;
         }
+        // Drop the datagram that failed and go on with the rest
+        counter_add(&stats->send_errors, 1);
+        sent++;
+        continue;
+      }
+      for (int i = 0; i < count; i++) {
+        counter_add(&stats->bytes_out, msgs[sent + i].msg_len);
       }
+      counter_add(&stats->datagrams_out, count);
+      sent += count;
+    }
+  }
+
+  free(buffers);
+  free(ctrls);
+  free(addrs);
+  free(iovs);
+  free(msgs);
+  return NULL;
+}
+
+/**
+ * @brief Start the UDP echo shards
+ *
+ * Every shard has its own SO_REUSEPORT socket bound to the server port, so the
+ * kernel spreads the flows across them, and its own thread pinned to a CPU.
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int init_udp(s_context *ctx) {
+  s_config *config = &ctx->config;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (!config->udp) {
+    return 0;
+  }
+
+  ctx->udp = calloc(config->udp_threads, sizeof(s_udp_shard));
+  assert(ctx->udp != NULL && "Maybe you should buy more RAM");
+
+  for (size_t i = 0; i < config->udp_threads; i++) {
+    s_udp_shard *shard = &ctx->udp[i];
+    struct sockaddr_in addr = {0};
+    pthread_t thread;
+    int sockopt = 1;
+
+    shard->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (shard->fd == -1) {
+      eprintf("Error socket failed: %s\n", strerror(errno));
+      return -1;
+    }
+    if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, &sockopt,
+                   sizeof(sockopt))) {
+      eprintf("Error setsockopt failed: %s\n", strerror(errno));
+      return -1;
+    }
+    shard->gro = config->udp_gro;
+    if (shard->gro && setsockopt(shard->fd, SOL_UDP, UDP_GRO, &sockopt,
+                                 sizeof(sockopt))) {
+      eprintf("Warning UDP GRO not available: %s\n", strerror(errno));
+      shard->gro = false;
     }
 
-    // Check if we have an incoming connection
-    if (fds->items[0].revents & POLLIN) {
-      connfd = accept(fds->items[0].fd, (struct sockaddr *)&client_addr,
-                      &client_size);
-      ip = inet_ntoa(client_addr.sin_addr);
-      // Display addr of connected
-      printf("Connection from %s, port %d\n", ip, ntohs(client_addr.sin_port));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(config->port);
+    if (bind(shard->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      eprintf("Error bind failed: %s\n", strerror(errno));
+      return -1;
+    }
 
-      register_client(fds, connfd);
-      da_append(addrs, client_addr);
+    shard->batch = config->udp_batch;
+    shard->cpu = cpus > 0 ? (int)(i % cpus) : -1;
+    if (pthread_create(&thread, NULL, udp_shard_thread, shard) != 0) {
+      eprintf("Error pthread_create failed\n");
+      return -1;
     }
+    pthread_detach(thread);
   }
+
+  printf("UDP echo on port %d (%zu shards, batch %zu%s)\n", config->port,
+         config->udp_threads, config->udp_batch,
+         config->udp_gro ? ", GRO/GSO" : "");
   return 0;
 }
 
-int main() {
-  s_da_fd fds = {0};
-  s_da_addr addrs = {0};
+/**
+ * @brief Detach a shared memory client (its socket was closed)
+ *
+ */
+void shm_detach(s_shm_server *shm, s_shm_client *client) {
+  shm_channel_close(&client->channel);
+  close(client->fd);
+  free(client);
+  counter_add(&shm->stats.detached, 1);
+  printf("Shared memory channel detached\n");
+}
+
+/**
+ * @brief Sleep until a client writes, frees space or disconnects
+ *
+ * The sleeping flags are published before the rings are checked one last
+ * time, so a client writing meanwhile either is seen here or sees the flag
+ * and signals the eventfd (see shm_ring.h).
+ *
+ * @param shm shared memory server
+ * @param clients served clients
+ * @param pfds poll array (scratch)
+ */
+void shm_sleep(s_shm_server *shm, s_da_shm *clients, s_da_fd *pfds) {
+  bool ready = false;
+  uint64_t value;
+
+  da_for_unsafe(clients, i) {
+    shm_sleep_prepare(&clients->items[i]->channel.header->server_sleeping);
+  }
+  da_for_unsafe(clients, i) {
+    s_shm_channel *channel = &clients->items[i]->channel;
+    s_shm_header *header = channel->header;
+    if (shm_ring_readable(&header->to_server) &&
+        shm_ring_writable(&header->to_client, channel->ring_size)) {
+      ready = true;
+    }
+  }
+
+  if (!ready &&
+      !atomic_load_explicit(&shm->has_pending, memory_order_acquire)) {
+    // Entry 0 is the wake eventfd, then the eventfd and socket of each client
+    da_clear(pfds);
+    da_append(pfds, ((struct pollfd){.fd = shm->wake_fd, .events = POLLIN}));
+    da_for_unsafe(clients, i) {
+      s_shm_client *client = clients->items[i];
+      struct pollfd efd = {.fd = client->channel.server_efd, .events = POLLIN};
+      struct pollfd sock = {.fd = client->fd, .events = POLLIN};
+      da_append(pfds, efd);
+      da_append(pfds, sock);
+    }
+    counter_add(&shm->stats.sleeps, 1);
+    if (poll(pfds->items, pfds->count, -1) > 0) {
+      if (pfds->items[0].revents & POLLIN) {
+        (void)!read(shm->wake_fd, &value, sizeof(value));
+      }
+      // Backwards: a removed client is replaced by one already visited
+      for (size_t i = clients->count; i-- > 0;) {
+        s_shm_client *client = clients->items[i];
+        struct pollfd *efd = &pfds->items[1 + 2 * i];
+        struct pollfd *sock = &pfds->items[2 + 2 * i];
+        char byte;
+
+        if (efd->revents & POLLIN) {
+          (void)!read(client->channel.server_efd, &value, sizeof(value));
+        }
+        // Nothing is expected on the socket: data, EOF or an error (reset
+        // peer) detaches
+        if (sock->revents & (POLLERR | POLLHUP | POLLNVAL) ||
+            (sock->revents & POLLIN &&
+             (recv(client->fd, &byte, 1, MSG_DONTWAIT) != -1 ||
+              (errno != EAGAIN && errno != EWOULDBLOCK)))) {
+          shm_sleep_done(&client->channel.header->server_sleeping);
+          shm_detach(shm, client);
+          da_fast_remove_unsafe(clients, i);
+        }
+      }
+    }
+  }
+
+  da_for_unsafe(clients, i) {
+    shm_sleep_done(&clients->items[i]->channel.header->server_sleeping);
+  }
+}
+
+/**
+ * @brief Shared memory thread: echo the rings of all the local clients
+ *
+ * Echo copies each client's to_server ring into its to_client ring. The
+ * thread spins while data moves and for a while after the last byte, so a
+ * client in a request/response exchange is served without any syscall, then
+ * sleeps until a client signals it. The spin time follows how fast the
+ * clients send again, up to the configured spin time.
+ *
+ * @param arg shared memory server
+ */
+void *shm_thread(void *arg) {
+  s_shm_server *shm = arg;
+  s_da_shm clients = {0};
+  s_da_fd pfds = {0};
+  uint64_t idle_ns = 0; // time of the last byte moved (0 while busy)
+
+  while (true) {
+    size_t moved = 0;
+
+    if (atomic_load_explicit(&shm->has_pending, memory_order_acquire)) {
+      pthread_mutex_lock(&shm->lock);
+      da_append_many(&clients, shm->pending.items, shm->pending.count);
+      da_clear(&shm->pending);
+      atomic_store_explicit(&shm->has_pending, false, memory_order_relaxed);
+      pthread_mutex_unlock(&shm->lock);
+      counter_set(&shm->stats.attached, counter_get(&shm->stats.detached) +
+                                            clients.count);
+    }
+
+    da_foreach_unsafe(&clients, item) {
+      s_shm_channel *channel = &(*item)->channel;
+      s_shm_header *header = channel->header;
+      size_t n = shm_ring_transfer(&header->to_server, channel->to_server,
+                                   &header->to_client, channel->to_client,
+                                   channel->ring_size);
+      if (n > 0) {
+        moved += n;
+        // The client may sleep waiting for its echo or for free space
+        if (shm_notify(&header->client_sleeping, channel->client_efd)) {
+          counter_add(&shm->stats.wakeups, 1);
+        }
+      }
+    }
+
+    if (moved > 0) {
+      counter_add(&shm->stats.bytes, moved);
+      idle_ns = 0;
+      continue;
+    }
+    if (idle_ns == 0) {
+      idle_ns = now_ns();
+    }
+    if (now_ns() - idle_ns < shm->spin.spin_ns) {
+      shm_cpu_relax();
+      continue;
+    }
+    shm_sleep(shm, &clients, &pfds);
+    shm_spin_update(&shm->spin, now_ns() - idle_ns);
+    idle_ns = 0;
+  }
+
+  da_free(&pfds);
+  da_free(&clients);
+  return NULL;
+}
+
+/**
+ * @brief Start the local listener (Unix socket) and the shared memory thread
+ *
+ * Local clients skip the TCP/IP stack. A local client may also pass a shared
+ * memory channel on its socket (see shm_ring.h) to be echoed by the shared
+ * memory thread without any syscall on the fast path.
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int init_local(s_context *ctx) {
+  s_config *config = &ctx->config;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  s_shm_server *shm;
+  pthread_t thread;
   int fd;
 
-  ctx = malloc(sizeof(s_context));
+  if (config->unix_path == NULL) {
+    return 0;
+  }
+  if (strlen(config->unix_path) >= sizeof(addr.sun_path)) {
+    eprintf("Error unix socket path too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, config->unix_path);
 
-  ctx->fds = &fds;
-  ctx->addrs = &addrs;
+  // The path is only replaced without a socket from the replaced server
+  fd = take_socket(ctx, HANDOFF_UNIX);
+  if (fd == -1) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+      eprintf("Error socket failed: %s\n", strerror(errno));
+      return -1;
+    }
+    unlink(config->unix_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      eprintf("Error bind failed: %s\n", strerror(errno));
+      close(fd);
+      return -1;
+    }
+    listen(fd, REACTOR_BACKLOG);
+  }
+  reactor_add_listener(&ctx->loop.reactor, fd);
 
-  // Initialize the server
-  fd = init_server(ctx);
+  shm = calloc(1, sizeof(s_shm_server));
+  assert(shm != NULL && "Maybe you should buy more RAM");
+  pthread_mutex_init(&shm->lock, NULL);
+  shm_spin_init(&shm->spin, config->shm_spin_us * 1000);
+  shm->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (shm->wake_fd == -1) {
+    eprintf("Error eventfd failed: %s\n", strerror(errno));
+    free(shm);
+    return -1;
+  }
+  ctx->shm = shm;
+  if (pthread_create(&thread, NULL, shm_thread, shm) != 0) {
+    eprintf("Error pthread_create failed\n");
+    return -1;
+  }
+  pthread_detach(thread);
 
-  // Register the server
-  register_server(&fds, fd);
+  printf("Local echo on unix:%s (shared memory spin %lluus)\n",
+         config->unix_path, (unsigned long long)config->shm_spin_us);
+  return 0;
+}
 
-  // Create a signal handler
-  register_signal();
+/**
+ * @brief Worker thread: serve the connections handed by the acceptor
+ *
+ * @param arg worker event loop
+ */
+void *worker_thread(void *arg) {
+  s_loop *loop = arg;
+  cpu_set_t set;
 
-  // Run the server
-  run_server(ctx);
+  CPU_ZERO(&set);
+  CPU_SET(loop->cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    eprintf("Warning cannot pin a worker to CPU %d\n", loop->cpu);
+  }
+  reactor_run(&loop->reactor);
+  return NULL;
+}
 
-  // Cleanup
-  cleanup(ctx);
+/**
+ * @brief Create the worker event loops (started by `start_workers`)
+ *
+ * The event loop becomes an acceptor: it keeps the listeners and enforces
+ * the connection and buffer limits on the sum of the workers, each accepted
+ * connection being handed to a worker pinned to its own CPU. With
+ * --reuseport, every worker instead accepts its TCP connections on its own
+ * SO_REUSEPORT listener, the acceptor only keeping the Unix socket.
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int init_workers(s_context *ctx) {
+  s_config *config = &ctx->config;
+  s_reactor_config worker_config = config->reactor;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  s_reactor **reactors;
+  int fd = -1;
+
+  if (config->workers == 0) {
+    return 0;
+  }
+
+  // Only the acceptor pauses accepting, unless the workers accept: then
+  // each one gets its share of the limits
+  worker_config.max_connections = 0;
+  worker_config.max_buffered = 0;
+  if (config->reuseport != REUSEPORT_OFF) {
+    worker_config.max_connections =
+        (config->reactor.max_connections + config->workers - 1) /
+        config->workers;
+    worker_config.max_buffered =
+        (config->reactor.max_buffered + config->workers - 1) / config->workers;
+  }
+  ctx->workers = calloc(config->workers, sizeof(s_loop));
+  reactors = calloc(config->workers, sizeof(s_reactor *));
+  assert(ctx->workers != NULL && reactors != NULL &&
+         "Maybe you should buy more RAM");
+  for (size_t i = 0; i < config->workers; i++) {
+    s_loop *loop = &ctx->workers[i];
+
+    loop->ctx = ctx;
+    loop->cpu = cpus > 0 ? (int)(i % cpus) : 0;
+    reactor_init(&loop->reactor, &worker_config, &echo_handler, loop);
+    loop->reactor.cpu = loop->cpu;
+    reactors[i] = &loop->reactor;
+
+    // Listening in worker order: socket i of the group is worker i
+    if (config->reuseport != REUSEPORT_OFF) {
+      fd = init_server(ctx, true);
+      if (fd == -1) {
+        free(reactors);
+        return -1;
+      }
+      reactor_add_listener(&loop->reactor, fd);
+    }
+  }
+  reactor_set_workers(&ctx->loop.reactor, reactors, config->workers,
+                      config->balance);
+  if (config->reuseport == REUSEPORT_CPU &&
+      reactor_steer_cpu(reactors, config->workers, fd) != 0) {
+    eprintf("Warning reuseport CPU program refused: %s\n", strerror(errno));
+  }
+  free(reactors);
+
+  for (size_t i = 0; i < config->workers && config->reactor.busy_poll_us;
+       i++) {
+    reactor_busy_poll(&ctx->workers[i].reactor);
+  }
+  if (config->reuseport != REUSEPORT_OFF) {
+    printf("Server started on port %d, %zu workers (SO_REUSEPORT, %s "
+           "steering)\n",
+           config->port, config->workers, reuseport_names[config->reuseport]);
+  } else {
+    printf("%zu workers (%s balancing)\n", config->workers,
+           balance_names[config->balance]);
+  }
+  return 0;
+}
+
+/**
+ * @brief Start the worker threads, also after a failed hot upgrade
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int start_workers(s_context *ctx) {
+  for (size_t i = 0; i < ctx->config.workers; i++) {
+    s_loop *loop = &ctx->workers[i];
+
+    if (pthread_create(&loop->thread, NULL, worker_thread, loop) != 0) {
+      eprintf("Error pthread_create failed\n");
+      return -1;
+    }
+  }
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Stop the worker threads, their connections stay open
+ *
+ */
+void stop_workers(s_context *ctx) {
+  for (size_t i = 0; i < ctx->config.workers; i++) {
+    // Every worker has an inbox (reactor_set_workers), reactor_stop wakes it
+    reactor_stop(&ctx->workers[i].reactor);
+    pthread_join(ctx->workers[i].thread, NULL);
+  }
+}
+
+/**
+ * @brief Set up the busy poll mode of the event loop
+ *
+ * Pins the calling thread (the event loop) to its CPU, so spinning never
+ * migrates and keeps its caches warm, and enables SO_BUSY_POLL on the
+ * listener and every TCP client. Must run after the other threads are
+ * started: they would inherit the affinity.
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int init_busy_poll(s_context *ctx) {
+  s_config *config = &ctx->config;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int cpu = config->loop_cpu;
+
+  if (config->reactor.busy_poll_us == 0) {
+    return 0;
+  }
+
+  // By default the last CPU, the first one usually takes more interrupts
+  if (cpu == -1 && cpus > 0) {
+    cpu = (int)cpus - 1;
+  }
+  if (cpu != -1) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      eprintf("Error cannot pin the event loop to CPU %d\n", cpu);
+      return -1;
+    }
+  }
+
+  if (reactor_busy_poll(&ctx->loop.reactor) != 0) {
+    // Raising it above net.core.busy_read needs CAP_NET_ADMIN
+    eprintf("Warning SO_BUSY_POLL not available: %s\n", strerror(errno));
+  }
+
+  printf("Busy poll: spin %lluus before blocking, event loop on CPU %d%s\n",
+         (unsigned long long)config->reactor.busy_poll_us, cpu,
+         ctx->loop.reactor.busy_poll ? ", SO_BUSY_POLL" : "");
+  return 0;
+}
+
+/**
+ * @brief Write the shared memory statistics in the Prometheus text format
+ *
+ * @param ctx server context
+ * @param file output file
+ */
+void write_shm_stats(s_context *ctx, FILE *file) {
+  s_shm_stats *stats = &ctx->shm->stats;
+  uint64_t attached = counter_get(&stats->attached);
+  uint64_t detached = counter_get(&stats->detached);
+
+  metric_print(file, "echo_shm_channels_active", "gauge",
+               "Shared memory channels served.",
+               attached > detached ? attached - detached : 0);
+  metric_print(file, "echo_shm_bytes_total", "counter",
+               "Bytes echoed through shared memory.",
+               counter_get(&stats->bytes));
+  metric_print(file, "echo_shm_wakeups_total", "counter",
+               "Eventfd signals sent to sleeping clients.",
+               counter_get(&stats->wakeups));
+  metric_print(file, "echo_shm_sleeps_total", "counter",
+               "Times the shared memory thread slept.",
+               counter_get(&stats->sleeps));
+}
+
+/**
+ * @brief Write the UDP shards statistics in the Prometheus text format
+ *
+ * @param ctx server context
+ * @param file output file
+ */
+void write_udp_stats(s_context *ctx, FILE *file) {
+  s_histogram fill = {0};
+
+  // Counters are exported per shard, the batch fill histogram is merged
+  fprintf(file, "# HELP echo_udp_datagrams_total Datagrams received and "
+                "echoed.\n# TYPE echo_udp_datagrams_total counter\n");
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    s_udp_stats *stats = &ctx->udp[i].stats;
+    fprintf(file,
+            "echo_udp_datagrams_total{shard=\"%zu\",direction=\"in\"} "
+            "%llu\n"
+            "echo_udp_datagrams_total{shard=\"%zu\",direction=\"out\"} "
+            "%llu\n",
+            i, (unsigned long long)counter_get(&stats->datagrams_in), i,
+            (unsigned long long)counter_get(&stats->datagrams_out));
+  }
+  fprintf(file, "# HELP echo_udp_bytes_total Bytes received and echoed.\n"
+                "# TYPE echo_udp_bytes_total counter\n");
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    s_udp_stats *stats = &ctx->udp[i].stats;
+    fprintf(file,
+            "echo_udp_bytes_total{shard=\"%zu\",direction=\"in\"} %llu\n"
+            "echo_udp_bytes_total{shard=\"%zu\",direction=\"out\"} %llu\n",
+            i, (unsigned long long)counter_get(&stats->bytes_in), i,
+            (unsigned long long)counter_get(&stats->bytes_out));
+  }
+  fprintf(file, "# HELP echo_udp_batches_total Receive batches.\n"
+                "# TYPE echo_udp_batches_total counter\n");
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    fprintf(file, "echo_udp_batches_total{shard=\"%zu\"} %llu\n", i,
+            (unsigned long long)counter_get(&ctx->udp[i].stats.batches));
+  }
+  fprintf(file, "# HELP echo_udp_gro_coalesced_total GRO buffers holding "
+                "several segments.\n"
+                "# TYPE echo_udp_gro_coalesced_total counter\n");
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    fprintf(file, "echo_udp_gro_coalesced_total{shard=\"%zu\"} %llu\n", i,
+            (unsigned long long)counter_get(&ctx->udp[i].stats.coalesced));
+  }
+  fprintf(file, "# HELP echo_udp_send_errors_total Datagrams dropped by "
+                "sendmmsg.\n# TYPE echo_udp_send_errors_total counter\n");
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    fprintf(file, "echo_udp_send_errors_total{shard=\"%zu\"} %llu\n", i,
+            (unsigned long long)counter_get(&ctx->udp[i].stats.send_errors));
+  }
+
+  for (size_t i = 0; i < ctx->config.udp_threads; i++) {
+    histogram_merge(&fill, &ctx->udp[i].stats.batch_fill);
+  }
+  metric_print(file, "echo_udp_batch_size", "gauge",
+               "Maximum datagrams per batch.", ctx->config.udp_batch);
+  histogram_print(file, "echo_udp_batch_fill", "Datagrams per receive batch.",
+                  &fill, 1, 11);
+}
+
+/**
+ * @brief Write the per worker statistics in the Prometheus text format
+ *
+ * @param ctx server context
+ * @param file output file
+ */
+void write_worker_stats(s_context *ctx, FILE *file) {
+  fprintf(file, "# HELP echo_worker_connections Connections served by a "
+                "worker.\n# TYPE echo_worker_connections gauge\n");
+  for (size_t i = 0; i < ctx->config.workers; i++) {
+    s_reactor_stats *stats = &ctx->workers[i].reactor.stats;
+    uint64_t accepted = counter_get(&stats->accepted);
+    uint64_t closed = counter_get(&stats->closed);
+
+    fprintf(file, "echo_worker_connections{worker=\"%zu\"} %llu\n", i,
+            (unsigned long long)(accepted > closed ? accepted - closed : 0));
+  }
+  fprintf(file, "# HELP echo_worker_bytes_total Bytes read and written by a "
+                "worker.\n# TYPE echo_worker_bytes_total counter\n");
+  for (size_t i = 0; i < ctx->config.workers; i++) {
+    s_reactor_stats *stats = &ctx->workers[i].reactor.stats;
+
+    fprintf(file, "echo_worker_bytes_total{worker=\"%zu\"} %llu\n", i,
+            (unsigned long long)(counter_get(&stats->bytes_in) +
+                                 counter_get(&stats->bytes_out)));
+  }
+}
+
+/**
+ * @brief Write the statistics in the Prometheus text format
+ *
+ * @param ctx server context
+ * @param file output file
+ */
+void write_stats(s_context *ctx, FILE *file) {
+  s_reactor_stats merged = {0};
+  s_reactor_stats *stats = &merged;
+  s_stats echo = {0};
+  uint64_t accepted;
+  uint64_t closed;
+
+  // The acceptor and the workers are exported as one server
+  for (size_t i = 0; i <= ctx->config.workers; i++) {
+    s_loop *loop = i == 0 ? &ctx->loop : &ctx->workers[i - 1];
+
+    reactor_stats_merge(&merged, &loop->reactor.stats);
+    counter_add(&echo.frames, counter_get(&loop->stats.frames));
+    histogram_merge(&echo.frames_per_write, &loop->stats.frames_per_write);
+  }
+  accepted = counter_get(&stats->accepted);
+  closed = counter_get(&stats->closed);
+
+  metric_print(file, "echo_connections_accepted_total", "counter",
+               "Connections accepted.", accepted);
+  metric_print(file, "echo_connections_closed_total", "counter",
+               "Connections closed.", closed);
+  metric_print(file, "echo_connections_active", "gauge",
+               "Connections currently open.",
+               accepted > closed ? accepted - closed : 0);
+  metric_print(file, "echo_connections_rejected_total", "counter",
+               "Connections closed at accept by the per address limit or a "
+               "full worker inbox.",
+               counter_get(&stats->rejected));
+  metric_print(file, "echo_accept_deferred_total", "counter",
+               "Times accepting was paused by a limit.",
+               counter_get(&stats->deferred));
+  metric_print(file, "echo_accept_paused", "gauge",
+               "1 while accepting is paused by a limit.",
+               counter_get(&stats->paused));
+  fprintf(file, "# HELP echo_evictions_total Connections closed by a "
+                "timeout.\n# TYPE echo_evictions_total counter\n");
+  fprintf(file, "echo_evictions_total{reason=\"idle\"} %llu\n",
+          (unsigned long long)counter_get(&stats->evicted_idle));
+  fprintf(file, "echo_evictions_total{reason=\"write_stall\"} %llu\n",
+          (unsigned long long)counter_get(&stats->evicted_write_stall));
+  fprintf(file, "echo_evictions_total{reason=\"lifetime\"} %llu\n",
+          (unsigned long long)counter_get(&stats->evicted_lifetime));
+  metric_print(file, "echo_drained_connections_total", "counter",
+               "Connections closed by a graceful drain (SIGTERM).",
+               counter_get(&stats->drained));
+  metric_print(file, "echo_received_bytes_total", "counter",
+               "Bytes read from the clients.", counter_get(&stats->bytes_in));
+  metric_print(file, "echo_sent_bytes_total", "counter",
+               "Bytes written to the clients.",
+               counter_get(&stats->bytes_out));
+  metric_print(file, "echo_buffered_bytes", "gauge",
+               "Output bytes pending on slow clients.",
+               counter_get(&stats->buffered));
+  metric_print(file, "echo_reads_total", "counter",
+               "Successful reads from the clients.",
+               counter_get(&stats->reads));
+  metric_print(file, "echo_read_buffer_allocs_total", "counter",
+               "Read buffers allocated, none was pooled.",
+               counter_get(&stats->buffer_allocs));
+  metric_print(file, "echo_read_buffer_pooled_bytes", "gauge",
+               "Bytes of the idle read buffers kept for reuse.",
+               counter_get(&stats->pooled_bytes));
+  metric_print(file, "echo_loop_wakeups_total", "counter",
+               "Event loop iterations.", counter_get(&stats->wakeups));
+  metric_print(file, "echo_poll_wait_seconds_total", "counter",
+               "Time spent waiting in poll.",
+               counter_get(&stats->poll_wait_ns) * 1e-9);
+  metric_print(file, "echo_processing_seconds_total", "counter",
+               "Time spent processing events.",
+               counter_get(&stats->processing_ns) * 1e-9);
+  metric_print(file, "echo_busy_polls_total", "counter",
+               "Non-blocking polls while busy polling.",
+               counter_get(&stats->spin_polls));
+  metric_print(file, "echo_busy_poll_hits_total", "counter",
+               "Wakeups served by busy polling.",
+               counter_get(&stats->spin_hits));
+  metric_print(file, "echo_blocking_waits_total", "counter",
+               "Blocking polls.", counter_get(&stats->blocking_waits));
+  if (ctx->config.framing != FRAMING_NONE) {
+    metric_print(file, "echo_frames_total", "counter", "Frames answered.",
+                 counter_get(&echo.frames));
+    metric_print(file, "echo_reply_writes_total", "counter",
+                 "Writes of gathered replies.", counter_get(&stats->writevs));
+    histogram_print(file, "echo_frames_per_write",
+                    "Frames answered per gathered write.",
+                    &echo.frames_per_write, 1, 12);
+  }
+  if (ctx->config.reactor.zerocopy != 0) {
+    metric_print(file, "echo_zerocopy_sends_total", "counter",
+                 "Replies sent with MSG_ZEROCOPY.",
+                 counter_get(&stats->zerocopy_sends));
+    metric_print(file, "echo_zerocopy_sent_bytes_total", "counter",
+                 "Bytes sent with MSG_ZEROCOPY.",
+                 counter_get(&stats->zerocopy_bytes));
+    metric_print(file, "echo_zerocopy_copied_total", "counter",
+                 "MSG_ZEROCOPY sends the kernel copied anyway (loopback).",
+                 counter_get(&stats->zerocopy_copied));
+  }
+  if (ctx->config.reactor.read_on_accept) {
+    metric_print(file, "echo_early_reads_total", "counter",
+                 "Connections with data read right after accept.",
+                 counter_get(&stats->early_reads));
+  }
+  histogram_print(file, "echo_reads_per_wakeup", "Reads per loop iteration.",
+                  &stats->reads_per_wakeup, 1, 12);
+  histogram_print(file, "echo_loop_iteration_seconds",
+                  "Processing time of a loop iteration.", &stats->loop_ns,
+                  1e-9, 31);
+  histogram_print(file, "echo_latency_seconds",
+                  "Time from wakeup to the echo being fully written.",
+                  &stats->latency_ns, 1e-9, 31);
+  if (ctx->workers != NULL) {
+    metric_print(file, "echo_cross_cpu_connections_total", "counter",
+                 "Connections served off the CPU that received them.",
+                 counter_get(&stats->cross_cpu));
+    metric_print(file, "echo_steered_connections_total", "counter",
+                 "Connections handed to the worker of their CPU at accept.",
+                 counter_get(&stats->steered));
+    write_worker_stats(ctx, file);
+  }
+  if (ctx->udp != NULL) {
+    write_udp_stats(ctx, file);
+  }
+  if (ctx->shm != NULL) {
+    write_shm_stats(ctx, file);
+  }
+}
+
+/**
+ * @brief Serve one scrape of the admin endpoint
+ *
+ * Answers any request (HTTP or a bare connection, e.g. from nc) with the
+ * statistics as an HTTP response.
+ *
+ * @param ctx server context
+ * @param fd admin client file descriptor
+ */
+void serve_admin(s_context *ctx, int fd) {
+  struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  char request[1024];
+  char *body = NULL;
+  size_t body_size = 0;
+  char header[128];
+  int header_size;
+  FILE *file;
+
+  // A slow scraper only ever delays this thread
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // Consume the request if there is one, do not wait for it otherwise
+  if (poll(&pfd, 1, 100) == 1) {
+    if (read(fd, request, sizeof(request)) == -1) {
+      return;
+    }
+  }
+
+  file = open_memstream(&body, &body_size);
+  if (file == NULL) {
+    return;
+  }
+  write_stats(ctx, file);
+  fclose(file);
+
+  header_size = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: %zu\r\n\r\n",
+                         body_size);
+  if (write(fd, header, header_size) == header_size) {
+    for (size_t sent = 0; sent < body_size;) {
+      ssize_t writed = write(fd, body + sent, body_size - sent);
+      if (writed <= 0) {
+        break;
+      }
+      sent += writed;
+    }
+  }
+  free(body);
+}
+
+/**
+ * @brief Admin thread: serve the statistics until the process exits
+ *
+ * @param arg server context
+ */
+void *admin_thread(void *arg) {
+  s_context *ctx = arg;
+
+  while (true) {
+    int fd = accept(ctx->admin_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      eprintf("Error admin accept failed: %s\n", strerror(errno));
+      return NULL;
+    }
+    serve_admin(ctx, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Start the admin endpoint (statistics) in its own thread
+ *
+ * The endpoint listens on 127.0.0.1:admin_port or on the admin_path Unix
+ * socket. The event loop never waits on it: the thread only reads the
+ * statistics counters.
+ *
+ * @return int 0 if success (or disabled), -1 on error
+ */
+int init_admin(s_context *ctx) {
+  s_config *config = &ctx->config;
+  pthread_t thread;
+  int sockopt = 1;
+  int fd;
+
+  if (config->admin_path != NULL) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (strlen(config->admin_path) >= sizeof(addr.sun_path)) {
+      eprintf("Error admin socket path too long\n");
+      return -1;
+    }
+    strcpy(addr.sun_path, config->admin_path);
+    fd = take_socket(ctx, HANDOFF_ADMIN);
+    if (fd == -1) {
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd == -1) {
+        eprintf("Error socket failed: %s\n", strerror(errno));
+        return -1;
+      }
+      unlink(config->admin_path);
+      if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        eprintf("Error admin bind failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+      }
+    }
+    printf("Statistics on unix:%s\n", config->admin_path);
+  } else if (config->admin_port) {
+    struct sockaddr_in addr = {0};
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config->admin_port);
+    fd = take_socket(ctx, HANDOFF_ADMIN);
+    if (fd == -1) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd == -1) {
+        eprintf("Error socket failed: %s\n", strerror(errno));
+        return -1;
+      }
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &sockopt, sizeof(sockopt));
+      if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        eprintf("Error admin bind failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+      }
+    }
+    printf("Statistics on http://127.0.0.1:%d/metrics\n", config->admin_port);
+  } else {
+    return 0;
+  }
+
+  listen(fd, 16);
+  ctx->admin_fd = fd;
+  if (pthread_create(&thread, NULL, admin_thread, ctx) != 0) {
+    eprintf("Error pthread_create failed\n");
+    close(fd);
+    ctx->admin_fd = -1;
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+/**
+ * @brief Receive the sockets of the server being replaced (hot upgrade)
+ *
+ * Only when started by `hot_upgrade`, before anything is bound: the
+ * listeners are then taken over (see take_socket) and the clients served
+ * again by `restore_clients`.
+ *
+ * @return int 0 if success (or not upgrading), -1 on error
+ */
+int receive_handoff(s_context *ctx) {
+  const char *env = getenv(HANDOFF_ENV);
+  s_handed handed;
+
+  if (env == NULL) {
+    return 0;
+  }
+  ctx->handoff_fd = atoi(env);
+  unsetenv(HANDOFF_ENV);
+  fcntl(ctx->handoff_fd, F_SETFD, FD_CLOEXEC);
+
+  do {
+    if (handoff_recv(ctx->handoff_fd, &handed.record, &handed.fd,
+                     &handed.data) != 0) {
+      eprintf("Error hot upgrade receive failed\n");
+      return -1;
+    }
+    da_append(&ctx->handed, handed);
+  } while (handed.record.kind != HANDOFF_END);
+  return 0;
+}
+
+/**
+ * @brief Serve the clients received from the replaced server, then let it
+ * exit
+ *
+ * Each client keeps its unconsumed input, its pending output and its age.
+ * With workers, the clients are spread round robin: must run before the
+ * workers are started.
+ *
+ * @return int 0 if success (or not upgrading), -1 on error
+ */
+int restore_clients(s_context *ctx) {
+  size_t restored = 0;
+
+  if (ctx->handoff_fd == -1) {
+    return 0;
+  }
+
+  da_for_unsafe(&ctx->handed, i) {
+    s_handed *handed = &ctx->handed.items[i];
+    s_handoff_record *record = &handed->record;
+    s_reactor *reactor = &ctx->loop.reactor;
+    s_conn *conn;
+
+    if (record->kind != HANDOFF_CLIENT) {
+      // Listener not taken over (different options)
+      if (handed->fd != -1) {
+        close(handed->fd);
+      }
+      continue;
+    }
+    if (ctx->config.workers > 0) {
+      reactor = &ctx->workers[restored % ctx->config.workers].reactor;
+    }
+    conn = reactor_add_client(reactor, handed->fd,
+                              record->local ? NULL : &record->addr);
+    reactor_conn_info(reactor, conn)->created_ms = record->created_ms;
+    if (record->in_size > 0) {
+      da_append_many(&conn->in, handed->data, record->in_size);
+    }
+    // A failed write shows as an error on the socket
+    if (record->out_size > 0) {
+      reactor_write(reactor, conn, handed->data + record->in_size,
+                    record->out_size);
+    }
+    free(handed->data);
+    restored++;
+  }
+  da_free(&ctx->handed);
+
+  // Not acknowledged: the replaced server timed out and serves again
+  if (handoff_ack(ctx->handoff_fd) != 0) {
+    eprintf("Error hot upgrade ack failed\n");
+    return -1;
+  }
+  close(ctx->handoff_fd);
+  ctx->handoff_fd = -1;
+  printf("Hot upgrade done, %zu connections taken over\n", restored);
+  return 0;
+}
+
+/**
+ * @brief Send the listeners and connections of a stopped event loop
+ *
+ * @param reactor the event loop
+ * @param sock hand off socket
+ * @param clients incremented by the connections sent
+ * @return int 0 if success, -1 on error
+ */
+int send_reactor(s_reactor *reactor, int sock, size_t *clients) {
+  for (size_t i = 0; i < reactor->listeners; i++) {
+    s_handoff_record record = {.kind = HANDOFF_LISTENER};
+    int fd = reactor->fds.items[i].fd;
+    int domain = AF_INET;
+    socklen_t size = sizeof(domain);
+
+    // The inbox eventfd and the signalfd stay with their reactor
+    if (!reactor_is_listener(reactor, i)) {
+      continue;
+    }
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &size) == 0 &&
+        domain == AF_UNIX) {
+      record.kind = HANDOFF_UNIX;
+    }
+    if (handoff_send(sock, &record, fd, NULL, NULL) != 0) {
+      return -1;
+    }
+  }
+
+  da_for_unsafe(&reactor->conns, i) {
+    s_conn *conn = reactor->conns.items[i];
+    s_conn_info *info = &reactor->info.items[i];
+    s_handoff_record record = {
+        .kind = HANDOFF_CLIENT,
+        .local = conn->local,
+        .addr = info->addr,
+        .created_ms = info->created_ms,
+        .in_size = conn->in.count,
+        .out_size = conn->out.count - conn->out_offset,
+    };
+
+    // Between two iterations `in` only holds unconsumed bytes
+    if (handoff_send(sock, &record, reactor->fds.items[conn->index].fd,
+                     conn->in.items, conn->out.items + conn->out_offset) !=
+        0) {
+      return -1;
+    }
+    (*clients)++;
+  }
+  return 0;
+}
+
+/**
+ * @brief Replace the running binary without dropping a connection
+ *
+ * Requested with SIGUSR2 once the new binary is installed at the path the
+ * server was started with. The event loops are stopped, then the binary is
+ * started again with the same options and a Unix socket on which it receives
+ * the listeners and every TCP and Unix client, with its unconsumed input and
+ * pending output (see handoff.h). Once it acknowledges, this process exits
+ * without closing anything: the sockets live on in the new one. If it fails,
+ * it is killed and serving resumes here.
+ *
+ * Shared memory channels and UDP are not handed over: the shared memory
+ * clients are closed with this process, the new UDP shards join the
+ * SO_REUSEPORT group of the old ones.
+ *
+ * @param ctx server context
+ * @param argv command line of this process
+ * @return int -1 (only returns if the upgrade failed)
+ */
+int hot_upgrade(s_context *ctx, char **argv) {
+  s_handoff_record end = {.kind = HANDOFF_END};
+  long max_fd = sysconf(_SC_OPEN_MAX);
+  char variable[64];
+  char **env;
+  size_t count = 0;
+  size_t clients = 0;
+  bool sent = true;
+  int sv[2];
+  pid_t pid;
+
+  printf("Hot upgrade to %s\n", argv[0]);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    eprintf("Error socketpair failed: %s\n", strerror(errno));
+    return -1;
+  }
+  fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+
+  // Built before forking: the child of a threaded process may only make
+  // async-signal-safe calls
+  snprintf(variable, sizeof(variable), HANDOFF_ENV "=%d", sv[1]);
+  while (environ[count] != NULL) {
+    count++;
+  }
+  env = calloc(count + 2, sizeof(char *));
+  assert(env != NULL && "Maybe you should buy more RAM");
+  memcpy(env, environ, count * sizeof(char *));
+  env[count] = variable;
+
+  // Connections must not change while they are sent
+  stop_workers(ctx);
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    // Only the hand off socket is inherited, sockets are passed explicitly
+    if (close_range(3, ~0U, CLOSE_RANGE_CLOEXEC) != 0) {
+      for (int fd = 3; fd < max_fd; fd++) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+      }
+    }
+    fcntl(sv[1], F_SETFD, 0);
+    execve(argv[0], argv, env);
+    _exit(127);
+  }
+  free(env);
+  close(sv[1]);
+  if (pid == -1) {
+    eprintf("Error fork failed: %s\n", strerror(errno));
+    sent = false;
+  }
+
+  sent = sent && send_reactor(&ctx->loop.reactor, sv[0], &clients) == 0;
+  for (size_t i = 0; sent && i < ctx->config.workers; i++) {
+    sent = send_reactor(&ctx->workers[i].reactor, sv[0], &clients) == 0;
+  }
+  if (sent && ctx->admin_fd != -1) {
+    s_handoff_record admin = {.kind = HANDOFF_ADMIN};
+
+    sent = handoff_send(sv[0], &admin, ctx->admin_fd, NULL, NULL) == 0;
+  }
+  sent = sent && handoff_send(sv[0], &end, -1, NULL, NULL) == 0;
+
+  if (sent && handoff_wait_ack(sv[0], HANDOFF_TIMEOUT)) {
+    printf("Hot upgrade handed over %zu connections, exiting\n", clients);
+    exit(0);
+  }
+
+  eprintf("Error hot upgrade failed, serving again\n");
+  close(sv[0]);
+  if (pid > 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  start_workers(ctx);
+  return -1;
+}
+
+/**
+ * @brief Start a graceful drain of every event loop
+ *
+ * @param ctx server context
+ * @param timeout longest drain in milliseconds (0 closes everything now)
+ */
+void drain(s_context *ctx, uint64_t timeout) {
+  printf("Draining, closing the clients still busy in %llums\n",
+         (unsigned long long)timeout);
+  ctx->draining = true;
+  reactor_drain(&ctx->loop.reactor, timeout);
+  for (size_t i = 0; i < ctx->config.workers; i++) {
+    reactor_drain(&ctx->workers[i].reactor, timeout);
+  }
+}
+
+/**
+ * @brief Handle the signals read from the signalfd, on the event loop
+ *
+ * SIGINT and SIGTERM start a graceful drain (a second one closes every
+ * client at once), SIGUSR1 prints the statistics, SIGUSR2 stops the event
+ * loop for a hot upgrade.
+ *
+ * @param reactor the event loop
+ * @param fd the signalfd
+ * @param arg server context
+ */
+void on_signal(s_reactor *reactor, int fd, void *arg) {
+  s_context *ctx = arg;
+  struct signalfd_siginfo info;
+
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    switch (info.ssi_signo) {
+    case SIGINT:
+    case SIGTERM:
+      drain(ctx, ctx->draining ? 0 : ctx->config.drain_timeout);
+      break;
+    case SIGUSR1:
+      write_stats(ctx, stdout);
+      fflush(stdout);
+      break;
+    case SIGUSR2:
+      // A draining server has nothing left to hand over
+      if (!ctx->draining) {
+        ctx->upgrading = true;
+        reactor_stop(reactor);
+      }
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Print the command line usage
+ *
+ */
+void usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  -p, --port PORT          listening port (default %d)\n"
+         "  -6, --ipv6               listen on IPv6 too (dual stack TCP)\n"
+         "  -i, --idle-timeout MS    close clients idle for MS milliseconds "
+         "(default %d, 0 disables)\n"
+         "  -w, --write-timeout MS   close clients not draining their output "
+         "for MS milliseconds (default %d, 0 disables)\n"
+         "  -l, --max-lifetime MS    close clients connected for MS "
+         "milliseconds (default %d, 0 disables)\n"
+         "  -c, --max-connections N  stop accepting at N clients "
+         "(default %d, 0 disables)\n"
+         "  -a, --max-per-ip N       reject clients beyond N per source "
+         "address (default %d, 0 disables)\n"
+         "  -b, --max-buffered BYTES stop accepting while BYTES of output are "
+         "pending (default %d, 0 disables)\n"
+         "  -P, --admin-port PORT    serve statistics on 127.0.0.1:PORT\n"
+         "  -U, --admin-socket PATH  serve statistics on a Unix socket "
+         "(instead of the port)\n"
+         "  -u, --udp                also serve UDP echo on the port\n"
+         "      --udp-threads N      SO_REUSEPORT UDP shards (default 1)\n"
+         "      --udp-batch N        datagrams per recvmmsg/sendmmsg "
+         "(default %d, max %d)\n"
+         "      --udp-gro            enable UDP GRO and GSO replies\n"
+         "      --unix PATH          also listen on a Unix socket (local and "
+         "shared memory clients)\n"
+         "      --shm-spin US        longest shared memory spin before "
+         "sleeping (default %d)\n"
+         "      --busy-poll US       spin US microseconds on the sockets "
+         "before blocking (default 0, disabled)\n"
+         "      --loop-cpu N         CPU of the busy polling event loop "
+         "(default last CPU)\n"
+         "      --framing CODEC      none, length (4 bytes big endian prefix) "
+         "or line (default none)\n"
+         "      --max-frame BYTES    close clients sending larger frames "
+         "(default %d)\n"
+         "      --workers N          hand the connections to N worker event "
+         "loops (default 0)\n"
+         "      --balance POLICY     worker of a new connection: rr, "
+         "least-conn or least-loaded (default rr)\n"
+         "      --reuseport MODE     a SO_REUSEPORT listener per worker, "
+         "steered by hash or cpu (default off)\n"
+         "      --drain-timeout MS   on SIGTERM, close the clients still busy "
+         "after MS milliseconds (default %d)\n"
+         "      --max-read BYTES     largest read size a bulk sender grows "
+         "to (default %d)\n"
+         "      --zerocopy BYTES     send replies of BYTES or more with "
+         "MSG_ZEROCOPY (default 0, disabled)\n"
+         "      --defer-accept S     accept a client once it sent data, or "
+         "after S seconds (default 0, disabled)\n"
+         "      --fastopen QLEN      TCP Fast Open with up to QLEN pending "
+         "requests (default 0, disabled)\n"
+         "  -h, --help               display this help\n",
+         name, SERVER_PORT, IDLE_TIMEOUT, WRITE_TIMEOUT, MAX_LIFETIME,
+         MAX_CONNECTIONS, MAX_CONNECTIONS_PER_IP, MAX_BUFFERED, UDP_BATCH,
+         UDP_MAX_BATCH, SHM_SPIN_US, MAX_FRAME, DRAIN_TIMEOUT,
+         MAX_READ_SIZE);
+}
+
+/**
+ * @brief Parse the command line into the configuration
+ *
+ * @return int 0 if success, 1 if the program should exit
+ */
+int parse_args(s_config *config, int argc, char **argv) {
+  static const struct option options[] = {
+      {"port", required_argument, NULL, 'p'},
+      {"idle-timeout", required_argument, NULL, 'i'},
+      {"write-timeout", required_argument, NULL, 'w'},
+      {"max-lifetime", required_argument, NULL, 'l'},
+      {"max-connections", required_argument, NULL, 'c'},
+      {"max-per-ip", required_argument, NULL, 'a'},
+      {"max-buffered", required_argument, NULL, 'b'},
+      {"admin-port", required_argument, NULL, 'P'},
+      {"admin-socket", required_argument, NULL, 'U'},
+      {"ipv6", no_argument, NULL, '6'},
+      {"udp", no_argument, NULL, 'u'},
+      {"udp-threads", required_argument, NULL, OPT_UDP_THREADS},
+      {"udp-batch", required_argument, NULL, OPT_UDP_BATCH},
+      {"udp-gro", no_argument, NULL, OPT_UDP_GRO},
+      {"unix", required_argument, NULL, OPT_UNIX},
+      {"shm-spin", required_argument, NULL, OPT_SHM_SPIN},
+      {"busy-poll", required_argument, NULL, OPT_BUSY_POLL},
+      {"loop-cpu", required_argument, NULL, OPT_LOOP_CPU},
+      {"framing", required_argument, NULL, OPT_FRAMING},
+      {"max-frame", required_argument, NULL, OPT_MAX_FRAME},
+      {"workers", required_argument, NULL, OPT_WORKERS},
+      {"balance", required_argument, NULL, OPT_BALANCE},
+      {"reuseport", required_argument, NULL, OPT_REUSEPORT},
+      {"drain-timeout", required_argument, NULL, OPT_DRAIN_TIMEOUT},
+      {"max-read", required_argument, NULL, OPT_MAX_READ},
+      {"zerocopy", required_argument, NULL, OPT_ZEROCOPY},
+      {"defer-accept", required_argument, NULL, OPT_DEFER_ACCEPT},
+      {"fastopen", required_argument, NULL, OPT_FASTOPEN},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+  static const char *short_options = "p:6i:w:l:c:a:b:P:U:uh";
+  int opt;
+  int balance;
+  int reuseport;
+
+  config->port = SERVER_PORT;
+  config->reactor.idle_timeout = IDLE_TIMEOUT;
+  config->reactor.write_timeout = WRITE_TIMEOUT;
+  config->reactor.max_lifetime = MAX_LIFETIME;
+  config->drain_timeout = DRAIN_TIMEOUT;
+  config->reactor.max_read_size = MAX_READ_SIZE;
+  config->reactor.max_connections = MAX_CONNECTIONS;
+  config->reactor.max_per_ip = MAX_CONNECTIONS_PER_IP;
+  config->reactor.max_buffered = MAX_BUFFERED;
+  config->udp_threads = 1;
+  config->udp_batch = UDP_BATCH;
+  config->shm_spin_us = SHM_SPIN_US;
+  config->loop_cpu = -1;
+  config->max_frame = MAX_FRAME;
+
+  while ((opt = getopt_long(argc, argv, short_options, options, NULL)) != -1) {
+    switch (opt) {
+    case 'p':
+      config->port = atoi(optarg);
+      break;
+    case 'i':
+      config->reactor.idle_timeout = strtoull(optarg, NULL, 10);
+      break;
+    case 'w':
+      config->reactor.write_timeout = strtoull(optarg, NULL, 10);
+      break;
+    case 'l':
+      config->reactor.max_lifetime = strtoull(optarg, NULL, 10);
+      break;
+    case 'c':
+      config->reactor.max_connections = strtoull(optarg, NULL, 10);
+      break;
+    case 'a':
+      config->reactor.max_per_ip = strtoull(optarg, NULL, 10);
+      break;
+    case 'b':
+      config->reactor.max_buffered = strtoull(optarg, NULL, 10);
+      break;
+    case 'P':
+      config->admin_port = atoi(optarg);
+      break;
+    case 'U':
+      config->admin_path = optarg;
+      break;
+    case '6':
+      config->ipv6 = true;
+      break;
+    case 'u':
+      config->udp = true;
+      break;
+    case OPT_UDP_THREADS:
+      config->udp_threads = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_UDP_BATCH:
+      config->udp_batch = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_UDP_GRO:
+      config->udp_gro = true;
+      break;
+    case OPT_UNIX:
+      config->unix_path = optarg;
+      break;
+    case OPT_SHM_SPIN:
+      config->shm_spin_us = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_BUSY_POLL:
+      config->reactor.busy_poll_us = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_LOOP_CPU:
+      config->loop_cpu = atoi(optarg);
+      break;
+    case OPT_FRAMING:
+      if (frame_parse_name(optarg) == -1) {
+        usage(argv[0]);
+        return 1;
+      }
+      config->framing = frame_parse_name(optarg);
+      break;
+    case OPT_MAX_FRAME:
+      config->max_frame = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_WORKERS:
+      config->workers = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_BALANCE:
+      for (balance = REACTOR_BALANCE_LEAST_LOADED; balance >= 0; balance--) {
+        if (strcmp(optarg, balance_names[balance]) == 0) {
+          break;
+        }
+      }
+      if (balance == -1) {
+        usage(argv[0]);
+        return 1;
+      }
+      config->balance = balance;
+      break;
+    case OPT_REUSEPORT:
+      for (reuseport = REUSEPORT_CPU; reuseport >= 0; reuseport--) {
+        if (strcmp(optarg, reuseport_names[reuseport]) == 0) {
+          break;
+        }
+      }
+      if (reuseport == -1) {
+        usage(argv[0]);
+        return 1;
+      }
+      config->reuseport = reuseport;
+      break;
+    case OPT_DRAIN_TIMEOUT:
+      config->drain_timeout = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_MAX_READ:
+      config->reactor.max_read_size = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_ZEROCOPY:
+      config->reactor.zerocopy = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_DEFER_ACCEPT:
+      config->defer_accept = atoi(optarg);
+      break;
+    case OPT_FASTOPEN:
+      config->fastopen = atoi(optarg);
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 1;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (config->udp_threads == 0 || config->udp_batch == 0 ||
+      config->udp_batch > UDP_MAX_BATCH ||
+      config->max_frame <= FRAME_HEADER_SIZE ||
+      (config->reuseport != REUSEPORT_OFF && config->workers == 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  s_context *ctx = calloc(1, sizeof(s_context));
+  int signal_fd;
+  int fd;
+
+  ctx->admin_fd = -1;
+  ctx->handoff_fd = -1;
+
+  if (parse_args(&ctx->config, argc, argv)) {
+    free(ctx);
+    return 1;
+  }
+
+  // Before any thread starts
+  signal_fd = init_signals();
+  if (signal_fd == -1) {
+    free(ctx);
+    return 1;
+  }
+
+  // Raw echo answers each read at once, framing buffers partial frames
+  ctx->config.reactor.read_size =
+      ctx->config.framing == FRAMING_NONE ? BUFF_SIZE : FRAME_BUFF_SIZE;
+  if (ctx->config.reactor.zerocopy != 0 &&
+      ctx->config.reactor.max_read_size < ZEROCOPY_BUFF_SIZE) {
+    ctx->config.reactor.max_read_size = ZEROCOPY_BUFF_SIZE;
+  }
+  ctx->config.reactor.read_on_accept =
+      ctx->config.defer_accept != 0 || ctx->config.fastopen != 0;
+  ctx->loop.ctx = ctx;
+  reactor_init(&ctx->loop.reactor, &ctx->config.reactor, &echo_handler,
+               &ctx->loop);
+  reactor_watch(&ctx->loop.reactor, signal_fd, on_signal, ctx);
+
+  // Hot upgrade: sockets of the replaced server
+  if (receive_handoff(ctx)) {
+    cleanup(ctx);
+    return 1;
+  }
+
+  // Initialize the server (the workers listen themselves with --reuseport)
+  if (ctx->config.reuseport == REUSEPORT_OFF) {
+    fd = init_server(ctx, false);
+    if (fd == -1) {
+      cleanup(ctx);
+      return 1;
+    }
+
+    // Register the server
+    reactor_add_listener(&ctx->loop.reactor, fd);
+  }
+
+  // Serve local clients, UDP echo and the statistics
+  if (init_local(ctx) || init_udp(ctx) || init_admin(ctx)) {
+    cleanup(ctx);
+    return 1;
+  }
+
+  // Pin the event loop last, the other threads would inherit its affinity
+  // (the workers pin themselves). Handed clients join the workers before
+  // they start.
+  if (init_workers(ctx) || init_busy_poll(ctx) || restore_clients(ctx) ||
+      start_workers(ctx)) {
+    cleanup(ctx);
+    return 1;
+  }
+
+  // Run the server until drained, SIGUSR2 stops it for a hot upgrade
+  // (returns on failure)
+  while (reactor_run(&ctx->loop.reactor) == 0 && ctx->upgrading) {
+    ctx->upgrading = false;
+    hot_upgrade(ctx, argv);
+  }
+
+  // The workers stop once their clients are drained
+  if (ctx->draining) {
+    for (size_t i = 0; i < ctx->config.workers; i++) {
+      pthread_join(ctx->workers[i].thread, NULL);
+    }
+    printf("Drained, exiting\n");
+  }
+
+  // Cleanup
+  cleanup(ctx);
+  return 0;
+}
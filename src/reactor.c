@@ -0,0 +1,2065 @@
+#define _GNU_SOURCE // MSG_CMSG_CLOEXEC
+#include <arpa/inet.h>
+#include <asm-generic/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define _DA_INIT_CAPACITY 16
+#include "../includes/reactor.h"
+#include "../includes/framing.h"
+#include "../includes/trace.h"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+
+// The fields used by every event fill the first two cache lines (see s_conn)
+_Static_assert(offsetof(s_conn, data) == 128, "Hot fields of s_conn moved");
+
+// Hash a source address to its home slot
+static inline size_t ip_hash(const s_ip_table *table,
+                             const struct in6_addr *ip) {
+  uint32_t words[4];
+
+  memcpy(words, ip, sizeof(words));
+  return (size_t)((words[0] ^ words[1] ^ words[2] ^ words[3]) * 2654435761u) &
+         (table->capacity - 1);
+}
+
+/**
+ * @brief Get the address of a client as an IPv6 address
+ *
+ * IPv4 addresses are mapped (::ffff:a.b.c.d), so a dual stack listener
+ * counts an IPv4 client under one address whatever the listener family.
+ *
+ */
+static struct in6_addr peer_ip(const struct sockaddr_storage *addr) {
+  struct in6_addr ip = {0};
+
+  if (addr->ss_family == AF_INET6) {
+    ip = ((const struct sockaddr_in6 *)addr)->sin6_addr;
+  } else if (addr->ss_family == AF_INET) {
+    ip.s6_addr[10] = 0xff;
+    ip.s6_addr[11] = 0xff;
+    memcpy(&ip.s6_addr[12], &((const struct sockaddr_in *)addr)->sin_addr, 4);
+  }
+  return ip;
+}
+
+/**
+ * @brief Find the slot of an address (or the empty slot where it belongs)
+ *
+ */
+static s_ip_slot *ip_table_slot(s_ip_table *table, const struct in6_addr *ip) {
+  size_t i = ip_hash(table, ip);
+
+  while (table->slots[i].count != 0 &&
+         memcmp(&table->slots[i].ip, ip, sizeof(*ip)) != 0) {
+    i = (i + 1) & (table->capacity - 1);
+  }
+  return &table->slots[i];
+}
+
+/**
+ * @brief Count a new connection from an address
+ *
+ * @return uint32_t the number of connections from the address
+ */
+static uint32_t ip_table_acquire(s_ip_table *table,
+                                 const struct in6_addr *ip) {
+  s_ip_slot *slot;
+
+  // Keep the load factor under 1/2
+  if (2 * (table->count + 1) > table->capacity) {
+    s_ip_table grown = {0};
+    grown.capacity = table->capacity ? table->capacity << 1 : 64;
+    grown.slots = calloc(grown.capacity, sizeof(s_ip_slot));
+    assert(grown.slots != NULL && "Maybe you should buy more RAM");
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i].count != 0) {
+        *ip_table_slot(&grown, &table->slots[i].ip) = table->slots[i];
+      }
+    }
+    grown.count = table->count;
+    free(table->slots);
+    *table = grown;
+  }
+
+  slot = ip_table_slot(table, ip);
+  if (slot->count == 0) {
+    slot->ip = *ip;
+    table->count++;
+  }
+  return ++slot->count;
+}
+
+/**
+ * @brief Forget a connection from an address
+ *
+ */
+static void ip_table_release(s_ip_table *table, const struct in6_addr *ip) {
+  s_ip_slot *slot;
+  size_t hole, i;
+
+  if (table->count == 0) {
+    return;
+  }
+  slot = ip_table_slot(table, ip);
+  if (slot->count == 0 || --slot->count > 0) {
+    return;
+  }
+
+  // Backward shift deletion: move back the entries displaced past the hole
+  hole = slot - table->slots;
+  i = hole;
+  while (true) {
+    size_t home;
+    i = (i + 1) & (table->capacity - 1);
+    if (table->slots[i].count == 0) {
+      break;
+    }
+    home = ip_hash(table, &table->slots[i].ip);
+    // Move the entry if its home is not in (hole, i] (cyclically)
+    if (((i - home) & (table->capacity - 1)) >=
+        ((i - hole) & (table->capacity - 1))) {
+      table->slots[hole] = table->slots[i];
+      hole = i;
+    }
+  }
+  table->slots[hole].count = 0;
+  table->count--;
+}
+
+/**
+ * @brief Format a source address as "address, port N"
+ *
+ * IPv4 clients of a dual stack listener are shown as IPv4 addresses.
+ *
+ */
+static const char *format_addr(const struct sockaddr_storage *addr,
+                               char *name, size_t size) {
+  char host[INET6_ADDRSTRLEN] = "?";
+  int port = 0;
+
+  if (addr->ss_family == AF_INET) {
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+
+    inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+    port = ntohs(in->sin_port);
+  } else if (addr->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+
+    if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+      inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], host, sizeof(host));
+    } else {
+      inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+    }
+    port = ntohs(in6->sin6_port);
+  }
+  snprintf(name, size, "%s, port %d", host, port);
+  return name;
+}
+
+const char *reactor_peer_name(const s_reactor *reactor, const s_conn *conn) {
+  static char name[INET6_ADDRSTRLEN + 16];
+
+  if (conn->local) {
+    return "unix socket";
+  }
+  return format_addr(&reactor_conn_info(reactor, conn)->addr, name,
+                     sizeof(name));
+}
+
+/**
+ * @brief Add a file descriptor to the poll array (read interest)
+ *
+ */
+static void register_fd(s_da_fd *fds, int fd) {
+  struct pollfd s_fd;
+  s_fd.fd = fd;
+  s_fd.events = POLLIN;
+  s_fd.revents = 0;
+  da_append(fds, s_fd);
+}
+
+/**
+ * @brief Add a connection to the list written at the end of the iteration
+ *
+ */
+static void mark_dirty(s_reactor *reactor, s_conn *conn) {
+  if (!conn->dirty) {
+    conn->dirty = true;
+    da_append(&reactor->dirty, conn);
+  }
+}
+
+/**
+ * @brief Get the size class of a read buffer
+ *
+ * @return int the class (capacity config.read_size << class), -1 if none
+ */
+static int buffer_class(s_reactor *reactor, size_t capacity) {
+  for (int class = 0; class < REACTOR_POOL_CLASSES; class++) {
+    if (reactor->config.read_size << class == capacity) {
+      return class;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Give a read buffer no longer used back to the pool
+ *
+ * Buffers of no size class, or beyond REACTOR_POOL_BYTES, are freed.
+ *
+ */
+static void release_buffer(s_reactor *reactor, char *items, size_t capacity) {
+  int class = buffer_class(reactor, capacity);
+
+  if (items == NULL) {
+    return;
+  }
+  if (class < 0 || reactor->pooled + capacity > REACTOR_POOL_BYTES) {
+    free(items);
+    return;
+  }
+  da_append(&reactor->pool[class], items);
+  reactor->pooled += capacity;
+  counter_set(&reactor->stats.pooled_bytes, reactor->pooled);
+}
+
+/**
+ * @brief Make room for a read of `size` bytes in the read buffer
+ *
+ * A connection without buffer takes the smallest pooled one of at least
+ * `size` bytes (a size class), or allocates one.
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param size bytes to read after the unconsumed ones
+ */
+static void reserve_buffer(s_reactor *reactor, s_conn *conn, size_t size) {
+  s_da_char *in = &conn->in;
+
+  if (in->items == NULL) {
+    int class = buffer_class(reactor, size);
+
+    for (; class >= 0 && class < REACTOR_POOL_CLASSES; class++) {
+      s_da_buffer *buffers = &reactor->pool[class];
+
+      if (buffers->count > 0) {
+        in->items = buffers->items[--buffers->count];
+        in->capacity = reactor->config.read_size << class;
+        in->count = 0;
+        reactor->pooled -= in->capacity;
+        counter_set(&reactor->stats.pooled_bytes, reactor->pooled);
+        return;
+      }
+    }
+    counter_add(&reactor->stats.buffer_allocs, 1);
+  }
+  da_resize(in, in->count + size);
+}
+
+/**
+ * @brief Give the read buffer of a connection without input to the pool
+ *
+ */
+static void drop_buffer(s_reactor *reactor, s_conn *conn) {
+  release_buffer(reactor, conn->in.items, conn->in.capacity);
+  conn->in.items = NULL;
+  conn->in.capacity = 0;
+  conn->in.count = 0;
+}
+
+/**
+ * @brief Count completed zerocopy sends against the buffers in flight
+ *
+ * A buffer is released once all its sends completed.
+ *
+ * @param reactor the reactor
+ * @param inflight buffers lent to the kernel, in send order
+ * @param lo first completed sequence number
+ * @param hi last completed sequence number
+ */
+static void complete_zerocopy(s_reactor *reactor, s_da_zc *inflight,
+                              uint32_t lo, uint32_t hi) {
+  size_t kept = 0;
+
+  for (size_t i = 0; i < inflight->count; i++) {
+    s_zc_buffer *buffer = &inflight->items[i];
+    // Sequence numbers wrap: compare differences
+    uint32_t start = (int32_t)(buffer->first - lo) > 0 ? buffer->first : lo;
+    uint32_t end = (int32_t)(buffer->last - hi) < 0 ? buffer->last : hi;
+
+    if ((int32_t)(end - start) >= 0) {
+      buffer->pending -= end - start + 1;
+    }
+    if (buffer->pending == 0) {
+      release_buffer(reactor, buffer->items, buffer->capacity);
+    } else {
+      inflight->items[kept++] = *buffer;
+    }
+  }
+  inflight->count = kept;
+}
+
+/**
+ * @brief Read the zerocopy completions from the error queue of a socket
+ *
+ * The queue is read until empty: completions of sends this reactor does not
+ * know (a connection handed over by a hot upgrade gets those of the previous
+ * process) are dropped.
+ *
+ * @param reactor the reactor
+ * @param fd the socket
+ * @param inflight buffers lent to the kernel by the socket
+ * @return int completions read, -1 if the socket reported another error
+ */
+static int reap_zerocopy(s_reactor *reactor, int fd, s_da_zc *inflight) {
+  int reaped = 0;
+
+  while (true) {
+    char control[128];
+    struct msghdr msg = {0};
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? reaped : -1;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err err;
+
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+      if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+        return -1;
+      }
+      // Loopback and devices without scatter-gather copy anyway
+      if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        counter_add(&reactor->stats.zerocopy_copied,
+                    err.ee_data - err.ee_info + 1);
+      }
+      complete_zerocopy(reactor, inflight, err.ee_info, err.ee_data);
+      reaped++;
+    }
+  }
+  return reaped;
+}
+
+/**
+ * @brief Close a lingering socket, reset if the kernel still uses buffers
+ *
+ * A reset drops the unsent bytes: the buffers can then be freed.
+ */
+static void end_linger(s_zc_linger *linger) {
+  if (linger->buffers.count > 0 && linger->owned) {
+    struct linger reset = {.l_onoff = 1, .l_linger = 0};
+
+    setsockopt(linger->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  }
+  if (linger->fd != -1) {
+    close(linger->fd);
+  }
+  da_foreach_unsafe(&linger->buffers, buffer) { free(buffer->items); }
+  da_free(&linger->buffers);
+}
+
+/**
+ * @brief Keep the socket of a closed connection until the kernel is done
+ * with its lent buffers
+ *
+ * @param reactor the reactor
+ * @param conn the connection, its buffers are moved
+ * @param fd the socket, or a duplicate of a detached one
+ * @param owned false for a duplicate (only closed, never reset)
+ */
+static void linger_client(s_reactor *reactor, s_conn *conn, int fd,
+                          bool owned) {
+  s_zc_linger linger = {.fd = fd,
+                        .owned = owned,
+                        .deadline_ms = now_ms() + REACTOR_ZEROCOPY_LINGER,
+                        .buffers = conn->zc_inflight};
+
+  memset(&conn->zc_inflight, 0, sizeof(conn->zc_inflight));
+  if (reap_zerocopy(reactor, fd, &linger.buffers) == -1 ||
+      linger.buffers.count == 0) {
+    end_linger(&linger);
+    return;
+  }
+  da_append(&reactor->zc_linger, linger);
+}
+
+/**
+ * @brief Close the lingering sockets whose sends completed or timed out
+ *
+ */
+static void reap_lingering(s_reactor *reactor) {
+  s_da_linger *lingering = &reactor->zc_linger;
+  uint64_t now = now_ms();
+  size_t kept = 0;
+
+  for (size_t i = 0; i < lingering->count; i++) {
+    s_zc_linger *linger = &lingering->items[i];
+
+    if (reap_zerocopy(reactor, linger->fd, &linger->buffers) != -1 &&
+        linger->buffers.count > 0 && now < linger->deadline_ms) {
+      lingering->items[kept++] = *linger;
+    } else {
+      end_linger(linger);
+    }
+  }
+  lingering->count = kept;
+}
+
+/**
+ * @brief Lend the read buffer to the kernel after zerocopy sends from it
+ *
+ * The buffer must not change until the sends complete: the connection goes
+ * on with a buffer of the pool holding the unconsumed bytes, or none.
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param first sequence number of the first send
+ * @param sends number of sends
+ */
+static void lend_buffer(s_reactor *reactor, s_conn *conn, uint32_t first,
+                        uint32_t sends) {
+  s_da_char *in = &conn->in;
+  s_zc_buffer lent = {.items = in->items,
+                      .capacity = in->capacity,
+                      .first = first,
+                      .last = first + sends - 1,
+                      .pending = sends};
+  size_t unconsumed = in->count - conn->in_consumed;
+
+  in->items = NULL;
+  in->capacity = 0;
+  in->count = 0;
+  if (unconsumed > 0) {
+    reserve_buffer(reactor, conn, conn->read_size);
+    da_append_many(in, lent.items + conn->in_consumed, unconsumed);
+  }
+  da_append(&conn->zc_inflight, lent);
+}
+
+/**
+ * @brief Check if the queued output can be sent with MSG_ZEROCOPY
+ *
+ * It must be large enough and only point into the read buffer, the one
+ * buffer the reactor can keep unchanged until the sends complete.
+ *
+ */
+static bool zerocopy_queued(s_reactor *reactor, s_conn *conn) {
+  s_da_iovec *queued = &conn->queued;
+  const char *start = conn->in.items;
+  const char *end = conn->in.items + conn->in.count;
+  size_t size = 0;
+
+  if (!conn->zerocopy) {
+    return false;
+  }
+  for (size_t i = 0; i < queued->count; i++) {
+    const char *base = queued->items[i].iov_base;
+
+    if (base < start || base + queued->items[i].iov_len > end) {
+      return false;
+    }
+    size += queued->items[i].iov_len;
+  }
+  return size >= reactor->config.zerocopy;
+}
+
+/**
+ * @brief Write as much pending output as possible to the client
+ *
+ * While output is pending the client is not read (backpressure) and only
+ * polled for POLLOUT.
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param pfd poll entry of the client
+ * @return int 0 if success, 1 if connection closed
+ */
+static int flush_client(s_reactor *reactor, s_conn *conn, struct pollfd *pfd) {
+  ssize_t writed = 0;
+  size_t pending = conn->out.count - conn->out_offset;
+
+  while (pending > 0) {
+    writed = write(pfd->fd, conn->out.items + conn->out_offset, pending);
+    TRACE_PROBE3(echo, write, pfd->fd, writed, pending);
+    if (writed == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      eprintf("Error write failed: %s\n", strerror(errno));
+      return 1;
+    }
+    conn->out_offset += writed;
+    reactor->admission.buffered -= writed;
+    counter_add(&reactor->stats.bytes_out, writed);
+    pending -= writed;
+    conn->last_active_ms = now_ms();
+  }
+
+  if (pending == 0) {
+    if (conn->reply_start_ns) {
+      histogram_record(&reactor->stats.latency_ns,
+                       now_ns() - conn->reply_start_ns);
+      conn->reply_start_ns = 0;
+    }
+    da_clear(&conn->out);
+    conn->out_offset = 0;
+    conn->stall_ms = 0;
+    pfd->events = POLLIN;
+  } else {
+    if (conn->stall_ms == 0) {
+      conn->stall_ms = now_ms();
+    }
+    pfd->events = POLLOUT;
+  }
+  return 0;
+}
+
+/**
+ * @brief Write the output queued by a connection during the iteration
+ *
+ * All of it goes out in one writev (per FRAME_IOV_MAX buffers), what the
+ * socket does not take is copied into the pending output (see
+ * `flush_client`). The consumed bytes of the read buffer are dropped only
+ * then, as the queued output may point into them. Large output sent with
+ * MSG_ZEROCOPY lends the read buffer to the kernel instead (see
+ * `lend_buffer`).
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @return int 0 if success, 1 if connection closed
+ */
+static int flush_queued(s_reactor *reactor, s_conn *conn) {
+  struct pollfd *pfd = &reactor->fds.items[conn->index];
+  s_da_iovec *queued = &conn->queued;
+  s_da_char *in = &conn->in;
+  bool stalled = conn->out.count > conn->out_offset;
+  bool zerocopy = !stalled && zerocopy_queued(reactor, conn);
+  uint32_t zc_first = conn->zc_next;
+  size_t first = 0;
+
+  // Output already pending goes first: queue behind it
+  while (!stalled && first < queued->count) {
+    size_t count = queued->count - first;
+    size_t pending = 0;
+    size_t done;
+    ssize_t writed;
+
+    if (count > FRAME_IOV_MAX) {
+      count = FRAME_IOV_MAX;
+    }
+    for (size_t i = first; i < first + count; i++) {
+      pending += queued->items[i].iov_len;
+    }
+    if (zerocopy) {
+      struct msghdr msg = {0};
+
+      msg.msg_iov = queued->items + first;
+      msg.msg_iovlen = count;
+      writed = sendmsg(pfd->fd, &msg, MSG_ZEROCOPY);
+    } else {
+      writed = writev(pfd->fd, queued->items + first, count);
+    }
+    TRACE_PROBE3(echo, write, pfd->fd, writed, pending);
+    if (writed == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      if (zerocopy && errno == ENOBUFS) {
+        zerocopy = false; // Notification memory exhausted: copy
+        continue;
+      }
+      eprintf("Error writev failed: %s\n", strerror(errno));
+      return 1;
+    }
+    if (zerocopy) {
+      conn->zc_next++;
+      counter_add(&reactor->stats.zerocopy_sends, 1);
+      counter_add(&reactor->stats.zerocopy_bytes, writed);
+    }
+    counter_add(&reactor->stats.writevs, 1);
+    counter_add(&reactor->stats.bytes_out, writed);
+    conn->last_active_ms = now_ms();
+    done = frame_iov_consume(queued->items + first, count, writed);
+    first += done;
+    if (done < count) {
+      break; // Socket buffer full
+    }
+  }
+
+  if (first < queued->count) {
+    // Short write: keep the rest until the client drains its socket
+    for (size_t i = first; i < queued->count; i++) {
+      da_append_many(&conn->out, (char *)queued->items[i].iov_base,
+                     queued->items[i].iov_len);
+      reactor->admission.buffered += queued->items[i].iov_len;
+    }
+    if (conn->reply_start_ns == 0) {
+      conn->reply_start_ns = reactor->wake_ns;
+    }
+  } else if (queued->count > 0) {
+    histogram_record(&reactor->stats.latency_ns, now_ns() - reactor->wake_ns);
+  }
+
+  if (conn->zc_next != zc_first) {
+    lend_buffer(reactor, conn, zc_first, conn->zc_next - zc_first);
+  } else if (conn->in_consumed > 0) {
+    memmove(in->items, in->items + conn->in_consumed,
+            in->count - conn->in_consumed);
+    in->count -= conn->in_consumed;
+  }
+  conn->in_consumed = 0;
+  if (in->count == 0) {
+    drop_buffer(reactor, conn); // Idle until the next read
+  }
+  da_clear(queued);
+
+  if (!stalled && conn->out.count > conn->out_offset) {
+    return flush_client(reactor, conn, pfd);
+  }
+  return 0;
+}
+
+/**
+ * @brief Read from a local client, receiving the file descriptors it passes
+ *
+ * The descriptors are stored in `conn->passed_fds`. More descriptors than
+ * REACTOR_MAX_PASSED_FDS are all closed and `conn->npassed` is set to -1.
+ *
+ * @return ssize_t bytes read, -1 on error
+ */
+static ssize_t read_local(s_conn *conn, int fd, char *buffer, size_t size) {
+  union {
+    char buf[CMSG_SPACE(REACTOR_MAX_PASSED_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = buffer, .iov_len = size};
+  struct msghdr msg = {0};
+  ssize_t readed;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  conn->npassed = 0;
+
+  readed = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (readed <= 0) {
+    return readed;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      conn->npassed = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(conn->passed_fds, CMSG_DATA(cmsg), conn->npassed * sizeof(int));
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    for (int i = 0; i < conn->npassed; i++) {
+      close(conn->passed_fds[i]);
+    }
+    conn->npassed = -1;
+  }
+  return readed;
+}
+
+/**
+ * @brief Adapt the next read size of a connection to its last read
+ *
+ * A read filling the buffer doubles it (bulk sender), REACTOR_SHRINK_READS
+ * reads in a row using less than a quarter of it halve it.
+ *
+ */
+static void adapt_read_size(s_reactor *reactor, s_conn *conn, size_t readed) {
+  if (readed == conn->read_size) {
+    if (conn->read_size < reactor->config.max_read_size) {
+      conn->read_size <<= 1;
+    }
+    conn->small_reads = 0;
+  } else if (readed < conn->read_size / 4 &&
+             conn->read_size > reactor->config.read_size) {
+    if (++conn->small_reads == REACTOR_SHRINK_READS) {
+      conn->read_size >>= 1;
+      conn->small_reads = 0;
+    }
+  } else {
+    conn->small_reads = 0;
+  }
+}
+
+/**
+ * @brief Read from a client and hand the unconsumed bytes to the handler
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param pfd poll entry of the client
+ * @return int 0 if success, REACTOR_CLOSE or REACTOR_DETACH
+ */
+static int read_client(s_reactor *reactor, s_conn *conn, struct pollfd *pfd) {
+  s_da_char *in = &conn->in;
+  size_t size = conn->read_size;
+  ssize_t readed = 0;
+  ssize_t consumed = 0;
+
+  // Room for a full read after the bytes kept from the last one
+  reserve_buffer(reactor, conn, size);
+  if (conn->local) {
+    readed = read_local(conn, pfd->fd, in->items + in->count, size);
+  } else {
+    readed = read(pfd->fd, in->items + in->count, size);
+  }
+  TRACE_PROBE2(echo, read, pfd->fd, readed);
+  if (readed == 0) {
+    return REACTOR_CLOSE; // Connection closed
+  } else if (readed == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      if (in->count == 0) {
+        drop_buffer(reactor, conn);
+      }
+      return 0;
+    }
+    eprintf("Error read failed: %s\n", strerror(errno));
+    return REACTOR_CLOSE;
+  }
+  if (conn->npassed == -1) {
+    eprintf("Error more than %d descriptors passed\n", REACTOR_MAX_PASSED_FDS);
+    return REACTOR_CLOSE;
+  }
+
+  conn->last_active_ms = now_ms();
+  counter_add(&reactor->stats.reads, 1);
+  counter_add(&reactor->stats.bytes_in, readed);
+  in->count += readed;
+  adapt_read_size(reactor, conn, readed);
+
+  consumed = reactor->handler.on_data(reactor, conn,
+                                      in->items + conn->in_consumed,
+                                      in->count - conn->in_consumed);
+  // Descriptors the handler did not take
+  for (int i = 0; i < conn->npassed; i++) {
+    close(conn->passed_fds[i]);
+  }
+  conn->npassed = 0;
+  if (consumed < 0) {
+    return consumed;
+  }
+  if (consumed > 0) {
+    conn->in_consumed += consumed;
+    mark_dirty(reactor, conn);
+  }
+  return 0;
+}
+
+void reactor_send(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  s_da_iovec *queued = &conn->queued;
+  struct iovec iov = {.iov_base = data, .iov_len = size};
+
+  if (size == 0) {
+    return;
+  }
+  mark_dirty(reactor, conn);
+  // Contiguous output (e.g. successive messages of the read buffer) merges
+  if (queued->count > 0) {
+    struct iovec *last = &queued->items[queued->count - 1];
+    if ((char *)last->iov_base + last->iov_len == data) {
+      last->iov_len += size;
+      return;
+    }
+  }
+  da_append(queued, iov);
+}
+
+/**
+ * @brief Get the next deadline of a connection
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ * @param reason set to the timeout that expires first (REACTOR_CLOSED if
+ * none)
+ * @return uint64_t deadline in milliseconds, UINT64_MAX if none
+ */
+static uint64_t conn_deadline(s_reactor *reactor, s_conn *conn,
+                              e_reactor_close *reason) {
+  s_reactor_config *config = &reactor->config;
+  uint64_t deadline = UINT64_MAX;
+
+  *reason = REACTOR_CLOSED;
+  if (config->idle_timeout &&
+      conn->last_active_ms + config->idle_timeout < deadline) {
+    deadline = conn->last_active_ms + config->idle_timeout;
+    *reason = REACTOR_EVICT_IDLE;
+  }
+  if (config->write_timeout && conn->stall_ms &&
+      conn->stall_ms + config->write_timeout < deadline) {
+    deadline = conn->stall_ms + config->write_timeout;
+    *reason = REACTOR_EVICT_WRITE_STALL;
+  }
+  if (config->max_lifetime) {
+    uint64_t created_ms = reactor_conn_info(reactor, conn)->created_ms;
+
+    if (created_ms + config->max_lifetime < deadline) {
+      deadline = created_ms + config->max_lifetime;
+      *reason = REACTOR_EVICT_LIFETIME;
+    }
+  }
+  return deadline;
+}
+
+/**
+ * @brief Arm the timer of a connection if its deadline moved earlier
+ *
+ * Activity only pushes the idle deadline later, so the timer is not re-armed
+ * on every read: it is checked lazily when it fires (see `expire_client`).
+ *
+ * @param reactor the reactor
+ * @param conn client connection
+ */
+static void schedule_client(s_reactor *reactor, s_conn *conn) {
+  e_reactor_close reason;
+  uint64_t deadline = conn_deadline(reactor, conn, &reason);
+
+  if (reason == REACTOR_CLOSED) {
+    tw_del(&reactor->timers, &conn->timer);
+  } else if (!tw_pending(&conn->timer) ||
+             deadline < tw_expires_ms(&reactor->timers, &conn->timer)) {
+    tw_mod(&reactor->timers, &conn->timer, deadline);
+  }
+}
+
+int reactor_write(s_reactor *reactor, s_conn *conn, const char *data,
+                  size_t size) {
+  struct pollfd *pfd = &reactor->fds.items[conn->index];
+  ssize_t writed = 0;
+
+  assert(conn->queued.count == 0 && "reactor_write after reactor_send");
+  // Output already pending goes first: queue behind it
+  while (size > 0 && conn->out.count == conn->out_offset) {
+    writed = write(pfd->fd, data, size);
+    TRACE_PROBE3(echo, write, pfd->fd, writed, size);
+    if (writed == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      eprintf("Error write failed: %s\n", strerror(errno));
+      return -1;
+    }
+    counter_add(&reactor->stats.bytes_out, writed);
+    conn->last_active_ms = now_ms();
+    data += writed;
+    size -= writed;
+  }
+
+  if (size == 0) {
+    return 0;
+  }
+  da_append_many(&conn->out, data, size);
+  reactor->admission.buffered += size;
+  if (conn->reply_start_ns == 0) {
+    conn->reply_start_ns = reactor->wake_ns;
+  }
+  if (conn->stall_ms == 0) {
+    conn->stall_ms = now_ms();
+  }
+  pfd->events = POLLOUT;
+  schedule_client(reactor, conn);
+  return 1;
+}
+
+void reactor_consume(s_reactor *reactor, s_conn *conn, size_t size) {
+  if (size > 0) {
+    conn->in_consumed += size;
+    mark_dirty(reactor, conn);
+  }
+}
+
+/**
+ * @brief Remove a client from the poll array without closing its socket
+ *
+ * The last connection is moved to `index` (order is not preserved).
+ *
+ * @param reactor the reactor
+ * @param index index of the client in the poll array
+ */
+static void remove_client(s_reactor *reactor, size_t index) {
+  s_da_fd *fds = &reactor->fds;
+  s_da_conn *conns = &reactor->conns;
+  s_conn *conn = conns->items[index - reactor->listeners];
+
+  tw_del(&reactor->timers, &conn->timer);
+  reactor->admission.buffered -= conn->out.count - conn->out_offset;
+  reactor->admission.out_of_fds = false;
+  if (reactor->config.max_per_ip && !conn->local) {
+    struct in6_addr ip = peer_ip(&reactor_conn_info(reactor, conn)->addr);
+
+    ip_table_release(&reactor->admission.per_ip, &ip);
+  }
+  if (conn->dirty) {
+    da_for_unsafe(&reactor->dirty, i) {
+      if (reactor->dirty.items[i] == conn) {
+        da_fast_remove(&reactor->dirty, i);
+        break;
+      }
+    }
+  }
+  da_free(&conn->out);
+  release_buffer(reactor, conn->in.items, conn->in.capacity);
+  da_free(&conn->queued);
+  da_foreach_unsafe(&conn->zc_inflight, buffer) { free(buffer->items); }
+  da_free(&conn->zc_inflight);
+  free(conn);
+  counter_add(&reactor->stats.closed, 1);
+
+  // Remove doesn't preserve order but we remove at same
+  // time so it should be fine.
+  da_fast_remove(fds, index);
+  da_fast_remove(conns, index - reactor->listeners);
+  da_fast_remove(&reactor->info, index - reactor->listeners);
+  if (index < fds->count) {
+    conns->items[index - reactor->listeners]->index = index;
+  }
+}
+
+/**
+ * @brief Close a client connection and remove it from the poll array
+ *
+ * @param reactor the reactor
+ * @param index index of the client in the poll array
+ * @param reason why the connection is closed (REACTOR_DETACHED keeps the
+ * socket open)
+ */
+static void close_client(s_reactor *reactor, size_t index,
+                         e_reactor_close reason) {
+  s_conn *conn = reactor->conns.items[index - reactor->listeners];
+  int fd = reactor->fds.items[index].fd;
+
+  if (reactor->handler.on_close != NULL) {
+    reactor->handler.on_close(reactor, conn, reason);
+  }
+  if (reason != REACTOR_DETACHED) {
+    TRACE_PROBE2(echo, close, fd, reason);
+  }
+  // The kernel may still send from lent buffers: wait for it to close
+  if (conn->zc_inflight.count > 0) {
+    linger_client(reactor, conn, reason == REACTOR_DETACHED ? dup(fd) : fd,
+                  reason != REACTOR_DETACHED);
+  } else if (reason != REACTOR_DETACHED) {
+    close(fd);
+  }
+  remove_client(reactor, index);
+}
+
+/**
+ * @brief Timer callback: evict the connection if one of its timeouts expired
+ *
+ * @param timer timer of the connection
+ * @param arg the reactor
+ */
+static void expire_client(s_tw_timer *timer, void *arg) {
+  s_reactor *reactor = arg;
+  s_conn *conn = tw_entry(timer, s_conn, timer);
+  e_reactor_close reason;
+  uint64_t deadline = conn_deadline(reactor, conn, &reason);
+
+  if (reason == REACTOR_CLOSED) {
+    return;
+  }
+  if (deadline > now_ms()) {
+    // Activity since the timer was armed: re-arm for the remaining time
+    tw_add(&reactor->timers, timer, deadline);
+    return;
+  }
+
+  switch (reason) {
+  case REACTOR_EVICT_IDLE:
+    counter_add(&reactor->stats.evicted_idle, 1);
+    break;
+  case REACTOR_EVICT_WRITE_STALL:
+    counter_add(&reactor->stats.evicted_write_stall, 1);
+    break;
+  case REACTOR_EVICT_LIFETIME:
+    counter_add(&reactor->stats.evicted_lifetime, 1);
+    break;
+  default:
+    break;
+  }
+  close_client(reactor, conn->index, reason);
+}
+
+/**
+ * @brief Get the open connections of a worker, from another thread
+ *
+ * Connections handed but not admitted yet count as open, so a burst of
+ * accepts is balanced before the worker catches up.
+ *
+ * @param reactor the acceptor
+ * @param worker index of the worker
+ */
+static size_t worker_clients(s_reactor *reactor, size_t worker) {
+  s_reactor *target = reactor->workers[worker];
+  s_inbox *inbox = &target->inbox;
+  uint64_t closed = counter_get(&target->stats.closed);
+  uint64_t accepted = counter_get(&target->stats.accepted);
+  size_t head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+
+  // Read without ordering, each difference may briefly be negative
+  return (accepted > closed ? accepted - closed : 0) +
+         (tail > head ? tail - head : 0);
+}
+
+/**
+ * @brief Add the open connections and pending output of the workers
+ *
+ * @param reactor the acceptor
+ * @param clients incremented by the open connections of the workers
+ * @param buffered incremented by the pending output of the workers
+ * @return uint64_t connections closed by the workers so far
+ */
+static uint64_t worker_totals(s_reactor *reactor, size_t *clients,
+                              size_t *buffered) {
+  uint64_t closed = 0;
+
+  for (size_t i = 0; i < reactor->nworkers; i++) {
+    *clients += worker_clients(reactor, i);
+    *buffered += counter_get(&reactor->workers[i]->stats.buffered);
+    closed += counter_get(&reactor->workers[i]->stats.closed);
+  }
+  return closed;
+}
+
+/**
+ * @brief Pause or resume accepting connections according to the limits
+ *
+ * While paused the listening sockets are polled without read interest, so new
+ * connections wait in the kernel accept queue (backpressure to the clients)
+ * instead of being accepted and closed.
+ *
+ * @param reactor the reactor
+ * @return bool true if accepting is paused
+ */
+static bool update_admission(s_reactor *reactor) {
+  s_reactor_config *config = &reactor->config;
+  s_admission *admission = &reactor->admission;
+  size_t clients = reactor->fds.count - reactor->listeners;
+  size_t buffered = admission->buffered;
+  bool paused;
+
+  // Never resumes once draining
+  if (reactor->draining) {
+    return true;
+  }
+
+  // An acceptor counts the clients of its workers
+  if (reactor->nworkers > 0) {
+    uint64_t closed = worker_totals(reactor, &clients, &buffered);
+
+    if (admission->out_of_fds && closed != admission->closed) {
+      admission->out_of_fds = false;
+    }
+  }
+  // Descriptors may be freed elsewhere (other threads, shared memory
+  // clients): retry a tick later even without any close
+  if (admission->out_of_fds &&
+      now_ms() - admission->fds_ms >= REACTOR_TIMER_TICK) {
+    admission->out_of_fds = false;
+  }
+  paused = admission->out_of_fds ||
+           (config->max_connections && clients >= config->max_connections) ||
+           (config->max_buffered && buffered >= config->max_buffered);
+
+  if (paused == admission->paused) {
+    return paused;
+  }
+
+  admission->paused = paused;
+  for (size_t i = 0; i < reactor->listeners; i++) {
+    if (reactor_is_listener(reactor, i)) {
+      reactor->fds.items[i].events = paused ? 0 : POLLIN;
+    }
+  }
+  counter_set(&reactor->stats.paused, paused);
+  if (paused) {
+    counter_add(&reactor->stats.deferred, 1);
+    printf("Accept paused (%zu clients, %zu bytes buffered), deferred=%llu "
+           "rejected=%llu\n",
+           clients, buffered,
+           (unsigned long long)counter_get(&reactor->stats.deferred),
+           (unsigned long long)counter_get(&reactor->stats.rejected));
+  } else {
+    printf("Accept resumed (%zu clients, %zu bytes buffered)\n", clients,
+           buffered);
+  }
+  return paused;
+}
+
+/**
+ * @brief Enable busy polling of the device queue on a socket
+ *
+ * Blocking and polling on the socket then spin on the device queue instead of
+ * waiting for its interrupt. SO_PREFER_BUSY_POLL (Linux 5.11) also lets the
+ * busy polling defer the device interrupts while the application keeps up.
+ *
+ * @return int 0 if success, -1 if SO_BUSY_POLL was refused
+ */
+static int set_busy_poll(s_reactor *reactor, int fd) {
+  int usec = reactor->config.busy_poll_us;
+  int sockopt = 1;
+  int budget = REACTOR_BUSY_POLL_BUDGET;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+    return -1;
+  }
+#ifdef SO_PREFER_BUSY_POLL
+  // Best effort: older kernels only have SO_BUSY_POLL
+  setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &sockopt, sizeof(sockopt));
+  setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget));
+#else
+  (void)sockopt;
+  (void)budget;
+#endif
+  return 0;
+}
+
+int reactor_busy_poll(s_reactor *reactor) {
+  reactor->busy_poll = true;
+  for (size_t i = 0; i < reactor->listeners; i++) {
+    int fd = reactor->fds.items[i].fd;
+    int domain = AF_UNIX;
+    socklen_t size = sizeof(domain);
+
+    // Unix sockets (and the inbox eventfd) have no device queue
+    getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &size);
+    if (domain != AF_UNIX && set_busy_poll(reactor, fd) != 0) {
+      reactor->busy_poll = false;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Register a new connection
+ *
+ * @param reactor the reactor
+ * @param fd connected socket
+ * @param addr source address, NULL for a local client
+ * @return s_conn* the connection
+ */
+static s_conn *register_client(s_reactor *reactor, int fd,
+                               const struct sockaddr_storage *addr) {
+  // The hot fields fill the first two cache lines of the allocation
+  s_conn *conn = aligned_alloc(_Alignof(s_conn), sizeof(s_conn));
+  s_conn_info info = {0};
+
+  assert(conn != NULL && "Maybe you should buy more RAM");
+  memset(conn, 0, sizeof(*conn));
+  if (addr != NULL) {
+    info.addr = *addr;
+  } else {
+    conn->local = true;
+  }
+
+  // Writes must never block the event loop
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if (reactor->busy_poll && !conn->local) {
+    set_busy_poll(reactor, fd);
+  }
+
+  conn->index = reactor->fds.count;
+  conn->read_size = reactor->config.read_size;
+  info.created_ms = now_ms();
+  conn->last_active_ms = info.created_ms;
+
+  register_fd(&reactor->fds, fd);
+  da_append(&reactor->conns, conn);
+  da_append(&reactor->info, info);
+  schedule_client(reactor, conn);
+  counter_add(&reactor->stats.accepted, 1);
+  return conn;
+}
+
+s_conn *reactor_add_client(s_reactor *reactor, int fd,
+                           const struct sockaddr_storage *addr) {
+  if (reactor->config.max_per_ip && addr != NULL) {
+    struct in6_addr ip = peer_ip(addr);
+
+    ip_table_acquire(&reactor->admission.per_ip, &ip);
+  }
+  return register_client(reactor, fd, addr);
+}
+
+/**
+ * @brief Get the CPU that last received a packet of a socket
+ *
+ * @return int the CPU, -1 if unknown
+ */
+static int incoming_cpu(int fd) {
+  int cpu = -1;
+  socklen_t size = sizeof(cpu);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &size) != 0) {
+    return -1;
+  }
+  return cpu;
+}
+
+/**
+ * @brief Admit a connection accepted by the reactor or handed by an acceptor
+ *
+ * @param reactor the reactor
+ * @param fd connected socket
+ * @param addr source address, NULL for a local client
+ */
+static void admit_client(s_reactor *reactor, int fd,
+                         const struct sockaddr_storage *addr) {
+  s_admission *admission = &reactor->admission;
+  s_conn *conn;
+
+  // The source address is only known once accepted
+  if (reactor->config.max_per_ip && addr != NULL) {
+    struct in6_addr ip = peer_ip(addr);
+
+    if (ip_table_acquire(&admission->per_ip, &ip) >
+        reactor->config.max_per_ip) {
+      char name[INET6_ADDRSTRLEN + 16];
+
+      ip_table_release(&admission->per_ip, &ip);
+      close(fd);
+      counter_add(&reactor->stats.rejected, 1);
+      printf("Connection from %s rejected (per address limit), "
+             "rejected=%llu\n",
+             format_addr(addr, name, sizeof(name)),
+             (unsigned long long)counter_get(&reactor->stats.rejected));
+      return;
+    }
+  }
+
+  // Only TCP clients have a receiving CPU
+  if (reactor->cpu != -1 && addr != NULL) {
+    int cpu = incoming_cpu(fd);
+
+    if (cpu != -1 && cpu != reactor->cpu) {
+      counter_add(&reactor->stats.cross_cpu, 1);
+    }
+  }
+  TRACE_PROBE2(echo, accept, fd, reactor->fds.count);
+  conn = register_client(reactor, fd, addr);
+  // Only for accepted connections: one handed over by a hot upgrade goes on
+  // with the zerocopy sequence numbers of the previous process, whose
+  // pending completions are dropped when they show up (see reap_zerocopy)
+  if (reactor->config.zerocopy && !conn->local) {
+    int one = 1;
+
+    conn->zerocopy =
+        setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+  }
+  if (reactor->handler.on_accept != NULL &&
+      reactor->handler.on_accept(reactor, conn) < 0) {
+    close(fd);
+    remove_client(reactor, conn->index);
+    return;
+  }
+
+  // With TCP_DEFER_ACCEPT or Fast Open the first request is usually queued
+  // already: answer it in this iteration instead of after the next poll
+  if (reactor->config.read_on_accept) {
+    uint64_t reads = counter_get(&reactor->stats.reads);
+    int status = read_client(reactor, conn, &reactor->fds.items[conn->index]);
+
+    if (counter_get(&reactor->stats.reads) != reads) {
+      counter_add(&reactor->stats.early_reads, 1);
+    }
+    if (status == REACTOR_DETACH) {
+      close_client(reactor, conn->index, REACTOR_DETACHED);
+    } else if (status == REACTOR_CLOSE) {
+      close_client(reactor, conn->index, REACTOR_CLOSED);
+    }
+  }
+}
+
+/**
+ * @brief Start a new load window once the current one is over
+ *
+ * @param reactor the acceptor
+ * @param now current time in milliseconds
+ */
+static void update_load(s_reactor *reactor, uint64_t now) {
+  if (now - reactor->window_ms < REACTOR_LOAD_WINDOW) {
+    return;
+  }
+  for (size_t i = 0; i < reactor->nworkers; i++) {
+    s_reactor_stats *stats = &reactor->workers[i]->stats;
+    s_worker_load *load = &reactor->load[i];
+    uint64_t bytes =
+        counter_get(&stats->bytes_in) + counter_get(&stats->bytes_out);
+
+    load->recent = bytes - load->bytes;
+    load->bytes = bytes;
+    load->assigned = 0;
+  }
+  reactor->window_ms = now;
+}
+
+/**
+ * @brief Pick the worker of a new connection
+ *
+ * least-loaded charges the connections handed during the window the average
+ * traffic of a connection over the previous one, so a burst spreads out
+ * instead of all going to the quietest worker. Ties go to the worker with
+ * the fewest connections.
+ *
+ * @param reactor the acceptor
+ * @return size_t index of the worker
+ */
+static size_t pick_worker(s_reactor *reactor) {
+  uint64_t best_score = UINT64_MAX;
+  size_t best_clients = SIZE_MAX;
+  uint64_t average = 0;
+  size_t best = 0;
+
+  if (reactor->balance == REACTOR_BALANCE_ROUND_ROBIN) {
+    best = reactor->next_worker;
+    reactor->next_worker = (best + 1) % reactor->nworkers;
+    return best;
+  }
+  if (reactor->balance == REACTOR_BALANCE_LEAST_LOADED) {
+    uint64_t recent = 0;
+    size_t clients = 0;
+
+    update_load(reactor, now_ms());
+    for (size_t i = 0; i < reactor->nworkers; i++) {
+      recent += reactor->load[i].recent;
+      clients += worker_clients(reactor, i);
+    }
+    average = recent / (clients + 1) + 1;
+  }
+
+  for (size_t i = 0; i < reactor->nworkers; i++) {
+    s_worker_load *load = &reactor->load[i];
+    size_t clients = worker_clients(reactor, i);
+    uint64_t score = clients;
+
+    if (reactor->balance == REACTOR_BALANCE_LEAST_LOADED) {
+      score = load->recent + load->assigned * average;
+    }
+    if (score < best_score ||
+        (score == best_score && clients < best_clients)) {
+      best_score = score;
+      best_clients = clients;
+      best = i;
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief Hand an accepted connection to a worker
+ *
+ * @param reactor the acceptor
+ * @param fd connected socket
+ * @param addr source address, NULL for a local client
+ */
+static void hand_off(s_reactor *reactor, int fd,
+                     const struct sockaddr_storage *addr) {
+  size_t worker = pick_worker(reactor);
+
+  if (reactor_post(reactor->workers[worker], fd, addr) != 0) {
+    close(fd);
+    counter_add(&reactor->stats.rejected, 1);
+    eprintf("Error inbox of worker %zu full, connection closed\n", worker);
+    return;
+  }
+  reactor->load[worker].assigned++;
+}
+
+/**
+ * @brief Hand a connection to the reactor of the CPU that received it
+ *
+ * @param reactor reactor of a CPU steered group
+ * @param fd connected socket
+ * @param addr source address
+ * @return bool true if handed over
+ */
+static bool steer_client(s_reactor *reactor, int fd,
+                         const struct sockaddr_storage *addr) {
+  int cpu = incoming_cpu(fd);
+
+  if (cpu == -1 || cpu == reactor->cpu) {
+    return false;
+  }
+  for (size_t i = 0; i < reactor->npeers; i++) {
+    s_reactor *peer = reactor->peers[i];
+
+    if (peer != reactor && peer->cpu == cpu) {
+      if (reactor_post(peer, fd, addr) != 0) {
+        return false; // Served here rather than dropped
+      }
+      counter_add(&reactor->stats.steered, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Accept the incoming connections
+ *
+ * Accepts up to REACTOR_ACCEPT_BATCH connections, stopping as soon as a limit
+ * is hit. An acceptor hands them to its workers.
+ *
+ * @param reactor the reactor
+ * @param listener index of the listening socket in the poll array
+ */
+static void accept_clients(s_reactor *reactor, size_t listener) {
+  s_admission *admission = &reactor->admission;
+
+  for (size_t n = 0;
+       n < REACTOR_ACCEPT_BATCH && !update_admission(reactor); n++) {
+    int connfd = 0;
+    struct sockaddr_storage addr = {0};
+    socklen_t addr_size = sizeof(addr);
+    bool local;
+
+    connfd = accept(reactor->fds.items[listener].fd, (struct sockaddr *)&addr,
+                    &addr_size);
+    if (connfd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno == EMFILE || errno == ENFILE) {
+        // Wait for a client to close, or a tick, instead of spinning on the
+        // listener
+        admission->out_of_fds = true;
+        admission->fds_ms = now_ms();
+        if (reactor->nworkers > 0) {
+          size_t ignored = 0;
+          admission->closed = worker_totals(reactor, &ignored, &ignored);
+        }
+        eprintf("Error accept failed: %s\n", strerror(errno));
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        eprintf("Error accept failed: %s\n", strerror(errno));
+      }
+      break;
+    }
+    local = addr.ss_family == AF_UNIX;
+
+    if (reactor->nworkers > 0) {
+      hand_off(reactor, connfd, local ? NULL : &addr);
+    } else if (reactor->npeers > 0 && !local &&
+               steer_client(reactor, connfd, &addr)) {
+      continue;
+    } else {
+      admit_client(reactor, connfd, local ? NULL : &addr);
+    }
+  }
+}
+
+int reactor_post(s_reactor *reactor, int fd,
+                 const struct sockaddr_storage *addr) {
+  s_inbox *inbox = &reactor->inbox;
+  size_t tail = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+  uint64_t one = 1;
+  s_inbox_slot *slot;
+
+  // Claim a position whose slot the worker already read
+  while (true) {
+    size_t seq;
+
+    slot = &inbox->slots[tail & (REACTOR_INBOX_SIZE - 1)];
+    seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq == tail) {
+      if (atomic_compare_exchange_weak_explicit(&inbox->tail, &tail, tail + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    } else if (seq < tail) {
+      return -1; // Full
+    } else {
+      tail = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+    }
+  }
+
+  slot->fd = fd;
+  slot->local = addr == NULL;
+  if (addr != NULL) {
+    slot->addr = *addr;
+  }
+  atomic_store_explicit(&slot->seq, tail + 1, memory_order_release);
+
+  // Wake the worker only if it may be blocked (see drain_inbox)
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&inbox->armed, memory_order_relaxed) &&
+      atomic_exchange_explicit(&inbox->armed, false, memory_order_relaxed)) {
+    if (write(inbox->efd, &one, sizeof(one)) != sizeof(one)) {
+      eprintf("Error write failed: %s\n", strerror(errno));
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Pop a connection handed to the reactor
+ *
+ * @return bool true if `entry` was filled
+ */
+static bool inbox_pop(s_inbox *inbox, s_inbox_slot *entry) {
+  size_t head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+  s_inbox_slot *slot = &inbox->slots[head & (REACTOR_INBOX_SIZE - 1)];
+
+  if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + 1) {
+    return false;
+  }
+  entry->fd = slot->fd;
+  entry->local = slot->local;
+  entry->addr = slot->addr;
+  // The slot is free again for the position one lap later
+  atomic_store_explicit(&slot->seq, head + REACTOR_INBOX_SIZE,
+                        memory_order_release);
+  atomic_store_explicit(&inbox->head, head + 1, memory_order_relaxed);
+  return true;
+}
+
+/**
+ * @brief Admit the connections handed to the reactor
+ *
+ * Producers only write the eventfd while the inbox is armed: it is armed
+ * once drained, then checked again, so a connection posted meanwhile is
+ * either seen here or signaled.
+ *
+ * @param reactor the reactor
+ */
+static void drain_inbox(s_reactor *reactor) {
+  s_inbox *inbox = &reactor->inbox;
+  s_inbox_slot entry;
+  uint64_t value;
+
+  if (read(inbox->efd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+    eprintf("Error read failed: %s\n", strerror(errno));
+  }
+  while (true) {
+    size_t head;
+
+    while (inbox_pop(inbox, &entry)) {
+      admit_client(reactor, entry.fd, entry.local ? NULL : &entry.addr);
+    }
+    atomic_store_explicit(&inbox->armed, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+    if (atomic_load_explicit(
+            &inbox->slots[head & (REACTOR_INBOX_SIZE - 1)].seq,
+            memory_order_acquire) != head + 1) {
+      break;
+    }
+    atomic_store_explicit(&inbox->armed, false, memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Create the inbox of a worker reactor
+ *
+ */
+static void add_inbox(s_reactor *reactor) {
+  s_inbox *inbox = &reactor->inbox;
+
+  if (inbox->slots != NULL) {
+    return;
+  }
+  assert(reactor->conns.count == 0 && "Inbox must be added before clients");
+  inbox->slots = calloc(REACTOR_INBOX_SIZE, sizeof(s_inbox_slot));
+  assert(inbox->slots != NULL && "Maybe you should buy more RAM");
+  for (size_t i = 0; i < REACTOR_INBOX_SIZE; i++) {
+    atomic_init(&inbox->slots[i].seq, i);
+  }
+  atomic_init(&inbox->tail, 0);
+  atomic_init(&inbox->armed, true);
+  atomic_init(&inbox->head, 0);
+  inbox->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(inbox->efd != -1 && "Cannot create the inbox eventfd");
+  inbox->index = reactor->fds.count;
+  register_fd(&reactor->fds, inbox->efd);
+  reactor->listeners = reactor->fds.count;
+}
+
+void reactor_set_workers(s_reactor *acceptor, s_reactor **workers,
+                         size_t count, e_reactor_balance balance) {
+  acceptor->workers = malloc(count * sizeof(s_reactor *));
+  assert(acceptor->workers != NULL && "Maybe you should buy more RAM");
+  memcpy(acceptor->workers, workers, count * sizeof(s_reactor *));
+  acceptor->nworkers = count;
+  acceptor->balance = balance;
+  acceptor->load = calloc(count, sizeof(s_worker_load));
+  assert(acceptor->load != NULL && "Maybe you should buy more RAM");
+  acceptor->window_ms = now_ms();
+  for (size_t i = 0; i < count; i++) {
+    add_inbox(workers[i]);
+  }
+}
+
+int reactor_steer_cpu(s_reactor **group, size_t count, int fd) {
+  // A = receiving CPU; return the index of the reactor pinned on it, or an
+  // out of range index (the kernel then falls back to its hash)
+  struct sock_filter *code = calloc(2 * count + 2, sizeof(struct sock_filter));
+  struct sock_fprog program = {.len = 2 * count + 2, .filter = code};
+  int status;
+
+  assert(code != NULL && "Maybe you should buy more RAM");
+  code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                         SKF_AD_OFF + SKF_AD_CPU);
+  for (size_t i = 0; i < count; i++) {
+    code[1 + 2 * i] = (struct sock_filter)BPF_JUMP(
+        BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)group[i]->cpu, 0, 1);
+    code[2 + 2 * i] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+  }
+  code[2 * count + 1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, count);
+
+  status = setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                      sizeof(program));
+  free(code);
+
+  for (size_t i = 0; i < count; i++) {
+    add_inbox(group[i]);
+    group[i]->peers = malloc(count * sizeof(s_reactor *));
+    assert(group[i]->peers != NULL && "Maybe you should buy more RAM");
+    memcpy(group[i]->peers, group, count * sizeof(s_reactor *));
+    group[i]->npeers = count;
+  }
+  return status == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Close the connections of a draining reactor once they are idle
+ *
+ * The first call stops polling the listeners. An idle connection has no
+ * unconsumed input and no pending output: everything it sent was answered
+ * and written. Past the deadline every connection is closed. The reactor
+ * stops once no connection is left, an acceptor once its workers have none
+ * either.
+ *
+ * @param reactor the reactor
+ * @param deadline drain deadline (now_ms)
+ */
+static void drain_clients(s_reactor *reactor, uint64_t deadline) {
+  uint64_t now = now_ms();
+
+  if (!reactor->draining) {
+    reactor->draining = true;
+    for (size_t i = 0; i < reactor->listeners; i++) {
+      if (reactor_is_listener(reactor, i)) {
+        reactor->fds.items[i].events = 0;
+      }
+    }
+  }
+
+  for (size_t i = reactor->listeners; i < reactor->fds.count; i++) {
+    s_conn *conn = reactor->conns.items[i - reactor->listeners];
+
+    if (now < deadline &&
+        (conn->in.count > 0 || conn->out_offset < conn->out.count)) {
+      continue;
+    }
+    counter_add(&reactor->stats.drained, 1);
+    close_client(reactor, i--, REACTOR_DRAINED);
+  }
+
+  // An acceptor keeps polling (its watched descriptor too) until the workers
+  // are drained
+  if (reactor->conns.count == 0) {
+    size_t clients = 0;
+    size_t buffered = 0;
+
+    worker_totals(reactor, &clients, &buffered);
+    if (clients == 0) {
+      atomic_store(&reactor->stop, true);
+    }
+  }
+}
+
+/**
+ * @brief Write the output queued during the iteration
+ *
+ * @param reactor the reactor
+ */
+static void flush_dirty(s_reactor *reactor) {
+  for (size_t i = 0; i < reactor->dirty.count; i++) {
+    s_conn *conn = reactor->dirty.items[i];
+
+    conn->dirty = false;
+    if (flush_queued(reactor, conn)) {
+      close_client(reactor, conn->index, REACTOR_CLOSED);
+    } else if (conn->stall_ms) {
+      schedule_client(reactor, conn);
+    }
+  }
+  da_clear(&reactor->dirty);
+}
+
+/**
+ * @brief Wait for events on the poll array
+ *
+ * In busy poll mode the array is first checked without blocking until an
+ * event shows up, the spin budget is spent or a timer is due: an event found
+ * while spinning is handled without any wakeup or scheduling latency. Only
+ * then does the loop fall back to a blocking poll.
+ *
+ * @param reactor the reactor
+ * @param timeout poll timeout in milliseconds (-1 for none)
+ * @return int poll status
+ */
+static int wait_events(s_reactor *reactor, int timeout) {
+  s_da_fd *fds = &reactor->fds;
+  uint64_t budget_ns = reactor->config.busy_poll_us * 1000;
+
+  if (budget_ns) {
+    uint64_t start = now_ns();
+    uint64_t spun = 0;
+    int status;
+
+    if (timeout >= 0 && (uint64_t)timeout * 1000000 < budget_ns) {
+      budget_ns = (uint64_t)timeout * 1000000;
+    }
+    do {
+      status = poll(fds->items, fds->count, 0);
+      counter_add(&reactor->stats.spin_polls, 1);
+      if (status != 0) {
+        if (status > 0) {
+          counter_add(&reactor->stats.spin_hits, 1);
+        }
+        return status;
+      }
+      spun = now_ns() - start;
+    } while (spun < budget_ns);
+
+    // The time spun counts toward the timer deadline
+    if (timeout > 0) {
+      timeout = spun / 1000000 < (uint64_t)timeout
+                    ? timeout - (int)(spun / 1000000)
+                    : 0;
+    }
+  }
+
+  counter_add(&reactor->stats.blocking_waits, 1);
+  return poll(fds->items, fds->count, timeout);
+}
+
+int reactor_run_once(s_reactor *reactor, int timeout) {
+  s_reactor_stats *stats = &reactor->stats;
+  s_da_fd *fds = &reactor->fds;
+  int next = tw_next_timeout(&reactor->timers, now_ms());
+  uint64_t reads = counter_get(&stats->reads);
+  int poll_status = 0;
+  int pending;
+  uint64_t drain_deadline;
+  uint64_t done_ns;
+
+  // Wait until an event or the next connection timer
+  if (timeout == -1 || (next != -1 && next < timeout)) {
+    timeout = next;
+  }
+  // A paused acceptor is not woken by the closes of its workers, accepting
+  // out of descriptors is retried, a draining reactor checks its deadline,
+  // lingering sockets are not polled
+  if (((reactor->nworkers > 0 && reactor->admission.paused) ||
+       reactor->admission.out_of_fds ||
+       atomic_load_explicit(&reactor->drain_ms, memory_order_relaxed) ||
+       reactor->zc_linger.count > 0) &&
+      (timeout == -1 || timeout > REACTOR_TIMER_TICK)) {
+    timeout = REACTOR_TIMER_TICK;
+  }
+  poll_status = wait_events(reactor, timeout);
+
+  reactor->wake_ns = now_ns();
+  TRACE_PROBE2(echo, loop_start, poll_status, fds->count);
+  counter_add(&stats->poll_wait_ns, reactor->wake_ns - reactor->idle_ns);
+  counter_add(&stats->wakeups, 1);
+
+  if (poll_status == -1) {
+    reactor->idle_ns = reactor->wake_ns;
+    if (errno == EINTR) {
+      return 0;
+    }
+    eprintf("Error poll failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // Clients with events: the poll array is only scanned up to the last one,
+  // and a connection is only loaded once it has events
+  pending = poll_status;
+  for (size_t i = 0; i < reactor->listeners; i++) {
+    pending -= fds->items[i].revents != 0;
+  }
+  for (size_t i = reactor->listeners; pending > 0 && i < fds->count; i++) {
+    struct pollfd *pfd = &fds->items[i];
+    s_conn *conn;
+    int status = 0;
+
+    if (pfd->revents == 0) {
+      continue;
+    }
+    pending--;
+    conn = reactor->conns.items[i - reactor->listeners];
+    // Zerocopy completions raise POLLERR without any error, also on a
+    // connection with nothing in flight (handed over with completions
+    // pending)
+    if (pfd->revents & POLLERR &&
+        reap_zerocopy(reactor, pfd->fd, &conn->zc_inflight) > 0) {
+      pfd->revents &= ~POLLERR;
+      if (pfd->revents == 0) {
+        continue;
+      }
+    }
+    if (pfd->revents & POLLOUT) {
+      status = flush_client(reactor, conn, pfd) ? REACTOR_CLOSE : 0;
+      if (status == 0 && conn->stall_ms == 0 &&
+          reactor->handler.on_writable != NULL) {
+        status = reactor->handler.on_writable(reactor, conn);
+      }
+    } else if (pfd->revents & POLLIN) {
+      status = read_client(reactor, conn, pfd);
+    } else if (pfd->revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      status = REACTOR_CLOSE;
+    }
+
+    if (status == REACTOR_DETACH) {
+      close_client(reactor, i--, REACTOR_DETACHED);
+    } else if (status == REACTOR_CLOSE) {
+      close_client(reactor, i--, REACTOR_CLOSED);
+    } else if (conn->stall_ms) {
+      schedule_client(reactor, conn);
+    }
+  }
+
+  // One writev per connection for the output of this iteration
+  flush_dirty(reactor);
+
+  // Check if we have incoming connections
+  for (size_t i = 0; i < reactor->listeners; i++) {
+    if (!(fds->items[i].revents & POLLIN)) {
+      continue;
+    }
+    if (reactor->inbox.slots != NULL && i == reactor->inbox.index) {
+      drain_inbox(reactor);
+    } else if (reactor->watch.fn != NULL && i == reactor->watch.index) {
+      reactor->watch.fn(reactor, reactor->watch.fd, reactor->watch.arg);
+    } else {
+      accept_clients(reactor, i);
+    }
+  }
+  // Replies to the requests read right after accept
+  if (reactor->dirty.count > 0) {
+    flush_dirty(reactor);
+  }
+
+  // Evict the connections whose timeouts expired
+  tw_advance(&reactor->timers, now_ms(), expire_client, reactor);
+
+  drain_deadline = atomic_load(&reactor->drain_ms);
+  if (drain_deadline != 0) {
+    drain_clients(reactor, drain_deadline);
+  }
+  if (reactor->zc_linger.count > 0) {
+    reap_lingering(reactor);
+  }
+
+  // Resume accepting if closed connections freed some capacity
+  update_admission(reactor);
+
+  done_ns = now_ns();
+  TRACE_PROBE2(echo, loop_end, counter_get(&stats->reads) - reads,
+               done_ns - reactor->wake_ns);
+  counter_set(&stats->buffered, reactor->admission.buffered);
+  counter_add(&stats->processing_ns, done_ns - reactor->wake_ns);
+  histogram_record(&stats->loop_ns, done_ns - reactor->wake_ns);
+  histogram_record(&stats->reads_per_wakeup,
+                   counter_get(&stats->reads) - reads);
+  reactor->idle_ns = done_ns;
+  return 0;
+}
+
+int reactor_run(s_reactor *reactor) {
+  while (!atomic_load(&reactor->stop)) {
+    if (reactor_run_once(reactor, -1) == -1) {
+      return -1;
+    }
+  }
+  // Ready to run again
+  atomic_store(&reactor->stop, false);
+  return 0;
+}
+
+void reactor_stop(s_reactor *reactor) {
+  atomic_store(&reactor->stop, true);
+  // Wake a worker blocked on its inbox
+  if (reactor->inbox.slots != NULL) {
+    eventfd_write(reactor->inbox.efd, 1);
+  }
+}
+
+void reactor_drain(s_reactor *reactor, uint64_t timeout) {
+  uint64_t deadline = now_ms() + timeout;
+  uint64_t current = atomic_load(&reactor->drain_ms);
+
+  while ((current == 0 || deadline < current) &&
+         !atomic_compare_exchange_weak(&reactor->drain_ms, &current,
+                                       deadline)) {
+  }
+  // Wake a worker blocked on its inbox
+  if (reactor->inbox.slots != NULL) {
+    eventfd_write(reactor->inbox.efd, 1);
+  }
+}
+
+void reactor_watch(s_reactor *reactor, int fd, reactor_watch_fn fn,
+                   void *arg) {
+  assert(reactor->conns.count == 0 && "Watch must be added before clients");
+  assert(reactor->watch.fn == NULL && "Only one descriptor can be watched");
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  reactor->watch.fd = fd;
+  reactor->watch.index = reactor->fds.count;
+  reactor->watch.fn = fn;
+  reactor->watch.arg = arg;
+  register_fd(&reactor->fds, fd);
+  reactor->listeners = reactor->fds.count;
+}
+
+void reactor_add_listener(s_reactor *reactor, int fd) {
+  // Listening sockets come first in the poll array, before any client
+  assert(reactor->conns.count == 0 && "Listeners must be added first");
+  // The accept loop drains the queue until EAGAIN
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  register_fd(&reactor->fds, fd);
+  reactor->listeners = reactor->fds.count;
+}
+
+void reactor_init(s_reactor *reactor, const s_reactor_config *config,
+                  const s_reactor_handler *handler, void *arg) {
+  size_t max_read_size;
+
+  memset(reactor, 0, sizeof(*reactor));
+  reactor->config = *config;
+  if (reactor->config.read_size == 0) {
+    reactor->config.read_size = REACTOR_READ_SIZE;
+  }
+  // Adaptive read sizes are size classes of the pool: round down
+  max_read_size = reactor->config.read_size;
+  for (int class = 1; class < REACTOR_POOL_CLASSES; class++) {
+    if (reactor->config.read_size << class <= reactor->config.max_read_size) {
+      max_read_size = reactor->config.read_size << class;
+    }
+  }
+  reactor->config.max_read_size = max_read_size;
+  reactor->handler = *handler;
+  reactor->arg = arg;
+  reactor->cpu = -1;
+  tw_init(&reactor->timers, now_ms(), REACTOR_TIMER_TICK);
+  reactor->idle_ns = now_ns();
+}
+
+void reactor_free(s_reactor *reactor) {
+  da_foreach_unsafe(&reactor->fds, item) { close(item->fd); }
+  da_for_unsafe(&reactor->conns, i) {
+    s_conn *conn = reactor->conns.items[i];
+    da_free(&conn->out);
+    da_free(&conn->in);
+    da_free(&conn->queued);
+    da_foreach_unsafe(&conn->zc_inflight, buffer) { free(buffer->items); }
+    da_free(&conn->zc_inflight);
+    free(conn);
+  }
+  da_foreach_unsafe(&reactor->zc_linger, linger) { end_linger(linger); }
+  da_free(&reactor->zc_linger);
+  for (int class = 0; class < REACTOR_POOL_CLASSES; class++) {
+    da_foreach_unsafe(&reactor->pool[class], items) { free(*items); }
+    da_free(&reactor->pool[class]);
+  }
+  reactor->pooled = 0;
+  da_free(&reactor->fds);
+  da_free(&reactor->conns);
+  da_free(&reactor->info);
+  da_free(&reactor->dirty);
+  free(reactor->admission.per_ip.slots);
+  reactor->admission.per_ip.slots = NULL;
+  if (reactor->inbox.slots != NULL) {
+    s_inbox_slot entry;
+
+    // Connections handed but never admitted (the eventfd is in fds)
+    while (inbox_pop(&reactor->inbox, &entry)) {
+      close(entry.fd);
+    }
+    free(reactor->inbox.slots);
+    reactor->inbox.slots = NULL;
+  }
+  free(reactor->workers);
+  free(reactor->load);
+  free(reactor->peers);
+  reactor->workers = NULL;
+  reactor->nworkers = 0;
+  reactor->load = NULL;
+  reactor->peers = NULL;
+  reactor->npeers = 0;
+}
+
+void reactor_stats_merge(s_reactor_stats *dst, s_reactor_stats *src) {
+#define MERGE(name) counter_add(&dst->name, counter_get(&src->name))
+  MERGE(accepted);
+  MERGE(closed);
+  MERGE(bytes_in);
+  MERGE(bytes_out);
+  MERGE(reads);
+  MERGE(writevs);
+  MERGE(wakeups);
+  MERGE(poll_wait_ns);
+  MERGE(processing_ns);
+  MERGE(evicted_idle);
+  MERGE(evicted_write_stall);
+  MERGE(evicted_lifetime);
+  MERGE(rejected);
+  MERGE(deferred);
+  MERGE(buffered);
+  MERGE(paused);
+  MERGE(spin_polls);
+  MERGE(spin_hits);
+  MERGE(blocking_waits);
+  MERGE(cross_cpu);
+  MERGE(steered);
+  MERGE(drained);
+  MERGE(zerocopy_sends);
+  MERGE(zerocopy_bytes);
+  MERGE(zerocopy_copied);
+  MERGE(early_reads);
+  MERGE(buffer_allocs);
+  MERGE(pooled_bytes);
+#undef MERGE
+  histogram_merge(&dst->reads_per_wakeup, &src->reads_per_wakeup);
+  histogram_merge(&dst->loop_ns, &src->loop_ns);
+  histogram_merge(&dst->latency_ns, &src->latency_ns);
+}
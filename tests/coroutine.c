@@ -0,0 +1,231 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../includes/coroutine.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define BIG_SIZE (1024 * 1024)
+
+// State shared with the client coroutines
+typedef struct {
+  int lines;    // lines answered
+  int unwound;  // coroutines that saw the close
+  size_t steps; // co_suspend calls seen by `counter`
+  char *big;    // BIG_SIZE reply (NULL to echo the line)
+} s_session;
+
+void counter(s_co *co, void *arg) {
+  s_session *session = arg;
+
+  for (int i = 0; i < 3; i++) {
+    session->steps++;
+    co_suspend(co);
+  }
+}
+
+int recurse(int depth) {
+  volatile char frame[1024];
+
+  frame[0] = (char)depth;
+  if (depth == 1 << 20) {
+    return 0; // 1 GiB, far past the guard page
+  }
+  return recurse(depth + 1) + frame[0];
+}
+
+void overflow(s_co *co, void *arg) { recurse(0); }
+
+// Greet, then answer every line
+void session(s_co *co, void *arg) {
+  s_session *state = arg;
+  char line[128];
+  size_t size = 0;
+
+  co_write(co, "hi\n", 3);
+  while (co_read(co, line + size, 1) == 1) {
+    if (line[size++] != '\n' && size < sizeof(line)) {
+      continue;
+    }
+    if (state->big != NULL) {
+      co_write(co, state->big, BIG_SIZE);
+    } else {
+      co_write(co, line, size);
+    }
+    state->lines++;
+    size = 0;
+  }
+  state->unwound++;
+}
+
+// Read what is available without blocking
+ssize_t read_now(int fd, char *buffer, size_t size) {
+  ssize_t n = recv(fd, buffer, size, MSG_DONTWAIT);
+  return n == -1 ? 0 : n;
+}
+
+int test_resume() {
+  s_session state = {0};
+  s_co_pool pool;
+  s_co *co;
+  char *mapping;
+
+  co_pool_init(&pool, 0);
+  co = co_create(&pool, counter, &state);
+  test_assert(co->state == CO_READY && state.steps == 0,
+              "Coroutine should not run before the first resume");
+  test_assert(co_resume(co) && state.steps == 1 &&
+                  co->state == CO_SUSPENDED,
+              "Coroutine should run until it suspends");
+  test_assert(co_resume(co) && co_resume(co) && state.steps == 3,
+              "Coroutine should continue where it suspended");
+  test_assert(!co_resume(co) && co->state == CO_DONE,
+              "Coroutine should end when its function returns");
+
+  mapping = co->mapping;
+  co_release(co);
+  co = co_create(&pool, counter, &state);
+  test_assert(co->mapping == mapping && pool.mapped == 1,
+              "Released stack should be reused");
+  co_release(co);
+  co_pool_free(&pool);
+  test_assert(pool.mapped == 0, "Free stacks should be unmapped");
+  return 0;
+}
+
+int test_guard_page() {
+  pid_t pid = fork();
+  int status;
+
+  if (pid == 0) {
+    s_co_pool pool;
+
+    co_pool_init(&pool, 16 * 1024);
+    co_resume(co_create(&pool, overflow, NULL));
+    exit(0);
+  }
+  test_assert(waitpid(pid, &status, 0) == pid, "Child should exit");
+  test_assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV,
+              "Stack overflow should fault on the guard page");
+  return 0;
+}
+
+int test_session() {
+  s_reactor_config config = {0};
+  s_co_server server = {.fn = session};
+  s_session state = {0};
+  s_reactor reactor;
+  char buffer[64] = {0};
+  int sv[2];
+
+  server.arg = &state;
+  co_pool_init(&server.pool, 0);
+  reactor_init(&reactor, &config, &co_handler, &server);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  co_spawn(&reactor, reactor_add_client(&reactor, sv[0], NULL));
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 3 &&
+                  memcmp(buffer, "hi\n", 3) == 0,
+              "Coroutine should greet before reading");
+
+  test_assert(write(sv[1], "ab", 2) == 2, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 0,
+              "Partial line should not be answered");
+
+  test_assert(write(sv[1], "c\nx\ny\n", 6) == 6, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(state.lines == 3 &&
+                  read_now(sv[1], buffer, sizeof(buffer)) == 8 &&
+                  memcmp(buffer, "abc\nx\ny\n", 8) == 0,
+              "Every line should be answered");
+
+  close(sv[1]);
+  reactor_run_once(&reactor, 1000);
+  test_assert(state.unwound == 1, "co_read should return 0 on close");
+  test_assert(server.pool.free.count == 1 && reactor.conns.count == 0,
+              "Closed client should release its coroutine");
+
+  reactor_free(&reactor);
+  co_pool_free(&server.pool);
+  return 0;
+}
+
+int test_backpressure() {
+  s_reactor_config config = {0};
+  s_co_server server = {.fn = session};
+  s_session state = {0};
+  s_reactor reactor;
+  s_co *co;
+  char *received = malloc(2 * BIG_SIZE);
+  size_t total = 0;
+  int sv[2];
+
+  state.big = malloc(BIG_SIZE);
+  for (size_t i = 0; i < BIG_SIZE; i++) {
+    state.big[i] = (char)(i * 7);
+  }
+  server.arg = &state;
+  co_pool_init(&server.pool, 0);
+  reactor_init(&reactor, &config, &co_handler, &server);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  co = co_spawn(&reactor, reactor_add_client(&reactor, sv[0], NULL));
+  test_assert(read_now(sv[1], received, 3) == 3, "Greeting should be read");
+
+  // Two requests in one segment: the second waits in the read buffer while
+  // the first reply drains
+  test_assert(write(sv[1], "a\nb\n", 4) == 4, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(co->state == CO_WAIT_WRITE && state.lines == 0,
+              "co_write should suspend on a full socket");
+
+  while (total < 2 * BIG_SIZE) {
+    total += read_now(sv[1], received + total, 2 * BIG_SIZE - total);
+    reactor_run_once(&reactor, 10);
+  }
+  test_assert(state.lines == 2 && co->state == CO_WAIT_READ,
+              "Buffered request should be answered after the drain");
+  test_assert(memcmp(received, state.big, BIG_SIZE) == 0 &&
+                  memcmp(received + BIG_SIZE, state.big, BIG_SIZE) == 0,
+              "Replies should be written in order");
+
+  close(sv[1]);
+  reactor_free(&reactor);
+  co_pool_free(&server.pool);
+  free(state.big);
+  free(received);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_resume();
+  failed += test_guard_page();
+  failed += test_session();
+  failed += test_backpressure();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
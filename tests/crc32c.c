@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../includes/crc32c.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define DATA_SIZE 100003
+
+int test_vectors() {
+  char zeros[32] = {0};
+  char ones[32];
+
+  memset(ones, 0xff, sizeof(ones));
+  // Check value of the CRC catalogue and RFC 3720 (iSCSI) vectors
+  test_assert(crc32c_update(0, "123456789", 9) == 0xe3069283,
+              "Check value should match");
+  test_assert(crc32c_update(0, zeros, sizeof(zeros)) == 0x8a9136aa,
+              "32 zero bytes should match RFC 3720");
+  test_assert(crc32c_update(0, ones, sizeof(ones)) == 0x62a8ab43,
+              "32 0xff bytes should match RFC 3720");
+  test_assert(crc32c_update(0, "", 0) == 0, "Empty data should give 0");
+  return 0;
+}
+
+int test_chunks() {
+  char *data = malloc(DATA_SIZE);
+  uint32_t whole;
+  uint32_t crc = 0;
+  size_t offset = 0;
+  size_t chunk = 1;
+
+  for (size_t i = 0; i < DATA_SIZE; i++) {
+    data[i] = (char)(i * 31 + (i >> 8));
+  }
+  whole = crc32c_update(0, data, DATA_SIZE);
+  // Odd sizes and unaligned starts
+  while (offset < DATA_SIZE) {
+    size_t size = DATA_SIZE - offset < chunk ? DATA_SIZE - offset : chunk;
+
+    crc = crc32c_update(crc, data + offset, size);
+    offset += size;
+    chunk = chunk * 3 + 1;
+  }
+  test_assert(crc == whole, "Running checksum should match the whole");
+  test_assert(_crc32c_table_update(~0u, data, DATA_SIZE) == ~whole,
+              "Table should match the default implementation");
+  free(data);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_vectors();
+  failed += test_chunks();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
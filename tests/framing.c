@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../includes/framing.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+int test_line() {
+  const char *data = "hello\nworld\npart";
+  size_t size = strlen(data);
+  size_t length = 0;
+
+  test_assert(frame_next(FRAMING_LINE, data, size, 100, &length) ==
+                  FRAME_COMPLETE,
+              "First line should be complete");
+  test_assert(length == 6, "Line should include its delimiter");
+  test_assert(frame_next(FRAMING_LINE, data + 6, size - 6, 100, &length) ==
+                      FRAME_COMPLETE &&
+                  length == 6,
+              "Second line should be complete");
+  test_assert(frame_next(FRAMING_LINE, data + 12, size - 12, 100, &length) ==
+                  FRAME_INCOMPLETE,
+              "Last line should be incomplete");
+  test_assert(frame_next(FRAMING_LINE, data + 12, size - 12, 4, &length) ==
+                  FRAME_TOO_LARGE,
+              "Line without delimiter within the limit should be too large");
+  test_assert(frame_next(FRAMING_LINE, data, size, 6, &length) ==
+                  FRAME_COMPLETE,
+              "Line of exactly the limit should be accepted");
+  return 0;
+}
+
+int test_length() {
+  char data[FRAME_HEADER_SIZE + 300] = {0, 0, 1, 44}; // 300 bytes payload
+  size_t length = 0;
+
+  test_assert(frame_next(FRAMING_LENGTH, data, 3, 1000, &length) ==
+                  FRAME_INCOMPLETE,
+              "Partial header should be incomplete");
+  test_assert(frame_next(FRAMING_LENGTH, data, 100, 1000, &length) ==
+                  FRAME_INCOMPLETE,
+              "Partial payload should be incomplete");
+  test_assert(frame_next(FRAMING_LENGTH, data, sizeof(data), 1000, &length) ==
+                  FRAME_COMPLETE,
+              "Frame should be complete");
+  test_assert(length == sizeof(data), "Frame should include its header");
+  test_assert(frame_next(FRAMING_LENGTH, data, 3 + 1, 303, &length) ==
+                  FRAME_TOO_LARGE,
+              "Announced size over the limit should be too large");
+
+  // Largest announced size must not overflow
+  data[0] = data[1] = data[2] = data[3] = (char)0xff;
+  test_assert(frame_next(FRAMING_LENGTH, data, 4, SIZE_MAX, &length) ==
+                  FRAME_INCOMPLETE,
+              "4 GiB payload should be incomplete");
+  return 0;
+}
+
+int test_none() {
+  size_t length = 0;
+
+  test_assert(frame_next(FRAMING_NONE, "abc", 0, 10, &length) ==
+                  FRAME_INCOMPLETE,
+              "Empty buffer should be incomplete");
+  test_assert(frame_next(FRAMING_NONE, "abc", 3, 10, &length) ==
+                      FRAME_COMPLETE &&
+                  length == 3,
+              "Everything should be one frame");
+  test_assert(frame_parse_name("line") == FRAMING_LINE &&
+                  frame_parse_name("length") == FRAMING_LENGTH &&
+                  frame_parse_name("none") == FRAMING_NONE &&
+                  frame_parse_name("xml") == -1,
+              "Framing names should parse");
+  return 0;
+}
+
+int test_iov_consume() {
+  char a[10], b[20], c[30];
+  struct iovec iov[3] = {{a, sizeof(a)}, {b, sizeof(b)}, {c, sizeof(c)}};
+  size_t first;
+
+  first = frame_iov_consume(iov, 3, 15);
+  test_assert(first == 1, "First iovec should be written");
+  test_assert(iov[1].iov_base == b + 5 && iov[1].iov_len == 15,
+              "Second iovec should be advanced");
+
+  first += frame_iov_consume(iov + first, 3 - first, 15);
+  test_assert(first == 2 && iov[2].iov_len == 30,
+              "Exact end of an iovec should move to the next one");
+
+  first += frame_iov_consume(iov + first, 3 - first, 30);
+  test_assert(first == 3, "Everything should be written");
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_line();
+  failed += test_length();
+  failed += test_none();
+  failed += test_iov_consume();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../includes/gap_buffer.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define PASTE_SIZE (64 * 1024)
+
+// Compare the text with a string, keeping the cursor
+bool text_is(s_gap_buffer *gb, const char *expected) {
+  size_t length = strlen(expected);
+
+  if (gap_length(gb) != length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    if (gap_at(gb, i) != expected[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int test_edit() {
+  s_gap_buffer gb;
+
+  gap_init(&gb);
+  gap_insert_many(&gb, "hello", 5);
+  test_assert(text_is(&gb, "hello") && gap_cursor(&gb) == 5,
+              "Insert should append at the cursor");
+
+  gap_move(&gb, 2);
+  gap_insert(&gb, 'X');
+  test_assert(text_is(&gb, "heXllo") && gap_cursor(&gb) == 3,
+              "Insert should go in the middle");
+
+  test_assert(gap_delete_before(&gb, 2) == 2 && text_is(&gb, "hllo") &&
+                  gap_cursor(&gb) == 1,
+              "Backspace should delete before the cursor");
+  test_assert(gap_delete_after(&gb, 1) == 1 && text_is(&gb, "hlo") &&
+                  gap_cursor(&gb) == 1,
+              "Delete should delete after the cursor");
+  test_assert(gap_delete_before(&gb, 10) == 1 &&
+                  gap_delete_after(&gb, 10) == 2 && gap_length(&gb) == 0,
+              "Deletes should stop at the ends of the text");
+
+  gap_insert_many(&gb, "abc", 3);
+  gap_move(&gb, 100);
+  test_assert(gap_cursor(&gb) == 3, "Cursor should be clamped to the text");
+  gap_clear(&gb);
+  test_assert(gap_length(&gb) == 0 && gap_cursor(&gb) == 0,
+              "Clear should delete the text");
+  gap_free(&gb);
+  return 0;
+}
+
+int test_spans() {
+  s_gap_buffer gb;
+  const char *before;
+  const char *after;
+  const char *text;
+  size_t before_size;
+  size_t after_size;
+  size_t size;
+
+  gap_init(&gb);
+  gap_insert_many(&gb, "abcdef", 6);
+  gap_move(&gb, 4);
+  before = gap_before(&gb, &before_size);
+  after = gap_after(&gb, &after_size);
+  test_assert(before_size == 4 && memcmp(before, "abcd", 4) == 0,
+              "Span before should end at the cursor");
+  test_assert(after_size == 2 && memcmp(after, "ef", 2) == 0,
+              "Span after should start at the cursor");
+
+  gap_move(&gb, 1);
+  gap_move(&gb, 5);
+  text = gap_text(&gb, &size);
+  test_assert(size == 6 && memcmp(text, "abcdef", 6) == 0 &&
+                  gap_cursor(&gb) == 6,
+              "Moves should keep the text");
+  gap_free(&gb);
+  return 0;
+}
+
+int test_paste() {
+  s_gap_buffer gb;
+  char *paste = malloc(PASTE_SIZE);
+  const char *text;
+  size_t size;
+
+  for (size_t i = 0; i < PASTE_SIZE; i++) {
+    paste[i] = 'a' + i % 26;
+  }
+  gap_init(&gb);
+  gap_insert_many(&gb, "<>", 2);
+  gap_move(&gb, 1);
+  gap_insert_many(&gb, paste, PASTE_SIZE);
+  test_assert(gap_length(&gb) == PASTE_SIZE + 2 &&
+                  gap_cursor(&gb) == PASTE_SIZE + 1,
+              "Paste should be inserted at the cursor");
+
+  // Typing in the middle of the paste only moves the gap
+  gap_move(&gb, PASTE_SIZE / 2);
+  for (size_t i = 0; i < PASTE_SIZE; i++) {
+    gap_insert(&gb, '-');
+    gap_delete_before(&gb, 1);
+  }
+  text = gap_text(&gb, &size);
+  test_assert(size == PASTE_SIZE + 2 && text[0] == '<' &&
+                  memcmp(text + 1, paste, PASTE_SIZE) == 0 &&
+                  text[PASTE_SIZE + 1] == '>',
+              "Text should survive the edits");
+  gap_free(&gb);
+  free(paste);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_edit();
+  failed += test_spans();
+  failed += test_paste();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "../includes/handoff.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+// Larger than the socket buffers: sent while the other side receives
+#define BIG_SIZE (4 * 1024 * 1024)
+
+int test_round_trip() {
+  s_handoff_record record = {.kind = HANDOFF_LISTENER};
+  s_handoff_record received;
+  char buffer[8] = {0};
+  char *data;
+  int sv[2];
+  int pipes[2];
+  int fd;
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  test_assert(pipe(pipes) == 0, "Pipe should be created");
+
+  test_assert(handoff_send(sv[0], &record, pipes[1], NULL, NULL) == 0,
+              "Listener should be sent");
+  record = (s_handoff_record){.kind = HANDOFF_CLIENT,
+                              .local = 1,
+                              .created_ms = 42,
+                              .in_size = 3,
+                              .out_size = 2};
+  test_assert(handoff_send(sv[0], &record, pipes[0], "abc", "de") == 0,
+              "Client should be sent");
+  record = (s_handoff_record){.kind = HANDOFF_END};
+  test_assert(handoff_send(sv[0], &record, -1, NULL, NULL) == 0,
+              "End should be sent");
+
+  test_assert(handoff_recv(sv[1], &received, &fd, &data) == 0 &&
+                  received.kind == HANDOFF_LISTENER && fd != -1 &&
+                  data == NULL,
+              "Listener should come with its descriptor");
+  test_assert(write(fd, "x", 1) == 1, "Received descriptor should be usable");
+  close(fd);
+
+  test_assert(handoff_recv(sv[1], &received, &fd, &data) == 0 &&
+                  received.kind == HANDOFF_CLIENT && received.local == 1 &&
+                  received.created_ms == 42,
+              "Client record should be received");
+  test_assert(data != NULL && memcmp(data, "abcde", 5) == 0,
+              "Input then output should follow the record");
+  test_assert(read(fd, buffer, sizeof(buffer)) == 1 && buffer[0] == 'x',
+              "Both ends should be the same pipe");
+  free(data);
+  close(fd);
+
+  test_assert(handoff_recv(sv[1], &received, &fd, &data) == 0 &&
+                  received.kind == HANDOFF_END && fd == -1 && data == NULL,
+              "End should come without a descriptor");
+
+  close(pipes[0]);
+  close(pipes[1]);
+  close(sv[0]);
+  close(sv[1]);
+  return 0;
+}
+
+int test_large() {
+  s_handoff_record received;
+  char *data;
+  int sv[2];
+  int status;
+  int fd;
+  pid_t pid;
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  pid = fork();
+  if (pid == 0) {
+    s_handoff_record record = {.kind = HANDOFF_CLIENT, .out_size = BIG_SIZE};
+    char *out = malloc(BIG_SIZE);
+
+    for (size_t i = 0; i < BIG_SIZE; i++) {
+      out[i] = (char)(i * 7);
+    }
+    exit(handoff_send(sv[0], &record, sv[0], NULL, out) == 0 ? 0 : 1);
+  }
+
+  test_assert(handoff_recv(sv[1], &received, &fd, &data) == 0 &&
+                  received.out_size == BIG_SIZE && fd != -1,
+              "Large output should be received");
+  for (size_t i = 0; i < BIG_SIZE; i++) {
+    test_assert(data[i] == (char)(i * 7), "Output should be intact");
+  }
+  test_assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+                  WEXITSTATUS(status) == 0,
+              "Sender should succeed");
+  free(data);
+  close(fd);
+  close(sv[0]);
+  close(sv[1]);
+  return 0;
+}
+
+int test_ack() {
+  s_handoff_record received;
+  char *data;
+  int sv[2];
+  int fd;
+
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  test_assert(!handoff_wait_ack(sv[0], 10), "Wait should time out");
+  test_assert(handoff_ack(sv[1]) == 0 && handoff_wait_ack(sv[0], 1000),
+              "Ack should be seen");
+
+  // New server gone: the old one resumes
+  close(sv[1]);
+  test_assert(!handoff_wait_ack(sv[0], 1000), "Close should not be an ack");
+  test_assert(handoff_recv(sv[0], &received, &fd, &data) == -1 && fd == -1,
+              "Receive should fail at the end of the stream");
+  close(sv[0]);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_round_trip();
+  failed += test_large();
+  failed += test_ack();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
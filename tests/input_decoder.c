@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../includes/input_decoder.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define MAX_KEYS 64
+#define PASTE_SIZE (256 * 1024)
+
+// Decode bytes, keeping the keys completed
+size_t decode(s_input_decoder *decoder, const char *data, size_t size,
+              s_input *keys) {
+  size_t count = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    if (input_decode(decoder, data[i], &keys[count]) && count < MAX_KEYS) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int test_burst() {
+  const char burst[] = "ab\n\x7f\x1b[A\x1b[B\x1bOC\x1b[D\x1b[3~\x1b[H\x1b[4~"
+                       "\x01\x1b[5~\x1b[6~";
+  e_input_type expected[] = {
+      INPUT_TYPE_KEY,   INPUT_TYPE_KEY,   INPUT_TYPE_ENTER,
+      INPUT_TYPE_BACKSPACE,
+      INPUT_TYPE_ARROW, INPUT_TYPE_ARROW, INPUT_TYPE_ARROW,
+      INPUT_TYPE_ARROW, INPUT_TYPE_DELETE, INPUT_TYPE_BEGIN,
+      INPUT_TYPE_END,   INPUT_TYPE_BEGIN, INPUT_TYPE_PAGE_UP,
+      INPUT_TYPE_PAGE_DOWN,
+  };
+  s_input_decoder decoder;
+  s_input keys[MAX_KEYS];
+  size_t count;
+
+  input_decoder_init(&decoder);
+  count = decode(&decoder, burst, sizeof(burst) - 1, keys);
+  test_assert(count == sizeof(expected) / sizeof(*expected),
+              "Every key of a read should be decoded");
+  for (size_t i = 0; i < count; i++) {
+    test_assert(keys[i].type == expected[i], "Key should match its bytes");
+  }
+  test_assert(keys[1].key == 'b' && keys[4].arrow == ARROW_UP &&
+                  keys[6].arrow == ARROW_RIGHT && keys[7].arrow == ARROW_LEFT,
+              "Key values should be decoded");
+  test_assert(!input_decode_pending(&decoder), "Nothing should be pending");
+  input_decoder_free(&decoder);
+  return 0;
+}
+
+int test_split() {
+  s_input_decoder decoder;
+  s_input keys[MAX_KEYS];
+
+  input_decoder_init(&decoder);
+  test_assert(decode(&decoder, "\x1b", 1, keys) == 0 &&
+                  input_decode_pending(&decoder),
+              "ESC should wait for the next byte");
+  test_assert(decode(&decoder, "[3", 2, keys) == 0 &&
+                  decode(&decoder, "~", 1, keys) == 1 &&
+                  keys[0].type == INPUT_TYPE_DELETE,
+              "Sequence split across reads should be decoded");
+
+  decode(&decoder, "\x1b", 1, keys);
+  test_assert(input_decode_timeout(&decoder, &keys[0]) &&
+                  keys[0].type == INPUT_TYPE_ESC &&
+                  !input_decode_pending(&decoder),
+              "Lone ESC should be reported after the timeout");
+  test_assert(!input_decode_timeout(&decoder, &keys[0]),
+              "Timeout without a pending sequence should do nothing");
+
+  test_assert(decode(&decoder, "\x1b\x1b[C", 4, keys) == 2 &&
+                  keys[0].type == INPUT_TYPE_ESC &&
+                  keys[1].type == INPUT_TYPE_ARROW,
+              "ESC before a sequence should be reported alone");
+  test_assert(decode(&decoder, "\x1bx\x1b[99;99Zq", 11, keys) == 3 &&
+                  keys[0].type == INPUT_TYPE_UNKNOWN &&
+                  keys[1].type == INPUT_TYPE_UNKNOWN &&
+                  keys[2].type == INPUT_TYPE_KEY && keys[2].key == 'q',
+              "Unknown sequences should be consumed whole");
+  input_decoder_free(&decoder);
+  return 0;
+}
+
+int test_paste() {
+  s_input_decoder decoder;
+  s_input keys[MAX_KEYS];
+  char *paste = malloc(PASTE_SIZE);
+  size_t count = 0;
+
+  for (size_t i = 0; i < PASTE_SIZE; i++) {
+    paste[i] = "ab\n\x1b["[i % 5];
+  }
+  input_decoder_init(&decoder);
+  decode(&decoder, "\x1b[200~", 6, keys);
+  // Chunks of a pipe or terminal read
+  for (size_t i = 0; i < PASTE_SIZE; i += 4000) {
+    size_t size = PASTE_SIZE - i < 4000 ? PASTE_SIZE - i : 4000;
+
+    count += decode(&decoder, paste + i, size, keys);
+  }
+  test_assert(count == 0, "Paste should not produce keys before its end");
+  test_assert(decode(&decoder, "\x1b[201", 5, keys) == 0 &&
+                  decode(&decoder, "~z", 2, keys) == 2,
+              "Paste should end with its closing bracket");
+  test_assert(keys[0].type == INPUT_TYPE_PASTE && keys[0].size == PASTE_SIZE &&
+                  memcmp(keys[0].text, paste, PASTE_SIZE) == 0,
+              "Paste should hold the whole text, escapes included");
+  test_assert(keys[1].type == INPUT_TYPE_KEY && keys[1].key == 'z',
+              "Keys after the paste should be decoded");
+  input_decoder_free(&decoder);
+  free(paste);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_burst();
+  failed += test_split();
+  failed += test_paste();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../includes/line_ring.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define MANY_LINES (3 * 1000 * 1000)
+
+// Compare a kept line with a string
+bool line_is(s_line_ring *ring, uint64_t number, const char *expected) {
+  size_t size;
+  const char *line = line_ring_get(ring, number, &size);
+
+  return line != NULL && size == strlen(expected) &&
+         memcmp(line, expected, size) == 0;
+}
+
+int test_push() {
+  s_line_ring ring;
+  size_t size;
+
+  line_ring_init(&ring, 64, 8);
+  line_ring_push(&ring, "first", 5);
+  line_ring_push(&ring, "", 0);
+  line_ring_push(&ring, "third", 5);
+  test_assert(line_ring_count(&ring) == 3 && ring.first == 0 && ring.end == 3,
+              "Lines should be numbered from 0");
+  test_assert(line_is(&ring, 0, "first") && line_is(&ring, 1, "") &&
+                  line_is(&ring, 2, "third"),
+              "Lines should be read back by number");
+  test_assert(line_ring_get(&ring, 3, &size) == NULL && size == 0,
+              "Line not appended yet should not be found");
+  line_ring_free(&ring);
+  return 0;
+}
+
+int test_bounds() {
+  s_line_ring ring;
+  char line[32];
+
+  // Index full: the oldest line goes
+  line_ring_init(&ring, 1024, 4);
+  for (int i = 0; i < 6; i++) {
+    snprintf(line, sizeof(line), "line %d", i);
+    line_ring_push(&ring, line, strlen(line));
+  }
+  test_assert(line_ring_count(&ring) == 4 && ring.first == 2 &&
+                  line_is(&ring, 2, "line 2") && line_is(&ring, 5, "line 5"),
+              "Index ring should keep the newest lines");
+  test_assert(line_ring_get(&ring, 1, &(size_t){0}) == NULL,
+              "Dropped line should not be found");
+  line_ring_free(&ring);
+
+  // Bytes full: lines stay contiguous, the overwritten ones go
+  line_ring_init(&ring, 16, 100);
+  line_ring_push(&ring, "aaaaaa", 6);
+  line_ring_push(&ring, "bbbbbb", 6);
+  line_ring_push(&ring, "cccccc", 6);
+  test_assert(ring.first == 1 && line_is(&ring, 1, "bbbbbb") &&
+                  line_is(&ring, 2, "cccccc"),
+              "Line wrapping the byte ring should start at its beginning");
+  line_ring_push(&ring, "0123456789abcdefXYZ", 19);
+  test_assert(line_ring_count(&ring) == 1 &&
+                  line_is(&ring, 3, "0123456789abcdef"),
+              "Line larger than the byte ring should be truncated");
+  line_ring_free(&ring);
+  return 0;
+}
+
+int test_many() {
+  s_line_ring ring;
+  char line[32];
+
+  line_ring_init(&ring, 1024 * 1024, 64 * 1024);
+  for (int i = 0; i < MANY_LINES; i++) {
+    int len = snprintf(line, sizeof(line), "message %d", i);
+
+    line_ring_push(&ring, line, len);
+  }
+  test_assert(ring.end == MANY_LINES &&
+                  line_ring_count(&ring) == 64 * 1024,
+              "Store should stay within its bounds");
+  snprintf(line, sizeof(line), "message %d", MANY_LINES - 1);
+  test_assert(line_is(&ring, MANY_LINES - 1, line),
+              "Newest line should be kept");
+  snprintf(line, sizeof(line), "message %llu",
+           (unsigned long long)ring.first);
+  test_assert(line_is(&ring, ring.first, line), "Oldest line should be kept");
+  line_ring_free(&ring);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_push();
+  failed += test_bounds();
+  failed += test_many();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
@@ -0,0 +1,925 @@
+#define _GNU_SOURCE // sched_getcpu
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../includes/reactor.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define BIG_SIZE (1024 * 1024)
+
+// Events seen by the test handlers
+typedef struct {
+  int accepted;
+  int writable;
+  int closed;
+  int watched; // reads of the watched descriptor
+  e_reactor_close reason;
+  size_t last_size; // size of the last view passed to on_data
+  char big[BIG_SIZE];
+} s_events;
+
+int on_accept(s_reactor *reactor, s_conn *conn) {
+  ((s_events *)reactor->arg)->accepted++;
+  return 0;
+}
+
+int on_writable(s_reactor *reactor, s_conn *conn) {
+  ((s_events *)reactor->arg)->writable++;
+  return 0;
+}
+
+void on_close(s_reactor *reactor, s_conn *conn, e_reactor_close reason) {
+  s_events *events = reactor->arg;
+  events->closed++;
+  events->reason = reason;
+}
+
+void on_watch(s_reactor *reactor, int fd, void *arg) {
+  char byte;
+
+  while (read(fd, &byte, 1) == 1) {
+    ((s_events *)arg)->watched++;
+  }
+}
+
+// Send everything back
+ssize_t echo_data(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  ((s_events *)reactor->arg)->last_size = size;
+  reactor_send(reactor, conn, data, size);
+  return size;
+}
+
+// Send back complete lines only
+ssize_t line_data(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  size_t consumed = 0;
+
+  ((s_events *)reactor->arg)->last_size = size;
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == '\n') {
+      reactor_send(reactor, conn, data + consumed, i + 1 - consumed);
+      consumed = i + 1;
+    }
+  }
+  return consumed;
+}
+
+// Answer any request with a large reply (not a view of the read buffer)
+ssize_t big_data(s_reactor *reactor, s_conn *conn, char *data, size_t size) {
+  reactor_send(reactor, conn, ((s_events *)reactor->arg)->big, BIG_SIZE);
+  return size;
+}
+
+ssize_t detach_data(s_reactor *reactor, s_conn *conn, char *data,
+                    size_t size) {
+  return REACTOR_DETACH;
+}
+
+static const s_reactor_config config = {0};
+
+// Read what is available without blocking
+ssize_t read_now(int fd, char *buffer, size_t size) {
+  ssize_t n = recv(fd, buffer, size, MSG_DONTWAIT);
+  return n == -1 ? 0 : n;
+}
+
+int test_echo() {
+  s_reactor_handler handler = {.on_data = echo_data, .on_close = on_close};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  char buffer[64] = {0};
+  int sv[2];
+
+  reactor_init(&reactor, &config, &handler, events);
+  test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0,
+              "Socket pair should be created");
+  test_assert(reactor_add_client(&reactor, sv[0], NULL) != NULL,
+              "Client should be added");
+
+  test_assert(write(sv[1], "hello", 5) == 5, "Write should succeed");
+  test_assert(reactor_run_once(&reactor, 1000) == 0, "Loop should run");
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 5 &&
+                  memcmp(buffer, "hello", 5) == 0,
+              "Data should be echoed");
+  test_assert(counter_get(&reactor.stats.writevs) == 1,
+              "Echo should take one writev");
+
+  close(sv[1]);
+  reactor_run_once(&reactor, 1000);
+  test_assert(events->closed == 1 && events->reason == REACTOR_CLOSED,
+              "Close should be reported");
+  test_assert(reactor.conns.count == 0, "Connection should be removed");
+
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_partial() {
+  s_reactor_handler handler = {.on_data = line_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  char buffer[64] = {0};
+  int sv[2];
+
+  reactor_init(&reactor, &config, &handler, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  reactor_add_client(&reactor, sv[0], NULL);
+
+  test_assert(write(sv[1], "ab", 2) == 2, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 0,
+              "Partial line should not be answered");
+
+  test_assert(write(sv[1], "c\nd", 3) == 3, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(events->last_size == 5,
+              "Unconsumed bytes should be passed again");
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 4 &&
+                  memcmp(buffer, "abc\n", 4) == 0,
+              "Complete line should be answered");
+
+  test_assert(write(sv[1], "\nx\ny\n", 5) == 5, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read_now(sv[1], buffer, sizeof(buffer)) == 6 &&
+                  memcmp(buffer, "d\nx\ny\n", 6) == 0,
+              "Pipelined lines should be answered");
+  test_assert(counter_get(&reactor.stats.writevs) == 2,
+              "Pipelined lines should take one writev");
+  test_assert(reactor.conns.items[0]->in.count == 0,
+              "Answered lines should leave the read buffer");
+
+  close(sv[1]);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_backpressure() {
+  s_reactor_handler handler = {.on_data = big_data,
+                               .on_writable = on_writable};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  s_conn *conn;
+  char *received = malloc(BIG_SIZE);
+  size_t total = 0;
+  int sv[2];
+
+  for (size_t i = 0; i < BIG_SIZE; i++) {
+    events->big[i] = (char)(i * 13);
+  }
+  reactor_init(&reactor, &config, &handler, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  conn = reactor_add_client(&reactor, sv[0], NULL);
+
+  test_assert(write(sv[1], "?", 1) == 1, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(conn->stall_ms != 0 && conn->out.count > conn->out_offset,
+              "Unwritten output should be pending");
+  test_assert(reactor.admission.buffered == conn->out.count,
+              "Pending output should be accounted");
+
+  while (total < BIG_SIZE) {
+    total += read_now(sv[1], received + total, BIG_SIZE - total);
+    reactor_run_once(&reactor, 10);
+  }
+  test_assert(memcmp(received, events->big, BIG_SIZE) == 0,
+              "Output should be written in order");
+  test_assert(events->writable == 1 && conn->stall_ms == 0,
+              "Drained output should be reported");
+  test_assert(reactor.admission.buffered == 0,
+              "Drained output should not be accounted");
+
+  close(sv[1]);
+  reactor_free(&reactor);
+  free(received);
+  free(events);
+  return 0;
+}
+
+int test_accept_timeout() {
+  s_reactor_config timeout_config = {.idle_timeout = 1};
+  s_reactor_handler handler = {
+      .on_accept = on_accept, .on_data = echo_data, .on_close = on_close};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  char byte;
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  reactor_init(&reactor, &timeout_config, &handler, events);
+  reactor_add_listener(&reactor, listener);
+
+  test_assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+              "Client should connect");
+  reactor_run_once(&reactor, 1000);
+  test_assert(events->accepted == 1 && reactor.conns.count == 1,
+              "Client should be accepted");
+  test_assert(!reactor.conns.items[0]->local,
+              "TCP client should not be local");
+
+  // The timer wheel fires within a tick of the deadline
+  for (int i = 0; i < 100 && events->closed == 0; i++) {
+    reactor_run_once(&reactor, REACTOR_TIMER_TICK);
+  }
+  test_assert(events->closed == 1 && events->reason == REACTOR_EVICT_IDLE,
+              "Idle client should be evicted");
+  test_assert(counter_get(&reactor.stats.evicted_idle) == 1,
+              "Eviction should be counted");
+  test_assert(read(client, &byte, 1) == 0, "Client should see the close");
+
+  close(client);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_out_of_fds() {
+  s_reactor_handler handler = {.on_accept = on_accept, .on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  struct rlimit limit;
+  struct rlimit lowered;
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  int free_fd;
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  reactor_init(&reactor, &config, &handler, events);
+  reactor_add_listener(&reactor, listener);
+  test_assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+              "Client should connect");
+
+  // No descriptor left for accept, and no client to close
+  free_fd = dup(0);
+  close(free_fd);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  lowered = limit;
+  lowered.rlim_cur = free_fd;
+  test_assert(setrlimit(RLIMIT_NOFILE, &lowered) == 0,
+              "Descriptor limit should be lowered");
+  reactor_run_once(&reactor, 1000);
+  setrlimit(RLIMIT_NOFILE, &limit);
+  test_assert(reactor.conns.count == 0 && reactor.admission.out_of_fds,
+              "Accept should stop once out of descriptors");
+
+  // Retried a tick later without any close
+  for (int i = 0; i < 10 && reactor.conns.count == 0; i++) {
+    reactor_run_once(&reactor, 1000);
+  }
+  test_assert(reactor.conns.count == 1 && !reactor.admission.paused,
+              "Accept should resume once descriptors are available");
+
+  close(client);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_detach() {
+  s_reactor_handler handler = {.on_data = detach_data, .on_close = on_close};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  char byte;
+  int sv[2];
+
+  reactor_init(&reactor, &config, &handler, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  reactor_add_client(&reactor, sv[0], NULL);
+
+  test_assert(write(sv[1], "S", 1) == 1, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(events->closed == 1 && events->reason == REACTOR_DETACHED,
+              "Detach should be reported");
+  test_assert(reactor.conns.count == 0, "Connection should be removed");
+  test_assert(write(sv[0], "K", 1) == 1 && read(sv[1], &byte, 1) == 1,
+              "Detached socket should stay open");
+
+  close(sv[0]);
+  close(sv[1]);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_workers() {
+  s_reactor_config acceptor_config = {.max_connections = 3};
+  s_reactor_handler handler = {.on_accept = on_accept, .on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor acceptor;
+  s_reactor workers[2];
+  s_reactor *reactors[2] = {&workers[0], &workers[1]};
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  char buffer[64] = {0};
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int clients[4];
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  reactor_init(&acceptor, &acceptor_config, &handler, events);
+  reactor_add_listener(&acceptor, listener);
+  for (int i = 0; i < 2; i++) {
+    reactor_init(&workers[i], &config, &handler, events);
+  }
+  reactor_set_workers(&acceptor, reactors, 2, REACTOR_BALANCE_ROUND_ROBIN);
+
+  for (int i = 0; i < 4; i++) {
+    clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(connect(clients[i], (struct sockaddr *)&addr,
+                        sizeof(addr)) == 0,
+                "Client should connect");
+  }
+  reactor_run_once(&acceptor, 1000);
+  test_assert(acceptor.conns.count == 0 && events->accepted == 0,
+              "Acceptor should hand the connections over");
+  test_assert(acceptor.admission.paused,
+              "Limit should count the connections of the workers");
+
+  reactor_run_once(&workers[0], 1000);
+  reactor_run_once(&workers[1], 1000);
+  test_assert(workers[0].conns.count == 2 && workers[1].conns.count == 1 &&
+                  events->accepted == 3,
+              "Workers should admit the connections in turn");
+
+  test_assert(write(clients[1], "hello", 5) == 5, "Write should succeed");
+  reactor_run_once(&workers[1], 1000);
+  test_assert(read_now(clients[1], buffer, sizeof(buffer)) == 5 &&
+                  memcmp(buffer, "hello", 5) == 0,
+              "Worker should serve its connection");
+
+  // Resumed at the end of an iteration, accepted on the next one
+  close(clients[0]);
+  reactor_run_once(&workers[0], 1000);
+  reactor_run_once(&acceptor, 1000);
+  reactor_run_once(&acceptor, 1000);
+  reactor_run_once(&workers[1], 1000);
+  test_assert(workers[1].conns.count == 2 && events->accepted == 4,
+              "Acceptor should resume once a worker closes a connection");
+
+  for (int i = 1; i < 4; i++) {
+    close(clients[i]);
+  }
+  reactor_free(&acceptor);
+  reactor_free(&workers[0]);
+  reactor_free(&workers[1]);
+  free(events);
+  return 0;
+}
+
+// Listening socket on a loopback port, joining its SO_REUSEPORT group
+int reuseport_listener(struct sockaddr_in *addr) {
+  socklen_t size = sizeof(*addr);
+  int sockopt = 1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt));
+  if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 ||
+      listen(fd, 16) != 0 ||
+      getsockname(fd, (struct sockaddr *)addr, &size) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int test_steer_cpu() {
+  s_reactor_handler handler = {.on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactors[2];
+  s_reactor *group[2] = {&reactors[0], &reactors[1]};
+  struct sockaddr_in addr = {0};
+  cpu_set_t set;
+  int listeners[2];
+  int clients[2];
+  int cpu;
+
+  // Loopback packets are received on the CPU of the sender
+  cpu = sched_getcpu();
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  test_assert(sched_setaffinity(0, sizeof(set), &set) == 0,
+              "Test should be pinned");
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  listeners[0] = reuseport_listener(&addr);
+  listeners[1] = reuseport_listener(&addr);
+  test_assert(listeners[0] != -1 && listeners[1] != -1,
+              "Listeners should share the port");
+  for (int i = 0; i < 2; i++) {
+    reactor_init(&reactors[i], &config, &handler, events);
+    reactor_add_listener(&reactors[i], listeners[i]);
+  }
+  reactors[0].cpu = cpu + 1;
+  reactors[1].cpu = cpu;
+  test_assert(reactor_steer_cpu(group, 2, listeners[0]) == 0,
+              "Program should be attached");
+
+  clients[0] = socket(AF_INET, SOCK_STREAM, 0);
+  test_assert(connect(clients[0], (struct sockaddr *)&addr,
+                      sizeof(addr)) == 0,
+              "Client should connect");
+  reactor_run_once(&reactors[1], 1000);
+  reactor_run_once(&reactors[0], 0);
+  test_assert(reactors[1].conns.count == 1 && reactors[0].conns.count == 0,
+              "Program should pick the listener of the receiving CPU");
+  test_assert(counter_get(&reactors[1].stats.cross_cpu) == 0,
+              "Connection should be served on its CPU");
+
+  // Without the listener of its CPU in the group, the kernel hash picks one
+  // and the accept time check hands the connection over
+  close(listeners[1]);
+  reactors[1].fds.items[0].fd = -1;
+  clients[1] = socket(AF_INET, SOCK_STREAM, 0);
+  test_assert(connect(clients[1], (struct sockaddr *)&addr,
+                      sizeof(addr)) == 0,
+              "Client should connect");
+  reactor_run_once(&reactors[0], 1000);
+  reactor_run_once(&reactors[1], 1000);
+  test_assert(counter_get(&reactors[0].stats.steered) == 1 &&
+                  reactors[0].conns.count == 0 &&
+                  reactors[1].conns.count == 2,
+              "Connection should be handed to the reactor of its CPU");
+
+  close(clients[0]);
+  close(clients[1]);
+  reactor_free(&reactors[0]);
+  reactor_free(&reactors[1]);
+  free(events);
+  return 0;
+}
+
+int test_drain() {
+  s_reactor_handler handler = {.on_data = line_data, .on_close = on_close};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  char buffer[64] = {0};
+  int idle[2];
+  int busy[2];
+  int pipes[2];
+
+  reactor_init(&reactor, &config, &handler, events);
+  test_assert(pipe(pipes) == 0, "Pipe should be created");
+  reactor_watch(&reactor, pipes[0], on_watch, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, idle);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, busy);
+  reactor_add_client(&reactor, idle[0], NULL);
+  reactor_add_client(&reactor, busy[0], NULL);
+
+  test_assert(write(pipes[1], "s", 1) == 1, "Write should succeed");
+  test_assert(write(busy[1], "ab", 2) == 2, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(events->watched == 1 && events->closed == 0,
+              "Watched descriptor should be passed to its callback");
+
+  reactor_drain(&reactor, 60000);
+  reactor_run_once(&reactor, 0);
+  test_assert(events->closed == 1 && events->reason == REACTOR_DRAINED &&
+                  reactor.conns.count == 1,
+              "Idle client should be closed first");
+  test_assert(read_now(idle[1], buffer, sizeof(buffer)) == 0,
+              "Idle client should see the close");
+
+  test_assert(write(busy[1], "c\n", 2) == 2, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read(busy[1], buffer, sizeof(buffer)) == 4 &&
+                  memcmp(buffer, "abc\n", 4) == 0,
+              "Request in flight should be answered before the close");
+  test_assert(events->closed == 2 &&
+                  counter_get(&reactor.stats.drained) == 2,
+              "Client should be closed once answered");
+  test_assert(reactor_run(&reactor) == 0,
+              "Drained reactor should stop right away");
+
+  // A later drain brings the deadline closer
+  socketpair(AF_UNIX, SOCK_STREAM, 0, busy);
+  reactor_add_client(&reactor, busy[0], NULL);
+  test_assert(write(busy[1], "ab", 2) == 2, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 1, "Busy client should be kept");
+  reactor_drain(&reactor, 0);
+  reactor_run_once(&reactor, 0);
+  test_assert(reactor.conns.count == 0 && events->closed == 3,
+              "Busy client should be closed at the deadline");
+
+  close(idle[1]);
+  close(busy[1]);
+  close(pipes[1]);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_drain_workers() {
+  s_reactor_handler handler = {.on_data = line_data, .on_close = on_close};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor acceptor;
+  s_reactor worker;
+  s_reactor *workers[1] = {&worker};
+  int busy[2];
+  int pipes[2];
+
+  reactor_init(&acceptor, &config, &handler, events);
+  reactor_init(&worker, &config, &handler, events);
+  reactor_set_workers(&acceptor, workers, 1, REACTOR_BALANCE_ROUND_ROBIN);
+  test_assert(pipe(pipes) == 0, "Pipe should be created");
+  reactor_watch(&acceptor, pipes[0], on_watch, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, busy);
+  reactor_add_client(&worker, busy[0], NULL);
+  test_assert(write(busy[1], "ab", 2) == 2, "Write should succeed");
+  reactor_run_once(&worker, 1000);
+
+  // The acceptor has no client but keeps polling while the worker drains
+  reactor_drain(&acceptor, 60000);
+  reactor_drain(&worker, 60000);
+  reactor_run_once(&worker, 0);
+  reactor_run_once(&acceptor, 0);
+  test_assert(worker.conns.count == 1 && !atomic_load(&acceptor.stop),
+              "Acceptor should run until its workers are drained");
+  test_assert(write(pipes[1], "s", 1) == 1, "Write should succeed");
+  reactor_run_once(&acceptor, 1000);
+  test_assert(events->watched == 1,
+              "Watched descriptor should be polled while draining");
+
+  // A second signal closes the busy client at once
+  reactor_drain(&acceptor, 0);
+  reactor_drain(&worker, 0);
+  reactor_run_once(&worker, 0);
+  reactor_run_once(&acceptor, 0);
+  test_assert(worker.conns.count == 0 && events->closed == 1 &&
+                  atomic_load(&acceptor.stop),
+              "Acceptor should stop once its workers are drained");
+
+  close(busy[1]);
+  close(pipes[1]);
+  reactor_free(&acceptor);
+  reactor_free(&worker);
+  free(events);
+  return 0;
+}
+
+int test_zerocopy() {
+  s_reactor_config zc_config = {.zerocopy = 4096, .read_size = 65536};
+  s_reactor_handler handler = {.on_accept = on_accept, .on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  s_conn *conn;
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  char *received = malloc(BIG_SIZE);
+  size_t sent = 0;
+  size_t total = 0;
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+
+  for (size_t i = 0; i < BIG_SIZE; i++) {
+    events->big[i] = (char)(i * 7 + (i >> 12));
+  }
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  reactor_init(&reactor, &zc_config, &handler, events);
+  reactor_add_listener(&reactor, listener);
+  test_assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+              "Client should connect");
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 1, "Client should be accepted");
+  conn = reactor.conns.items[0];
+  if (!conn->zerocopy) {
+    eprintf("SO_ZEROCOPY not supported, skipping %s\n", __func__);
+    close(client);
+    reactor_free(&reactor);
+    free(received);
+    free(events);
+    return 0;
+  }
+
+  // Below the threshold: copied
+  test_assert(write(client, "small", 5) == 5, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read(client, received, BIG_SIZE) == 5 &&
+                  counter_get(&reactor.stats.zerocopy_sends) == 0,
+              "Small echo should be copied");
+
+  while (total < BIG_SIZE) {
+    if (sent < BIG_SIZE) {
+      ssize_t n = send(client, events->big + sent,
+                       BIG_SIZE - sent < 65536 ? BIG_SIZE - sent : 65536,
+                       MSG_DONTWAIT);
+      sent += n > 0 ? n : 0;
+    }
+    reactor_run_once(&reactor, 10);
+    total += read_now(client, received + total, BIG_SIZE - total);
+  }
+  test_assert(memcmp(received, events->big, BIG_SIZE) == 0,
+              "Zerocopy echo should be written in order");
+  test_assert(counter_get(&reactor.stats.zerocopy_sends) > 0,
+              "Large echo should be sent with MSG_ZEROCOPY");
+
+  // Completions give the lent buffers back to the pool
+  for (int i = 0; i < 100 && conn->zc_inflight.count > 0; i++) {
+    reactor_run_once(&reactor, 10);
+  }
+  test_assert(conn->zc_inflight.count == 0 && reactor.pooled > 0,
+              "Completed buffers should return to the pool");
+
+  close(client);
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 0 && reactor.zc_linger.count == 0,
+              "Closed connection should not linger once completed");
+
+  reactor_free(&reactor);
+  free(received);
+  free(events);
+  return 0;
+}
+
+int test_zerocopy_handoff() {
+  s_reactor_handler handler = {.on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  struct sockaddr_storage peer = {0};
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  char buffer[16] = {0};
+  int one = 1;
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  int fd;
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  test_assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+              "Client should connect");
+  size = sizeof(peer);
+  fd = accept(listener, (struct sockaddr *)&peer, &size);
+  test_assert(fd != -1, "Connection should be accepted");
+  if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+    eprintf("SO_ZEROCOPY not supported, skipping %s\n", __func__);
+    close(fd);
+    close(client);
+    close(listener);
+    free(events);
+    return 0;
+  }
+
+  // The previous process sent with MSG_ZEROCOPY and handed the socket over
+  // before reading the completion
+  test_assert(send(fd, "old", 3, MSG_ZEROCOPY) == 3 &&
+                  read(client, buffer, sizeof(buffer)) == 3,
+              "Zerocopy send should succeed");
+  reactor_init(&reactor, &config, &handler, events);
+  reactor_add_client(&reactor, fd, &peer);
+
+  test_assert(write(client, "hello", 5) == 5, "Write should succeed");
+  for (int i = 0; i < 10 && read_now(client, buffer, sizeof(buffer)) != 5;
+       i++) {
+    reactor_run_once(&reactor, 100);
+  }
+  test_assert(memcmp(buffer, "hello", 5) == 0, "Data should be echoed");
+  // Without input, the completion alone raises POLLERR
+  reactor_run_once(&reactor, 0);
+  reactor_run_once(&reactor, 0);
+  test_assert(reactor.conns.count == 1,
+              "Unknown completions should not close the connection");
+
+  close(client);
+  close(listener);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_read_on_accept() {
+  s_reactor_config early_config = {.read_on_accept = true};
+  s_reactor_handler handler = {.on_accept = on_accept, .on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  struct sockaddr_in addr = {0};
+  socklen_t size = sizeof(addr);
+  char buffer[16] = {0};
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  test_assert(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Listener should be created");
+  reactor_init(&reactor, &early_config, &handler, events);
+  reactor_add_listener(&reactor, listener);
+  test_assert(connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+                  write(client, "early", 5) == 5,
+              "Client should connect and write");
+
+  // The request is queued before the connection is accepted: read and
+  // echoed in the same iteration
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 1, "Client should be accepted");
+  test_assert(read_now(client, buffer, sizeof(buffer)) == 5 &&
+                  memcmp(buffer, "early", 5) == 0,
+              "Echo should be written right after accept");
+  test_assert(counter_get(&reactor.stats.early_reads) == 1,
+              "Read after accept should be counted");
+
+  close(client);
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 0, "Closed client should be removed");
+
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int test_adaptive_read() {
+  s_reactor_config adaptive_config = {.read_size = 1024,
+                                      .max_read_size = 8192};
+  s_reactor_handler handler = {.on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  s_conn *conn;
+  char *buffer = malloc(BIG_SIZE);
+  size_t total = 0;
+  int sv[2];
+
+  reactor_init(&reactor, &adaptive_config, &handler, events);
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+  conn = reactor_add_client(&reactor, sv[0], NULL);
+
+  // An idle connection holds no buffer, the next read reuses the pooled one
+  test_assert(write(sv[1], "hello", 5) == 5, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read_now(sv[1], buffer, BIG_SIZE) == 5, "Data should be echoed");
+  test_assert(conn->in.items == NULL && reactor.pooled == 1024,
+              "Idle connection should give its buffer to the pool");
+  test_assert(write(sv[1], "hello", 5) == 5, "Write should succeed");
+  reactor_run_once(&reactor, 1000);
+  test_assert(read_now(sv[1], buffer, BIG_SIZE) == 5 &&
+                  counter_get(&reactor.stats.buffer_allocs) == 1,
+              "Pooled buffer should be reused");
+
+  // Full reads double the read size, up to max_read_size
+  test_assert(write(sv[1], events->big, 65536) == 65536,
+              "Write should succeed");
+  while (total < 65536) {
+    reactor_run_once(&reactor, 1000);
+    total += read_now(sv[1], buffer + total, BIG_SIZE - total);
+  }
+  test_assert(conn->read_size == 8192, "Bulk reads should grow the buffer");
+  test_assert(counter_get(&reactor.stats.reads) < 2 + 65536 / 1024,
+              "Bulk reads should take fewer reads");
+
+  // Small reads in a row halve it
+  for (int i = 0; i < REACTOR_SHRINK_READS; i++) {
+    test_assert(write(sv[1], "hello", 5) == 5, "Write should succeed");
+    reactor_run_once(&reactor, 1000);
+    read_now(sv[1], buffer, BIG_SIZE);
+  }
+  test_assert(conn->read_size == 4096, "Small reads should shrink the buffer");
+  test_assert(conn->in.items == NULL, "Idle connection should hold no buffer");
+
+  close(sv[1]);
+  reactor_free(&reactor);
+  free(buffer);
+  free(events);
+  return 0;
+}
+
+int test_ipv6() {
+  s_reactor_config limit_config = {.max_per_ip = 1};
+  s_reactor_handler handler = {.on_accept = on_accept, .on_data = echo_data};
+  s_events *events = calloc(1, sizeof(s_events));
+  s_reactor reactor;
+  struct sockaddr_in6 addr = {0};
+  struct sockaddr_in addr4 = {0};
+  socklen_t size = sizeof(addr);
+  int v6only = 0;
+  int listener = socket(AF_INET6, SOCK_STREAM, 0);
+  int client6 = socket(AF_INET6, SOCK_STREAM, 0);
+  int client4 = socket(AF_INET, SOCK_STREAM, 0);
+  int extra4 = socket(AF_INET, SOCK_STREAM, 0);
+
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  test_assert(setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                         sizeof(v6only)) == 0 &&
+                  bind(listener, (struct sockaddr *)&addr, sizeof(addr)) ==
+                      0 &&
+                  listen(listener, 16) == 0 &&
+                  getsockname(listener, (struct sockaddr *)&addr, &size) == 0,
+              "Dual stack listener should be created");
+  reactor_init(&reactor, &limit_config, &handler, events);
+  reactor_add_listener(&reactor, listener);
+
+  // The cold side table holds the IPv6 source address
+  addr.sin6_addr = in6addr_loopback;
+  test_assert(connect(client6, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+              "IPv6 client should connect");
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 1, "IPv6 client should be accepted");
+  test_assert(reactor_conn_info(&reactor, reactor.conns.items[0])
+                      ->addr.ss_family == AF_INET6 &&
+                  strncmp(reactor_peer_name(&reactor, reactor.conns.items[0]),
+                          "::1,", 4) == 0,
+              "IPv6 source address should be kept");
+
+  // IPv4 clients come mapped (::ffff:127.0.0.1): shown and limited as IPv4
+  addr4.sin_family = AF_INET;
+  addr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr4.sin_port = addr.sin6_port;
+  test_assert(connect(client4, (struct sockaddr *)&addr4, sizeof(addr4)) == 0,
+              "IPv4 client should connect");
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 2 &&
+                  strncmp(reactor_peer_name(&reactor, reactor.conns.items[1]),
+                          "127.0.0.1,", 10) == 0,
+              "Mapped IPv4 address should be shown as IPv4");
+  test_assert(connect(extra4, (struct sockaddr *)&addr4, sizeof(addr4)) == 0,
+              "Second IPv4 client should connect");
+  reactor_run_once(&reactor, 1000);
+  test_assert(reactor.conns.count == 2 &&
+                  counter_get(&reactor.stats.rejected) == 1,
+              "Per address limit should apply to mapped addresses");
+
+  close(client6);
+  close(client4);
+  close(extra4);
+  reactor_free(&reactor);
+  free(events);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_echo();
+  failed += test_partial();
+  failed += test_backpressure();
+  failed += test_accept_timeout();
+  failed += test_out_of_fds();
+  failed += test_detach();
+  failed += test_workers();
+  failed += test_steer_cpu();
+  failed += test_drain();
+  failed += test_drain_workers();
+  failed += test_zerocopy();
+  failed += test_zerocopy_handoff();
+  failed += test_read_on_accept();
+  failed += test_adaptive_read();
+  failed += test_ipv6();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../includes/screen.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+// Output of the last render, NUL terminated
+const char *rendered(s_screen *screen) {
+  screen_render(screen);
+  da_append(&screen->output, '\0');
+  screen->output.count--;
+  return screen->output.items;
+}
+
+int test_first_frame() {
+  s_screen screen;
+
+  screen_init(&screen, 2, 4);
+  screen_put(&screen, 0, 0, "ab", 2, 0);
+  test_assert(strcmp(rendered(&screen), "\033[0m\033[2J\033[1;1Hab") == 0,
+              "First frame should clear the terminal and skip blank cells");
+  test_assert(screen_render(&screen) == 0,
+              "Unchanged frame should emit nothing");
+
+  screen_invalidate(&screen);
+  test_assert(strcmp(rendered(&screen), "\033[0m\033[2J\033[1;1Hab") == 0,
+              "Invalidated frame should be redrawn");
+  screen_free(&screen);
+  return 0;
+}
+
+int test_coalesce() {
+  s_screen screen;
+
+  screen_init(&screen, 3, 20);
+  screen_render(&screen);
+
+  screen_put(&screen, 1, 2, "x", 1, 0);
+  screen_put(&screen, 1, 4, "y", 1, 0);
+  test_assert(strcmp(rendered(&screen), "\033[2;3Hx y") == 0,
+              "Short gap should be written again instead of moving");
+
+  screen_put(&screen, 1, 2, "a", 1, 0);
+  screen_put(&screen, 1, 15, "b", 1, 0);
+  screen_put(&screen, 2, 0, "c", 1, 0);
+  test_assert(strcmp(rendered(&screen), "\033[2;3Ha\033[12Cb\033[3;1Hc") == 0,
+              "Long gap should move forward, a new row should position");
+  screen_free(&screen);
+  return 0;
+}
+
+int test_attributes() {
+  s_screen screen;
+
+  screen_init(&screen, 1, 10);
+  screen_render(&screen);
+
+  screen_put(&screen, 0, 0, "ab", 2, SCREEN_INVERSE);
+  screen_put(&screen, 0, 2, "c", 1, 0);
+  test_assert(strcmp(rendered(&screen), "\033[1;1H\033[0;7mab\033[0mc") == 0,
+              "Attribute should be switched once and reset");
+
+  screen_put(&screen, 0, 0, "ab", 2, 0);
+  test_assert(strcmp(rendered(&screen), "\033[1;1Hab") == 0,
+              "Attribute change alone should redraw the cell");
+  screen_free(&screen);
+  return 0;
+}
+
+int test_put() {
+  s_screen screen;
+
+  screen_init(&screen, 2, 4);
+  screen_render(&screen);
+
+  test_assert(screen_put(&screen, 0, 0, "┌─┐", 9, 0) == 3 &&
+                  screen.cells[1].size == 3,
+              "UTF-8 character should use one cell");
+  test_assert(screen_put(&screen, 1, 2, "abcdef", 6, 0) == 2,
+              "Text should be clipped at the end of the row");
+  test_assert(screen_put(&screen, 2, 0, "a", 1, 0) == 0,
+              "Row out of the screen should be ignored");
+  screen_put(&screen, 1, 0, "\033[", 2, 0);
+  test_assert(screen.cells[4].bytes[0] == '?' &&
+                  screen.cells[5].bytes[0] == '[',
+              "Control characters should be replaced");
+
+  screen_fill(&screen, 0, 0, 10, "─", 0);
+  test_assert(strcmp(rendered(&screen),
+                     "\033[1;1H────\033[2;1H?[ab") == 0,
+              "Last column should leave the cursor position unknown");
+  screen_free(&screen);
+  return 0;
+}
+
+int test_invalid_utf8() {
+  s_screen screen;
+
+  screen_init(&screen, 1, 8);
+  screen_render(&screen);
+
+  // A truncated sequence must not take the ESC as a continuation byte
+  test_assert(screen_put(&screen, 0, 0, "a\xc2\033[2Jx", 7, 0) == 7,
+              "Each invalid byte should use one cell");
+  test_assert(strcmp(rendered(&screen), "\033[1;1Ha??[2Jx") == 0,
+              "Truncated sequence should not inject an escape sequence");
+
+  screen_put(&screen, 0, 0, "\xc0\xaf\xf5\x80\x80\x80\xe2\x94", 8, 0);
+  test_assert(strcmp(rendered(&screen), "\033[1;1H????????") == 0,
+              "Invalid leads and continuation bytes should be replaced");
+  screen_free(&screen);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_first_frame();
+  failed += test_coalesce();
+  failed += test_attributes();
+  failed += test_put();
+  failed += test_invalid_utf8();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
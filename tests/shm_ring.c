@@ -0,0 +1,243 @@
+#define _GNU_SOURCE // memfd_create
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../includes/shm_ring.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define RING_SIZE 4096
+#define STREAM_BYTES (8 * 1024 * 1024)
+
+// Attach a channel as the server would (on duplicated descriptors)
+int attach_copy(s_shm_channel *server, s_shm_channel *client) {
+  int fds[3] = {dup(client->memfd), dup(client->server_efd),
+                dup(client->client_efd)};
+  return shm_channel_attach(server, fds);
+}
+
+int test_wrap() {
+  s_shm_channel channel;
+  s_shm_header *header;
+  char in[3000], out[3000];
+
+  test_assert(shm_channel_create(&channel, RING_SIZE) == 0,
+              "Channel should be created");
+  header = channel.header;
+
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < sizeof(in); i++) {
+      in[i] = (char)(round * 31 + i);
+    }
+    test_assert(shm_ring_write(&header->to_server, channel.to_server,
+                               RING_SIZE, in, sizeof(in)) == sizeof(in),
+                "Write should fit");
+    test_assert(shm_ring_writable(&header->to_server, RING_SIZE) ==
+                    RING_SIZE - sizeof(in),
+                "Free space should shrink");
+    test_assert(shm_ring_write(&header->to_server, channel.to_server,
+                               RING_SIZE, in, sizeof(in)) ==
+                    RING_SIZE - sizeof(in),
+                "Write should be truncated to the free space");
+    test_assert(shm_ring_read(&header->to_server, channel.to_server,
+                              RING_SIZE, out, sizeof(out)) == sizeof(out),
+                "Read should return the data");
+    test_assert(memcmp(in, out, sizeof(in)) == 0, "Data should match");
+    // Drop the truncated write
+    shm_ring_read(&header->to_server, channel.to_server, RING_SIZE, out,
+                  sizeof(out));
+    test_assert(shm_ring_readable(&header->to_server) == 0,
+                "Ring should be empty");
+  }
+
+  shm_channel_close(&channel);
+  return 0;
+}
+
+int test_transfer() {
+  s_shm_channel channel;
+  s_shm_header *header;
+  char in[RING_SIZE], out[RING_SIZE];
+
+  test_assert(shm_channel_create(&channel, RING_SIZE) == 0,
+              "Channel should be created");
+  header = channel.header;
+  for (size_t i = 0; i < sizeof(in); i++) {
+    in[i] = (char)(i * 7);
+  }
+
+  // Misalign both rings so the transfer wraps on each side
+  shm_ring_write(&header->to_server, channel.to_server, RING_SIZE, in, 1000);
+  shm_ring_read(&header->to_server, channel.to_server, RING_SIZE, out, 1000);
+  shm_ring_write(&header->to_client, channel.to_client, RING_SIZE, in, 3000);
+  shm_ring_read(&header->to_client, channel.to_client, RING_SIZE, out, 3000);
+
+  shm_ring_write(&header->to_server, channel.to_server, RING_SIZE, in, 3500);
+  test_assert(shm_ring_transfer(&header->to_server, channel.to_server,
+                                &header->to_client, channel.to_client,
+                                RING_SIZE) == 3500,
+              "Everything should be moved");
+  test_assert(shm_ring_read(&header->to_client, channel.to_client, RING_SIZE,
+                            out, sizeof(out)) == 3500,
+              "Echo should be readable");
+  test_assert(memcmp(in, out, 3500) == 0, "Echo should match");
+
+  shm_channel_close(&channel);
+  return 0;
+}
+
+int test_attach() {
+  s_shm_channel client, server;
+
+  test_assert(shm_channel_create(&client, RING_SIZE) == 0,
+              "Channel should be created");
+  test_assert(attach_copy(&server, &client) == 0,
+              "Channel should be attached");
+  test_assert(server.ring_size == RING_SIZE, "Ring size should match");
+  test_assert(ftruncate(client.memfd, 4096) != 0,
+              "Attached memfd should not shrink");
+
+  // The rings are shared
+  shm_ring_write(&client.header->to_server, client.to_server, RING_SIZE, "hi",
+                 2);
+  test_assert(shm_ring_readable(&server.header->to_server) == 2,
+              "Server should see the client data");
+  shm_channel_close(&server);
+
+  // A corrupted header is refused
+  client.header->magic = 0;
+  test_assert(attach_copy(&server, &client) == -1,
+              "Bad magic should be refused");
+  client.header->magic = SHM_MAGIC;
+  client.header->ring_size = RING_SIZE * 2;
+  test_assert(attach_copy(&server, &client) == -1,
+              "Size mismatch should be refused");
+
+  shm_channel_close(&client);
+  return 0;
+}
+
+typedef struct {
+  s_shm_channel *channel;
+  uint64_t sleeps;
+} s_echo_arg;
+
+// Echo thread: spin briefly, then sleep until notified
+void *echo_thread(void *arg) {
+  s_echo_arg *echo = arg;
+  s_shm_channel *channel = echo->channel;
+  s_shm_header *header = channel->header;
+  size_t total = 0;
+  uint64_t value;
+
+  while (total < STREAM_BYTES) {
+    size_t n = shm_ring_transfer(&header->to_server, channel->to_server,
+                                 &header->to_client, channel->to_client,
+                                 channel->ring_size);
+    if (n > 0) {
+      total += n;
+      shm_notify(&header->client_sleeping, channel->client_efd);
+      continue;
+    }
+    shm_sleep_prepare(&header->server_sleeping);
+    if (!(shm_ring_readable(&header->to_server) &&
+          shm_ring_writable(&header->to_client, channel->ring_size))) {
+      struct pollfd pfd = {.fd = channel->server_efd, .events = POLLIN};
+      poll(&pfd, 1, -1);
+      (void)!read(channel->server_efd, &value, sizeof(value));
+      echo->sleeps++;
+    }
+    shm_sleep_done(&header->server_sleeping);
+  }
+  return NULL;
+}
+
+int test_stream() {
+  s_shm_channel client, server;
+  s_shm_header *header;
+  s_echo_arg echo = {.channel = &server};
+  pthread_t thread;
+  size_t sent = 0, received = 0;
+  uint8_t buffer[1500];
+  uint64_t value;
+
+  test_assert(shm_channel_create(&client, RING_SIZE) == 0,
+              "Channel should be created");
+  test_assert(attach_copy(&server, &client) == 0,
+              "Channel should be attached");
+  header = client.header;
+  pthread_create(&thread, NULL, echo_thread, &echo);
+
+  // Both sides sleep when blocked: lost wakeups would hang the test
+  while (received < STREAM_BYTES) {
+    size_t chunk = STREAM_BYTES - sent < 1021 ? STREAM_BYTES - sent : 1021;
+    size_t n;
+
+    for (size_t i = 0; i < chunk; i++) {
+      buffer[i] = (uint8_t)((sent + i) % 251);
+    }
+    n = shm_ring_write(&header->to_server, client.to_server, RING_SIZE, buffer,
+                       chunk);
+    sent += n;
+    if (n > 0) {
+      shm_notify(&header->server_sleeping, client.server_efd);
+    }
+
+    n = shm_ring_read(&header->to_client, client.to_client, RING_SIZE, buffer,
+                      sizeof(buffer));
+    for (size_t i = 0; i < n; i++) {
+      test_assert(buffer[i] == (uint8_t)((received + i) % 251),
+                  "Echo should preserve order");
+    }
+    received += n;
+    if (n > 0) {
+      shm_notify(&header->server_sleeping, client.server_efd);
+    } else {
+      shm_sleep_prepare(&header->client_sleeping);
+      if (shm_ring_readable(&header->to_client) == 0 &&
+          (sent == STREAM_BYTES ||
+           shm_ring_writable(&header->to_server, RING_SIZE) == 0)) {
+        (void)!read(client.client_efd, &value, sizeof(value));
+      }
+      shm_sleep_done(&header->client_sleeping);
+    }
+  }
+
+  pthread_join(thread, NULL);
+  test_assert(received == STREAM_BYTES, "Every byte should be echoed");
+  shm_channel_close(&server);
+  shm_channel_close(&client);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_wrap();
+  failed += test_transfer();
+  failed += test_attach();
+  failed += test_stream();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}
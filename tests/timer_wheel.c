@@ -0,0 +1,164 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../includes/timer_wheel.h"
+
+#define COLOR_RED "\033[0;31m"
+#define COLOR_GREEN "\033[0;32m"
+#define COLOR_YELLOW "\033[0;33m"
+#define COLOR_RESET "\033[0m"
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define test_assert(cond, fmt)                                                 \
+  if (!(cond)) {                                                               \
+    eprintf("[%s:%d] %s: " COLOR_YELLOW fmt COLOR_RESET "\n", __FILE__,        \
+            __LINE__, __func__);                                               \
+    return 1;                                                                  \
+  }
+
+#define TICK_MS 10
+
+typedef struct {
+  s_tw_timer timer;
+  uint64_t deadline_ms;
+  uint64_t fired_ms;
+  int fired;
+} s_item;
+
+typedef struct {
+  uint64_t now_ms;
+  int count;
+} s_expire_ctx;
+
+void on_expire(s_tw_timer *timer, void *arg) {
+  s_item *item = tw_entry(timer, s_item, timer);
+  s_expire_ctx *ctx = arg;
+
+  item->fired++;
+  item->fired_ms = ctx->now_ms;
+  ctx->count++;
+}
+
+int test_fire() {
+  s_tw_wheel wheel;
+  s_item item = {0};
+  s_expire_ctx ctx = {0};
+
+  tw_init(&wheel, 1000, TICK_MS);
+  tw_add(&wheel, &item.timer, 1000 + 50);
+
+  test_assert(tw_pending(&item.timer), "Timer should be pending");
+  test_assert(tw_next_timeout(&wheel, 1000) == 50, "Timeout should be 50ms");
+
+  ctx.now_ms = 1049;
+  tw_advance(&wheel, ctx.now_ms, on_expire, &ctx);
+  test_assert(item.fired == 0, "Timer should not fire early");
+
+  ctx.now_ms = 1050;
+  tw_advance(&wheel, ctx.now_ms, on_expire, &ctx);
+  test_assert(item.fired == 1, "Timer should fire at its expiry");
+  test_assert(!tw_pending(&item.timer), "Timer should not be pending");
+  test_assert(tw_next_timeout(&wheel, 1050) == -1, "Wheel should be empty");
+  return 0;
+}
+
+int test_delete() {
+  s_tw_wheel wheel;
+  s_item a = {0}, b = {0};
+  s_expire_ctx ctx = {0};
+
+  tw_init(&wheel, 0, TICK_MS);
+  tw_add(&wheel, &a.timer, 100);
+  tw_add(&wheel, &b.timer, 100);
+  tw_del(&wheel, &a.timer);
+  tw_del(&wheel, &a.timer); // No-op
+
+  test_assert(wheel.count == 1, "Count should be 1");
+
+  ctx.now_ms = 200;
+  tw_advance(&wheel, ctx.now_ms, on_expire, &ctx);
+  test_assert(a.fired == 0, "Deleted timer should not fire");
+  test_assert(b.fired == 1, "Timer should fire");
+  test_assert(wheel.occupied[0] == 0, "Slots should be empty");
+  return 0;
+}
+
+int test_cascade() {
+  s_tw_wheel wheel;
+  s_item item = {0};
+  s_expire_ctx ctx = {0};
+  // Level 2 (more than 64 * 64 ticks away)
+  uint64_t deadline = 5000 * TICK_MS + 3;
+
+  tw_init(&wheel, 0, TICK_MS);
+  tw_add(&wheel, &item.timer, deadline);
+
+  test_assert(item.timer.bucket / TW_SLOTS == 2, "Timer should be on level 2");
+
+  // Step as an event loop would, from timeout to timeout
+  ctx.now_ms = 0;
+  while (!item.fired) {
+    int timeout = tw_next_timeout(&wheel, ctx.now_ms);
+    test_assert(timeout >= 0, "Timeout should be set");
+    ctx.now_ms += timeout;
+    tw_advance(&wheel, ctx.now_ms, on_expire, &ctx);
+  }
+
+  test_assert(item.fired_ms >= deadline, "Timer should not fire early");
+  test_assert(item.fired_ms - deadline < TICK_MS,
+              "Timer should fire within one tick");
+  return 0;
+}
+
+int test_random() {
+#define N_ITEMS 10000
+  s_tw_wheel wheel;
+  s_item *items = calloc(N_ITEMS, sizeof(*items));
+  s_expire_ctx ctx = {0};
+  uint64_t seed = 42;
+
+  tw_init(&wheel, 0, TICK_MS);
+  for (size_t i = 0; i < N_ITEMS; i++) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    items[i].deadline_ms = (seed >> 33) % (3600 * 1000);
+    tw_add(&wheel, &items[i].timer, items[i].deadline_ms);
+  }
+
+  // Advance by irregular steps, with jumps over several wheel revolutions
+  while (ctx.now_ms < 3600 * 1000 + TICK_MS) {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    ctx.now_ms += (seed >> 33) % 70000;
+    tw_advance(&wheel, ctx.now_ms, on_expire, &ctx);
+  }
+
+  test_assert(ctx.count == N_ITEMS, "All timers should fire");
+  test_assert(wheel.count == 0, "Wheel should be empty");
+  for (size_t i = 0; i < N_ITEMS; i++) {
+    test_assert(items[i].fired == 1, "Timer should fire once");
+    test_assert(items[i].fired_ms >= items[i].deadline_ms,
+                "Timer should not fire early");
+  }
+
+  free(items);
+  return 0;
+}
+
+int main() {
+
+  int failed = 0;
+
+  failed += test_fire();
+  failed += test_delete();
+  failed += test_cascade();
+  failed += test_random();
+
+  if (failed) {
+    eprintf(COLOR_RED "Failed %d tests" COLOR_RESET "\n", failed);
+    return 1;
+  } else {
+    eprintf(COLOR_GREEN "All tests passed" COLOR_RESET "\n");
+    return 0;
+  }
+}